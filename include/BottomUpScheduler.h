@@ -0,0 +1,103 @@
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <functional>
+
+#include "TaskPool.h"
+
+using namespace std;
+
+// Runs a callback on each inner node of a tree after it ran on all inner children of that node,
+// e.g. to voxelize bottom-up from the voxels and points of the children.
+//
+// Unlike the waves of computeWorkload() in the CUDA voxelizers, which scan all nodes and synchronize
+// once per level, each inner node counts its unfinished inner children and is queued the moment
+// the last one completes. Threads keep working on deep, unbalanced subtrees while others are done.
+//
+// Node needs Node* children[8]. Nodes without children are leaves and aren't processed.
+template<class Node>
+struct BottomUpScheduler{
+
+	struct Entry{
+		Node* node = nullptr;
+		Entry* parent = nullptr;
+		atomic<int> pending = 0; // inner children that aren't processed, yet
+	};
+
+	static bool isInner(Node* node){
+		for(int i = 0; i < 8; i++){
+			if(node->children[i] != nullptr) return true;
+		}
+
+		return false;
+	}
+
+	static void run(Node* root, int numThreads, function<void(Node*)> process){
+
+		if(root == nullptr || !isInner(root)) return;
+
+		// DEPENDENCIES - one entry per inner node, deque keeps addresses stable
+		deque<Entry> entries;
+		vector<Entry*> stack;
+
+		entries.emplace_back();
+		entries.back().node = root;
+		stack.push_back(&entries.back());
+
+		while(!stack.empty()){
+			Entry* entry = stack.back();
+			stack.pop_back();
+
+			for(int i = 0; i < 8; i++){
+				Node* child = entry->node->children[i];
+
+				if(child == nullptr || !isInner(child)) continue;
+
+				entries.emplace_back();
+				entries.back().node = child;
+				entries.back().parent = entry;
+				entry->pending++;
+
+				stack.push_back(&entries.back());
+			}
+		}
+
+		// PROCESS - start with nodes whose children are all leaves
+		struct Task{
+			Entry* entry = nullptr;
+		};
+
+		shared_ptr<TaskPool<Task>> pool = nullptr;
+
+		pool = make_shared<TaskPool<Task>>(std::max(numThreads, 1), [&pool, &process](shared_ptr<Task> task){
+
+			Entry* entry = task->entry;
+
+			process(entry->node);
+
+			Entry* parent = entry->parent;
+			if(parent != nullptr && parent->pending.fetch_sub(1) == 1){
+				auto next = make_shared<Task>();
+				next->entry = parent;
+
+				pool->addTask(next);
+			}
+		});
+
+		for(Entry& entry : entries){
+			if(entry.pending == 0){
+				auto task = make_shared<Task>();
+				task->entry = &entry;
+
+				pool->addTask(task);
+			}
+		}
+
+		pool->waitTillEmpty();
+		pool->close();
+	}
+
+};
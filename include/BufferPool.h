@@ -0,0 +1,391 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <bit>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+// platform specific, see unsuck_platform_specific.cpp.
+// Page-granular allocations, backed by huge/large pages if <hugePages> and the OS permits it.
+// With <numaNode> >= 0, the pages are placed on that NUMA node, wherever they are first touched.
+void* allocatePages(int64_t size, bool hugePages, int numaNode = -1);
+void freePages(void* data, int64_t size);
+
+// Size-class pool for the memory of Buffer instances.
+//
+// - requests are rounded up to size classes, 4 per power of two, so at most 25% of a block is slack.
+// - released blocks are kept for reuse, first in a cache of the releasing thread, then in a
+//   central per-class list. Reused blocks were already touched, so they don't page fault again.
+//   All cached blocks together, in thread caches and central lists, stay within <maxCachedBytes>.
+// - cached blocks are only returned to the system by trim(), e.g. at the end of a build, or when an allocation fails.
+// - blocks larger than MAX_POOLED_SIZE are allocated and freed directly.
+// - pools are created by name with BufferPool::get() and live until the process exits,
+//   so that threads can return cached blocks whenever they finish.
+// - with <hugePages>, blocks of at least HUGE_PAGE_SIZE are backed by huge pages where the OS allows.
+//   On Windows, large pages need the "Lock pages in memory" privilege, otherwise regular pages are used.
+// - with <numaNode>, blocks of at least NUMA_PAGE_SIZE are placed on that node. Smaller blocks come from
+//   malloc and are placed by first touch, so they should be allocated by threads pinned to the node.
+struct BufferPool{
+
+	static constexpr int64_t MIN_CLASS_SIZE  = 256;
+	static constexpr int     MIN_CLASS_SHIFT = 8;
+	static constexpr int     SUBCLASSES      = 4;
+	static constexpr int64_t MAX_POOLED_SIZE = 1ll << 30;
+	static constexpr int     NUM_CLASSES     = (30 - MIN_CLASS_SHIFT) * SUBCLASSES + 1;
+	static constexpr int64_t HUGE_PAGE_SIZE  = 2 * 1024 * 1024;
+	static constexpr int64_t NUMA_PAGE_SIZE  = 64 * 1024;
+
+	struct SizeClass{
+		std::mutex mtx;
+		std::vector<void*> blocks;
+	};
+
+	struct ThreadCache{
+		BufferPool* pool = nullptr;
+		std::vector<void*> blocks[NUM_CLASSES];
+		int64_t bytes = 0;
+
+		~ThreadCache(){
+			pool->flush(*this);
+		}
+	};
+
+	std::string name = "";
+	int index = 0;
+	bool hugePages = false;
+	int numaNode = -1;
+
+	// limits of the cached, unused blocks
+	int64_t maxThreadCacheBytes = 64ll * 1024 * 1024;
+	int64_t maxCachedBytes = 4ll * 1024 * 1024 * 1024;
+
+	std::atomic<int64_t> liveBytes = 0;
+	std::atomic<int64_t> peakBytes = 0;
+	std::atomic<int64_t> cachedBytes = 0;
+	std::atomic<int64_t> numAllocations = 0;
+	std::atomic<int64_t> numReused = 0;
+	std::atomic<int64_t> numSystemAllocations = 0;
+
+	SizeClass classes[NUM_CLASSES];
+
+	struct Registry{
+		std::mutex mtx;
+		std::vector<BufferPool*> pools;
+	};
+
+	static Registry& registry(){
+		static Registry* _registry = new Registry();
+
+		return *_registry;
+	}
+
+	// the pool named <name>, created on first use. <hugePages> and <numaNode> only apply on creation.
+	static BufferPool* get(std::string name, bool hugePages = false, int numaNode = -1){
+		Registry& registry = BufferPool::registry();
+		std::lock_guard<std::mutex> lock(registry.mtx);
+
+		for(BufferPool* pool : registry.pools){
+			if(pool->name == name) return pool;
+		}
+
+		BufferPool* pool = new BufferPool();
+		pool->name = name;
+		pool->index = registry.pools.size();
+		pool->hugePages = hugePages;
+		pool->numaNode = numaNode;
+
+		registry.pools.push_back(pool);
+
+		return pool;
+	}
+
+	static BufferPool* global(){
+		static BufferPool* _global = BufferPool::get("default");
+
+		return _global;
+	}
+
+	static int classIndex(int64_t size){
+		if(size <= MIN_CLASS_SIZE) return 0;
+
+		// size is in (2^shift, 2^(shift + 1)]
+		int shift = std::bit_width(uint64_t(size - 1)) - 1;
+		int64_t step = (1ll << shift) / SUBCLASSES;
+		int64_t subclass = (size - (1ll << shift) + step - 1) / step;
+
+		return (shift - MIN_CLASS_SHIFT) * SUBCLASSES + int(subclass);
+	}
+
+	static int64_t classSize(int classIndex){
+		int shift = MIN_CLASS_SHIFT + classIndex / SUBCLASSES;
+		int64_t subclass = classIndex % SUBCLASSES;
+
+		return (1ll << shift) + subclass * ((1ll << shift) / SUBCLASSES);
+	}
+
+	// nullptr while the thread exits, e.g. for Buffers owned by other thread_locals
+	ThreadCache* threadCache(){
+
+		struct ThreadCaches{
+			std::vector<std::unique_ptr<ThreadCache>> caches;
+
+			~ThreadCaches(){
+				threadExiting() = true;
+				caches.clear();
+			}
+		};
+
+		if(threadExiting()) return nullptr;
+
+		thread_local ThreadCaches threadCaches;
+		auto& caches = threadCaches.caches;
+
+		if(caches.size() <= size_t(index)){
+			caches.resize(index + 1);
+		}
+
+		if(caches[index] == nullptr){
+			caches[index] = std::make_unique<ThreadCache>();
+			caches[index]->pool = this;
+		}
+
+		return caches[index].get();
+	}
+
+	static bool& threadExiting(){
+		thread_local bool exiting = false;
+
+		return exiting;
+	}
+
+	bool usesPages(int64_t size){
+		return (hugePages && size >= HUGE_PAGE_SIZE) || (numaNode >= 0 && size >= NUMA_PAGE_SIZE);
+	}
+
+	void* systemAllocate(int64_t size){
+		numSystemAllocations++;
+
+		if(usesPages(size)){
+			return allocatePages(size, hugePages && size >= HUGE_PAGE_SIZE, numaNode);
+		}else{
+			return malloc(size);
+		}
+	}
+
+	void systemFree(void* data, int64_t size){
+		if(usesPages(size)){
+			freePages(data, size);
+		}else{
+			free(data);
+		}
+	}
+
+	void addLive(int64_t bytes){
+		int64_t live = liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		int64_t peak = peakBytes.load(std::memory_order_relaxed);
+
+		while(live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+	}
+
+	// returns nullptr if the system is out of memory, even after all cached blocks were released
+	void* allocate(int64_t size){
+
+		numAllocations++;
+
+		if(size > MAX_POOLED_SIZE){
+			void* data = systemAllocate(size);
+
+			if(data == nullptr){
+				trimAll();
+				data = systemAllocate(size);
+			}
+
+			if(data != nullptr) addLive(size);
+
+			return data;
+		}
+
+		int index = classIndex(size);
+		int64_t blockSize = classSize(index);
+
+		void* data = nullptr;
+
+		ThreadCache* cache = threadCache();
+		if(cache != nullptr && !cache->blocks[index].empty()){
+			data = cache->blocks[index].back();
+			cache->blocks[index].pop_back();
+			cache->bytes -= blockSize;
+		}else{
+			SizeClass& sizeClass = classes[index];
+			std::lock_guard<std::mutex> lock(sizeClass.mtx);
+
+			if(!sizeClass.blocks.empty()){
+				data = sizeClass.blocks.back();
+				sizeClass.blocks.pop_back();
+			}
+		}
+
+		if(data != nullptr){
+			numReused++;
+			cachedBytes -= blockSize;
+		}else{
+			data = systemAllocate(blockSize);
+
+			if(data == nullptr){
+				trimAll();
+				data = systemAllocate(blockSize);
+			}
+
+			if(data == nullptr) return nullptr;
+		}
+
+		addLive(blockSize);
+
+		return data;
+	}
+
+	// reserves room for a block in the cache, false if it would exceed <maxCachedBytes>
+	bool reserveCached(int64_t blockSize){
+		int64_t cached = cachedBytes.fetch_add(blockSize, std::memory_order_relaxed) + blockSize;
+
+		if(cached > maxCachedBytes){
+			cachedBytes.fetch_sub(blockSize, std::memory_order_relaxed);
+
+			return false;
+		}
+
+		return true;
+	}
+
+	// <size> must be the size that was passed to allocate()
+	void release(void* data, int64_t size){
+
+		if(data == nullptr) return;
+
+		if(size > MAX_POOLED_SIZE){
+			liveBytes -= size;
+			systemFree(data, size);
+
+			return;
+		}
+
+		int index = classIndex(size);
+		int64_t blockSize = classSize(index);
+
+		liveBytes -= blockSize;
+
+		if(!reserveCached(blockSize)){
+			systemFree(data, blockSize);
+
+			return;
+		}
+
+		ThreadCache* cache = threadCache();
+		if(cache != nullptr && cache->bytes + blockSize <= maxThreadCacheBytes){
+			cache->blocks[index].push_back(data);
+			cache->bytes += blockSize;
+
+			return;
+		}
+
+		SizeClass& sizeClass = classes[index];
+		std::lock_guard<std::mutex> lock(sizeClass.mtx);
+
+		sizeClass.blocks.push_back(data);
+	}
+
+	// Moves the blocks of a thread cache to the central lists.
+	// Blocks beyond <maxCachedBytes>, e.g. after the limit was lowered, are freed instead.
+	void flush(ThreadCache& cache){
+		for(int index = 0; index < NUM_CLASSES; index++){
+			if(cache.blocks[index].empty()) continue;
+
+			int64_t blockSize = classSize(index);
+			SizeClass& sizeClass = classes[index];
+			std::lock_guard<std::mutex> lock(sizeClass.mtx);
+
+			for(void* data : cache.blocks[index]){
+				if(cachedBytes.load(std::memory_order_relaxed) > maxCachedBytes){
+					systemFree(data, blockSize);
+					cachedBytes -= blockSize;
+				}else{
+					sizeClass.blocks.push_back(data);
+				}
+			}
+
+			cache.blocks[index].clear();
+		}
+
+		cache.bytes = 0;
+	}
+
+	// frees the cached blocks of the central lists and of the calling thread
+	void trim(){
+		ThreadCache* cache = threadCache();
+		if(cache != nullptr) flush(*cache);
+
+		for(int index = 0; index < NUM_CLASSES; index++){
+			SizeClass& sizeClass = classes[index];
+			std::lock_guard<std::mutex> lock(sizeClass.mtx);
+
+			int64_t blockSize = classSize(index);
+			for(void* data : sizeClass.blocks){
+				systemFree(data, blockSize);
+				cachedBytes -= blockSize;
+			}
+
+			sizeClass.blocks.clear();
+		}
+	}
+
+	static void trimAll(){
+		Registry& registry = BufferPool::registry();
+
+		std::vector<BufferPool*> pools;
+		{
+			std::lock_guard<std::mutex> lock(registry.mtx);
+			pools = registry.pools;
+		}
+
+		for(BufferPool* pool : pools){
+			pool->trim();
+		}
+	}
+
+	// live, peak and cached bytes of all pools
+	static void printReport(){
+		Registry& registry = BufferPool::registry();
+		std::lock_guard<std::mutex> lock(registry.mtx);
+
+		double MB = 1024.0 * 1024.0;
+
+		std::stringstream ss;
+		ss.precision(1);
+		ss << std::fixed;
+
+		ss << "=== BUFFER POOLS ===" << std::endl;
+		for(BufferPool* pool : registry.pools){
+			int64_t allocations = pool->numAllocations;
+			double reused = allocations > 0 ? 100.0 * double(pool->numReused) / double(allocations) : 0.0;
+
+			ss << pool->name << ": "
+				<< "live " << (double(pool->liveBytes) / MB) << " MB, "
+				<< "peak " << (double(pool->peakBytes) / MB) << " MB, "
+				<< "cached " << (double(pool->cachedBytes) / MB) << " MB, "
+				<< allocations << " allocations, "
+				<< reused << "% reused, "
+				<< pool->numSystemAllocations << " system allocations" << std::endl;
+		}
+
+		std::cout << ss.str();
+	}
+
+};
@@ -0,0 +1,247 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <bit>
+
+#include "unsuck.hpp"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+// 64 bit checksum of a stream of bytes, fed in pieces of any size.
+// Not cryptographic, it detects torn writes and corrupted files. Also used to derive checkpoint keys.
+struct Checksum{
+
+	static constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ull;
+	static constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+	static constexpr uint64_t PRIME_3 = 0x165667B19E3779F9ull;
+
+	uint64_t hash = PRIME_3;
+	uint64_t tail = 0;
+	int numTailBytes = 0;
+	uint64_t length = 0;
+
+	void round(uint64_t word){
+		hash ^= std::rotl(word * PRIME_2, 31) * PRIME_1;
+		hash = std::rotl(hash, 27) * PRIME_1 + PRIME_3;
+	}
+
+	void update(const void* data, int64_t size){
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+		int64_t i = 0;
+
+		length += size;
+
+		// complete the word of the previous update
+		while(numTailBytes > 0 && i < size){
+			tail |= uint64_t(bytes[i]) << (8 * numTailBytes);
+			numTailBytes = (numTailBytes + 1) % 8;
+			i++;
+
+			if(numTailBytes == 0){
+				round(tail);
+				tail = 0;
+			}
+		}
+
+		for(; i + 8 <= size; i += 8){
+			uint64_t word;
+			memcpy(&word, bytes + i, 8);
+			round(word);
+		}
+
+		for(; i < size; i++){
+			tail |= uint64_t(bytes[i]) << (8 * numTailBytes);
+			numTailBytes++;
+		}
+	}
+
+	template<class T>
+	void add(const T& value){
+		update(&value, sizeof(T));
+	}
+
+	void add(const string& value){
+		add(uint64_t(value.size()));
+		update(value.data(), value.size());
+	}
+
+	uint64_t value() const {
+		uint64_t h = hash ^ length;
+
+		if(numTailBytes > 0){
+			h ^= tail * PRIME_1;
+			h = std::rotl(h, 23) * PRIME_2;
+		}
+
+		h ^= h >> 33;
+		h *= PRIME_2;
+		h ^= h >> 29;
+		h *= PRIME_3;
+		h ^= h >> 32;
+
+		return h;
+	}
+
+	static uint64_t of(const void* data, int64_t size){
+		Checksum checksum;
+		checksum.update(data, size);
+
+		return checksum.value();
+	}
+};
+
+// Persisted output of a phase of a long build, so that a restarted build can skip what was completed before.
+//
+// A checkpoint holds a payload, the <key> of the inputs and options it was computed from, and a checksum.
+// It's written to <path>.tmp and renamed once complete, so an interrupted write never shows up as a checkpoint.
+// read() only returns payloads with a matching key and checksum, anything else is recomputed.
+//
+// Layout: MAGIC, VERSION, key, payload size, checksum of the payload, payload at HEADER_SIZE.
+struct Checkpoint{
+
+	static constexpr uint32_t MAGIC = 0x50434c43; // "CLCP"
+	static constexpr uint32_t VERSION = 1;
+	static constexpr int64_t HEADER_SIZE = 32;
+	static constexpr int64_t VERIFY_BLOCK_SIZE = 4 * 1024 * 1024;
+
+	struct Header{
+		uint32_t magic = MAGIC;
+		uint32_t version = VERSION;
+		uint64_t key = 0;
+		uint64_t size = 0;
+		uint64_t checksum = 0;
+	};
+
+	// streams a payload into a checkpoint
+	struct Writer{
+		string path = "";
+		ofstream fout;
+		Header header;
+		Checksum checksum;
+
+		Writer(string path, uint64_t key){
+			this->path = path;
+			header.key = key;
+
+			fout.open(path + ".tmp", ios::out | ios::binary | ios::trunc);
+			fout.write(reinterpret_cast<const char*>(&header), HEADER_SIZE);
+		}
+
+		void write(const void* data, int64_t size){
+			fout.write(reinterpret_cast<const char*>(data), size);
+			checksum.update(data, size);
+			header.size += size;
+		}
+
+		template<class T>
+		void write(const T& value){
+			write(&value, sizeof(T));
+		}
+
+		// publishes the checkpoint, returns false if anything failed to write
+		bool close(){
+			header.checksum = checksum.value();
+
+			fout.seekp(0);
+			fout.write(reinterpret_cast<const char*>(&header), HEADER_SIZE);
+			fout.close();
+
+			if(fout.fail()){
+				cout << "ERROR: failed to write checkpoint " << path << endl;
+				fs::remove(path + ".tmp");
+
+				return false;
+			}
+
+			fs::rename(path + ".tmp", path);
+
+			return true;
+		}
+	};
+
+	static bool write(string path, uint64_t key, const void* data, int64_t size){
+		Writer writer(path, key);
+		writer.write(data, size);
+
+		return writer.close();
+	}
+
+	// header of a checkpoint of <key> with the expected size, without verifying the payload
+	static bool exists(string path, uint64_t key){
+
+		if(!fs::exists(path) || fs::file_size(path) < HEADER_SIZE) return false;
+
+		Header header;
+		readBinaryFile(path, 0, HEADER_SIZE, &header);
+
+		return header.magic == MAGIC
+			&& header.version == VERSION
+			&& header.key == key
+			&& header.size + HEADER_SIZE == fs::file_size(path);
+	}
+
+	// The whole file, with the payload at HEADER_SIZE.
+	// nullptr if there is no checkpoint, or if it was computed from other inputs or is corrupted.
+	static shared_ptr<Buffer> read(string path, uint64_t key){
+
+		if(!exists(path, key)) return nullptr;
+
+		auto buffer = readBinaryFile(path);
+		Header header;
+		memcpy(&header, buffer->data, HEADER_SIZE);
+
+		if(Checksum::of(buffer->data_u8 + HEADER_SIZE, header.size) != header.checksum){
+			cout << "WARNING: checksum mismatch, discarding checkpoint " << path << endl;
+
+			return nullptr;
+		}
+
+		return buffer;
+	}
+
+	// Like read(), but streams the payload through the checksum in blocks instead of loading it.
+	// For callers that only need parts of a checkpoint, see readBinaryFile(path, start, size, target).
+	static bool verify(string path, uint64_t key){
+
+		if(!exists(path, key)) return false;
+
+		Header header;
+		readBinaryFile(path, 0, HEADER_SIZE, &header);
+
+		ifstream fin(path, ios::in | ios::binary);
+		fin.seekg(HEADER_SIZE);
+
+		vector<char> block(VERIFY_BLOCK_SIZE);
+		Checksum checksum;
+
+		for(int64_t remaining = header.size; remaining > 0;){
+			int64_t size = std::min(remaining, VERIFY_BLOCK_SIZE);
+
+			if(!fin.read(block.data(), size)) return false;
+
+			checksum.update(block.data(), size);
+			remaining -= size;
+		}
+
+		if(checksum.value() != header.checksum){
+			cout << "WARNING: checksum mismatch, discarding checkpoint " << path << endl;
+
+			return false;
+		}
+
+		return true;
+	}
+
+	static void remove(string path){
+		fs::remove(path);
+		fs::remove(path + ".tmp");
+	}
+
+};
@@ -0,0 +1,67 @@
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// Unordered list that many threads can push to without locks.
+//
+// takeAll() detaches all entries with a single exchange, so each pushed value is taken exactly once,
+// even if pushes race with takes. Values pushed after the exchange stay for the next takeAll().
+template<class T>
+struct ConcurrentList{
+
+	struct Entry{
+		T value;
+		Entry* next = nullptr;
+	};
+
+	atomic<Entry*> head = nullptr;
+
+	ConcurrentList(){
+
+	}
+
+	ConcurrentList(const ConcurrentList&) = delete;
+	ConcurrentList& operator=(const ConcurrentList&) = delete;
+
+	~ConcurrentList(){
+		takeAll();
+	}
+
+	void push(const T& value){
+		Entry* entry = new Entry();
+		entry->value = value;
+		entry->next = head.load();
+
+		while(!head.compare_exchange_weak(entry->next, entry));
+	}
+
+	// in the order in which they were pushed
+	vector<T> takeAll(){
+
+		Entry* entry = head.exchange(nullptr);
+
+		vector<T> values;
+		while(entry != nullptr){
+			Entry* next = entry->next;
+
+			values.push_back(entry->value);
+			delete entry;
+
+			entry = next;
+		}
+
+		std::reverse(values.begin(), values.end());
+
+		return values;
+	}
+
+	bool empty(){
+		return head.load() == nullptr;
+	}
+
+};
@@ -0,0 +1,308 @@
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <type_traits>
+
+using namespace std;
+
+// CPU counterpart of SparseSampleGrid in modules/simlod/sampling_cuda/kernel_moduled.cu.
+//
+// Open addressing hash map from 128 bit voxel keys to accumulated RGB and weight,
+// which many threads can insert into concurrently without locks:
+// - keys are claimed with CAS, 64 bits at a time, just like add_128bit() on the GPU.
+//   A thread that claimed the first half but loses the second half to a different key
+//   keeps probing, so every key ends up in exactly one slot.
+// - linear probing, power-of-two capacity, no deletes and no resizing.
+//   Use estimateCapacity() to size the map upfront.
+// - values are accumulated with relaxed atomic adds. Results must only be read after all
+//   inserting threads are done.
+// - iteration is a linear scan over the slots, optionally split across threads.
+struct ConcurrentSparseGrid{
+
+	constexpr static uint64_t EMPTY_VALUE = 0xffffffff'ffffffffull;
+	constexpr static double MAX_LOAD_FACTOR = 0.5;
+
+	struct Key{
+		uint64_t k0 = EMPTY_VALUE;
+		uint64_t k1 = EMPTY_VALUE;
+	};
+
+	struct Cell{
+		Key key;
+		uint64_t R = 0;
+		uint64_t G = 0;
+		uint64_t B = 0;
+		uint64_t weight = 0;
+
+		uint32_t color(){
+			if(weight == 0) return 0;
+
+			uint32_t r = (R / weight) & 0xff;
+			uint32_t g = (G / weight) & 0xff;
+			uint32_t b = (B / weight) & 0xff;
+
+			return r | (g << 8) | (b << 16);
+		}
+	};
+
+	// key and values share a slot so that an insert touches a single cache line, most of the time
+	struct Slot{
+		atomic<uint64_t> k0;
+		atomic<uint64_t> k1;
+		atomic<uint64_t> R;
+		atomic<uint64_t> G;
+		atomic<uint64_t> B;
+		atomic<uint64_t> weight;
+	};
+
+	uint64_t capacity = 0;
+	uint64_t mask = 0;
+
+	unique_ptr<Slot[]> slots;
+
+	atomic<uint64_t> numOccupied = 0;
+	atomic<uint64_t> numDropped = 0;
+
+	ConcurrentSparseGrid(uint64_t capacity, int numThreads = 1){
+		this->capacity = std::bit_ceil(std::max(capacity, uint64_t(16)));
+		this->mask = this->capacity - 1;
+
+		slots = make_unique<Slot[]>(this->capacity);
+
+		clear(numThreads);
+	}
+
+	// Number of slots needed to insert <numPoints> points into a grid with <numCells> cells,
+	// since there can't be more occupied voxels than either of them.
+	static uint64_t estimateCapacity(uint64_t numPoints, uint64_t numCells){
+		uint64_t maxOccupied = std::min(numPoints, numCells);
+
+		return std::bit_ceil(uint64_t(double(maxOccupied) / MAX_LOAD_FACTOR) + 1);
+	}
+
+	// voxel coordinates of up to 32 bits per axis, plus a level to store multiple LODs in one map.
+	// ix == iy == 0xffffffff is reserved for the EMPTY_VALUE sentinel.
+	static Key toKey(uint32_t ix, uint32_t iy, uint32_t iz, uint32_t level = 0){
+		Key key;
+		key.k0 = uint64_t(ix) | (uint64_t(iy) << 32);
+		key.k1 = uint64_t(iz) | (uint64_t(level) << 32);
+
+		return key;
+	}
+
+	static void fromKey(Key key, uint32_t& ix, uint32_t& iy, uint32_t& iz, uint32_t& level){
+		ix    = (key.k0 >>  0) & 0xffffffff;
+		iy    = (key.k0 >> 32) & 0xffffffff;
+		iz    = (key.k1 >>  0) & 0xffffffff;
+		level = (key.k1 >> 32) & 0xffffffff;
+	}
+
+	// murmur3 finalizer over both key halves
+	static uint64_t hash(Key key){
+		uint64_t h = key.k0 ^ (key.k1 * 0x9e3779b97f4a7c15ull + (key.k1 >> 29));
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+
+		return h;
+	}
+
+	void clear(int numThreads = 1){
+
+		parallelRange(capacity, numThreads, [&](uint64_t first, uint64_t last){
+			for(uint64_t slot = first; slot < last; slot++){
+				slots[slot].k0.store(EMPTY_VALUE, memory_order_relaxed);
+				slots[slot].k1.store(EMPTY_VALUE, memory_order_relaxed);
+				slots[slot].R.store(0, memory_order_relaxed);
+				slots[slot].G.store(0, memory_order_relaxed);
+				slots[slot].B.store(0, memory_order_relaxed);
+				slots[slot].weight.store(0, memory_order_relaxed);
+			}
+		});
+
+		numOccupied = 0;
+		numDropped = 0;
+	}
+
+	// returns the slot of <key>, claiming a new one if necessary. Returns -1 if the map is full.
+	int64_t findOrInsert(Key key){
+
+		uint64_t start = hash(key);
+
+		for(uint64_t i = 0; i < capacity; i++){
+			uint64_t slot = (start + i) & mask;
+
+			// non-atomic-RMW read first, CAS only if the slot looks empty
+			uint64_t old_0 = slots[slot].k0.load(memory_order_acquire);
+			if(old_0 == EMPTY_VALUE){
+				if(slots[slot].k0.compare_exchange_strong(old_0, key.k0, memory_order_acq_rel)){
+					old_0 = key.k0;
+				}
+			}
+
+			if(old_0 != key.k0) continue;
+
+			// first half matches, try 2nd key part
+			uint64_t old_1 = slots[slot].k1.load(memory_order_acquire);
+			if(old_1 == EMPTY_VALUE){
+				if(slots[slot].k1.compare_exchange_strong(old_1, key.k1, memory_order_acq_rel)){
+					old_1 = key.k1;
+					numOccupied.fetch_add(1, memory_order_relaxed);
+				}
+			}
+
+			if(old_1 == key.k1){
+				return slot;
+			}
+
+			// 2nd part taken by other key. do probing
+		}
+
+		return -1;
+	}
+
+	// accumulates <weight> times the color. Returns false if the map is full.
+	bool add(Key key, uint32_t color, uint32_t weight = 1){
+
+		int64_t slot = findOrInsert(key);
+
+		if(slot < 0){
+			numDropped.fetch_add(1, memory_order_relaxed);
+
+			return false;
+		}
+
+		uint64_t R = (color >>  0) & 0xff;
+		uint64_t G = (color >>  8) & 0xff;
+		uint64_t B = (color >> 16) & 0xff;
+
+		slots[slot].R.fetch_add(weight * R, memory_order_relaxed);
+		slots[slot].G.fetch_add(weight * G, memory_order_relaxed);
+		slots[slot].B.fetch_add(weight * B, memory_order_relaxed);
+		slots[slot].weight.fetch_add(weight, memory_order_relaxed);
+
+		return true;
+	}
+
+	bool add(uint32_t ix, uint32_t iy, uint32_t iz, uint32_t color, uint32_t weight = 1){
+		return add(toKey(ix, iy, iz), color, weight);
+	}
+
+	Cell cellAt(uint64_t slot){
+		Cell cell;
+		cell.key.k0  = slots[slot].k0.load(memory_order_relaxed);
+		cell.key.k1  = slots[slot].k1.load(memory_order_relaxed);
+		cell.R       = slots[slot].R.load(memory_order_relaxed);
+		cell.G       = slots[slot].G.load(memory_order_relaxed);
+		cell.B       = slots[slot].B.load(memory_order_relaxed);
+		cell.weight  = slots[slot].weight.load(memory_order_relaxed);
+
+		return cell;
+	}
+
+	bool isOccupied(uint64_t slot){
+		return slots[slot].k1.load(memory_order_relaxed) != EMPTY_VALUE;
+	}
+
+	// callback(Cell& cell) for each occupied slot, in slot order
+	template<typename Callback>
+	void forEach(Callback callback){
+		for(uint64_t slot = 0; slot < capacity; slot++){
+			if(!isOccupied(slot)) continue;
+
+			Cell cell = cellAt(slot);
+			callback(cell);
+		}
+	}
+
+	// callback(int threadIndex, Cell& cell) for each occupied slot, slot ranges split across threads
+	template<typename Callback>
+	void parallelForEach(int numThreads, Callback callback){
+		parallelRange(capacity, numThreads, [&](uint64_t first, uint64_t last, int threadIndex){
+			for(uint64_t slot = first; slot < last; slot++){
+				if(!isOccupied(slot)) continue;
+
+				Cell cell = cellAt(slot);
+				callback(threadIndex, cell);
+			}
+		});
+	}
+
+	// compacts all occupied cells into a list, in slot order
+	vector<Cell> extract(int numThreads = 1){
+
+		numThreads = std::max(numThreads, 1);
+
+		vector<uint64_t> counts(numThreads, 0);
+		parallelRange(capacity, numThreads, [&](uint64_t first, uint64_t last, int threadIndex){
+			for(uint64_t slot = first; slot < last; slot++){
+				if(isOccupied(slot)) counts[threadIndex]++;
+			}
+		});
+
+		vector<uint64_t> offsets(numThreads, 0);
+		uint64_t numCells = 0;
+		for(int i = 0; i < numThreads; i++){
+			offsets[i] = numCells;
+			numCells += counts[i];
+		}
+
+		vector<Cell> cells(numCells);
+		parallelRange(capacity, numThreads, [&](uint64_t first, uint64_t last, int threadIndex){
+			uint64_t target = offsets[threadIndex];
+
+			for(uint64_t slot = first; slot < last; slot++){
+				if(isOccupied(slot)){
+					cells[target] = cellAt(slot);
+					target++;
+				}
+			}
+		});
+
+		return cells;
+	}
+
+	// splits [0, count) into <numThreads> contiguous ranges.
+	// callback(first, last) or callback(first, last, threadIndex)
+	template<typename Callback>
+	static void parallelRange(uint64_t count, int numThreads, Callback callback){
+
+		numThreads = std::max(numThreads, 1);
+		uint64_t rangeSize = (count + numThreads - 1) / numThreads;
+
+		auto invoke = [&](int threadIndex){
+			uint64_t first = std::min(count, threadIndex * rangeSize);
+			uint64_t last = std::min(count, first + rangeSize);
+
+			if constexpr (std::is_invocable_v<Callback, uint64_t, uint64_t, int>){
+				callback(first, last, threadIndex);
+			}else{
+				callback(first, last);
+			}
+		};
+
+		if(numThreads == 1){
+			invoke(0);
+
+			return;
+		}
+
+		vector<thread> threads;
+		for(int threadIndex = 0; threadIndex < numThreads; threadIndex++){
+			threads.emplace_back(invoke, threadIndex);
+		}
+
+		for(auto& t : threads){
+			t.join();
+		}
+	}
+
+};
@@ -0,0 +1,519 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <filesystem>
+#include <iomanip>
+
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+
+#include "unsuck.hpp"
+#include "Box.h"
+#include "LasHeader.h"
+#include "Tracer.h"
+#include "Checkpoint.h"
+#include "morton.h"
+
+using namespace std;
+using glm::dvec3;
+
+namespace fs = std::filesystem;
+
+// Persistent per-file metadata of a multi-file LAS/LAZ data set.
+//
+// Headers of all files are parsed in parallel once and cached in a binary manifest file.
+// The manifest is written wherever the caller asks, by default to the system's temp directory,
+// so that read-only or shared data directories are never written to. Subsequent loads only re-scan files whose size or modification time changed, or that were added.
+// Optionally, uncompressed LAS files are scanned in chunks of <pointsPerChunk> points
+// to store per-chunk bounding boxes and a sparse, coarse morton histogram of each file,
+// which allows planning splits and chunk assignments without touching point data again.
+
+struct ManifestChunk{
+	int64_t firstPoint = 0;
+	int64_t numPoints = 0;
+	dvec3 min = {Infinity, Infinity, Infinity};
+	dvec3 max = {-Infinity, -Infinity, -Infinity};
+};
+
+struct ManifestHistogramCell{
+	uint32_t mortonCode = 0;
+	uint32_t count = 0;
+};
+
+// chunks and histogram cells are stored as raw arrays, which is only valid without padding
+static_assert(sizeof(ManifestChunk) == 64);
+static_assert(sizeof(ManifestHistogramCell) == 8);
+
+struct ManifestFile{
+	string path = "";
+	int64_t fileSize = 0;
+	int64_t modifiedTime = 0;
+
+	LasHeader header;
+
+	// empty unless chunk statistics were requested and the file is uncompressed
+	int64_t pointsPerChunk = 0;
+	vector<ManifestChunk> chunks;
+
+	// sparse, sorted by morton code. Relative to the cube around the header's bounding box.
+	int histogramLevel = 0;
+	vector<ManifestHistogramCell> histogram;
+
+	bool hasChunkStats(){
+		return pointsPerChunk > 0;
+	}
+};
+
+struct DatasetManifest{
+
+	static constexpr uint32_t MAGIC = 0x4d534c43; // "CLSM"
+	static constexpr uint32_t VERSION = 2;
+
+	struct Options{
+		bool chunkStats = false;
+		int64_t pointsPerChunk = 1'000'000;
+		int histogramLevel = 4;
+		int numThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+	};
+
+	string path = "";
+	vector<ManifestFile> files;
+	Box boundingBox;
+	int64_t numPoints = 0;
+
+	// statistics of the last load
+	int64_t numReused = 0;
+	int64_t numScanned = 0;
+
+	static int64_t getModifiedTime(string path){
+		return fs::last_write_time(path).time_since_epoch().count();
+	}
+
+	static vector<string> listFiles(string dir){
+		vector<string> files;
+
+		for(const auto& entry : fs::directory_iterator(dir)){
+			string filepath = entry.path().string();
+
+			if(iEndsWith(filepath, ".las") || iEndsWith(filepath, ".laz")){
+				files.push_back(filepath);
+			}
+		}
+
+		std::sort(files.begin(), files.end());
+
+		return files;
+	}
+
+	static void scanHeader(ManifestFile& file){
+
+		auto zone = Tracer::zone("scanHeader");
+
+		file.fileSize = fs::file_size(file.path);
+		file.modifiedTime = getModifiedTime(file.path);
+		file.header = LasHeader::read(file.path);
+		file.pointsPerChunk = 0;
+		file.chunks.clear();
+		file.histogramLevel = 0;
+		file.histogram.clear();
+	}
+
+	static void scanChunk(ManifestFile& file, int64_t chunkIndex, vector<uint32_t>& histogram){
+
+		auto zone = Tracer::zone("scanChunk");
+
+		LasHeader& header = file.header;
+		ManifestChunk& chunk = file.chunks[chunkIndex];
+
+		int64_t recordLength = header.recordLength;
+		auto source = readBinaryFile(file.path, header.offsetToPointData + chunk.firstPoint * recordLength, chunk.numPoints * recordLength);
+
+		int64_t numPoints = source->size / recordLength;
+		int64_t gridSize = 1 << file.histogramLevel;
+		Box box;
+		box.min = header.min;
+		box.max = header.max;
+		Box cube = box.cube();
+		dvec3 cubeSize = glm::max(cube.size(), dvec3(0.000'001));
+
+		for(int64_t i = 0; i < numPoints; i++){
+			int32_t X = source->get<int32_t>(i * recordLength + 0);
+			int32_t Y = source->get<int32_t>(i * recordLength + 4);
+			int32_t Z = source->get<int32_t>(i * recordLength + 8);
+
+			dvec3 pos = {
+				double(X) * header.scale.x + header.offset.x,
+				double(Y) * header.scale.y + header.offset.y,
+				double(Z) * header.scale.z + header.offset.z,
+			};
+
+			chunk.min = glm::min(chunk.min, pos);
+			chunk.max = glm::max(chunk.max, pos);
+
+			dvec3 ipos = double(gridSize) * (pos - cube.min) / cubeSize;
+			uint32_t ix = std::clamp(int64_t(ipos.x), int64_t(0), gridSize - 1);
+			uint32_t iy = std::clamp(int64_t(ipos.y), int64_t(0), gridSize - 1);
+			uint32_t iz = std::clamp(int64_t(ipos.z), int64_t(0), gridSize - 1);
+
+			histogram[morton::encode(ix, iy, iz)]++;
+		}
+	}
+
+	// Loads the manifest of <files> from <manifestPath>, re-scans stale or missing entries and
+	// writes the updated manifest back if anything changed. Pass an empty <manifestPath> to skip caching.
+	static shared_ptr<DatasetManifest> load(vector<string> paths, string manifestPath, Options options){
+
+		auto manifest = make_shared<DatasetManifest>();
+		manifest->path = manifestPath;
+
+		unordered_map<string, ManifestFile> cached;
+		if(manifestPath != "" && fs::exists(manifestPath)){
+			for(auto& file : deserialize(readBinaryFile(manifestPath))){
+				cached[file.path] = file;
+			}
+		}
+
+		// revalidate cached entries, collect files that need a new scan
+		vector<int64_t> stale;
+		manifest->files.resize(paths.size());
+		for(int64_t i = 0; i < int64_t(paths.size()); i++){
+			string path = paths[i];
+			auto it = cached.find(path);
+
+			bool isValid = it != cached.end()
+				&& it->second.fileSize == int64_t(fs::file_size(path))
+				&& it->second.modifiedTime == getModifiedTime(path);
+
+			if(isValid && options.chunkStats && !it->second.header.isCompressed){
+				isValid = it->second.pointsPerChunk == options.pointsPerChunk
+					&& it->second.histogramLevel == options.histogramLevel;
+			}
+
+			if(isValid){
+				manifest->files[i] = it->second;
+			}else{
+				manifest->files[i].path = path;
+				stale.push_back(i);
+			}
+		}
+
+		manifest->numReused = paths.size() - stale.size();
+		manifest->numScanned = stale.size();
+
+		// headers of stale files
+		parallelFor(stale.size(), options.numThreads, [&](int64_t i){
+			scanHeader(manifest->files[stale[i]]);
+		});
+
+		// chunk bounding boxes and histograms of stale, uncompressed files
+		if(options.chunkStats){
+
+			struct ChunkTask{
+				int64_t fileIndex;
+				int64_t chunkIndex;
+			};
+
+			vector<ChunkTask> tasks;
+			for(int64_t fileIndex : stale){
+				ManifestFile& file = manifest->files[fileIndex];
+
+				if(file.header.isCompressed || file.header.recordLength < 12) continue;
+
+				file.pointsPerChunk = options.pointsPerChunk;
+				file.histogramLevel = options.histogramLevel;
+
+				for(int64_t firstPoint = 0; firstPoint < file.header.numPoints; firstPoint += options.pointsPerChunk){
+					ManifestChunk chunk;
+					chunk.firstPoint = firstPoint;
+					chunk.numPoints = std::min(options.pointsPerChunk, file.header.numPoints - firstPoint);
+
+					tasks.push_back({fileIndex, int64_t(file.chunks.size())});
+					file.chunks.push_back(chunk);
+				}
+			}
+
+			int64_t numCells = 1ll << (3 * options.histogramLevel);
+
+			// dense histograms only exist while chunks of a file are in flight.
+			// Once the last chunk of a file is done, its histogram is stored in sparse form.
+			vector<vector<uint32_t>> denseHistograms(manifest->files.size());
+			vector<int64_t> remainingChunks(manifest->files.size(), 0);
+			for(auto task : tasks){
+				remainingChunks[task.fileIndex]++;
+			}
+
+			mutex mtx_histogram;
+			parallelFor(tasks.size(), options.numThreads, [&](int64_t i){
+				ChunkTask task = tasks[i];
+				ManifestFile& file = manifest->files[task.fileIndex];
+
+				vector<uint32_t> histogram(numCells, 0);
+				scanChunk(file, task.chunkIndex, histogram);
+
+				lock_guard<mutex> lock(mtx_histogram);
+				auto& dense = denseHistograms[task.fileIndex];
+				dense.resize(numCells, 0);
+
+				for(int64_t cell = 0; cell < numCells; cell++){
+					dense[cell] += histogram[cell];
+				}
+
+				remainingChunks[task.fileIndex]--;
+
+				if(remainingChunks[task.fileIndex] == 0){
+					for(int64_t cell = 0; cell < numCells; cell++){
+						if(dense[cell] > 0){
+							file.histogram.push_back({uint32_t(cell), dense[cell]});
+						}
+					}
+
+					dense = vector<uint32_t>();
+				}
+			});
+		}
+
+		for(auto& file : manifest->files){
+			manifest->boundingBox.expand(file.header.min);
+			manifest->boundingBox.expand(file.header.max);
+			manifest->numPoints += file.header.numPoints;
+		}
+
+		bool filesRemoved = int64_t(cached.size()) != manifest->numReused;
+		if(manifestPath != "" && (stale.size() > 0 || filesRemoved)){
+			manifest->save(manifestPath);
+		}
+
+		return manifest;
+	}
+
+	// one manifest per data set directory, in the temp directory
+	static string defaultManifestPath(string dir){
+		fs::path normalized = fs::weakly_canonical(dir);
+		if(!normalized.has_filename()){
+			normalized = normalized.parent_path();
+		}
+
+		string absolute = normalized.string();
+		uint64_t hash = Checksum::of(absolute.data(), absolute.size());
+
+		stringstream ss;
+		ss << "manifest_" << std::hex << std::setw(16) << std::setfill('0') << hash << ".clsm";
+
+		return (fs::temp_directory_path() / ss.str()).string();
+	}
+
+	// all *.las and *.laz files in <dir>, cached in <manifestPath>
+	static shared_ptr<DatasetManifest> load(string dir, string manifestPath, Options options){
+		return load(listFiles(dir), manifestPath, options);
+	}
+
+	static shared_ptr<DatasetManifest> load(string dir, Options options){
+		return load(dir, defaultManifestPath(dir), options);
+	}
+
+	static shared_ptr<DatasetManifest> load(string dir){
+		return load(dir, Options());
+	}
+
+	static void parallelFor(int64_t count, int numThreads, function<void(int64_t)> callback){
+
+		atomic<int64_t> counter = 0;
+
+		vector<thread> threads;
+		for(int i = 0; i < std::min(int64_t(numThreads), count); i++){
+			threads.emplace_back([&](){
+				while(true){
+					int64_t index = counter.fetch_add(1);
+
+					if(index >= count) break;
+
+					callback(index);
+				}
+			});
+		}
+
+		for(auto& t : threads){
+			t.join();
+		}
+	}
+
+	// Written to <path>.tmp and renamed once complete, so an interrupted write leaves the previous manifest intact.
+	bool save(string path){
+
+		auto data = serialize();
+
+		ofstream fout(path + ".tmp", ios::out | ios::binary | ios::trunc);
+		fout.write(reinterpret_cast<const char*>(data.data()), data.size());
+		fout.close();
+
+		if(fout.fail()){
+			cout << "WARNING: failed to write manifest " << path << endl;
+			fs::remove(path + ".tmp");
+
+			return false;
+		}
+
+		fs::rename(path + ".tmp", path);
+
+		return true;
+	}
+
+	vector<uint8_t> serialize(){
+
+		vector<uint8_t> data;
+
+		auto write = [&data](auto value){
+			uint8_t* ptr = reinterpret_cast<uint8_t*>(&value);
+			data.insert(data.end(), ptr, ptr + sizeof(value));
+		};
+
+		auto writeVector = [&data, &write](auto& values){
+			write(uint64_t(values.size()));
+			uint8_t* ptr = reinterpret_cast<uint8_t*>(values.data());
+			data.insert(data.end(), ptr, ptr + values.size() * sizeof(values[0]));
+		};
+
+		// field by field, so the file holds no padding and does not depend on the struct layout
+		auto writeHeader = [&write](LasHeader& header){
+			write(uint8_t(header.versionMajor));
+			write(uint8_t(header.versionMinor));
+			write(uint16_t(header.headerSize));
+			write(uint64_t(header.offsetToPointData));
+			write(uint32_t(header.numVLRs));
+			write(uint8_t(header.format));
+			write(uint8_t(header.isCompressed ? 1 : 0));
+			write(uint16_t(header.recordLength));
+			write(int64_t(header.numPoints));
+
+			for(dvec3 v : {header.scale, header.offset, header.min, header.max}){
+				write(v.x);
+				write(v.y);
+				write(v.z);
+			}
+		};
+
+		write(MAGIC);
+		write(VERSION);
+		write(uint64_t(files.size()));
+
+		for(auto& file : files){
+			write(uint64_t(file.path.size()));
+			data.insert(data.end(), file.path.begin(), file.path.end());
+
+			write(file.fileSize);
+			write(file.modifiedTime);
+			writeHeader(file.header);
+			write(file.pointsPerChunk);
+			write(int64_t(file.histogramLevel));
+			writeVector(file.chunks);
+			writeVector(file.histogram);
+		}
+
+		return data;
+	}
+
+	// Returns an empty list if the data is not a complete manifest of the current version,
+	// so that a truncated or corrupted manifest is treated like a missing one and rebuilt.
+	static vector<ManifestFile> deserialize(shared_ptr<Buffer> buffer){
+
+		vector<ManifestFile> files;
+		int64_t cursor = 0;
+		int64_t size = buffer->size;
+
+		auto readBytes = [&](void* target, uint64_t numBytes) -> bool {
+			if(numBytes > uint64_t(size - cursor)) return false;
+
+			memcpy(target, buffer->data_u8 + cursor, numBytes);
+			cursor += numBytes;
+
+			return true;
+		};
+
+		auto read = [&]<typename T>(T& value) -> bool {
+			return readBytes(&value, sizeof(T));
+		};
+
+		auto readVector = [&]<typename T>(vector<T>& values) -> bool {
+			uint64_t count;
+			if(!read(count)) return false;
+			if(count > uint64_t(size - cursor) / sizeof(T)) return false;
+
+			values.resize(count);
+
+			return readBytes(values.data(), count * sizeof(T));
+		};
+
+		auto readHeader = [&](LasHeader& header) -> bool {
+			uint8_t versionMajor = 0, versionMinor = 0, format = 0, isCompressed = 0;
+			uint16_t headerSize = 0, recordLength = 0;
+			uint32_t numVLRs = 0;
+			uint64_t offsetToPointData = 0;
+			int64_t numPoints = 0;
+
+			bool complete = read(versionMajor) && read(versionMinor)
+				&& read(headerSize)
+				&& read(offsetToPointData)
+				&& read(numVLRs)
+				&& read(format) && read(isCompressed)
+				&& read(recordLength)
+				&& read(numPoints);
+
+			for(dvec3* v : {&header.scale, &header.offset, &header.min, &header.max}){
+				complete = complete && read(v->x) && read(v->y) && read(v->z);
+			}
+
+			header.versionMajor      = versionMajor;
+			header.versionMinor      = versionMinor;
+			header.headerSize        = headerSize;
+			header.offsetToPointData = offsetToPointData;
+			header.numVLRs           = numVLRs;
+			header.format            = format;
+			header.isCompressed      = isCompressed != 0;
+			header.recordLength      = recordLength;
+			header.numPoints         = numPoints;
+
+			return complete;
+		};
+
+		uint32_t magic, version;
+		uint64_t numFiles;
+		if(!read(magic) || !read(version) || !read(numFiles)) return {};
+		if(magic != MAGIC || version != VERSION) return {};
+
+		for(uint64_t i = 0; i < numFiles; i++){
+			ManifestFile file;
+
+			uint64_t pathLength;
+			if(!read(pathLength) || pathLength > uint64_t(size - cursor)) return {};
+
+			file.path.resize(pathLength);
+			readBytes(file.path.data(), pathLength);
+
+			int64_t histogramLevel;
+			bool complete = read(file.fileSize)
+				&& read(file.modifiedTime)
+				&& readHeader(file.header)
+				&& read(file.pointsPerChunk)
+				&& read(histogramLevel)
+				&& readVector(file.chunks)
+				&& readVector(file.histogram);
+
+			if(!complete) return {};
+			if(histogramLevel < 0 || histogramLevel > 10) return {};
+
+			file.histogramLevel = histogramLevel;
+
+			files.push_back(file);
+		}
+
+		if(cursor != size) return {};
+
+		return files;
+	}
+
+};
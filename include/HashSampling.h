@@ -0,0 +1,332 @@
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "BottomUpScheduler.h"
+#include "unsuck.hpp"
+#include "LasAttributes.h"
+#include "simlod/sampling_cuda_nonprogressive/sample_hash.h"
+
+using namespace std;
+
+// CPU counterpart of the RANDOM strategy in
+// modules/simlod/sampling_cuda_nonprogressive/voxelize_sampleselect_random_blockwise_globalmem.cu.
+//
+// Selects one representative per cell of a node's 128³ grid from the points or voxels of its children.
+// Each cell keeps the candidate with the smallest seeded hash (sample_hash.h), reduced in one pass with
+// an atomic min per cell. Given the same input, the selected samples are identical to the GPU
+// and independent of the number of threads. Unlike on the GPU, the result is sorted by cell index.
+//
+// Voxels can also carry LAS attributes, see select(). The GPU kernels don't have them.
+struct HashSampling{
+
+	static constexpr int GRID_SIZE = 128;
+
+	// layout of Point in lib.h.cu
+	struct Point{
+		float x;
+		float y;
+		float z;
+		uint32_t color;
+	};
+
+	struct Child{
+		const Point* points = nullptr;
+		int64_t numPoints = 0;
+		const Point* voxels = nullptr;
+		int64_t numVoxels = 0;
+
+		// optional, indexed like <points> and <voxels>
+		const AttributeChannels* pointAttributes = nullptr;
+		const AttributeChannels* voxelAttributes = nullptr;
+	};
+
+	struct Node{
+		float min[3];
+		float max[3];
+		Child children[8];
+
+		// the attributes that the samples get, from the attributes of the children
+		uint32_t attributeMask = 0;
+	};
+
+	// the child and the index within its points or voxels that a sample was selected from
+	struct Source{
+		uint32_t childIndex;
+		uint32_t index;
+	};
+
+	uint32_t seed = 0;
+	int numThreads = 1;
+
+	// reused across nodes, EMPTY_KEY between calls
+	vector<atomic<uint64_t>> cells;
+
+	HashSampling(uint32_t seed, int numThreads){
+		this->seed = seed;
+		this->numThreads = std::max(numThreads, 1);
+
+		cells = vector<atomic<uint64_t>>(GRID_SIZE * GRID_SIZE * GRID_SIZE);
+		for(auto& cell : cells){
+			cell.store(sample_hash::EMPTY_KEY, memory_order_relaxed);
+		}
+	}
+
+	// <attributes>, if given, receives the attributes in <node.attributeMask> of each sample: the returns and class
+	// of the selected point or voxel, and the intensity and GPS time averaged over all candidates of its cell.
+	vector<Point> select(const Node& node, AttributeChannels* attributes = nullptr){
+
+		float fGridSize = GRID_SIZE;
+		float size[3] = {
+			node.max[0] - node.min[0],
+			node.max[1] - node.min[1],
+			node.max[2] - node.min[2],
+		};
+
+		auto toVoxelIndex = [&](const Point& point){
+			int ix = sample_hash::toCell(point.x, node.min[0], size[0], fGridSize);
+			int iy = sample_hash::toCell(point.y, node.min[1], size[1], fGridSize);
+			int iz = sample_hash::toCell(point.z, node.min[2], size[2], fGridSize);
+
+			return ix + GRID_SIZE * iy + GRID_SIZE * GRID_SIZE * iz;
+		};
+
+		// flattened list of candidates, so that threads get equal shares regardless of child sizes
+		struct Range{
+			const Point* points;
+			int64_t count;
+			uint32_t childIndex;
+			int64_t offset;
+			const AttributeChannels* attributes;
+		};
+
+		vector<Range> ranges;
+		int64_t numCandidates = 0;
+		for(uint32_t childIndex = 0; childIndex < 8; childIndex++){
+			const Child& child = node.children[childIndex];
+
+			if(child.numPoints > 0){
+				ranges.push_back({child.points, child.numPoints, childIndex, numCandidates, child.pointAttributes});
+				numCandidates += child.numPoints;
+			}
+
+			if(child.numVoxels > 0){
+				ranges.push_back({child.voxels, child.numVoxels, childIndex, numCandidates, child.voxelAttributes});
+				numCandidates += child.numVoxels;
+			}
+		}
+
+		// REDUCE - keep the smallest key per cell, the first candidate of a cell registers it
+		vector<vector<uint32_t>> accepted(numThreads);
+
+		parallelRange(numCandidates, numThreads, [&](int64_t first, int64_t last, int threadIndex){
+			for(auto& range : ranges){
+				int64_t begin = std::max(first, range.offset);
+				int64_t end = std::min(last, range.offset + range.count);
+
+				for(int64_t i = begin; i < end; i++){
+					uint32_t pointIndex = i - range.offset;
+					const Point& point = range.points[pointIndex];
+
+					int voxelIndex = toVoxelIndex(point);
+					uint64_t hash = sample_hash::hashPoint(point.x, point.y, point.z, point.color, seed);
+					uint64_t key = sample_hash::toKey(hash, range.childIndex, pointIndex);
+
+					// atomic min
+					uint64_t old = cells[voxelIndex].load(memory_order_relaxed);
+					while(key < old){
+						if(cells[voxelIndex].compare_exchange_weak(old, key, memory_order_relaxed)){
+							if(old == sample_hash::EMPTY_KEY){
+								accepted[threadIndex].push_back(voxelIndex);
+							}
+
+							break;
+						}
+					}
+				}
+			}
+		});
+
+		vector<uint32_t> voxelIndices;
+		for(auto& list : accepted){
+			voxelIndices.insert(voxelIndices.end(), list.begin(), list.end());
+		}
+		std::sort(voxelIndices.begin(), voxelIndices.end());
+
+		// RESOLVE - fetch the winners, snap them to cell centers and reset the grid
+		vector<Point> samples(voxelIndices.size());
+		vector<Source> sources(attributes != nullptr ? voxelIndices.size() : 0);
+
+		parallelRange(voxelIndices.size(), numThreads, [&](int64_t first, int64_t last, int threadIndex){
+			for(int64_t i = first; i < last; i++){
+				uint32_t voxelIndex = voxelIndices[i];
+				uint64_t key = cells[voxelIndex].load(memory_order_relaxed);
+				const Child& child = node.children[sample_hash::childIndexOf(key)];
+				uint32_t sampleIndex = sample_hash::indexOf(key);
+
+				Point voxel = child.numPoints > 0 ? child.points[sampleIndex] : child.voxels[sampleIndex];
+
+				int ix = sample_hash::toCell(voxel.x, node.min[0], size[0], fGridSize);
+				int iy = sample_hash::toCell(voxel.y, node.min[1], size[1], fGridSize);
+				int iz = sample_hash::toCell(voxel.z, node.min[2], size[2], fGridSize);
+
+				voxel.x = sample_hash::cellCenter(ix, node.min[0], size[0], fGridSize);
+				voxel.y = sample_hash::cellCenter(iy, node.min[1], size[1], fGridSize);
+				voxel.z = sample_hash::cellCenter(iz, node.min[2], size[2], fGridSize);
+
+				samples[i] = voxel;
+
+				if(attributes != nullptr){
+					sources[i] = {sample_hash::childIndexOf(key), sampleIndex};
+				}
+
+				cells[voxelIndex].store(sample_hash::EMPTY_KEY, memory_order_relaxed);
+			}
+		});
+
+		// ATTRIBUTES of the winners, then averaged over the candidates of each cell.
+		// Accumulated on one thread in candidate order, so that the sums don't depend on the number of threads.
+		if(attributes != nullptr){
+			const AttributeChannels* children[8];
+			for(int childIndex = 0; childIndex < 8; childIndex++){
+				const Child& child = node.children[childIndex];
+				children[childIndex] = child.numPoints > 0 ? child.pointAttributes : child.voxelAttributes;
+			}
+
+			*attributes = LasAttributes::select(children, sources, node.attributeMask);
+
+			AttributeAccumulator accumulator(samples.size(), node.attributeMask);
+
+			for(auto& range : ranges){
+				if(range.attributes == nullptr) continue;
+
+				for(int64_t i = 0; i < range.count; i++){
+					uint32_t voxelIndex = toVoxelIndex(range.points[i]);
+					int64_t sampleIndex = std::lower_bound(voxelIndices.begin(), voxelIndices.end(), voxelIndex) - voxelIndices.begin();
+
+					accumulator.add(sampleIndex, *range.attributes, i);
+				}
+			}
+
+			accumulator.resolve(*attributes);
+		}
+
+		return samples;
+	}
+
+	// Voxelizes all inner nodes of a tree bottom-up on <numThreads> threads, see BottomUpScheduler.
+	// TreeNode needs min, max, children[8], points, numPoints, voxels and numVoxels, with the layout of Point,
+	// e.g. the host tree of OctreeWriter. Returns the buffers that the voxels were written to.
+	// If TreeNode also has pointAttributes and voxelAttributes, shared_ptr<AttributeChannels>, voxels get
+	// the attributes that the children have, e.g. distributed::Node.
+	template<class TreeNode>
+	static vector<shared_ptr<Buffer>> voxelize(TreeNode* root, uint32_t seed, int numThreads){
+
+		return voxelizeWith(root, numThreads, [seed](const Node& node, AttributeChannels* attributes){
+
+			// one 128³ grid per thread, nodes are processed concurrently
+			thread_local unique_ptr<HashSampling> sampling = nullptr;
+			if(sampling == nullptr){
+				sampling = make_unique<HashSampling>(seed, 1);
+			}
+			sampling->seed = seed;
+
+			return sampling->select(node, attributes);
+		});
+	}
+
+	// voxelize() with the samples of each node selected by <select>,
+	// vector<Point> select(const Node&, AttributeChannels* attributes), where <attributes> is nullptr
+	// if the children have none. <select> is called concurrently for different nodes.
+	template<class TreeNode, class Select>
+	static vector<shared_ptr<Buffer>> voxelizeWith(TreeNode* root, int numThreads, Select select){
+
+		constexpr bool hasAttributes = requires(TreeNode* treeNode){ treeNode->voxelAttributes; };
+
+		mutex mtx;
+		vector<shared_ptr<Buffer>> buffers;
+
+		BottomUpScheduler<TreeNode>::run(root, numThreads, [&](TreeNode* treeNode){
+
+			Node node;
+			node.min[0] = treeNode->min.x;
+			node.min[1] = treeNode->min.y;
+			node.min[2] = treeNode->min.z;
+			node.max[0] = treeNode->max.x;
+			node.max[1] = treeNode->max.y;
+			node.max[2] = treeNode->max.z;
+
+			for(int i = 0; i < 8; i++){
+				TreeNode* child = treeNode->children[i];
+
+				if(child == nullptr) continue;
+
+				node.children[i].points = reinterpret_cast<const Point*>(child->points);
+				node.children[i].numPoints = child->numPoints;
+				node.children[i].voxels = reinterpret_cast<const Point*>(child->voxels);
+				node.children[i].numVoxels = child->numVoxels;
+
+				if constexpr (hasAttributes){
+					node.children[i].pointAttributes = child->pointAttributes.get();
+					node.children[i].voxelAttributes = child->voxelAttributes.get();
+
+					if(child->pointAttributes != nullptr) node.attributeMask |= child->pointAttributes->mask;
+					if(child->voxelAttributes != nullptr) node.attributeMask |= child->voxelAttributes->mask;
+				}
+			}
+
+			AttributeChannels attributes;
+			vector<Point> samples = select(node, node.attributeMask != 0 ? &attributes : nullptr);
+
+			if constexpr (hasAttributes){
+				if(node.attributeMask != 0){
+					treeNode->voxelAttributes = make_shared<AttributeChannels>(std::move(attributes));
+				}else{
+					treeNode->voxelAttributes = nullptr;
+				}
+			}
+
+			auto buffer = make_shared<Buffer>(samples.size() * sizeof(Point));
+			memcpy(buffer->data, samples.data(), samples.size() * sizeof(Point));
+
+			treeNode->voxels = reinterpret_cast<decltype(treeNode->voxels)>(buffer->data);
+			treeNode->numVoxels = samples.size();
+
+			lock_guard<mutex> lock(mtx);
+			buffers.push_back(buffer);
+		});
+
+		return buffers;
+	}
+
+	// splits [0, count) into one contiguous range per thread, callback(first, last, threadIndex)
+	template<typename Callback>
+	static void parallelRange(int64_t count, int numThreads, Callback callback){
+
+		numThreads = std::max(numThreads, 1);
+		int64_t rangeSize = (count + numThreads - 1) / numThreads;
+
+		vector<thread> threads;
+		for(int threadIndex = 0; threadIndex < numThreads; threadIndex++){
+			int64_t first = std::min(count, threadIndex * rangeSize);
+			int64_t last = std::min(count, first + rangeSize);
+
+			if(numThreads == 1){
+				callback(first, last, threadIndex);
+			}else{
+				threads.emplace_back(callback, first, last, threadIndex);
+			}
+		}
+
+		for(auto& t : threads){
+			t.join();
+		}
+	}
+
+};
@@ -0,0 +1,289 @@
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "unsuck.hpp"
+#include "LasHeader.h"
+
+using namespace std;
+
+// Attributes of LAS records besides position and color.
+//
+// Loaders keep the raw records of what they loaded (LasRecords). Attributes are decoded into one array
+// per attribute (SoA) when a consumer requests them, so builds that don't use them don't pay for them.
+enum LasAttribute : uint32_t {
+	LAS_INTENSITY         = 1 << 0,
+	LAS_RETURN_NUMBER     = 1 << 1,
+	LAS_NUMBER_OF_RETURNS = 1 << 2,
+	LAS_CLASSIFICATION    = 1 << 3,
+	LAS_GPS_TIME          = 1 << 4,
+	LAS_ALL_ATTRIBUTES    = 0b11111,
+};
+
+// Raw records of a loaded range of a LAS file, point formats 0 - 10
+struct LasRecords{
+	shared_ptr<Buffer> buffer = nullptr;
+	int format = 0;
+	int recordLength = 0;
+	int64_t numRecords = 0;
+
+	// attributes that the point format provides
+	uint32_t available(){
+		uint32_t mask = LAS_INTENSITY | LAS_RETURN_NUMBER | LAS_NUMBER_OF_RETURNS | LAS_CLASSIFICATION;
+
+		if(LasHeader::gpsTimeOffset(format) >= 0){
+			mask |= LAS_GPS_TIME;
+		}
+
+		return mask;
+	}
+
+	uint16_t intensity(int64_t index){
+		return buffer->get<uint16_t>(index * recordLength + 12);
+	}
+
+	// formats 6 - 10 have 4 bit return fields, the others 3 bit
+	uint8_t returnNumber(int64_t index){
+		uint8_t bits = buffer->get<uint8_t>(index * recordLength + 14);
+
+		return format >= 6 ? (bits & 0b1111) : (bits & 0b111);
+	}
+
+	uint8_t numberOfReturns(int64_t index){
+		uint8_t bits = buffer->get<uint8_t>(index * recordLength + 14);
+
+		return format >= 6 ? (bits >> 4) : ((bits >> 3) & 0b111);
+	}
+
+	// formats 6 - 10 have a full byte for the class, the others 5 bits next to the flags
+	uint8_t classification(int64_t index){
+		if(format >= 6){
+			return buffer->get<uint8_t>(index * recordLength + 16);
+		}else{
+			return buffer->get<uint8_t>(index * recordLength + 15) & 0b11111;
+		}
+	}
+
+	double gpsTime(int64_t index){
+		int offset = LasHeader::gpsTimeOffset(format);
+
+		if(offset < 0) return 0.0;
+
+		return buffer->get<double>(index * recordLength + offset);
+	}
+};
+
+// Decoded attributes, one array per attribute. Only the channels in <mask> are filled.
+struct AttributeChannels{
+	uint32_t mask = 0;
+	int64_t size = 0;
+
+	vector<uint16_t> intensity;
+	vector<uint8_t> returnNumber;
+	vector<uint8_t> numberOfReturns;
+	vector<uint8_t> classification;
+	vector<double> gpsTime;
+
+	AttributeChannels(){
+
+	}
+
+	AttributeChannels(uint32_t mask, int64_t size){
+		this->size = size;
+		allocate(mask);
+	}
+
+	// adds the channels in <mask>, zero-filled
+	void allocate(uint32_t mask){
+		if(mask & LAS_INTENSITY)         intensity.resize(size, 0);
+		if(mask & LAS_RETURN_NUMBER)     returnNumber.resize(size, 0);
+		if(mask & LAS_NUMBER_OF_RETURNS) numberOfReturns.resize(size, 0);
+		if(mask & LAS_CLASSIFICATION)    classification.resize(size, 0);
+		if(mask & LAS_GPS_TIME)          gpsTime.resize(size, 0.0);
+
+		this->mask |= mask;
+	}
+
+	// copies sample <sourceIndex> of <source> to <index>, for the channels that both have
+	void copy(int64_t index, const AttributeChannels& source, int64_t sourceIndex){
+		uint32_t shared = mask & source.mask;
+
+		if(shared & LAS_INTENSITY)         intensity[index]       = source.intensity[sourceIndex];
+		if(shared & LAS_RETURN_NUMBER)     returnNumber[index]    = source.returnNumber[sourceIndex];
+		if(shared & LAS_NUMBER_OF_RETURNS) numberOfReturns[index] = source.numberOfReturns[sourceIndex];
+		if(shared & LAS_CLASSIFICATION)    classification[index]  = source.classification[sourceIndex];
+		if(shared & LAS_GPS_TIME)          gpsTime[index]         = source.gpsTime[sourceIndex];
+	}
+
+	// appends sample <sourceIndex> of <source>, zeros for the channels that it lacks
+	void push(const AttributeChannels& source, int64_t sourceIndex){
+		size++;
+
+		if(mask & LAS_INTENSITY)         intensity.push_back(0);
+		if(mask & LAS_RETURN_NUMBER)     returnNumber.push_back(0);
+		if(mask & LAS_NUMBER_OF_RETURNS) numberOfReturns.push_back(0);
+		if(mask & LAS_CLASSIFICATION)    classification.push_back(0);
+		if(mask & LAS_GPS_TIME)          gpsTime.push_back(0.0);
+
+		copy(size - 1, source, sourceIndex);
+	}
+
+	// appends all samples of <other>
+	void append(const AttributeChannels& other){
+		for(int64_t i = 0; i < other.size; i++){
+			push(other, i);
+		}
+	}
+
+	// callback(attribute, channel) for each channel in <mask>, e.g. to serialize them
+	template<class Callback>
+	void forEachChannel(Callback callback){
+		if(mask & LAS_INTENSITY)         callback(LAS_INTENSITY, intensity);
+		if(mask & LAS_RETURN_NUMBER)     callback(LAS_RETURN_NUMBER, returnNumber);
+		if(mask & LAS_NUMBER_OF_RETURNS) callback(LAS_NUMBER_OF_RETURNS, numberOfReturns);
+		if(mask & LAS_CLASSIFICATION)    callback(LAS_CLASSIFICATION, classification);
+		if(mask & LAS_GPS_TIME)          callback(LAS_GPS_TIME, gpsTime);
+	}
+
+	// samples [first, first + count)
+	AttributeChannels slice(int64_t first, int64_t count) const {
+		AttributeChannels sliced(mask, count);
+
+		for(int64_t i = 0; i < count; i++){
+			sliced.copy(i, *this, first + i);
+		}
+
+		return sliced;
+	}
+
+	// samples in the order of <order>, sample i of the result is sample order[i]
+	template<class Index>
+	AttributeChannels permute(const vector<Index>& order) const {
+		AttributeChannels permuted(mask, order.size());
+
+		for(int64_t i = 0; i < int64_t(order.size()); i++){
+			permuted.copy(i, *this, order[i]);
+		}
+
+		return permuted;
+	}
+};
+
+// Lazily decoded attributes of a list of points.
+// Point i is record indices[first + i], as uint32_t. Without <indices>, point i is record first + i.
+struct LasAttributes{
+	shared_ptr<LasRecords> records = nullptr;
+	shared_ptr<Buffer> indices = nullptr;
+	int64_t first = 0;
+	int64_t numPoints = 0;
+
+	mutex mtx;
+	AttributeChannels decoded;
+
+	LasAttributes(shared_ptr<LasRecords> records, shared_ptr<Buffer> indices, int64_t first, int64_t numPoints){
+		this->records = records;
+		this->indices = indices;
+		this->first = first;
+		this->numPoints = numPoints;
+
+		decoded.size = numPoints;
+	}
+
+	int64_t recordIndex(int64_t i){
+		if(indices == nullptr){
+			return first + i;
+		}else{
+			return indices->get<uint32_t>(4 * (first + i));
+		}
+	}
+
+	// Decodes the channels in <mask> that weren't requested before, once, safe to call from multiple threads.
+	// Channels that the point format lacks stay empty. Returned channels stay valid while others are decoded.
+	const AttributeChannels& decode(uint32_t mask){
+
+		lock_guard<mutex> lock(mtx);
+
+		uint32_t missing = mask & records->available() & ~decoded.mask;
+
+		if(missing == 0){
+			return decoded;
+		}
+
+		decoded.allocate(missing);
+
+		for(int64_t i = 0; i < numPoints; i++){
+			int64_t record = recordIndex(i);
+
+			if(missing & LAS_INTENSITY)         decoded.intensity[i]       = records->intensity(record);
+			if(missing & LAS_RETURN_NUMBER)     decoded.returnNumber[i]    = records->returnNumber(record);
+			if(missing & LAS_NUMBER_OF_RETURNS) decoded.numberOfReturns[i] = records->numberOfReturns(record);
+			if(missing & LAS_CLASSIFICATION)    decoded.classification[i]  = records->classification(record);
+			if(missing & LAS_GPS_TIME)          decoded.gpsTime[i]         = records->gpsTime(record);
+		}
+
+		return decoded;
+	}
+
+	// The attributes of voxels that were selected from the points or voxels of 8 children,
+	// e.g. with the sources reported by HashSampling::select(). Source needs childIndex and index.
+	template<class Source>
+	static AttributeChannels select(const AttributeChannels* children[8], const vector<Source>& sources, uint32_t mask){
+
+		AttributeChannels selected(mask, sources.size());
+
+		for(int64_t i = 0; i < int64_t(sources.size()); i++){
+			const AttributeChannels* child = children[sources[i].childIndex];
+
+			if(child != nullptr){
+				selected.copy(i, *child, sources[i].index);
+			}
+		}
+
+		return selected;
+	}
+};
+
+// Averages the attributes of the samples that fall into each voxel, like the averaged colors of the voxelizers.
+// Only intensity and GPS time are averaged, returns and classification can't be. Voxels keep those of the
+// sample that was selected for them. Not thread-safe, use one accumulator per thread and node.
+struct AttributeAccumulator{
+	uint32_t mask = 0;
+
+	vector<uint32_t> counts;
+	vector<double> intensitySums;
+	vector<double> gpsTimeSums;
+
+	AttributeAccumulator(int64_t numVoxels, uint32_t mask){
+		this->mask = mask & (LAS_INTENSITY | LAS_GPS_TIME);
+
+		counts.resize(numVoxels, 0);
+		if(this->mask & LAS_INTENSITY) intensitySums.resize(numVoxels, 0.0);
+		if(this->mask & LAS_GPS_TIME)  gpsTimeSums.resize(numVoxels, 0.0);
+	}
+
+	void add(int64_t voxel, const AttributeChannels& source, int64_t index){
+
+		counts[voxel]++;
+
+		if(mask & source.mask & LAS_INTENSITY) intensitySums[voxel] += source.intensity[index];
+		if(mask & source.mask & LAS_GPS_TIME)  gpsTimeSums[voxel] += source.gpsTime[index];
+	}
+
+	// replaces the intensity and GPS time of <voxels> with the averages
+	void resolve(AttributeChannels& voxels){
+
+		uint32_t averaged = mask & voxels.mask;
+
+		for(int64_t voxel = 0; voxel < int64_t(counts.size()); voxel++){
+			uint32_t count = counts[voxel];
+
+			if(count == 0) continue;
+
+			if(averaged & LAS_INTENSITY) voxels.intensity[voxel] = uint16_t(intensitySums[voxel] / double(count) + 0.5);
+			if(averaged & LAS_GPS_TIME)  voxels.gpsTime[voxel] = gpsTimeSums[voxel] / double(count);
+		}
+	}
+};
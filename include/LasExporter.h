@@ -0,0 +1,641 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+
+#include "laszip_api.h"
+#include "src/bytestreamout_array.hpp"
+#include "src/arithmeticencoder.hpp"
+#include "src/integercompressor.hpp"
+
+#include "unsuck.hpp"
+#include "Checkpoint.h"
+#include "SpatialQuery.h"
+#include "LasAttributes.h"
+
+using namespace std;
+using glm::dvec3;
+using glm::i64vec3;
+
+// Exports a level of detail of an octree or of one of its subtrees as LAS 1.4, point format 7, or as LAZ.
+//
+// The hierarchy is cut like in SpatialQuery: leaves contribute their points, inner nodes at <maxLevel>
+// or <spacing> their voxels. The samples are split into chunks of CHUNK_SIZE in hierarchy order,
+// which are encoded on <numThreads> threads and written in order. For LAZ, each chunk is compressed
+// independently by its own LASzip writer, and the chunk table is assembled once all chunks are written.
+//
+// With a <progressPath>, the written chunks are checkpointed every <progressInterval> seconds.
+// An export of the same samples that was interrupted continues after the last checkpointed chunk
+// whose bytes in the file still match their checksum.
+//
+// Node needs min, max, level, children[8], points, numPoints, voxels and numVoxels, with points
+// that have x, y, z and an rgba color, e.g. the host tree of OctreeWriter. If Node also has pointAttributes
+// and voxelAttributes, shared_ptr<AttributeChannels> as in distributed::Node, records get their intensity,
+// returns, classification and GPS time. Without, all samples are written as return 1 of 1.
+template<class Node>
+struct LasExporter{
+
+	using Query = SpatialQuery<Node>;
+	using Point = typename Query::Point;
+	using Selection = typename Query::Selection;
+
+	static constexpr int64_t CHUNK_SIZE = 50'000; // LASzip's default
+	static constexpr int FORMAT = 7;
+	static constexpr int RECORD_LENGTH = 36;
+	static constexpr int HEADER_SIZE = 375;
+	static constexpr int NUM_RETURNS = 15;
+
+	static constexpr bool HAS_ATTRIBUTES = requires(Node* node){ node->pointAttributes; node->voxelAttributes; };
+
+	struct Options{
+		int maxLevel = 1'000;
+		double spacing = 0.0;
+		bool compress = false;
+		dvec3 scale = {0.001, 0.001, 0.001};
+		dvec3 origin = {0.0, 0.0, 0.0}; // added to all coordinates, e.g. the min that the loaders subtracted
+		int numThreads = std::thread::hardware_concurrency();
+
+		string progressPath = "";
+		double progressInterval = 10.0;
+	};
+
+	// a written chunk, as recorded in the progress checkpoint
+	struct ChunkProgress{
+		int64_t numPoints = 0;
+		i64vec3 min = {0, 0, 0};
+		i64vec3 max = {0, 0, 0};
+		uint64_t checksum = 0;
+		uint32_t bytes = 0;
+		uint32_t padding = 0;
+		int64_t numByReturn[NUM_RETURNS] = {};
+	};
+
+	struct Chunk{
+		shared_ptr<Buffer> data = nullptr; // records, or the compressed chunk
+		int64_t numPoints = 0;
+		i64vec3 min = {INT64_MAX, INT64_MAX, INT64_MAX};
+		i64vec3 max = {INT64_MIN, INT64_MIN, INT64_MIN};
+		int64_t numByReturn[NUM_RETURNS] = {};
+	};
+
+	// the fields of a record besides position and color
+	struct Attributes{
+		uint16_t intensity = 0;
+		uint8_t returnNumber = 1;
+		uint8_t numberOfReturns = 1;
+		uint8_t classification = 0;
+		double gpsTime = 0.0;
+	};
+
+	static const AttributeChannels* attributesOf(const Selection& selected){
+		if constexpr (HAS_ATTRIBUTES){
+			return selected.voxels ? selected.node->voxelAttributes.get() : selected.node->pointAttributes.get();
+		}else{
+			return nullptr;
+		}
+	}
+
+	// attributes of sample <index> of <channels>, return 1 of 1 if they lack the returns
+	static Attributes attributesAt(const AttributeChannels* channels, int64_t index){
+		Attributes attributes;
+
+		if(channels == nullptr) return attributes;
+
+		uint32_t mask = channels->mask;
+		if(mask & LAS_INTENSITY)         attributes.intensity = channels->intensity[index];
+		if(mask & LAS_RETURN_NUMBER)     attributes.returnNumber = channels->returnNumber[index];
+		if(mask & LAS_NUMBER_OF_RETURNS) attributes.numberOfReturns = channels->numberOfReturns[index];
+		if(mask & LAS_CLASSIFICATION)    attributes.classification = channels->classification[index];
+		if(mask & LAS_GPS_TIME)          attributes.gpsTime = channels->gpsTime[index];
+
+		return attributes;
+	}
+
+	// the samples of a cut through the hierarchy, addressed as one contiguous list
+	struct Samples{
+		vector<Selection> selection;
+		vector<int64_t> starts;
+		int64_t numPoints = 0;
+
+		// callback(point, attributes)
+		template<class Callback>
+		void forEach(int64_t first, int64_t count, Callback callback){
+			int64_t s = std::upper_bound(starts.begin(), starts.end(), first) - starts.begin() - 1;
+			int64_t local = first - starts[s];
+
+			for(int64_t i = 0; i < count; i++){
+				while(local >= selection[s].numPoints()){
+					s++;
+					local = 0;
+				}
+
+				callback(selection[s].points()[local], attributesAt(attributesOf(selection[s]), local));
+				local++;
+			}
+		}
+	};
+
+	static bool write(string path, Node* root, Options options){
+
+		Samples samples;
+		{
+			typename Query::Options queryOptions;
+			queryOptions.maxLevel = options.maxLevel;
+			queryOptions.spacing = options.spacing;
+
+			// everything below <root> is inside
+			Query query(root);
+			query.select(root, QueryBox(root->min, root->max), queryOptions, true, samples.selection);
+
+			for(auto& selected : samples.selection){
+				samples.starts.push_back(samples.numPoints);
+				samples.numPoints += selected.numPoints();
+			}
+		}
+
+		dvec3 offset = dvec3(root->min) + options.origin;
+		int64_t numChunks = (samples.numPoints + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+		auto toInt = [&](const Point& point){
+			return i64vec3(
+				std::llround((double(point.x) + options.origin.x - offset.x) / options.scale.x),
+				std::llround((double(point.y) + options.origin.y - offset.y) / options.scale.y),
+				std::llround((double(point.z) + options.origin.z - offset.z) / options.scale.z)
+			);
+		};
+
+		shared_ptr<Buffer> header = createHeader(samples.numPoints, offset, options);
+		int64_t chunkTableOffsetPosition = header->size;
+		int64_t dataStart = header->size + (options.compress ? 8 : 0);
+
+		// PROGRESS of an interrupted export of the same samples
+		bool checkpoints = options.progressPath != "";
+		uint64_t progressKey = 0;
+		vector<ChunkProgress> progress;
+
+		if(checkpoints){
+			progressKey = progressKeyOf(samples, offset, options);
+			progress = resume(path, options.progressPath, progressKey, dataStart);
+		}
+
+		int64_t numResumed = progress.size();
+		progress.resize(numChunks);
+
+		fstream fout(path, numResumed > 0 ? (ios::in | ios::out | ios::binary) : (ios::out | ios::binary));
+		if(!fout.good()){
+			cout << "ERROR: could not open " << path << endl;
+			return false;
+		}
+
+		// HEADER, rewritten with the bounds at the end
+		fout.write(header->data_char, header->size);
+
+		if(options.compress){
+			int64_t placeholder = -1;
+			fout.write(reinterpret_cast<char*>(&placeholder), 8);
+		}
+
+		// CHUNKS, encoded in parallel, written in order
+		vector<Chunk> chunks(numChunks);
+		vector<bool> finished(numChunks, false);
+		vector<uint32_t> chunkBytes(numChunks);
+		int64_t nextToWrite = 0;
+		mutex mtx_write;
+		atomic<int64_t> nextChunk = 0;
+		atomic<bool> failed = false;
+		double tProgress = now();
+
+		if(numResumed > 0){
+			int64_t resumeOffset = dataStart;
+
+			for(int64_t i = 0; i < numResumed; i++){
+				chunks[i].numPoints = progress[i].numPoints;
+				chunks[i].min = progress[i].min;
+				chunks[i].max = progress[i].max;
+				std::copy(progress[i].numByReturn, progress[i].numByReturn + NUM_RETURNS, chunks[i].numByReturn);
+				chunkBytes[i] = progress[i].bytes;
+				finished[i] = true;
+
+				resumeOffset += progress[i].bytes;
+			}
+
+			fout.seekp(resumeOffset);
+			nextToWrite = numResumed;
+			nextChunk = numResumed;
+
+			cout << "resuming " << path << " after " << numResumed << " of " << numChunks << " chunks" << endl;
+		}
+
+		auto work = [&](){
+			while(true){
+				int64_t chunkIndex = nextChunk.fetch_add(1);
+				if(chunkIndex >= numChunks || failed) break;
+
+				int64_t first = chunkIndex * CHUNK_SIZE;
+				int64_t count = std::min(CHUNK_SIZE, samples.numPoints - first);
+
+				Chunk chunk;
+				chunk.numPoints = count;
+
+				auto bounds = [&chunk](i64vec3 xyz, const Attributes& attributes){
+					chunk.min = glm::min(chunk.min, xyz);
+					chunk.max = glm::max(chunk.max, xyz);
+
+					if(attributes.returnNumber >= 1 && attributes.returnNumber <= NUM_RETURNS){
+						chunk.numByReturn[attributes.returnNumber - 1]++;
+					}
+				};
+
+				bool success = options.compress
+					? compressChunk(samples, first, count, offset, options, toInt, bounds, chunk)
+					: encodeChunk(samples, first, count, toInt, bounds, chunk);
+
+				if(!success){
+					failed = true;
+					break;
+				}
+
+				lock_guard<mutex> lock(mtx_write);
+
+				chunks[chunkIndex] = chunk;
+				finished[chunkIndex] = true;
+
+				while(nextToWrite < numChunks && finished[nextToWrite]){
+					Chunk& next = chunks[nextToWrite];
+
+					fout.write(next.data->data_char, next.data->size);
+					chunkBytes[nextToWrite] = next.data->size;
+
+					if(checkpoints){
+						ChunkProgress& written = progress[nextToWrite];
+						written.numPoints = next.numPoints;
+						written.min = next.min;
+						written.max = next.max;
+						written.checksum = Checksum::of(next.data->data, next.data->size);
+						written.bytes = next.data->size;
+						std::copy(next.numByReturn, next.numByReturn + NUM_RETURNS, written.numByReturn);
+					}
+
+					next.data = nullptr;
+
+					nextToWrite++;
+				}
+
+				if(checkpoints && now() - tProgress > options.progressInterval){
+					fout.flush();
+
+					Checkpoint::Writer writer(options.progressPath, progressKey);
+					writer.write(nextToWrite);
+					writer.write(progress.data(), nextToWrite * sizeof(ChunkProgress));
+					writer.close();
+
+					tProgress = now();
+				}
+			}
+		};
+
+		int numThreads = std::max(options.numThreads, 1);
+		vector<thread> threads;
+		for(int i = 1; i < numThreads; i++){
+			threads.emplace_back(work);
+		}
+
+		work();
+
+		for(thread& t : threads){
+			t.join();
+		}
+
+		if(failed){
+			cout << "ERROR: failed to encode " << path << endl;
+			return false;
+		}
+
+		int64_t fileSize = fout.tellp();
+
+		// CHUNK TABLE
+		if(options.compress){
+			int64_t chunkTableOffset = fileSize;
+
+			shared_ptr<Buffer> chunkTable = createChunkTable(chunkBytes);
+			fout.write(chunkTable->data_char, chunkTable->size);
+			fileSize += chunkTable->size;
+
+			fout.seekp(chunkTableOffsetPosition);
+			fout.write(reinterpret_cast<char*>(&chunkTableOffset), 8);
+		}
+
+		// BOUNDS
+		i64vec3 min = {0, 0, 0};
+		i64vec3 max = {0, 0, 0};
+		int64_t numByReturn[NUM_RETURNS] = {};
+		if(numChunks > 0){
+			min = chunks[0].min;
+			max = chunks[0].max;
+		}
+		for(Chunk& chunk : chunks){
+			min = glm::min(min, chunk.min);
+			max = glm::max(max, chunk.max);
+
+			for(int i = 0; i < NUM_RETURNS; i++){
+				numByReturn[i] += chunk.numByReturn[i];
+			}
+		}
+
+		for(int i = 0; i < NUM_RETURNS; i++){
+			header->set<uint64_t>(numByReturn[i], 255 + 8 * i);
+		}
+
+		header->set<double>(double(max.x) * options.scale.x + offset.x, 179);
+		header->set<double>(double(min.x) * options.scale.x + offset.x, 187);
+		header->set<double>(double(max.y) * options.scale.y + offset.y, 195);
+		header->set<double>(double(min.y) * options.scale.y + offset.y, 203);
+		header->set<double>(double(max.z) * options.scale.z + offset.z, 211);
+		header->set<double>(double(min.z) * options.scale.z + offset.z, 219);
+
+		fout.seekp(0);
+		fout.write(header->data_char, HEADER_SIZE);
+		fout.close();
+
+		if(numResumed > 0){
+			// an earlier, larger export of the same samples may have left bytes behind
+			fs::resize_file(path, fileSize);
+		}
+
+		if(checkpoints){
+			Checkpoint::remove(options.progressPath);
+		}
+
+		return true;
+	}
+
+	// the samples and everything that affects how they're encoded
+	static uint64_t progressKeyOf(Samples& samples, dvec3 offset, Options& options){
+
+		Checksum checksum;
+		checksum.add(options.compress);
+		checksum.add(options.scale);
+		checksum.add(options.origin);
+		checksum.add(offset);
+		checksum.add(CHUNK_SIZE);
+		checksum.add(uint64_t(sizeof(ChunkProgress)));
+		checksum.add(samples.numPoints);
+
+		for(auto& selected : samples.selection){
+			checksum.update(selected.points(), selected.numPoints() * sizeof(Point));
+
+			if(const AttributeChannels* attributes = attributesOf(selected)){
+				checksum.add(attributes->mask);
+				checksum.update(attributes->intensity.data(), attributes->intensity.size() * sizeof(uint16_t));
+				checksum.update(attributes->returnNumber.data(), attributes->returnNumber.size());
+				checksum.update(attributes->numberOfReturns.data(), attributes->numberOfReturns.size());
+				checksum.update(attributes->classification.data(), attributes->classification.size());
+				checksum.update(attributes->gpsTime.data(), attributes->gpsTime.size() * sizeof(double));
+			}
+		}
+
+		return checksum.value();
+	}
+
+	// Chunks that an interrupted export wrote to <path>, up to the first one whose bytes don't match the checkpoint.
+	// Empty if there is no checkpoint of <key>.
+	static vector<ChunkProgress> resume(string path, string progressPath, uint64_t key, int64_t dataStart){
+
+		vector<ChunkProgress> progress;
+
+		auto checkpoint = Checkpoint::read(progressPath, key);
+
+		if(checkpoint == nullptr || !fs::exists(path)) return progress;
+
+		int64_t numWritten = checkpoint->get<int64_t>(Checkpoint::HEADER_SIZE);
+		int64_t fileSize = fs::file_size(path);
+		int64_t offset = dataStart;
+
+		for(int64_t i = 0; i < numWritten; i++){
+			ChunkProgress written;
+			memcpy(&written, checkpoint->data_u8 + Checkpoint::HEADER_SIZE + 8 + i * sizeof(ChunkProgress), sizeof(ChunkProgress));
+
+			if(offset + written.bytes > fileSize) break;
+
+			auto bytes = readBinaryFile(path, offset, written.bytes);
+
+			if(Checksum::of(bytes->data, bytes->size) != written.checksum) break;
+
+			progress.push_back(written);
+			offset += written.bytes;
+		}
+
+		return progress;
+	}
+
+	template<class ToInt, class Bounds>
+	static bool encodeChunk(Samples& samples, int64_t first, int64_t count, ToInt& toInt, Bounds& bounds, Chunk& chunk){
+
+		auto records = make_shared<Buffer>(count * RECORD_LENGTH);
+		memset(records->data, 0, records->size);
+
+		int64_t i = 0;
+		samples.forEach(first, count, [&](const Point& point, const Attributes& attributes){
+			i64vec3 xyz = toInt(point);
+			bounds(xyz, attributes);
+
+			int64_t offset = i * RECORD_LENGTH;
+			records->set<int32_t>(int32_t(xyz.x), offset + 0);
+			records->set<int32_t>(int32_t(xyz.y), offset + 4);
+			records->set<int32_t>(int32_t(xyz.z), offset + 8);
+			records->set<uint16_t>(attributes.intensity, offset + 12);
+			records->set<uint8_t>((attributes.returnNumber & 0b1111) | (attributes.numberOfReturns << 4), offset + 14);
+			records->set<uint8_t>(attributes.classification, offset + 16);
+			records->set<double>(attributes.gpsTime, offset + 22);
+			records->set<uint16_t>(257 * ((point.color >>  0) & 0xff), offset + 30);
+			records->set<uint16_t>(257 * ((point.color >>  8) & 0xff), offset + 32);
+			records->set<uint16_t>(257 * ((point.color >> 16) & 0xff), offset + 34);
+
+			i++;
+		});
+
+		chunk.data = records;
+
+		return true;
+	}
+
+	// Compresses the points with a LASzip writer that writes no header. Its stream holds the position
+	// of its chunk table, the chunk, and a chunk table with just this chunk, which is dropped.
+	template<class ToInt, class Bounds>
+	static bool compressChunk(Samples& samples, int64_t first, int64_t count, dvec3 offset, Options& options, ToInt& toInt, Bounds& bounds, Chunk& chunk){
+
+		laszip_POINTER writer = nullptr;
+		laszip_create(&writer);
+
+		laszip_header* header = nullptr;
+		laszip_get_header_pointer(writer, &header);
+		setLaszipHeader(header, count, offset, options);
+
+		stringstream stream(ios::in | ios::out | ios::binary);
+
+		if(laszip_open_writer_stream(writer, stream, 1, 1)){
+			laszip_CHAR* error = nullptr;
+			laszip_get_error(writer, &error);
+			cout << "ERROR: laszip_open_writer_stream: " << error << endl;
+
+			laszip_destroy(writer);
+
+			return false;
+		}
+
+		laszip_point* lpoint = nullptr;
+		laszip_get_point_pointer(writer, &lpoint);
+		lpoint->extended_point_type = 1;
+
+		samples.forEach(first, count, [&](const Point& point, const Attributes& attributes){
+			i64vec3 xyz = toInt(point);
+			bounds(xyz, attributes);
+
+			lpoint->X = int32_t(xyz.x);
+			lpoint->Y = int32_t(xyz.y);
+			lpoint->Z = int32_t(xyz.z);
+			lpoint->intensity = attributes.intensity;
+			lpoint->return_number = std::min(attributes.returnNumber, uint8_t(7));
+			lpoint->number_of_returns = std::min(attributes.numberOfReturns, uint8_t(7));
+			lpoint->extended_return_number = attributes.returnNumber;
+			lpoint->extended_number_of_returns = attributes.numberOfReturns;
+			lpoint->classification = attributes.classification < 32 ? attributes.classification : 0; // LASzip's legacy field has 5 bits
+			lpoint->extended_classification = attributes.classification;
+			lpoint->gps_time = attributes.gpsTime;
+			lpoint->rgb[0] = 257 * ((point.color >>  0) & 0xff);
+			lpoint->rgb[1] = 257 * ((point.color >>  8) & 0xff);
+			lpoint->rgb[2] = 257 * ((point.color >> 16) & 0xff);
+
+			laszip_write_point(writer);
+		});
+
+		laszip_close_writer(writer);
+		laszip_destroy(writer);
+
+		string bytes = stream.str();
+
+		int64_t chunkTableStart = 0;
+		memcpy(&chunkTableStart, bytes.data(), 8);
+
+		int64_t chunkSize = chunkTableStart - 8;
+		chunk.data = make_shared<Buffer>(chunkSize);
+		memcpy(chunk.data->data, bytes.data() + 8, chunkSize);
+
+		return true;
+	}
+
+	static void setLaszipHeader(laszip_header* header, int64_t numPoints, dvec3 offset, Options& options){
+		header->version_major = 1;
+		header->version_minor = 4;
+		header->header_size = HEADER_SIZE;
+		header->offset_to_point_data = HEADER_SIZE;
+		header->point_data_format = FORMAT;
+		header->point_data_record_length = RECORD_LENGTH;
+		header->number_of_point_records = 0;
+		header->extended_number_of_point_records = numPoints;
+		header->extended_number_of_points_by_return[0] = numPoints;
+		header->x_scale_factor = options.scale.x;
+		header->y_scale_factor = options.scale.y;
+		header->z_scale_factor = options.scale.z;
+		header->x_offset = offset.x;
+		header->y_offset = offset.y;
+		header->z_offset = offset.z;
+	}
+
+	// public header block, followed by the LASzip VLR if compressed
+	static shared_ptr<Buffer> createHeader(int64_t numPoints, dvec3 offset, Options& options){
+
+		laszip_U8* vlr = nullptr;
+		laszip_U32 vlrSize = 0;
+		laszip_POINTER writer = nullptr;
+
+		if(options.compress){
+			laszip_create(&writer);
+
+			laszip_header* header = nullptr;
+			laszip_get_header_pointer(writer, &header);
+			setLaszipHeader(header, numPoints, offset, options);
+
+			laszip_create_laszip_vlr(writer, &vlr, &vlrSize);
+		}
+
+		auto buffer = make_shared<Buffer>(HEADER_SIZE + vlrSize);
+		memset(buffer->data, 0, buffer->size);
+
+		string software = "CudaLOD";
+
+		memcpy(buffer->data_u8 + 0, "LASF", 4);
+		buffer->set<uint16_t>(0b1'0000, 6);                // WKT, required for formats 6 - 10
+		buffer->set<uint8_t>(1, 24);
+		buffer->set<uint8_t>(4, 25);
+		memcpy(buffer->data_u8 + 58, software.c_str(), software.size());
+		buffer->set<uint16_t>(HEADER_SIZE, 94);
+		buffer->set<uint32_t>(HEADER_SIZE + vlrSize, 96);
+		buffer->set<uint32_t>(options.compress ? 1 : 0, 100);
+		buffer->set<uint8_t>(FORMAT | (options.compress ? 0b1000'0000 : 0), 104);
+		buffer->set<uint16_t>(RECORD_LENGTH, 105);
+		buffer->set<uint32_t>(0, 107);                     // legacy count, 0 for formats 6 - 10
+
+		buffer->set<double>(options.scale.x, 131);
+		buffer->set<double>(options.scale.y, 139);
+		buffer->set<double>(options.scale.z, 147);
+		buffer->set<double>(offset.x, 155);
+		buffer->set<double>(offset.y, 163);
+		buffer->set<double>(offset.z, 171);
+
+		buffer->set<uint64_t>(numPoints, 247);
+		buffer->set<uint64_t>(numPoints, 255);             // points by return, counted while writing
+
+		if(vlrSize > 0){
+			memcpy(buffer->data_u8 + HEADER_SIZE, vlr, vlrSize);
+		}
+
+		if(writer != nullptr){
+			laszip_destroy(writer);
+		}
+
+		return buffer;
+	}
+
+	// same encoding as LASwritePoint::write_chunk_table() for chunks with a fixed number of points
+	static shared_ptr<Buffer> createChunkTable(vector<uint32_t>& chunkBytes){
+
+		ByteStreamOutArrayLE out;
+
+		uint32_t version = 0;
+		uint32_t numChunks = chunkBytes.size();
+		out.put32bitsLE(reinterpret_cast<U8*>(&version));
+		out.put32bitsLE(reinterpret_cast<U8*>(&numChunks));
+
+		if(numChunks > 0){
+			ArithmeticEncoder encoder;
+			encoder.init(&out);
+
+			IntegerCompressor ic(&encoder, 32, 2);
+			ic.initCompressor();
+
+			for(uint32_t i = 0; i < numChunks; i++){
+				ic.compress(i ? chunkBytes[i - 1] : 0, chunkBytes[i], 1);
+			}
+
+			encoder.done();
+		}
+
+		auto buffer = make_shared<Buffer>(out.getSize());
+		memcpy(buffer->data, out.getData(), out.getSize());
+
+		return buffer;
+	}
+
+};
@@ -0,0 +1,105 @@
+
+#pragma once
+
+#include <string>
+
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+
+#include "unsuck.hpp"
+
+using glm::dvec3;
+
+using namespace std;
+
+// Public header block of LAS 1.0 - 1.4 files. Also valid for LAZ, which keeps the
+// uncompressed record length in the header and flags compression in the format byte.
+struct LasHeader{
+
+	int versionMajor = 0;
+	int versionMinor = 0;
+	int headerSize = 0;
+	uint64_t offsetToPointData = 0;
+	uint32_t numVLRs = 0;
+	int format = 0;
+	bool isCompressed = false;
+	int recordLength = 0;
+	int64_t numPoints = 0;
+
+	dvec3 scale = {1.0, 1.0, 1.0};
+	dvec3 offset = {0.0, 0.0, 0.0};
+	dvec3 min = {0.0, 0.0, 0.0};
+	dvec3 max = {0.0, 0.0, 0.0};
+
+	// size of a record without extra bytes, for point formats 0 - 10
+	static int standardRecordLength(int format){
+		constexpr int sizes[11] = {20, 28, 26, 34, 57, 63, 30, 36, 38, 59, 67};
+
+		if(format < 0 || format > 10) return 0;
+
+		return sizes[format];
+	}
+
+	// byte offset of the rgb triple within a record, or -1
+	static int rgbOffset(int format){
+		constexpr int offsets[11] = {-1, -1, 20, 28, -1, 28, -1, 30, 30, -1, 30};
+
+		if(format < 0 || format > 10) return -1;
+
+		return offsets[format];
+	}
+
+	// byte offset of the GPS time within a record, or -1
+	static int gpsTimeOffset(int format){
+		constexpr int offsets[11] = {-1, 20, -1, 20, 20, 20, 22, 22, 22, 22, 22};
+
+		if(format < 0 || format > 10) return -1;
+
+		return offsets[format];
+	}
+
+	// parses the public header block from a buffer that starts at the first byte of the file
+	static LasHeader parse(Buffer* buffer){
+		LasHeader header;
+
+		header.versionMajor      = buffer->get<uint8_t>(24);
+		header.versionMinor      = buffer->get<uint8_t>(25);
+		header.headerSize        = buffer->get<uint16_t>(94);
+		header.offsetToPointData = buffer->get<uint32_t>(96);
+		header.numVLRs           = buffer->get<uint32_t>(100);
+
+		int formatByte           = buffer->get<uint8_t>(104);
+		header.format            = formatByte & 0b0011'1111;
+		header.isCompressed      = (formatByte & 0b1100'0000) != 0;
+		header.recordLength      = buffer->get<uint16_t>(105);
+
+		header.numPoints = buffer->get<uint32_t>(107);
+		if(header.versionMajor == 1 && header.versionMinor >= 4 && buffer->size >= 255){
+			header.numPoints = buffer->get<uint64_t>(247);
+		}
+
+		header.scale.x  = buffer->get<double>(131);
+		header.scale.y  = buffer->get<double>(139);
+		header.scale.z  = buffer->get<double>(147);
+
+		header.offset.x = buffer->get<double>(155);
+		header.offset.y = buffer->get<double>(163);
+		header.offset.z = buffer->get<double>(171);
+
+		header.max.x    = buffer->get<double>(179);
+		header.min.x    = buffer->get<double>(187);
+		header.max.y    = buffer->get<double>(195);
+		header.min.y    = buffer->get<double>(203);
+		header.max.z    = buffer->get<double>(211);
+		header.min.z    = buffer->get<double>(219);
+
+		return header;
+	}
+
+	static LasHeader read(string path){
+		auto buffer = readBinaryFile(path, 0, 375);
+
+		return parse(buffer.get());
+	}
+
+};
@@ -12,6 +12,10 @@
 #include <glm/gtx/transform.hpp>
 
 #include "unsuck.hpp"
+#include "LasHeader.h"
+#include "LasAttributes.h"
+#include "Tracer.h"
+#include "Metrics.h"
 
 using glm::dvec3;
 using glm::ivec3;
@@ -21,6 +25,9 @@ using namespace std;
 struct LasPoints{
 	shared_ptr<Buffer> buffer;
 	int64_t numPoints;
+
+	// raw records of the loaded points, in the same order, if requested with <keepRecords>
+	shared_ptr<LasRecords> records = nullptr;
 };
 
 
@@ -32,59 +39,77 @@ struct LasLoader{
 	
 	}
 
-	static LasPoints loadSync(string file, int64_t firstPoint, int64_t wantedPoints){
+	// <keepRecords> keeps the raw records so that attributes other than XYZ and RGB can be decoded later.
+	static LasPoints loadSync(string file, int64_t firstPoint, int64_t wantedPoints, bool keepRecords = false){
 
 		//lock_guard<mutex> lock(mtx_wat);
 
-		auto headerBuffer = new Buffer(2 * 1024);
-		readBinaryFile(file, 0, headerBuffer ->size, headerBuffer ->data);
-
-		uint64_t offsetToPointData = headerBuffer ->get<uint32_t>(96);
-		int format = headerBuffer ->get<uint8_t>(104);
-		int recordLength = headerBuffer ->get<uint16_t>(105);
-
-		int versionMajor = headerBuffer ->get<uint8_t>(24);
-		int versionMinor = headerBuffer ->get<uint8_t>(25);
-
-		int64_t numPoints = 0;
-		if(versionMajor == 1 && versionMinor <= 3){
-			numPoints = headerBuffer ->get<uint32_t>(107);
-		}else{
-			numPoints = headerBuffer ->get<int64_t>(247);
-		}
+		auto zone = Tracer::zone("LasLoader::loadSync");
 
-		dvec3 c_scale = {
-			headerBuffer->get<double>(131),
-			headerBuffer->get<double>(139),
-			headerBuffer->get<double>(147)
-		};
+		auto header = LasHeader::read(file);
 
-		dvec3 c_offset = {
-			headerBuffer->get<double>(155),
-			headerBuffer->get<double>(163),
-			headerBuffer->get<double>(171)
-		};
+		uint64_t offsetToPointData = header.offsetToPointData;
+		int recordLength = header.recordLength;
+		int64_t numPoints = header.numPoints;
+		dvec3 c_scale = header.scale;
+		dvec3 c_offset = header.offset;
 
 		int64_t batchSize_points = std::min(numPoints - firstPoint, wantedPoints);
 
 		int64_t byteOffset = offsetToPointData + recordLength * firstPoint;
 		int64_t byteSize = batchSize_points * recordLength;
 
-		auto rawBuffer = make_shared<Buffer>(byteSize);
-		readBinaryFile(file, byteOffset, byteSize, rawBuffer->data);
+		// raw batches are several MB, backed by huge pages where available
+		static BufferPool* pool = BufferPool::get("LasLoader", true);
+
+		static auto& pointsRead   = Metrics::counter("cudalod_points_read_total", "Points read from input files");
+		static auto& bytesRead    = Metrics::counter("cudalod_bytes_read_total", "Bytes read from input files");
+		static auto& readDuration = Metrics::histogram("cudalod_read_duration_seconds", "Duration of reads of a batch of points", Metrics::durationBuckets());
+
+		auto rawBuffer = make_shared<Buffer>(byteSize, pool);
+		{
+			auto zone = Tracer::zone("read");
+			double tStart = now();
+			readBinaryFile(file, byteOffset, byteSize, rawBuffer->data);
+			readDuration.observe(now() - tStart);
+		}
 
 		// transform to XYZRGBA
-		auto targetBuffer = make_shared<Buffer>(32 * batchSize_points);
+		auto targetBuffer = make_shared<Buffer>(32 * batchSize_points, pool);
+
+		decode(*rawBuffer, batchSize_points, recordLength, c_scale, c_offset, targetBuffer->data_u8);
 
-		for(int i = 0; i < batchSize_points; i++){
+		LasPoints laspoints;
+		laspoints.buffer = targetBuffer;
+		laspoints.numPoints = batchSize_points;
+
+		if(keepRecords){
+			laspoints.records = make_shared<LasRecords>();
+			laspoints.records->buffer = rawBuffer;
+			laspoints.records->format = header.format;
+			laspoints.records->recordLength = recordLength;
+			laspoints.records->numRecords = batchSize_points;
+		}
+
+		Tracer::increment("bytes read", double(byteSize));
+		pointsRead.add(double(batchSize_points));
+		bytesRead.add(double(byteSize));
+
+		return laspoints;
+	}
+
+	// raw records to 32 bytes per point: XYZ as doubles, RGBA as uint32_t, 4 bytes padding
+	static void decode(Buffer& raw, int64_t numPoints, int recordLength, dvec3 c_scale, dvec3 c_offset, uint8_t* target){
+
+		for(int64_t i = 0; i < numPoints; i++){
 			int64_t offset = i * recordLength;
 
-			int32_t X = rawBuffer->get<int32_t>(offset + 0);
-			int32_t Y = rawBuffer->get<int32_t>(offset + 4);
-			int32_t Z = rawBuffer->get<int32_t>(offset + 8);
-			uint16_t R = rawBuffer->get<uint16_t>(offset + 28);
-			uint16_t G = rawBuffer->get<uint16_t>(offset + 30);
-			uint16_t B = rawBuffer->get<uint16_t>(offset + 32);
+			int32_t X = raw.get<int32_t>(offset + 0);
+			int32_t Y = raw.get<int32_t>(offset + 4);
+			int32_t Z = raw.get<int32_t>(offset + 8);
+			uint16_t R = raw.get<uint16_t>(offset + 28);
+			uint16_t G = raw.get<uint16_t>(offset + 30);
+			uint16_t B = raw.get<uint16_t>(offset + 32);
 
 			double x = double(X) * c_scale.x + c_offset.x;
 			double y = double(Y) * c_scale.y + c_offset.y;
@@ -95,17 +120,44 @@ struct LasLoader{
 			B = B > 255 ? B / 255 : B;
 			uint32_t color = (R << 0) | (G << 8) | (B << 16);
 
-			targetBuffer->set<double>(x, 32 * i + 0);
-			targetBuffer->set<double>(y, 32 * i + 8);
-			targetBuffer->set<double>(z, 32 * i + 16);
-			targetBuffer->set<uint32_t>(color, 32 * i + 24);
+			memcpy(target + 32 * i + 0, &x, 8);
+			memcpy(target + 32 * i + 8, &y, 8);
+			memcpy(target + 32 * i + 16, &z, 8);
+			memcpy(target + 32 * i + 24, &color, 4);
 		}
+	}
 
-		LasPoints laspoints;
-		laspoints.buffer = targetBuffer;
-		laspoints.numPoints = batchSize_points;
+	// Same as loadSync(), but decodes into <target>, which holds 32 * <wantedPoints> bytes, 
+	// e.g. a slot of a SharedRing. Returns the number of decoded points.
+	static int64_t loadInto(string file, int64_t firstPoint, int64_t wantedPoints, uint8_t* target){
 
-		return laspoints;
+		auto zone = Tracer::zone("LasLoader::loadInto");
+
+		auto header = LasHeader::read(file);
+
+		int recordLength = header.recordLength;
+		int64_t batchSize_points = std::max(std::min(header.numPoints - firstPoint, wantedPoints), int64_t(0));
+
+		int64_t byteOffset = header.offsetToPointData + recordLength * firstPoint;
+		int64_t byteSize = batchSize_points * recordLength;
+
+		static BufferPool* pool = BufferPool::get("LasLoader", true);
+		static auto& pointsRead = Metrics::counter("cudalod_points_read_total", "Points read from input files");
+		static auto& bytesRead  = Metrics::counter("cudalod_bytes_read_total", "Bytes read from input files");
+
+		Buffer rawBuffer(byteSize, pool);
+		{
+			auto zone = Tracer::zone("read");
+			readBinaryFile(file, byteOffset, byteSize, rawBuffer.data);
+		}
+
+		decode(rawBuffer, batchSize_points, recordLength, header.scale, header.offset, target);
+
+		Tracer::increment("bytes read", double(byteSize));
+		pointsRead.add(double(batchSize_points));
+		bytesRead.add(double(byteSize));
+
+		return batchSize_points;
 	}
 
 	static void load(string file, int64_t firstPoint, int64_t wantedPoints, function<void(shared_ptr<Buffer>, int64_t numLoaded)> callback){
@@ -0,0 +1,377 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <condition_variable>
+#include <iostream>
+
+#include "unsuck.hpp"
+
+using namespace std;
+
+namespace fs = std::filesystem;
+
+// Live metrics of long-running builds in the Prometheus text format, so that orchestration can detect
+// stalled or slow builds, e.g. with node_exporter's textfile collector or by reading the file directly.
+//
+// - counters only go up, e.g. points or bytes read. Gauges are set to the current value, e.g. queue depths.
+//   Histograms count observations into buckets, e.g. the duration of reads.
+// - metrics are created on first use and live as long as the process. Keep a reference rather than
+//   looking them up per point:
+//
+//       static auto& pointsRead = Metrics::counter("cudalod_points_read_total", "Points read from input files");
+//       pointsRead.add(batch.numPoints);
+//
+// - <labels> distinguish series of the same metric, e.g. "phase=\"sort\"".
+// - updates are lock-free. Lookups and export take a lock.
+// - startWriter() periodically writes all metrics to a file, replaced atomically so readers never see partial output.
+//   process_resident_memory_bytes and cudalod_uptime_seconds are updated right before each export.
+struct Metrics{
+
+	enum class Type{
+		COUNTER,
+		GAUGE,
+		HISTOGRAM,
+	};
+
+	struct Counter{
+		atomic<double> value = 0.0;
+
+		void add(double delta = 1.0){
+			value.fetch_add(delta, memory_order_relaxed);
+		}
+	};
+
+	struct Gauge{
+		atomic<double> value = 0.0;
+
+		void set(double value){
+			this->value.store(value, memory_order_relaxed);
+		}
+
+		void add(double delta){
+			value.fetch_add(delta, memory_order_relaxed);
+		}
+	};
+
+	struct Histogram{
+		vector<double> bounds;               // upper bounds of the buckets, ascending, +Inf is implicit
+		unique_ptr<atomic<uint64_t>[]> buckets; // bounds.size() + 1, not cumulative
+		atomic<double> sum = 0.0;
+		atomic<uint64_t> count = 0;
+
+		Histogram(vector<double> bounds){
+			this->bounds = bounds;
+			this->buckets = make_unique<atomic<uint64_t>[]>(bounds.size() + 1);
+		}
+
+		void observe(double value){
+			int64_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+
+			buckets[bucket].fetch_add(1, memory_order_relaxed);
+			sum.fetch_add(value, memory_order_relaxed);
+			count.fetch_add(1, memory_order_relaxed);
+		}
+	};
+
+	// all series of one metric name
+	struct Family{
+		Type type = Type::COUNTER;
+		string help = "";
+		map<string, unique_ptr<Counter>> counters;
+		map<string, unique_ptr<Gauge>> gauges;
+		map<string, unique_ptr<Histogram>> histograms;
+	};
+
+	// Tracks the throughput of a build phase while it runs:
+	//   cudalod_phase_points_total{phase}      points processed so far
+	//   cudalod_phase_seconds_total{phase}     time spent in completed runs of the phase
+	//   cudalod_phase_points_per_second{phase} throughput of the current or last run
+	//   cudalod_phase_active{phase}            number of running instances
+	// addPoints() may be called from several threads, e.g. from the tasks of a TaskPool.
+	struct Phase{
+		Counter* points = nullptr;
+		Counter* seconds = nullptr;
+		Gauge* throughput = nullptr;
+		Gauge* active = nullptr;
+		double start = 0.0;
+		atomic<double> numPoints = 0.0;
+		bool ended = false;
+
+		Phase(string name){
+			string labels = "phase=\"" + name + "\"";
+
+			points     = &Metrics::counter("cudalod_phase_points_total", "Points processed by a build phase", labels);
+			seconds    = &Metrics::counter("cudalod_phase_seconds_total", "Time spent in completed runs of a build phase", labels);
+			throughput = &Metrics::gauge("cudalod_phase_points_per_second", "Throughput of the current or last run of a build phase", labels);
+			active     = &Metrics::gauge("cudalod_phase_active", "Running instances of a build phase", labels);
+
+			start = now();
+			active->add(1.0);
+		}
+
+		Phase(const Phase&) = delete;
+		Phase& operator=(const Phase&) = delete;
+
+		~Phase(){
+			end();
+		}
+
+		void addPoints(double numPoints){
+			double total = this->numPoints.fetch_add(numPoints, memory_order_relaxed) + numPoints;
+			points->add(numPoints);
+
+			double duration = now() - start;
+			if(duration > 0.0){
+				throughput->set(total / duration);
+			}
+		}
+
+		void end(){
+			if(ended) return;
+
+			double duration = now() - start;
+
+			seconds->add(duration);
+			if(duration > 0.0){
+				throughput->set(numPoints / duration);
+			}
+			active->add(-1.0);
+
+			ended = true;
+		}
+	};
+
+	mutex mtx;
+	map<string, Family> families;
+	double startTime = now();
+
+	// WRITER
+	thread writer;
+	mutex mtx_writer;
+	condition_variable cv_writer;
+	bool writerStopped = false;
+	string writerPath = "";
+
+	static Metrics* instance(){
+		static Metrics* _instance = new Metrics();
+
+		return _instance;
+	}
+
+	static Family& family(string name, string help, Type type){
+		Metrics* metrics = instance();
+		Family& family = metrics->families[name];
+
+		if(family.help.empty()){
+			family.type = type;
+			family.help = help;
+		}else if(family.type != type){
+			cout << "WARNING: metric " << name << " is used with different types" << endl;
+		}
+
+		return family;
+	}
+
+	static Counter& counter(string name, string help, string labels = ""){
+		lock_guard<mutex> lock(instance()->mtx);
+
+		auto& series = family(name, help, Type::COUNTER).counters[labels];
+		if(series == nullptr){
+			series = make_unique<Counter>();
+		}
+
+		return *series;
+	}
+
+	static Gauge& gauge(string name, string help, string labels = ""){
+		lock_guard<mutex> lock(instance()->mtx);
+
+		auto& series = family(name, help, Type::GAUGE).gauges[labels];
+		if(series == nullptr){
+			series = make_unique<Gauge>();
+		}
+
+		return *series;
+	}
+
+	// <bounds> only apply to the first use of a series
+	static Histogram& histogram(string name, string help, vector<double> bounds, string labels = ""){
+		lock_guard<mutex> lock(instance()->mtx);
+
+		auto& series = family(name, help, Type::HISTOGRAM).histograms[labels];
+		if(series == nullptr){
+			series = make_unique<Histogram>(bounds);
+		}
+
+		return *series;
+	}
+
+	// buckets from 1ms to about 100s, for durations in seconds
+	static vector<double> durationBuckets(){
+		return {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 25.0, 50.0, 100.0};
+	}
+
+	// shortest representation that parses back to the same double
+	static string formatValue(double value){
+		if(std::isinf(value)) return value > 0.0 ? "+Inf" : "-Inf";
+		if(std::isnan(value)) return "NaN";
+
+		char buffer[64];
+		auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+
+		return string(buffer, result.ptr);
+	}
+
+	static string seriesName(string name, string labels, string extraLabel = ""){
+		string all = labels;
+
+		if(!extraLabel.empty()){
+			all = all.empty() ? extraLabel : all + "," + extraLabel;
+		}
+
+		return all.empty() ? name : name + "{" + all + "}";
+	}
+
+	static string toPrometheusText(){
+
+		{ // process metrics
+			auto memory = getMemoryData();
+
+			gauge("process_resident_memory_bytes", "Resident memory size in bytes").set(double(memory.physical_usedByProcess));
+			gauge("cudalod_uptime_seconds", "Seconds since metrics were first used").set(now() - instance()->startTime);
+		}
+
+		Metrics* metrics = instance();
+		lock_guard<mutex> lock(metrics->mtx);
+
+		stringstream ss;
+
+		for(auto& [name, family] : metrics->families){
+
+			string type = "counter";
+			if(family.type == Type::GAUGE) type = "gauge";
+			if(family.type == Type::HISTOGRAM) type = "histogram";
+
+			ss << "# HELP " << name << " " << family.help << "\n";
+			ss << "# TYPE " << name << " " << type << "\n";
+
+			for(auto& [labels, counter] : family.counters){
+				ss << seriesName(name, labels) << " " << formatValue(counter->value.load(memory_order_relaxed)) << "\n";
+			}
+
+			for(auto& [labels, gauge] : family.gauges){
+				ss << seriesName(name, labels) << " " << formatValue(gauge->value.load(memory_order_relaxed)) << "\n";
+			}
+
+			for(auto& [labels, histogram] : family.histograms){
+				uint64_t cumulative = 0;
+
+				int64_t numBounds = histogram->bounds.size();
+
+				for(int64_t i = 0; i <= numBounds; i++){
+					cumulative += histogram->buckets[i].load(memory_order_relaxed);
+
+					double bound = i < numBounds ? histogram->bounds[i] : INFINITY;
+					string le = "le=\"" + formatValue(bound) + "\"";
+
+					ss << seriesName(name + "_bucket", labels, le) << " " << cumulative << "\n";
+				}
+
+				ss << seriesName(name + "_sum", labels) << " " << formatValue(histogram->sum.load(memory_order_relaxed)) << "\n";
+				ss << seriesName(name + "_count", labels) << " " << histogram->count.load(memory_order_relaxed) << "\n";
+			}
+		}
+
+		return ss.str();
+	}
+
+	// written to <path>.tmp and renamed, returns false if the file couldn't be written
+	static bool writeFile(string path){
+
+		string text = toPrometheusText();
+		string tmpPath = path + ".tmp";
+
+		ofstream fout(tmpPath, ios::out | ios::binary | ios::trunc);
+		fout << text;
+		fout.close();
+
+		if(fout.fail()){
+			cout << "WARNING: failed to write metrics to " << path << endl;
+
+			return false;
+		}
+
+		std::error_code ec;
+		fs::rename(tmpPath, path, ec);
+
+		if(ec){
+			cout << "WARNING: failed to write metrics to " << path << ": " << ec.message() << endl;
+
+			return false;
+		}
+
+		return true;
+	}
+
+	// writes all metrics to <path> every <interval> seconds, until stopWriter()
+	static void startWriter(string path, double interval = 5.0){
+		Metrics* metrics = instance();
+
+		stopWriter();
+
+		{
+			lock_guard<mutex> lock(metrics->mtx_writer);
+			metrics->writerStopped = false;
+			metrics->writerPath = path;
+		}
+
+		metrics->writer = thread([metrics, path, interval](){
+			auto period = chrono::duration<double>(interval);
+
+			unique_lock<mutex> lock(metrics->mtx_writer);
+
+			while(!metrics->writerStopped){
+				lock.unlock();
+				writeFile(path);
+				lock.lock();
+
+				metrics->cv_writer.wait_for(lock, period, [metrics](){
+					return metrics->writerStopped;
+				});
+			}
+		});
+	}
+
+	// stops the writer after a final write, so the file holds the totals of the build
+	static void stopWriter(){
+		Metrics* metrics = instance();
+
+		if(!metrics->writer.joinable()) return;
+
+		{
+			lock_guard<mutex> lock(metrics->mtx_writer);
+			metrics->writerStopped = true;
+		}
+
+		metrics->cv_writer.notify_all();
+		metrics->writer.join();
+
+		writeFile(metrics->writerPath);
+	}
+
+};
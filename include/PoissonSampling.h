@@ -0,0 +1,219 @@
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <tuple>
+#include <unordered_map>
+
+#include "HashSampling.h"
+#include "simlod/sampling_cuda_nonprogressive/poisson_policy.h"
+
+using namespace std;
+
+// CPU counterpart of the POISSON_DISK strategy in
+// modules/simlod/sampling_cuda_nonprogressive/voxelize_poisson_blockwise.cu.
+//
+// Selects a blue-noise subset of the points or voxels of a node's children in which no two samples are
+// closer than PoissonPolicy::radius(). Samples keep their original positions instead of being snapped to
+// the 128³ cell grid, which avoids the grid aliasing of the other strategies and needs fewer samples
+// for the same coverage. See poisson_policy.h for the spatial hash and the 27 conflict-free phases.
+// Each phase is processed in parallel without locks. Unlike on the GPU, the result is sorted by cell key.
+struct PoissonSampling{
+
+	using Point = HashSampling::Point;
+	using Child = HashSampling::Child;
+	using Node = HashSampling::Node;
+
+	PoissonPolicy policy;
+	uint32_t seed = 0;
+	int numThreads = 1;
+
+	PoissonSampling(PoissonPolicy policy, uint32_t seed, int numThreads){
+		this->policy = policy;
+		this->seed = seed;
+		this->numThreads = std::max(numThreads, 1);
+	}
+
+	struct Candidate{
+		uint64_t cellKey;
+		uint64_t priority;
+		Point point;
+		const AttributeChannels* attributes;
+		int64_t index;
+	};
+
+	struct Cell{
+		int64_t firstCandidate = 0;
+		int64_t numCandidates = 0;
+		int ix = 0;
+		int iy = 0;
+		int iz = 0;
+		int64_t accepted = -1; // index of the accepted candidate, relative to firstCandidate
+	};
+
+	// <attributes>, if given, receives the attributes in <node.attributeMask> of the selected points or voxels.
+	// They aren't averaged, samples keep their positions and their own attributes.
+	vector<Point> select(const Node& node, AttributeChannels* attributes = nullptr){
+
+		double nodeSize = std::max(std::max(node.max[0] - node.min[0], node.max[1] - node.min[1]), node.max[2] - node.min[2]);
+		double radius = policy.radius(nodeSize, HashSampling::GRID_SIZE);
+		double radiusSquared = radius * radius;
+		double cellSize = policy.cellSize(radius);
+		int maxCell = policy.maxCell(nodeSize, cellSize);
+
+		// CANDIDATES, with keys like those of HashSampling
+		vector<Candidate> candidates;
+		for(uint32_t childIndex = 0; childIndex < 8; childIndex++){
+			const Child& child = node.children[childIndex];
+
+			for(auto [points, numPoints, channels] : {
+				tuple(child.points, child.numPoints, child.pointAttributes),
+				tuple(child.voxels, child.numVoxels, child.voxelAttributes)
+			}){
+				for(int64_t i = 0; i < numPoints; i++){
+					const Point& point = points[i];
+
+					int ix = policy.toCell(point.x, node.min[0], cellSize, maxCell);
+					int iy = policy.toCell(point.y, node.min[1], cellSize, maxCell);
+					int iz = policy.toCell(point.z, node.min[2], cellSize, maxCell);
+					uint64_t hash = sample_hash::hashPoint(point.x, point.y, point.z, point.color, seed);
+
+					Candidate candidate;
+					candidate.cellKey = policy.keyOf(ix, iy, iz);
+					candidate.priority = sample_hash::toKey(hash, childIndex, i);
+					candidate.point = point;
+					candidate.attributes = channels;
+					candidate.index = i;
+
+					candidates.push_back(candidate);
+				}
+			}
+		}
+
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b){
+			if(a.cellKey != b.cellKey) return a.cellKey < b.cellKey;
+
+			return a.priority < b.priority;
+		});
+
+		// SPATIAL HASH
+		vector<Cell> cells;
+		unordered_map<uint64_t, int64_t> cellIndices;
+		vector<int64_t> phases[PoissonPolicy::NUM_PHASES];
+
+		uint64_t cellMask = (1ull << PoissonPolicy::KEY_BITS) - 1;
+
+		for(int64_t i = 0; i < int64_t(candidates.size()); i++){
+			if(cells.size() > 0 && candidates[i].cellKey == candidates[cells.back().firstCandidate].cellKey){
+				cells.back().numCandidates++;
+
+				continue;
+			}
+
+			uint64_t key = candidates[i].cellKey;
+
+			Cell cell;
+			cell.firstCandidate = i;
+			cell.numCandidates = 1;
+			cell.ix = (key >> 0) & cellMask;
+			cell.iy = (key >> PoissonPolicy::KEY_BITS) & cellMask;
+			cell.iz = (key >> (2 * PoissonPolicy::KEY_BITS)) & cellMask;
+
+			phases[policy.phaseOf(cell.ix, cell.iy, cell.iz)].push_back(cells.size());
+			cellIndices[key] = cells.size();
+
+			cells.push_back(cell);
+		}
+
+		// PHASES
+		auto conflicts = [&](const Point& point, const Cell& cell){
+			for(int dz = -2; dz <= 2; dz++)
+			for(int dy = -2; dy <= 2; dy++)
+			for(int dx = -2; dx <= 2; dx++){
+				int nx = cell.ix + dx;
+				int ny = cell.iy + dy;
+				int nz = cell.iz + dz;
+
+				if(nx < 0 || ny < 0 || nz < 0) continue;
+				if(nx > maxCell || ny > maxCell || nz > maxCell) continue;
+				if(dx == 0 && dy == 0 && dz == 0) continue;
+
+				auto it = cellIndices.find(policy.keyOf(nx, ny, nz));
+				if(it == cellIndices.end()) continue;
+
+				const Cell& neighbor = cells[it->second];
+				if(neighbor.accepted < 0) continue;
+
+				const Point& sample = candidates[neighbor.firstCandidate + neighbor.accepted].point;
+				double ddx = double(point.x) - double(sample.x);
+				double ddy = double(point.y) - double(sample.y);
+				double ddz = double(point.z) - double(sample.z);
+
+				if(ddx * ddx + ddy * ddy + ddz * ddz < radiusSquared){
+					return true;
+				}
+			}
+
+			return false;
+		};
+
+		for(auto& phase : phases){
+			HashSampling::parallelRange(phase.size(), numThreads, [&](int64_t first, int64_t last, int){
+				for(int64_t i = first; i < last; i++){
+					Cell& cell = cells[phase[i]];
+
+					for(int64_t j = 0; j < cell.numCandidates; j++){
+						if(!conflicts(candidates[cell.firstCandidate + j].point, cell)){
+							cell.accepted = j;
+
+							break;
+						}
+					}
+				}
+			});
+		}
+
+		// SAMPLES, in cell order
+		vector<Point> samples;
+		for(auto& cell : cells){
+			if(cell.accepted >= 0){
+				samples.push_back(candidates[cell.firstCandidate + cell.accepted].point);
+			}
+		}
+
+		if(attributes != nullptr){
+			*attributes = AttributeChannels(node.attributeMask, samples.size());
+
+			int64_t sampleIndex = 0;
+			for(auto& cell : cells){
+				if(cell.accepted < 0) continue;
+
+				const Candidate& sample = candidates[cell.firstCandidate + cell.accepted];
+
+				if(sample.attributes != nullptr){
+					attributes->copy(sampleIndex, *sample.attributes, sample.index);
+				}
+
+				sampleIndex++;
+			}
+		}
+
+		return samples;
+	}
+
+	// HashSampling::voxelize() with Poisson-disk samples
+	template<class TreeNode>
+	static vector<shared_ptr<Buffer>> voxelize(TreeNode* root, PoissonPolicy policy, uint32_t seed, int numThreads){
+
+		// nodes are processed concurrently, one thread each
+		PoissonSampling sampling(policy, seed, 1);
+
+		return HashSampling::voxelizeWith(root, numThreads, [&sampling](const Node& node, AttributeChannels* attributes){
+			return sampling.select(node, attributes);
+		});
+	}
+
+};
@@ -18,10 +18,11 @@
 // progressively load a file into an OpenGL buffer (or multiple, if large).
 // main thread must call process() each frame to ensure that data loaded from file 
 // by a separate thread gets sent to the GPU in the main thread.
+// GL buffers are created once the first batch for them arrives, rather than for the whole file up front.
 struct ProgressiveFileBuffer{
 
 	struct BufferTask{
-		GLuint handle = -1;
+		int bufferIndex = 0;
 		shared_ptr<Buffer> buffer = nullptr;
 		int64_t byteOffset = 0;
 		int64_t byteSize = 0;
@@ -47,7 +48,19 @@ struct ProgressiveFileBuffer{
 
 		// should be thread safe if read and assignment are individually atomic... are they?
 		if(this->task != nullptr){
-			glNamedBufferSubData(task->handle, task->byteOffset, task->byteSize, task->buffer->data);
+
+			while(int64_t(glBuffers.size()) <= task->bufferIndex){
+				int64_t remaining = fileSize - int64_t(glBuffers.size()) * MAX_BUFFER_SIZE;
+				int64_t bufferSize = std::min(remaining, MAX_BUFFER_SIZE);
+
+				GLuint ssbo;
+				glCreateBuffers(1, &ssbo);
+				glNamedBufferStorage(ssbo, bufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+				glBuffers.push_back(ssbo);
+			}
+
+			glNamedBufferSubData(glBuffers[task->bufferIndex], task->byteOffset, task->byteSize, task->buffer->data);
 
 			this->size = max(this->size, task->totalBytesRead);
 			this->task = nullptr;
@@ -61,21 +74,6 @@ struct ProgressiveFileBuffer{
 		int64_t fileSize = fs::file_size(path);
 		loader->fileSize = fileSize;
 
-		{// initialize gpu memory
-			int64_t remaining = fileSize;
-			while(remaining > 0){
-				int64_t bufferSize = std::min(remaining, MAX_BUFFER_SIZE);
-
-				GLuint ssbo;
-				glCreateBuffers(1, &ssbo);
-				glNamedBufferStorage(ssbo, bufferSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
-
-				loader->glBuffers.push_back(ssbo);
-
-				remaining -= bufferSize;
-			}
-		}
-
 		// start thread that fills gpu memory
 		thread t([loader, path, fileSize](){
 			
@@ -96,10 +94,9 @@ struct ProgressiveFileBuffer{
 				readBinaryFile(path, byteOffset , batchSize, target->data);
 				
 				int targetBufferIndex = byteOffset / MAX_BUFFER_SIZE;
-				GLuint targetBufferHandle = loader->glBuffers[targetBufferIndex];
 
 				auto task = make_shared<BufferTask>();
-				task->handle = targetBufferHandle;
+				task->bufferIndex = targetBufferIndex;
 				task->byteOffset = byteOffset % MAX_BUFFER_SIZE;
 				task->byteSize = batchSize;
 				task->buffer = target;
@@ -0,0 +1,258 @@
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <set>
+#include <tuple>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// Decides which nodes of a data set stay in memory, within a budget of bytes.
+// The cache only does the bookkeeping, the owner holds the data and loads or frees it when told to.
+//
+// - each frame, the owner request()s the nodes it needs, e.g. the visible ones. Resident nodes are hits
+//   and stay pinned until unpinAll(). Others are misses that the owner fetches, and then insert()s.
+//   Inserted nodes are pinned as well, so that they aren't evicted before the next frame requests them.
+// - misses are only granted while the pinned and pending nodes fit into the budget, so the most important
+//   nodes should be requested first. Otherwise, the request is DEFERRED and may be retried later.
+// - inserting a node evicts unpinned nodes until the budget holds again, by least recent use or by
+//   lowest priority. onEvict is called for each, from the thread that calls insert() or setBudget(),
+//   after the cache released its mutex. It must free the node's data. Since the cache isn't locked
+//   anymore, it may take the owner's locks, even if the owner holds them while it calls the cache.
+// - requests that are no longer needed before the data arrives can be cancel()ed.
+struct ResidencyCache{
+
+	enum class Eviction{
+		LRU,
+		PRIORITY,
+	};
+
+	enum class Status{
+		RESIDENT,
+		PENDING,
+		MISS,     // granted, the owner should fetch the node
+		DEFERRED, // doesn't fit next to the pinned and pending nodes
+	};
+
+	struct Stats{
+		int64_t hits = 0;
+		int64_t misses = 0;
+		int64_t evictions = 0;
+		int64_t numResident = 0;
+		int64_t bytesResident = 0;
+		int64_t bytesPinned = 0;
+		int64_t bytesPending = 0;
+		int64_t peakBytesResident = 0;
+	};
+
+	// (priority, lastUsed, id), ordered by what is evicted first
+	using EvictionKey = tuple<double, int64_t, int64_t>;
+
+	struct Entry{
+		Status status = Status::PENDING;
+		int64_t byteSize = 0;
+		double priority = 0.0;
+		int64_t lastUsed = 0;
+		bool pinned = false;
+		EvictionKey key;
+	};
+
+	int64_t budget = 0;
+	Eviction eviction = Eviction::LRU;
+	function<void(int64_t id)> onEvict;
+
+	mutex mtx;
+	unordered_map<int64_t, Entry> entries;
+	set<EvictionKey> candidates;  // resident and unpinned
+	vector<int64_t> pinnedIDs;
+	int64_t clock = 0;
+	Stats stats;
+
+	ResidencyCache(int64_t budget = 0, Eviction eviction = Eviction::LRU){
+		this->budget = budget;
+		this->eviction = eviction;
+	}
+
+	EvictionKey keyOf(int64_t id, Entry& entry){
+		double priority = eviction == Eviction::PRIORITY ? entry.priority : 0.0;
+
+		return {priority, entry.lastUsed, id};
+	}
+
+	// <priority> matters for Eviction::PRIORITY, higher priorities are kept longer.
+	// <byteSize> is the expected size of a missing node.
+	Status request(int64_t id, double priority, int64_t byteSize){
+		lock_guard<mutex> lock(mtx);
+
+		clock++;
+
+		auto it = entries.find(id);
+
+		if(it == entries.end()){
+			if(stats.bytesPinned + stats.bytesPending + byteSize > budget){
+				return Status::DEFERRED;
+			}
+
+			Entry entry;
+			entry.status = Status::PENDING;
+			entry.byteSize = byteSize;
+			entry.priority = priority;
+			entry.lastUsed = clock;
+
+			entries[id] = entry;
+
+			stats.misses++;
+			stats.bytesPending += byteSize;
+
+			return Status::MISS;
+		}
+
+		Entry& entry = it->second;
+
+		if(entry.status == Status::PENDING){
+			entry.priority = priority;
+
+			return Status::PENDING;
+		}
+
+		stats.hits++;
+
+		if(!entry.pinned){
+			candidates.erase(entry.key);
+
+			entry.pinned = true;
+			pinnedIDs.push_back(id);
+			stats.bytesPinned += entry.byteSize;
+		}
+
+		entry.priority = priority;
+		entry.lastUsed = clock;
+
+		return Status::RESIDENT;
+	}
+
+	// the data of a pending node arrived
+	void insert(int64_t id, int64_t byteSize){
+		unique_lock<mutex> lock(mtx);
+
+		auto it = entries.find(id);
+
+		if(it == entries.end() || it->second.status != Status::PENDING){
+			cout << "WARNING: ResidencyCache::insert() of a node that wasn't requested: " << id << endl;
+
+			return;
+		}
+
+		Entry& entry = it->second;
+
+		stats.bytesPending -= entry.byteSize;
+
+		entry.status = Status::RESIDENT;
+		entry.byteSize = byteSize;
+		entry.pinned = true;
+		pinnedIDs.push_back(id);
+
+		stats.bytesPinned += byteSize;
+		stats.numResident++;
+		stats.bytesResident += byteSize;
+		stats.peakBytesResident = std::max(stats.peakBytesResident, stats.bytesResident);
+
+		vector<int64_t> evicted = evictToBudget();
+
+		lock.unlock();
+
+		notifyEvicted(evicted);
+	}
+
+	// a pending node won't be fetched after all
+	void cancel(int64_t id){
+		lock_guard<mutex> lock(mtx);
+
+		auto it = entries.find(id);
+
+		if(it == entries.end() || it->second.status != Status::PENDING) return;
+
+		stats.bytesPending -= it->second.byteSize;
+		entries.erase(it);
+	}
+
+	// makes all nodes that were requested since the last call evictable again
+	void unpinAll(){
+		lock_guard<mutex> lock(mtx);
+
+		for(int64_t id : pinnedIDs){
+			Entry& entry = entries[id];
+
+			entry.pinned = false;
+			entry.key = keyOf(id, entry);
+			candidates.insert(entry.key);
+
+			stats.bytesPinned -= entry.byteSize;
+		}
+
+		pinnedIDs.clear();
+	}
+
+	void setBudget(int64_t budget){
+		unique_lock<mutex> lock(mtx);
+
+		this->budget = budget;
+
+		vector<int64_t> evicted = evictToBudget();
+
+		lock.unlock();
+
+		notifyEvicted(evicted);
+	}
+
+	// mtx must be held. Returns the evicted ids, pass them to notifyEvicted() once mtx is released.
+	vector<int64_t> evictToBudget(){
+		vector<int64_t> evicted;
+
+		while(stats.bytesResident > budget && !candidates.empty()){
+			int64_t id = get<2>(*candidates.begin());
+			candidates.erase(candidates.begin());
+
+			Entry& entry = entries[id];
+
+			stats.evictions++;
+			stats.numResident--;
+			stats.bytesResident -= entry.byteSize;
+
+			entries.erase(id);
+
+			evicted.push_back(id);
+		}
+
+		return evicted;
+	}
+
+	// mtx must not be held
+	void notifyEvicted(const vector<int64_t>& evicted){
+		if(!onEvict) return;
+
+		for(int64_t id : evicted){
+			onEvict(id);
+		}
+	}
+
+	bool isResident(int64_t id){
+		lock_guard<mutex> lock(mtx);
+
+		auto it = entries.find(id);
+
+		return it != entries.end() && it->second.status == Status::RESIDENT;
+	}
+
+	Stats getStats(){
+		lock_guard<mutex> lock(mtx);
+
+		return stats;
+	}
+
+};
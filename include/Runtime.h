@@ -11,6 +11,10 @@
 #include "compute/Resources.h"
 
 #include "compute/LasLoaderSparse.h"
+#include "simlod/sampling_cuda_nonprogressive/split_policy.h"
+#include "simlod/sampling_cuda_nonprogressive/dedup_policy.h"
+#include "simlod/sampling_cuda_nonprogressive/compact_input.h"
+#include "simlod/sampling_cuda_nonprogressive/poisson_policy.h"
 
 using namespace std;
 
@@ -36,6 +40,11 @@ struct Runtime{
 	inline static shared_ptr<LasLoaderSparse> lasLoaderSparse = nullptr;
 	inline static vector<GuiItem> guiItems;
 	inline static int samplingStrategy = 0;
+	inline static uint32_t samplingSeed = 0;
+	inline static SplitPolicy splitPolicy;
+	inline static DedupPolicy dedupPolicy;
+	inline static CompactInput compactInput; // format and bitsPerAxis of the split input
+	inline static PoissonPolicy poissonPolicy; // minimum sample distance of the POISSON_DISK strategy
 	inline static bool requestLodGeneration = false;
 	inline static float LOD = 0.95f;
 
@@ -0,0 +1,327 @@
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <cstdint>
+#include <new>
+
+using namespace std;
+
+// platform specific, see unsuck_platform_specific.cpp.
+// Named shared memory that other processes map under the same <name>. With <create>, a new segment
+// of <size> bytes is created and fails if it exists. Otherwise, <size> is set to the size of the existing segment.
+void* mapSharedMemory(string name, int64_t& size, bool create, void*& handle);
+void unmapSharedMemory(void* data, int64_t size, void* handle);
+void removeSharedMemory(string name);
+int64_t getProcessId();
+bool isProcessRunning(int64_t pid);
+
+// Single-producer, single-consumer ring of fixed-size slots in shared memory, to hand batches
+// between processes without serializing or copying them.
+//
+// The producer acquire()s a free slot, writes a batch directly into it, e.g. with LasLoader::loadInto(),
+// and publish()es it. The consumer gets the next published slot with next(), reads it in place
+// and release()s it for reuse. Both sides only advance their own index, so no locks are involved.
+//
+//     // process A
+//     auto ring = SharedRing::create("cudalod_batches", 8, 32 * 1'000'000);
+//     uint8_t* target = ring->acquire();
+//     int64_t numPoints = LasLoader::loadInto(path, firstPoint, ring->slotSize / 32, target);
+//     ring->publish(32 * numPoints, numPoints);
+//     ring->close();
+//     ring->waitForOpener(); // before the ring is destroyed
+//
+//     // process B
+//     auto ring = SharedRing::open("cudalod_batches");
+//     SharedRing::Slot slot;
+//     while(ring->next(slot)){
+//         ...
+//         ring->release();
+//     }
+//     if(ring->peerLost) ...
+//
+// Waiting sides spin briefly, then sleep in short intervals. A wait fails if the other process exited,
+// or if none opened the ring within <attachTimeout> seconds. acquire() then returns nullptr,
+// next() returns false, and <peerLost> is set. The creator removes the segment's name once
+// it's destroyed, the memory is freed when the last process unmaps it. A ring that is destroyed
+// before the other process opened it can't be opened anymore, so either the opener has to attach
+// first, or the creator waits for it with waitForOpener() before it destroys the ring.
+struct SharedRing{
+
+	static constexpr uint32_t MAGIC = 0x474e5253; // "SRNG"
+	static constexpr uint32_t VERSION = 2;
+	static constexpr int64_t PAGE_SIZE = 4096;
+
+	static_assert(atomic<uint64_t>::is_always_lock_free, "shared atomics must not rely on process-local locks");
+
+	// at the start of the segment. The indices count slots since creation and are on separate cache lines,
+	// so producer and consumer don't invalidate each other's line with every update.
+	// <magic> is stored last, once the other fields are valid.
+	struct Header{
+		atomic<uint32_t> magic = 0;
+		uint32_t version = VERSION;
+		int64_t numSlots = 0;
+		int64_t slotSize = 0;
+		int64_t dataOffset = 0;
+
+		// process ids, 0 until the other process opened the ring
+		atomic<uint64_t> creatorPid = 0;
+		atomic<uint64_t> openerPid = 0;
+
+		alignas(64) atomic<uint64_t> head = 0; // published by the producer
+		alignas(64) atomic<uint64_t> tail = 0; // released by the consumer
+		alignas(64) atomic<uint32_t> closed = 0;
+	};
+
+	struct SlotInfo{
+		int64_t size = 0;
+		uint64_t tag = 0;
+	};
+
+	// a published batch, valid until release()
+	struct Slot{
+		uint8_t* data = nullptr;
+		int64_t size = 0;
+		uint64_t tag = 0;
+	};
+
+	string name = "";
+	bool isOwner = false;
+	void* handle = nullptr;
+	uint8_t* memory = nullptr;
+	int64_t memorySize = 0;
+
+	Header* header = nullptr;
+	SlotInfo* infos = nullptr;
+	int64_t numSlots = 0;
+	int64_t slotSize = 0;
+
+	double attachTimeout = 30.0;
+	bool peerLost = false;
+
+	SharedRing() = default;
+	SharedRing(const SharedRing&) = delete;
+	SharedRing& operator=(const SharedRing&) = delete;
+
+	~SharedRing(){
+		if(memory != nullptr){
+			unmapSharedMemory(memory, memorySize, handle);
+		}
+
+		if(isOwner){
+			removeSharedMemory(name);
+		}
+	}
+
+	static int64_t roundUp(int64_t value, int64_t alignment){
+		return ((value + alignment - 1) / alignment) * alignment;
+	}
+
+	uint8_t* slotData(uint64_t index){
+		return memory + header->dataOffset + int64_t(index % numSlots) * slotSize;
+	}
+
+	// slots of at least <slotSize> bytes, rounded up to pages. nullptr if the segment can't be created.
+	static shared_ptr<SharedRing> create(string name, int64_t numSlots, int64_t slotSize){
+
+		slotSize = roundUp(std::max(slotSize, int64_t(1)), PAGE_SIZE);
+		numSlots = std::max(numSlots, int64_t(1));
+
+		int64_t dataOffset = roundUp(sizeof(Header) + numSlots * sizeof(SlotInfo), PAGE_SIZE);
+		int64_t size = dataOffset + numSlots * slotSize;
+
+		void* handle = nullptr;
+		void* data = mapSharedMemory(name, size, true, handle);
+
+		if(data == nullptr){
+			cout << "ERROR: failed to create shared memory " << name << endl;
+			return nullptr;
+		}
+
+		auto ring = make_shared<SharedRing>();
+		ring->name = name;
+		ring->isOwner = true;
+		ring->handle = handle;
+		ring->memory = reinterpret_cast<uint8_t*>(data);
+		ring->memorySize = size;
+		ring->numSlots = numSlots;
+		ring->slotSize = slotSize;
+
+		ring->header = new (data) Header();
+		ring->header->numSlots = numSlots;
+		ring->header->slotSize = slotSize;
+		ring->header->dataOffset = dataOffset;
+		ring->header->creatorPid.store(getProcessId(), memory_order_relaxed);
+
+		ring->infos = reinterpret_cast<SlotInfo*>(ring->memory + sizeof(Header));
+
+		ring->header->magic.store(MAGIC, memory_order_release);
+
+		return ring;
+	}
+
+	// ring of another process, nullptr if there is none with that name
+	static shared_ptr<SharedRing> open(string name){
+
+		int64_t size = 0;
+		void* handle = nullptr;
+		void* data = mapSharedMemory(name, size, false, handle);
+
+		if(data == nullptr){
+			cout << "ERROR: failed to open shared memory " << name << endl;
+			return nullptr;
+		}
+
+		auto ring = make_shared<SharedRing>();
+		ring->name = name;
+		ring->handle = handle;
+		ring->memory = reinterpret_cast<uint8_t*>(data);
+		ring->memorySize = size;
+		ring->header = reinterpret_cast<Header*>(data);
+
+		Header* header = ring->header;
+		bool valid = size >= int64_t(sizeof(Header));
+
+		// the creator may still be initializing the header
+		auto tStart = chrono::steady_clock::now();
+		while(valid && header->magic.load(memory_order_acquire) != MAGIC){
+			double waited = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+
+			if(waited > 1.0){
+				valid = false;
+			}else{
+				std::this_thread::sleep_for(chrono::microseconds(20));
+			}
+		}
+
+		valid = valid
+			&& header->version == VERSION
+			&& header->dataOffset + header->numSlots * header->slotSize <= size;
+
+		if(!valid){
+			cout << "ERROR: " << name << " is not a shared ring of this version" << endl;
+			return nullptr;
+		}
+
+		ring->numSlots = header->numSlots;
+		ring->slotSize = header->slotSize;
+		ring->infos = reinterpret_cast<SlotInfo*>(ring->memory + sizeof(Header));
+
+		header->openerPid.store(getProcessId(), memory_order_release);
+
+		return ring;
+	}
+
+	// whether the other process is still there, or may still open the ring
+	bool isPeerAlive(double waited){
+		uint64_t pid = isOwner ? header->openerPid.load(memory_order_acquire) : header->creatorPid.load(memory_order_acquire);
+
+		if(pid == 0) return waited < attachTimeout;
+
+		return isProcessRunning(pid);
+	}
+
+	// waits until <ready> holds, false if the other process is gone
+	template<class Predicate>
+	bool waitFor(Predicate ready){
+		auto tStart = chrono::steady_clock::now();
+
+		for(int i = 0; !ready(); i++){
+			if(i < 64){
+				std::this_thread::yield();
+				continue;
+			}
+
+			std::this_thread::sleep_for(chrono::microseconds(20));
+
+			if(i % 256 != 0) continue;
+
+			double waited = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+
+			// it may have made progress before it exited
+			if(!isPeerAlive(waited) && !ready()){
+				cout << "ERROR: the other process of shared ring " << name << " is gone" << endl;
+				peerLost = true;
+
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// waits until the other process opened the ring, false if none did within <attachTimeout> seconds
+	bool waitForOpener(){
+		return waitFor([&](){
+			return header->openerPid.load(memory_order_acquire) != 0;
+		});
+	}
+
+	// PRODUCER
+
+	// next slot to write, waits until the consumer released it. nullptr if the consumer is gone.
+	uint8_t* acquire(){
+		uint64_t head = header->head.load(memory_order_relaxed);
+
+		bool free = waitFor([&](){
+			return head - header->tail.load(memory_order_acquire) < uint64_t(numSlots);
+		});
+
+		if(!free) return nullptr;
+
+		return slotData(head);
+	}
+
+	// makes the acquired slot with <size> bytes available to the consumer
+	void publish(int64_t size, uint64_t tag = 0){
+		uint64_t head = header->head.load(memory_order_relaxed);
+
+		infos[head % numSlots].size = size;
+		infos[head % numSlots].tag = tag;
+
+		header->head.store(head + 1, memory_order_release);
+	}
+
+	// no more slots will be published
+	void close(){
+		header->closed.store(1, memory_order_release);
+	}
+
+	// CONSUMER
+
+	// waits for the next published slot. false once the producer closed the ring and all slots were read,
+	// or if the producer is gone, see <peerLost>.
+	bool next(Slot& slot){
+		uint64_t tail = header->tail.load(memory_order_relaxed);
+		bool available = false;
+
+		waitFor([&](){
+			// closed is checked first, so slots published before close() are still seen
+			bool closed = header->closed.load(memory_order_acquire) != 0;
+			available = header->head.load(memory_order_acquire) > tail;
+
+			return available || closed;
+		});
+
+		if(!available) return false;
+
+		slot.data = slotData(tail);
+		slot.size = infos[tail % numSlots].size;
+		slot.tag = infos[tail % numSlots].tag;
+
+		return true;
+	}
+
+	// the slot returned by next() may be reused by the producer
+	void release(){
+		uint64_t tail = header->tail.load(memory_order_relaxed);
+
+		header->tail.store(tail + 1, memory_order_release);
+	}
+
+};
@@ -0,0 +1,427 @@
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+
+#include "glm/common.hpp"
+#include "glm/matrix.hpp"
+#include <glm/gtx/transform.hpp>
+
+#include "Box.h"
+#include "Frustum.h"
+
+using namespace std;
+using glm::dvec2;
+using glm::dvec3;
+
+// Shapes for SpatialQuery.
+// classify() tells whether a node's box is outside, partially inside or entirely inside the shape,
+// contains() tests individual points.
+
+enum class QueryRelation{
+	OUTSIDE,
+	INTERSECTS,
+	INSIDE,
+};
+
+struct QueryBox{
+
+	Box box;
+
+	QueryBox(dvec3 min, dvec3 max){
+		box.min = min;
+		box.max = max;
+	}
+
+	QueryRelation classify(const Box& node) const {
+		if(node.max.x < box.min.x || node.min.x > box.max.x) return QueryRelation::OUTSIDE;
+		if(node.max.y < box.min.y || node.min.y > box.max.y) return QueryRelation::OUTSIDE;
+		if(node.max.z < box.min.z || node.min.z > box.max.z) return QueryRelation::OUTSIDE;
+
+		bool inside_x = node.min.x >= box.min.x && node.max.x <= box.max.x;
+		bool inside_y = node.min.y >= box.min.y && node.max.y <= box.max.y;
+		bool inside_z = node.min.z >= box.min.z && node.max.z <= box.max.z;
+
+		return (inside_x && inside_y && inside_z) ? QueryRelation::INSIDE : QueryRelation::INTERSECTS;
+	}
+
+	bool contains(dvec3 point) const {
+		return point.x >= box.min.x && point.x <= box.max.x
+			&& point.y >= box.min.y && point.y <= box.max.y
+			&& point.z >= box.min.z && point.z <= box.max.z;
+	}
+};
+
+struct QuerySphere{
+
+	dvec3 center;
+	double radius = 0.0;
+
+	QuerySphere(dvec3 center, double radius){
+		this->center = center;
+		this->radius = radius;
+	}
+
+	QueryRelation classify(const Box& node) const {
+		dvec3 closest = glm::clamp(center, node.min, node.max);
+		dvec3 farthest = glm::max(glm::abs(center - node.min), glm::abs(center - node.max));
+
+		double rr = radius * radius;
+
+		if(glm::dot(closest - center, closest - center) > rr) return QueryRelation::OUTSIDE;
+		if(glm::dot(farthest, farthest) <= rr) return QueryRelation::INSIDE;
+
+		return QueryRelation::INTERSECTS;
+	}
+
+	bool contains(dvec3 point) const {
+		dvec3 d = point - center;
+
+		return glm::dot(d, d) <= radius * radius;
+	}
+};
+
+// vertical extrusion of a simple polygon in the xy plane, from minZ to maxZ
+struct QueryPrism{
+
+	vector<dvec2> polygon;
+	double minZ = 0.0;
+	double maxZ = 0.0;
+
+	dvec2 polygonMin = {Infinity, Infinity};
+	dvec2 polygonMax = {-Infinity, -Infinity};
+
+	QueryPrism(vector<dvec2> polygon, double minZ, double maxZ){
+		this->polygon = polygon;
+		this->minZ = minZ;
+		this->maxZ = maxZ;
+
+		for(dvec2 vertex : polygon){
+			polygonMin = glm::min(polygonMin, vertex);
+			polygonMax = glm::max(polygonMax, vertex);
+		}
+	}
+
+	// even-odd rule
+	bool containsXY(dvec2 point) const {
+		bool inside = false;
+
+		for(size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++){
+			dvec2 a = polygon[i];
+			dvec2 b = polygon[j];
+
+			if((a.y > point.y) != (b.y > point.y)){
+				double x = a.x + (point.y - a.y) * (b.x - a.x) / (b.y - a.y);
+
+				if(point.x < x) inside = !inside;
+			}
+		}
+
+		return inside;
+	}
+
+	// Liang-Barsky clipping of the segment ab against the rectangle
+	static bool segmentIntersectsRect(dvec2 a, dvec2 b, dvec2 min, dvec2 max){
+		double t0 = 0.0;
+		double t1 = 1.0;
+		dvec2 d = b - a;
+
+		double p[4] = {-d.x, d.x, -d.y, d.y};
+		double q[4] = {a.x - min.x, max.x - a.x, a.y - min.y, max.y - a.y};
+
+		for(int i = 0; i < 4; i++){
+			if(p[i] == 0.0){
+				if(q[i] < 0.0) return false;
+			}else{
+				double t = q[i] / p[i];
+
+				if(p[i] < 0.0){
+					t0 = std::max(t0, t);
+				}else{
+					t1 = std::min(t1, t);
+				}
+
+				if(t0 > t1) return false;
+			}
+		}
+
+		return true;
+	}
+
+	QueryRelation classify(const Box& node) const {
+		if(polygon.size() < 3) return QueryRelation::OUTSIDE;
+		if(node.max.z < minZ || node.min.z > maxZ) return QueryRelation::OUTSIDE;
+		if(node.max.x < polygonMin.x || node.min.x > polygonMax.x) return QueryRelation::OUTSIDE;
+		if(node.max.y < polygonMin.y || node.min.y > polygonMax.y) return QueryRelation::OUTSIDE;
+
+		dvec2 rectMin = {node.min.x, node.min.y};
+		dvec2 rectMax = {node.max.x, node.max.y};
+
+		for(size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++){
+			if(segmentIntersectsRect(polygon[j], polygon[i], rectMin, rectMax)){
+				return QueryRelation::INTERSECTS;
+			}
+		}
+
+		// no edge crosses the rectangle, so it's either entirely inside or entirely outside of the polygon
+		if(containsXY((rectMin + rectMax) * 0.5)){
+			bool inside_z = node.min.z >= minZ && node.max.z <= maxZ;
+
+			return inside_z ? QueryRelation::INSIDE : QueryRelation::INTERSECTS;
+		}
+
+		return QueryRelation::OUTSIDE;
+	}
+
+	bool contains(dvec3 point) const {
+		if(point.z < minZ || point.z > maxZ) return false;
+
+		return containsXY({point.x, point.y});
+	}
+};
+
+struct QueryFrustum{
+
+	Frustum frustum;
+
+	// e.g. proj * view
+	QueryFrustum(dmat4 viewProj){
+		frustum.set(viewProj);
+	}
+
+	QueryRelation classify(const Box& node) const {
+		QueryRelation relation = QueryRelation::INSIDE;
+
+		for(Plane plane : frustum.planes){
+
+			dvec3 positive = {
+				plane.normal.x > 0.0 ? node.max.x : node.min.x,
+				plane.normal.y > 0.0 ? node.max.y : node.min.y,
+				plane.normal.z > 0.0 ? node.max.z : node.min.z
+			};
+			dvec3 negative = {
+				plane.normal.x > 0.0 ? node.min.x : node.max.x,
+				plane.normal.y > 0.0 ? node.min.y : node.max.y,
+				plane.normal.z > 0.0 ? node.min.z : node.max.z
+			};
+
+			if(plane.distanceTo(positive) < 0.0) return QueryRelation::OUTSIDE;
+			if(plane.distanceTo(negative) < 0.0) relation = QueryRelation::INTERSECTS;
+		}
+
+		return relation;
+	}
+
+	bool contains(dvec3 point) const {
+		for(Plane plane : frustum.planes){
+			if(plane.distanceTo(point) < 0.0) return false;
+		}
+
+		return true;
+	}
+};
+
+// Queries over a built LOD hierarchy on the host, e.g. OctreeWriter::hostRoot().
+// Works with any node type that has the fields of CuNode:
+//     vec3 min, max;  int level;  Node* children[8];  int numPoints;  Point* points;  int numVoxels;  Point* voxels;
+//
+// A query returns the samples of a cut through the hierarchy: leaves return their points, and inner nodes
+// return their voxels once they satisfy the requested LOD. Traversal stops at inner nodes
+// - at Options::maxLevel, or
+// - whose voxel spacing, cubeSize / 128, is at most Options::spacing.
+// With the defaults, the full-resolution points are returned.
+//
+// The hierarchy is classified against the shape on the calling thread, which only visits nodes.
+// The points of the selected nodes are then filtered by <numThreads> threads, largest nodes first.
+// Points of nodes that are entirely inside the shape are passed on without tests or copies.
+// The callback receives chunks of at most <chunkSize> points, one call at a time, from the worker threads.
+template<class Node>
+struct SpatialQuery{
+
+	using Point = remove_pointer_t<decltype(Node::points)>;
+
+	static constexpr int VOXEL_GRID_SIZE = 128;
+
+	struct Options{
+		int maxLevel = 1'000;
+		double spacing = 0.0;
+		int64_t chunkSize = 65'536;
+		int numThreads = std::thread::hardware_concurrency();
+	};
+
+	struct Chunk{
+		const Point* points = nullptr;
+		int64_t numPoints = 0;
+	};
+
+	struct Selection{
+		const Node* node = nullptr;
+		bool voxels = false;
+		bool inside = false;
+
+		const Point* points() const { return voxels ? node->voxels : node->points; }
+		int64_t numPoints() const { return voxels ? node->numVoxels : node->numPoints; }
+	};
+
+	Node* root = nullptr;
+
+	SpatialQuery(Node* root){
+		this->root = root;
+	}
+
+	static bool isLeaf(const Node* node){
+		for(int i = 0; i < 8; i++){
+			if(node->children[i] != nullptr) return false;
+		}
+
+		return true;
+	}
+
+	template<class Shape>
+	void select(const Node* node, const Shape& shape, const Options& options, bool inside, vector<Selection>& selection){
+
+		QueryRelation relation = QueryRelation::INSIDE;
+		if(!inside){
+			Box box;
+			box.min = node->min;
+			box.max = node->max;
+
+			relation = shape.classify(box);
+		}
+
+		if(relation == QueryRelation::OUTSIDE) return;
+
+		inside = relation == QueryRelation::INSIDE;
+
+		if(isLeaf(node)){
+			selection.push_back({node, false, inside});
+
+			return;
+		}
+
+		double cubeSize = node->max.x - node->min.x;
+		bool reachedLevel = node->level >= options.maxLevel;
+		bool reachedSpacing = options.spacing > 0.0 && cubeSize / double(VOXEL_GRID_SIZE) <= options.spacing;
+
+		if(reachedLevel || reachedSpacing){
+			selection.push_back({node, true, inside});
+
+			return;
+		}
+
+		for(int i = 0; i < 8; i++){
+			if(node->children[i] == nullptr) continue;
+
+			select(node->children[i], shape, options, inside, selection);
+		}
+	}
+
+	template<class Shape>
+	void query(const Shape& shape, Options options, function<void(const Chunk&)> callback){
+
+		vector<Selection> selection;
+		select(root, shape, options, false, selection);
+
+		std::sort(selection.begin(), selection.end(), [](const Selection& a, const Selection& b){
+			return a.numPoints() > b.numPoints();
+		});
+
+		mutex mtx_callback;
+		atomic<int64_t> nextSelection = 0;
+		int64_t chunkSize = std::max(options.chunkSize, int64_t(1));
+
+		auto emit = [&](const Point* points, int64_t numPoints){
+			lock_guard<mutex> lock(mtx_callback);
+
+			Chunk chunk;
+			chunk.points = points;
+			chunk.numPoints = numPoints;
+
+			callback(chunk);
+		};
+
+		auto work = [&](){
+
+			vector<Point> filtered;
+			filtered.reserve(chunkSize);
+
+			while(true){
+				int64_t index = nextSelection.fetch_add(1);
+				if(index >= int64_t(selection.size())) break;
+
+				const Selection& selected = selection[index];
+				const Point* points = selected.points();
+				int64_t numPoints = selected.numPoints();
+
+				if(selected.inside){
+					for(int64_t first = 0; first < numPoints; first += chunkSize){
+						emit(points + first, std::min(chunkSize, numPoints - first));
+					}
+
+					continue;
+				}
+
+				for(int64_t i = 0; i < numPoints; i++){
+					const Point& point = points[i];
+
+					if(!shape.contains(dvec3(point.x, point.y, point.z))) continue;
+
+					filtered.push_back(point);
+
+					if(filtered.size() == chunkSize){
+						emit(filtered.data(), filtered.size());
+						filtered.clear();
+					}
+				}
+			}
+
+			if(filtered.size() > 0){
+				emit(filtered.data(), filtered.size());
+			}
+		};
+
+		int numThreads = std::max(options.numThreads, 1);
+		vector<thread> threads;
+		for(int i = 1; i < numThreads; i++){
+			threads.emplace_back(work);
+		}
+
+		work();
+
+		for(thread& t : threads){
+			t.join();
+		}
+	}
+
+	template<class Shape>
+	vector<Point> collect(const Shape& shape, Options options){
+
+		vector<Point> points;
+
+		query(shape, options, [&points](const Chunk& chunk){
+			points.insert(points.end(), chunk.points, chunk.points + chunk.numPoints);
+		});
+
+		return points;
+	}
+
+	// number of points in the shape, without copying them
+	template<class Shape>
+	int64_t count(const Shape& shape, Options options){
+
+		int64_t numPoints = 0;
+
+		query(shape, options, [&numPoints](const Chunk& chunk){
+			numPoints += chunk.numPoints;
+		});
+
+		return numPoints;
+	}
+
+};
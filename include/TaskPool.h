@@ -3,13 +3,19 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <deque>
 #include <vector>
 
+#include "Metrics.h"
+
 using namespace std;
 
 // might be better off using https://github.com/progschj/ThreadPool
+//
+// Idle threads sleep on a condition variable until tasks are added or the pool is closed.
+// Tasks may add further tasks to their own pool.
 template<class Task>
 class TaskPool {
 public:
@@ -23,6 +29,12 @@ public:
 	atomic<bool> isClosed = false;
 
 	mutex mtx_task;
+	condition_variable cv_task; // tasks added, or pool closed
+	condition_variable cv_idle; // no queued and no running tasks
+	int numRunning = 0;
+
+	// optional, tracks the number of queued tasks
+	Metrics::Gauge* queueDepth = nullptr;
 
 	TaskPool(int numThreads, TaskProcessorType processor) {
 		this->numThreads = numThreads;
@@ -37,27 +49,38 @@ public:
 					shared_ptr<Task> task = nullptr;
 
 					{ // retrieve task or leave thread if done
-						lock_guard<mutex> lock(mtx_task);
+						unique_lock<mutex> lock(mtx_task);
+
+						cv_task.wait(lock, [this]() {
+							return tasks.size() > 0 || isClosed;
+						});
 
-						bool allDone = tasks.size() == 0 && isClosed;
-						bool waitingForWork = tasks.size() == 0 && !allDone;
-						bool workAvailable = tasks.size() > 0;
+						bool allDone = tasks.size() == 0;
 
 						if (allDone) {
 							break;
-						} else if (workAvailable) {
-							task = tasks.front();
-							tasks.pop_front();
 						}
 
+						task = tasks.front();
+						tasks.pop_front();
+						numRunning++;
 
+						if (queueDepth != nullptr) {
+							queueDepth->set(double(tasks.size()));
+						}
 					}
 
-					if (task != nullptr) {
-						this->processor(task);
-					}
+					this->processor(task);
 
-					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					{
+						lock_guard<mutex> lock(mtx_task);
+
+						numRunning--;
+
+						if (tasks.size() == 0 && numRunning == 0) {
+							cv_idle.notify_all();
+						}
+					}
 				}
 
 				});
@@ -66,40 +89,42 @@ public:
 	}
 
 	void addTask(shared_ptr<Task> t) {
-		lock_guard<mutex> lock(mtx_task);
+		{
+			lock_guard<mutex> lock(mtx_task);
+
+			tasks.push_back(t);
+
+			if (queueDepth != nullptr) {
+				queueDepth->set(double(tasks.size()));
+			}
+		}
 
-		tasks.push_back(t);
+		cv_task.notify_one();
 	}
 
 	void close() {
-		isClosed = true;
+		{
+			lock_guard<mutex> lock(mtx_task);
+
+			isClosed = true;
+		}
+
+		cv_task.notify_all();
 
 		for (thread& t : threads) {
 			t.join();
 		}
 	}
 
+	// waits until all tasks, including those added by running tasks, are done
 	void waitTillEmpty() {
 
-		while (true) {
-
-			int size = 0;
+		unique_lock<mutex> lock(mtx_task);
 
-			{
-				lock_guard<mutex> lock(mtx_task);
-
-				size = tasks.size();
-			}
-
-			if (size == 0) {
-				return;
-			} else {
-				std::this_thread::sleep_for(std::chrono::milliseconds(10));
-			}
-
-		}
+		cv_idle.wait(lock, [this]() {
+			return tasks.size() == 0 && numRunning == 0;
+		});
 
 	}
 
 };
-
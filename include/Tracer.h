@@ -0,0 +1,400 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// Low-overhead CPU tracing with Chrome trace export, viewable in https://ui.perfetto.dev or chrome://tracing.
+//
+// - each thread records into its own fixed-size ring buffer, no locks on the hot path.
+//   Once a buffer is full, the oldest events of that thread are overwritten.
+// - ring buffers are pooled. When a thread exits, its ring goes back to the pool, keeping its events,
+//   and the next thread that starts tracing continues writing into it. Memory is bounded by the
+//   number of threads that trace at the same time, not by how many threads were ever spawned.
+// - zones are RAII objects that record a single complete event when they go out of scope:
+//
+//       auto zone = Tracer::zone("split");
+//
+// - counters record a value over time, e.g. points loaded or bytes written.
+//   increment() turns deltas from several threads into a running total.
+// - names must outlive the tracer, i.e. string literals. Use Tracer::intern() for dynamic names.
+// - disabled by default. A disabled tracer costs one relaxed atomic load per zone.
+// - export while other threads are still tracing may miss their most recent events. Events that
+//   are overwritten while they are copied are detected through the ring's write counter and dropped.
+struct Tracer{
+
+	enum class EventType : uint8_t {
+		ZONE = 0,
+		COUNTER = 1,
+	};
+
+	struct Event{
+		const char* name = nullptr;
+		uint64_t start = 0;     // nanoseconds since the tracer was created
+		uint64_t duration = 0;  // zones only
+		double value = 0.0;     // counters only
+		uint32_t threadIndex = 0;
+		EventType type = EventType::ZONE;
+	};
+
+	struct ThreadBuffer{
+		uint32_t threadIndex = 0;  // of the thread that currently writes into this ring
+		vector<Event> events;
+		atomic<uint64_t> numWritten = 0;
+
+		void push(const Event& event){
+			uint64_t index = numWritten.load(memory_order_relaxed);
+			Event& slot = events[index % events.size()];
+			slot = event;
+			slot.threadIndex = threadIndex;
+			numWritten.store(index + 1, memory_order_release);
+		}
+	};
+
+	// returns the thread's ring to the pool when the thread exits
+	struct ThreadBufferHandle{
+		ThreadBuffer* buffer = nullptr;
+
+		~ThreadBufferHandle(){
+			if(buffer != nullptr){
+				Tracer::releaseBuffer(buffer);
+			}
+		}
+	};
+
+	struct Zone{
+		ThreadBuffer* buffer = nullptr;
+		const char* name = nullptr;
+		uint64_t start = 0;
+
+		Zone(const char* name){
+			if(!Tracer::isEnabled()) return;
+
+			this->buffer = Tracer::threadBuffer();
+			this->name = name;
+			this->start = Tracer::timestamp();
+		}
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+
+		~Zone(){
+			end();
+		}
+
+		// ends the zone before it goes out of scope
+		void end(){
+			if(buffer == nullptr) return;
+
+			Event event;
+			event.name = name;
+			event.start = start;
+			event.duration = Tracer::timestamp() - start;
+			event.type = EventType::ZONE;
+
+			buffer->push(event);
+			buffer = nullptr;
+		}
+	};
+
+	atomic<bool> enabled = false;
+	int64_t eventsPerThread = 65'536;
+	chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	mutex mtx;
+	vector<shared_ptr<ThreadBuffer>> buffers;
+	vector<ThreadBuffer*> freeBuffers;
+	vector<string> threadNames;
+	unordered_set<string> names;
+	unordered_map<const char*, double> totals;
+
+	static Tracer* instance(){
+		static Tracer* _instance = new Tracer();
+
+		return _instance;
+	}
+
+	// <eventsPerThread> only affects ring buffers that are created afterwards
+	static void enable(int64_t eventsPerThread = 65'536){
+		Tracer* tracer = instance();
+
+		{
+			lock_guard<mutex> lock(tracer->mtx);
+			tracer->eventsPerThread = std::max(eventsPerThread, int64_t(1));
+		}
+
+		tracer->enabled.store(true, memory_order_relaxed);
+	}
+
+	static void disable(){
+		instance()->enabled.store(false, memory_order_relaxed);
+	}
+
+	static bool isEnabled(){
+		return instance()->enabled.load(memory_order_relaxed);
+	}
+
+	static uint64_t timestamp(){
+		auto elapsed = chrono::steady_clock::now() - instance()->startTime;
+
+		return chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+	}
+
+	static ThreadBuffer* threadBuffer(){
+		thread_local ThreadBufferHandle handle;
+
+		if(handle.buffer == nullptr){
+			handle.buffer = acquireBuffer();
+		}
+
+		return handle.buffer;
+	}
+
+	static ThreadBuffer* acquireBuffer(){
+		Tracer* tracer = instance();
+		lock_guard<mutex> lock(tracer->mtx);
+
+		ThreadBuffer* buffer = nullptr;
+
+		if(tracer->freeBuffers.size() > 0){
+			buffer = tracer->freeBuffers.back();
+			tracer->freeBuffers.pop_back();
+		}else{
+			// owned by the tracer, so events of finished threads can still be exported
+			auto newBuffer = make_shared<ThreadBuffer>();
+			newBuffer->events.resize(tracer->eventsPerThread);
+
+			tracer->buffers.push_back(newBuffer);
+			buffer = newBuffer.get();
+		}
+
+		buffer->threadIndex = tracer->threadNames.size();
+		tracer->threadNames.push_back("thread " + to_string(buffer->threadIndex));
+
+		return buffer;
+	}
+
+	static void releaseBuffer(ThreadBuffer* buffer){
+		Tracer* tracer = instance();
+		lock_guard<mutex> lock(tracer->mtx);
+
+		tracer->freeBuffers.push_back(buffer);
+	}
+
+	// stable pointer to a copy of <name>, for zones and counters with dynamic names
+	static const char* intern(string name){
+		Tracer* tracer = instance();
+		lock_guard<mutex> lock(tracer->mtx);
+
+		auto [it, inserted] = tracer->names.insert(name);
+
+		return it->c_str();
+	}
+
+	static Zone zone(const char* name){
+		return Zone(name);
+	}
+
+	static void counter(const char* name, double value){
+		if(!isEnabled()) return;
+
+		Event event;
+		event.name = name;
+		event.start = timestamp();
+		event.value = value;
+		event.type = EventType::COUNTER;
+
+		threadBuffer()->push(event);
+	}
+
+	// records the running total of <name>, e.g. bytes read so far by all threads.
+	// Takes a lock, meant for per-batch rather than per-point updates.
+	static void increment(const char* name, double delta){
+		if(!isEnabled()) return;
+
+		Tracer* tracer = instance();
+		double total = 0.0;
+		{
+			lock_guard<mutex> lock(tracer->mtx);
+			total = tracer->totals[name] += delta;
+		}
+
+		counter(name, total);
+	}
+
+	// no-op while disabled, so that untraced threads don't allocate a buffer
+	static void setThreadName(string name){
+		if(!isEnabled()) return;
+
+		ThreadBuffer* buffer = threadBuffer();
+
+		lock_guard<mutex> lock(instance()->mtx);
+		instance()->threadNames[buffer->threadIndex] = name;
+	}
+
+	// events of all threads that are still in their ring buffers, ordered by start time
+	static vector<pair<uint32_t, Event>> collect(){
+		Tracer* tracer = instance();
+		lock_guard<mutex> lock(tracer->mtx);
+
+		vector<pair<uint32_t, Event>> events;
+
+		for(auto& buffer : tracer->buffers){
+			uint64_t numWritten = buffer->numWritten.load(memory_order_acquire);
+			uint64_t capacity = buffer->events.size();
+			uint64_t first = numWritten > capacity ? numWritten - capacity : 0;
+
+			vector<Event> copies(buffer->events.begin(), buffer->events.end());
+
+			// Writing event i overwrites the slot of event i - capacity. If the ring has an owner that may have
+			// kept tracing while we copied, the slots of all events up to (numWritten after copying) - capacity
+			// may be torn. Pooled rings have no owner, and can't get one while we hold the lock.
+			bool isPooled = std::find(tracer->freeBuffers.begin(), tracer->freeBuffers.end(), buffer.get()) != tracer->freeBuffers.end();
+
+			atomic_thread_fence(memory_order_acquire);
+			uint64_t numWrittenAfter = buffer->numWritten.load(memory_order_relaxed);
+			if(!isPooled && numWrittenAfter >= capacity){
+				first = std::max(first, numWrittenAfter - capacity + 1);
+			}
+
+			for(uint64_t i = first; i < numWritten; i++){
+				Event& event = copies[i % capacity];
+				events.push_back({event.threadIndex, event});
+			}
+		}
+
+		std::stable_sort(events.begin(), events.end(), [](auto& a, auto& b){
+			return a.second.start < b.second.start;
+		});
+
+		return events;
+	}
+
+	static string escape(const char* str){
+		string escaped;
+
+		for(const char* c = str; *c != 0; c++){
+			if(*c == '"' || *c == '\\'){
+				escaped += '\\';
+			}
+
+			escaped += *c;
+		}
+
+		return escaped;
+	}
+
+	// Chrome trace event format, JSON object variant
+	static void writeChromeTrace(string path){
+
+		auto events = collect();
+		Tracer* tracer = instance();
+
+		vector<string> entries;
+
+		{
+			lock_guard<mutex> lock(tracer->mtx);
+
+			// names of threads that still have events in the rings
+			vector<bool> hasEvents(tracer->threadNames.size(), false);
+			for(auto& [threadIndex, event] : events){
+				hasEvents[threadIndex] = true;
+			}
+
+			for(uint32_t threadIndex = 0; threadIndex < hasEvents.size(); threadIndex++){
+				if(!hasEvents[threadIndex]) continue;
+
+				stringstream entry;
+				entry << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << threadIndex
+					<< ", \"args\": {\"name\": \"" << escape(tracer->threadNames[threadIndex].c_str()) << "\"}}";
+				entries.push_back(entry.str());
+			}
+		}
+
+		for(auto& [threadIndex, event] : events){
+			stringstream entry;
+			entry.precision(3);
+			entry << fixed;
+
+			// microseconds
+			double ts = double(event.start) / 1000.0;
+
+			if(event.type == EventType::ZONE){
+				double dur = double(event.duration) / 1000.0;
+
+				entry << "{\"name\": \"" << escape(event.name) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << threadIndex
+					<< ", \"ts\": " << ts << ", \"dur\": " << dur << "}";
+			}else if(event.type == EventType::COUNTER){
+				entry << "{\"name\": \"" << escape(event.name) << "\", \"ph\": \"C\", \"pid\": 1, \"tid\": " << threadIndex
+					<< ", \"ts\": " << ts << ", \"args\": {\"value\": " << event.value << "}}";
+			}
+
+			entries.push_back(entry.str());
+		}
+
+		stringstream ss;
+		ss << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+
+		for(size_t i = 0; i < entries.size(); i++){
+			ss << entries[i] << (i + 1 < entries.size() ? "," : "") << endl;
+		}
+
+		ss << "]}" << endl;
+
+		ofstream fout(path, ios::out | ios::binary);
+		fout << ss.str();
+		fout.close();
+	}
+
+	// total time, count and max per zone name
+	static void printSummary(){
+
+		struct Stats{
+			uint64_t count = 0;
+			uint64_t total = 0;
+			uint64_t max = 0;
+		};
+
+		unordered_map<string, Stats> statsByName;
+		for(auto& [threadIndex, event] : collect()){
+			if(event.type != EventType::ZONE) continue;
+
+			Stats& stats = statsByName[event.name];
+			stats.count++;
+			stats.total += event.duration;
+			stats.max = std::max(stats.max, event.duration);
+		}
+
+		vector<pair<string, Stats>> sorted(statsByName.begin(), statsByName.end());
+		std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b){
+			return a.second.total > b.second.total;
+		});
+
+		stringstream ss;
+		ss.precision(3);
+		ss << fixed;
+
+		ss << "=== TRACE SUMMARY ===" << endl;
+		for(auto& [name, stats] : sorted){
+			ss << name << ": " << (double(stats.total) / 1'000'000'000.0) << "s total, "
+				<< stats.count << " calls, "
+				<< (double(stats.max) / 1'000'000.0) << "ms max" << endl;
+		}
+
+		cout << ss.str();
+	}
+
+};
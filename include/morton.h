@@ -0,0 +1,280 @@
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <type_traits>
+
+// Morton codes (Z-order curve) for all builders and tools.
+//
+// 3D: 21 bits per axis. Each triplet holds x at bit 2, y at bit 1 and z at bit 0,
+//     so the lowest triplet of a node's code is its octree child index (x << 2) | (y << 1) | z.
+// 2D: 32 bits per axis. Each pair holds x at bit 0 and y at bit 1, the usual image layout.
+//
+// - With BMI2, scalar encode/decode is a PDEP/PEXT per axis. MSVC doesn't define __BMI2__, so /arch:AVX2
+//   is taken as BMI2 as well. PDEP/PEXT are microcoded and slow on AMD before Zen 3.
+//   Define MORTON_NO_BMI2 to fall back to the lookup tables on those.
+// - Without BMI2, and in constant expressions, 3D encode goes through a constexpr lookup table.
+//   Decoding and 2D use magic bits, which measured faster than table lookups there (see tools/morton_bench).
+// - The array variants encode/decode 4 codes at a time with AVX2 magic bits, if available.
+//
+// See tools/morton_bench for microbenchmarks of all paths.
+//
+// based on: https://www.forceflow.be/2013/10/07/morton-encodingdecoding-through-bit-interleaving-implementations/
+// license: Creative Commons Attribute-NonCommercial Sharealike 3.0 Unported license.
+// also: https://github.com/Forceflow/libmorton
+
+#if !defined(MORTON_NO_BMI2) && (defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__)))
+	#define MORTON_BMI2 1
+#else
+	#define MORTON_BMI2 0
+#endif
+
+#if defined(__AVX2__)
+	#define MORTON_AVX2 1
+#else
+	#define MORTON_AVX2 0
+#endif
+
+#if MORTON_BMI2 || MORTON_AVX2
+	#include <immintrin.h>
+#endif
+
+namespace morton{
+
+	constexpr uint64_t MASK_3D_X = 0x4924924924924924;
+	constexpr uint64_t MASK_3D_Y = 0x2492492492492492;
+	constexpr uint64_t MASK_3D_Z = 0x1249249249249249;
+	constexpr uint64_t MASK_2D_X = 0x5555555555555555;
+	constexpr uint64_t MASK_2D_Y = 0xaaaaaaaaaaaaaaaa;
+
+	constexpr int MAX_LEVELS_3D = 21;
+	constexpr int MAX_LEVELS_2D = 32;
+
+	// method to seperate bits from a given integer 3 positions apart
+	constexpr uint64_t splitBy3(uint32_t a){
+		uint64_t x = a & 0x1fffff; // we only look at the first 21 bits
+		x = (x | x << 32) & 0x1f00000000ffff;
+		x = (x | x << 16) & 0x1f0000ff0000ff;
+		x = (x | x <<  8) & 0x100f00f00f00f00f;
+		x = (x | x <<  4) & 0x10c30c30c30c30c3;
+		x = (x | x <<  2) & 0x1249249249249249;
+
+		return x;
+	}
+
+	// inverse of splitBy3, gathers every third bit
+	constexpr uint32_t compactBy3(uint64_t x){
+		x = x & 0x1249249249249249;
+		x = (x ^ (x >>  2)) & 0x10c30c30c30c30c3;
+		x = (x ^ (x >>  4)) & 0x100f00f00f00f00f;
+		x = (x ^ (x >>  8)) & 0x1f0000ff0000ff;
+		x = (x ^ (x >> 16)) & 0x1f00000000ffff;
+		x = (x ^ (x >> 32)) & 0x1fffff;
+
+		return uint32_t(x);
+	}
+
+	constexpr uint64_t splitBy2(uint32_t a){
+		uint64_t x = a;
+		x = (x | x << 16) & 0x0000ffff0000ffff;
+		x = (x | x <<  8) & 0x00ff00ff00ff00ff;
+		x = (x | x <<  4) & 0x0f0f0f0f0f0f0f0f;
+		x = (x | x <<  2) & 0x3333333333333333;
+		x = (x | x <<  1) & 0x5555555555555555;
+
+		return x;
+	}
+
+	constexpr uint32_t compactBy2(uint64_t x){
+		x = x & 0x5555555555555555;
+		x = (x ^ (x >>  1)) & 0x3333333333333333;
+		x = (x ^ (x >>  2)) & 0x0f0f0f0f0f0f0f0f;
+		x = (x ^ (x >>  4)) & 0x00ff00ff00ff00ff;
+		x = (x ^ (x >>  8)) & 0x0000ffff0000ffff;
+		x = (x ^ (x >> 16)) & 0x00000000ffffffff;
+
+		return uint32_t(x);
+	}
+
+	namespace lut{
+
+		// byte -> its bits spread 3 positions apart
+		constexpr std::array<uint64_t, 256> SPLIT_3 = [](){
+			std::array<uint64_t, 256> table = {};
+			for(uint32_t i = 0; i < 256; i++) table[i] = morton::splitBy3(i);
+			return table;
+		}();
+
+		// 9 bits of a code -> 3 bits of z, y, x, packed as z | y << 3 | x << 6
+		constexpr std::array<uint16_t, 512> COMPACT_3 = [](){
+			std::array<uint16_t, 512> table = {};
+			for(uint32_t i = 0; i < 512; i++){
+				table[i] = morton::compactBy3(i) | (morton::compactBy3(i >> 1) << 3) | (morton::compactBy3(i >> 2) << 6);
+			}
+			return table;
+		}();
+
+		constexpr uint64_t splitBy3(uint32_t a){
+			return (SPLIT_3[(a >>  0) & 0xff] <<  0)
+				| (SPLIT_3[(a >>  8) & 0xff] << 24)
+				| (SPLIT_3[(a >> 16) & 0x1f] << 48);
+		}
+
+		constexpr uint64_t encode(uint32_t x, uint32_t y, uint32_t z){
+			return (splitBy3(x) << 2) | (splitBy3(y) << 1) | (splitBy3(z) << 0);
+		}
+
+		constexpr void decode(uint64_t code, uint32_t& x, uint32_t& y, uint32_t& z){
+			x = 0;
+			y = 0;
+			z = 0;
+
+			for(int chunk = 0; chunk < 7; chunk++){
+				uint32_t packed = COMPACT_3[(code >> (9 * chunk)) & 0x1ff];
+
+				z |= ((packed >> 0) & 0b111) << (3 * chunk);
+				y |= ((packed >> 3) & 0b111) << (3 * chunk);
+				x |= ((packed >> 6) & 0b111) << (3 * chunk);
+			}
+		}
+	}
+
+	constexpr uint64_t encode(uint32_t x, uint32_t y, uint32_t z){
+		#if MORTON_BMI2
+		if(!std::is_constant_evaluated()){
+			return _pdep_u64(x, MASK_3D_X) | _pdep_u64(y, MASK_3D_Y) | _pdep_u64(z, MASK_3D_Z);
+		}
+		#endif
+
+		return lut::encode(x, y, z);
+	}
+
+	constexpr void decode(uint64_t code, uint32_t& x, uint32_t& y, uint32_t& z){
+		#if MORTON_BMI2
+		if(!std::is_constant_evaluated()){
+			x = uint32_t(_pext_u64(code, MASK_3D_X));
+			y = uint32_t(_pext_u64(code, MASK_3D_Y));
+			z = uint32_t(_pext_u64(code, MASK_3D_Z));
+
+			return;
+		}
+		#endif
+
+		x = compactBy3(code >> 2);
+		y = compactBy3(code >> 1);
+		z = compactBy3(code >> 0);
+	}
+
+	constexpr uint64_t encode2D(uint32_t x, uint32_t y){
+		#if MORTON_BMI2
+		if(!std::is_constant_evaluated()){
+			return _pdep_u64(x, MASK_2D_X) | _pdep_u64(y, MASK_2D_Y);
+		}
+		#endif
+
+		return splitBy2(x) | (splitBy2(y) << 1);
+	}
+
+	constexpr void decode2D(uint64_t code, uint32_t& x, uint32_t& y){
+		#if MORTON_BMI2
+		if(!std::is_constant_evaluated()){
+			x = uint32_t(_pext_u64(code, MASK_2D_X));
+			y = uint32_t(_pext_u64(code, MASK_2D_Y));
+
+			return;
+		}
+		#endif
+
+		x = compactBy2(code >> 0);
+		y = compactBy2(code >> 1);
+	}
+
+	// octree child index at <level> (root = 0) of a code with <numLevels> levels
+	constexpr uint32_t childIndexAt(uint64_t code, int level, int numLevels){
+		return (code >> (3 * (numLevels - level - 1))) & 0b111;
+	}
+
+	// code of the cell <levelsUp> levels above
+	constexpr uint64_t ancestor(uint64_t code, int levelsUp){
+		return code >> (3 * levelsUp);
+	}
+
+	#if MORTON_AVX2
+	namespace avx2{
+
+		inline __m256i splitBy3(__m256i x){
+			x = _mm256_and_si256(x, _mm256_set1_epi64x(0x1fffff));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 32)), _mm256_set1_epi64x(0x1f00000000ffff));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 16)), _mm256_set1_epi64x(0x1f0000ff0000ff));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x,  8)), _mm256_set1_epi64x(0x100f00f00f00f00f));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x,  4)), _mm256_set1_epi64x(0x10c30c30c30c30c3));
+			x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x,  2)), _mm256_set1_epi64x(0x1249249249249249));
+
+			return x;
+		}
+
+		inline __m256i compactBy3(__m256i x){
+			x = _mm256_and_si256(x, _mm256_set1_epi64x(0x1249249249249249));
+			x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x,  2)), _mm256_set1_epi64x(0x10c30c30c30c30c3));
+			x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x,  4)), _mm256_set1_epi64x(0x100f00f00f00f00f));
+			x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x,  8)), _mm256_set1_epi64x(0x1f0000ff0000ff));
+			x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 16)), _mm256_set1_epi64x(0x1f00000000ffff));
+			x = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 32)), _mm256_set1_epi64x(0x1fffff));
+
+			return x;
+		}
+
+		inline __m256i load4(const uint32_t* values){
+			return _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values)));
+		}
+
+		// lower 32 bits of each 64 bit lane
+		inline void store4(uint32_t* target, __m256i values){
+			__m256i packed = _mm256_permutevar8x32_epi32(values, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm256_castsi256_si128(packed));
+		}
+	}
+	#endif
+
+	// codes[i] = encode(x[i], y[i], z[i])
+	inline void encode(const uint32_t* x, const uint32_t* y, const uint32_t* z, uint64_t* codes, int64_t count){
+		int64_t i = 0;
+
+		#if MORTON_AVX2
+		for(; i + 4 <= count; i += 4){
+			__m256i sx = avx2::splitBy3(avx2::load4(x + i));
+			__m256i sy = avx2::splitBy3(avx2::load4(y + i));
+			__m256i sz = avx2::splitBy3(avx2::load4(z + i));
+
+			__m256i code = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi64(sx, 2), _mm256_slli_epi64(sy, 1)), sz);
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i), code);
+		}
+		#endif
+
+		for(; i < count; i++){
+			codes[i] = encode(x[i], y[i], z[i]);
+		}
+	}
+
+	// decode(codes[i], x[i], y[i], z[i])
+	inline void decode(const uint64_t* codes, uint32_t* x, uint32_t* y, uint32_t* z, int64_t count){
+		int64_t i = 0;
+
+		#if MORTON_AVX2
+		for(; i + 4 <= count; i += 4){
+			__m256i code = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+
+			avx2::store4(x + i, avx2::compactBy3(_mm256_srli_epi64(code, 2)));
+			avx2::store4(y + i, avx2::compactBy3(_mm256_srli_epi64(code, 1)));
+			avx2::store4(z + i, avx2::compactBy3(code));
+		}
+		#endif
+
+		for(; i < count; i++){
+			decode(codes[i], x[i], y[i], z[i]);
+		}
+	}
+
+}
@@ -1,7 +1,7 @@
 
 #pragma once
 
-constexpr uint64_t NODE_CAPACITY = 1'000'000;
+constexpr uint64_t NODE_CAPACITY = IN_MEMORY_SPLIT_POLICY.splitThreshold();
 constexpr uint64_t MAX_BATCH_SIZE = 1'000'000;
 
 struct Point {
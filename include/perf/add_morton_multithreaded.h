@@ -12,16 +12,18 @@
 #include "unsuck.hpp"
 #include "LasLoader.h"
 #include "base.h"
-#include "utils.h"
+#include "morton.h"
 
 
 using namespace std;
 
 namespace add_morton_multithreaded {
 
-	constexpr uint64_t NODE_CAPACITY = 1'000'000;
+	constexpr uint64_t NODE_CAPACITY = IN_MEMORY_SPLIT_POLICY.splitThreshold();
 	constexpr uint64_t MAX_BATCH_SIZE = 1'000'000;
 
+	BufferPool* bufferPool = BufferPool::get("add_morton_multithreaded");
+
 	struct Point {
 		double x;
 		double y;
@@ -124,7 +126,7 @@ namespace add_morton_multithreaded {
 		shared_ptr<Buffer> buffers[8];
 		for (int i = 0; i < 8; i++) {
 			int numChildPoints = counters[i];
-			buffers[i] = make_shared<Buffer>(32 * numChildPoints);
+			buffers[i] = make_shared<Buffer>(32 * numChildPoints, bufferPool);
 		}
 
 		for (int i = 0; i < numPoints; i++) {
@@ -183,8 +185,7 @@ namespace add_morton_multithreaded {
 
 		do {
 
-			int shift = 3 * (8 - level);
-			int childIndex = (point.mortonCode >> shift) & 0b111;
+			int childIndex = morton::childIndexAt(point.mortonCode, level, 9);
 
 			Node* child = current->children[childIndex];
 
@@ -233,7 +234,7 @@ namespace add_morton_multithreaded {
 
 			} while(i + splitSize < numPoints);
 
-			shared_ptr<Buffer> part = make_shared<Buffer>(32 * splitSize);
+			shared_ptr<Buffer> part = make_shared<Buffer>(32 * splitSize, bufferPool);
 			memcpy(part->data, buffer->data_u8 + 32 * i, 32 * splitSize);
 
 
@@ -6,15 +6,15 @@
 
 
 #include "TaskPool.h"
+#include "ConcurrentList.h"
+#include "Tracer.h"
 
 namespace batchwise_multithreaded_2{
-	constexpr uint64_t NODE_CAPACITY = 1'000'000;
+	constexpr uint64_t NODE_CAPACITY = IN_MEMORY_SPLIT_POLICY.splitThreshold();
 	constexpr uint64_t MAX_BATCH_SIZE = 1'000'000;
 	constexpr int MORTON_LEVELS = 20;
 	double MORTON_GRID_SIZE = pow(2, MORTON_LEVELS); // 10: 1024
 
-	mutex mtx_add;
-
 	struct Point {
 		double x;
 		double y;
@@ -53,19 +53,35 @@ namespace batchwise_multithreaded_2{
 		Cube_i cube;
 	};
 
+	// Nodes are inserted into without locks:
+	// - a LEAF collects batches in a lock-free list.
+	// - the thread whose batch exceeds NODE_CAPACITY claims the split by moving the node to SPLITTING.
+	//   It creates the children, publishes INNER, then passes the collected batches down.
+	// - batches that arrive at an INNER node are passed down right away.
+	// Work of a split is handed to the other threads of the domain.
+	enum NodeState : int {
+		LEAF      = 0,
+		SPLITTING = 1,
+		INNER     = 2,
+	};
+
 	struct Node {
 
 		string name = "";
-		uint64_t numPoints = 0;
+		atomic<uint64_t> numPoints = 0;
 		int index = 0;
 		int level = 0;
+		int domain = 0;
 		Box boundingBox;
 		Cube cube;
 		Cube_i cube_i;
 
 		Node* children[8] = { nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr };
+		atomic<int> state = LEAF;
+		ConcurrentList<Batch> batches;
+
+		// batches of leaves, moved from <batches> by finalize() once all threads are done
 		vector<Batch> points;
-		mutex mtx;
 
 		Node() {
 
@@ -90,7 +106,32 @@ namespace batchwise_multithreaded_2{
 		int64_t numPoints;
 	};
 
+	struct InsertTask{
+		Node* node = nullptr;
+		Batch batch;
+		bool handedOff = false; // already counted by <node>, only pass it to the children
+	};
+
+	// NUMA
+	// The 8 top-level subtrees are split into contiguous morton ranges, one per NUMA domain.
+	// A domain inserts into its subtrees with threads pinned to its node and allocates from its own
+	// buffer pool, so nodes and their points stay on one socket. Loaders copy each loaded batch
+	// once, into the domain that owns it. The root is merged from the subtrees at the end.
+	struct Domain{
+		int numaNode = -1;
+		BufferPool* bufferPool = nullptr;
+		shared_ptr<TaskPool<InsertTask>> inserts = nullptr;
+	};
+
 	shared_ptr<TaskPool<Task>> pool = nullptr;
+	vector<Domain> domains;
+
+	// pool of the domain that the calling thread inserts into
+	thread_local BufferPool* bufferPool = nullptr;
+
+	inline int domainOf(int octant){
+		return octant * domains.size() / 8;
+	}
 
 	inline Box childBoundingBoxOf(dvec3 min, dvec3 max, int index) {
 		Box box;
@@ -149,21 +190,67 @@ namespace batchwise_multithreaded_2{
 		return childCube;
 	}
 
-	
+	// smallest octree cube that contains the sorted morton codes from <first> to <last>
+	inline Cube_i cubeOf(uint64_t first, uint64_t last){
+		int numBits = std::bit_width(first ^ last);
+		int levels = (numBits + 2) / 3;
+
+		uint32_t x, y, z;
+		morton::decode(first & ~((1ull << (3 * levels)) - 1), x, y, z);
+
+		Cube_i cube;
+		cube.min = {int(x), int(y), int(z)};
+		cube.size = 1 << levels;
+
+		return cube;
+	}
 
 	void pass(Node* node, Batch batch);
 	void addPoints(Node* node, Batch batch);
 
+	// passes batches that were collected by <node> to its children.
+	// The first one on this thread, the others on the other threads of the domain.
+	void handOff(Node* node, vector<Batch>& batches){
+
+		for(int i = 1; i < batches.size(); i++){
+			auto task = make_shared<InsertTask>();
+			task->node = node;
+			task->batch = batches[i];
+			task->handedOff = true;
+
+			domains[node->domain].inserts->addTask(task);
+		}
+
+		if(batches.size() > 0){
+			pass(node, batches[0]);
+		}
+	}
+
+	// only called by the thread that moved <node> from LEAF to SPLITTING
 	void split(Node* node){
 
 		//cout << repeat(" ", 4 * node->level) << "split( " << node->name << ");" << endl;
-		
-		auto pointsList = node->points;
-		node->points = vector<Batch>();
 
-		for(auto points : pointsList){
-			pass(node, points);
-		}		
+		auto zone = Tracer::zone("split");
+
+		for(int i = 0; i < 8; i++){
+			Node* child = new Node();
+			child->name = node->name + to_string(i);
+			child->boundingBox = childBoundingBoxOf(node->boundingBox.min, node->boundingBox.max, i);
+			child->cube_i = childCubeOf(node, i);
+			child->level = node->level + 1;
+			child->index = i;
+			child->domain = node->domain;
+
+			node->children[i] = child;
+		}
+
+		// Batches pushed before this point are taken here. Threads that push
+		// concurrently see INNER afterwards and take their batches themselves.
+		node->state = INNER;
+
+		vector<Batch> batches = node->batches.takeAll();
+		handOff(node, batches);
 
 	}
 
@@ -171,18 +258,9 @@ namespace batchwise_multithreaded_2{
 
 		//cout << repeat(" ", 4 * node->level) << "pass( " << node->name << ", " << (pointBuffer->size / sizeof(Point)) << ")" << endl;
 
+		auto zone = Tracer::zone("pass");
+
 		for(int i = 0; i < 8; i++){
-			
-			if(node->children[i] == nullptr){
-				Node* child = new Node();
-				child->name = node->name + to_string(i);
-				child->boundingBox = childBoundingBoxOf(node->boundingBox.min, node->boundingBox.max, i);
-				child->cube_i = childCubeOf(node, i);
-				child->level = node->level + 1;
-				child->index = i;
-
-				node->children[i] = child;
-			}
 
 			// FAST PATH
 			{
@@ -201,14 +279,11 @@ namespace batchwise_multithreaded_2{
 		//for(auto pointBuffer : points)
 		{
 
-			Point* points = reinterpret_cast<Point*>(batch.buffer->data);
+			Point* points = reinterpret_cast<Point*>(batch.buffer->data) + batch.first;
 
 			for(int i = 0; i < batch.size; i++){
 
-				uint64_t shift_levels = (MORTON_LEVELS - node->level - 1);
-				uint64_t shift = 3 * shift_levels;
-				uint64_t shifted = points[i].mortonCode >> shift;
-				uint64_t childIndex = shifted & 0b111;
+				uint64_t childIndex = morton::childIndexAt(points[i].mortonCode, node->level, MORTON_LEVELS);
 
 				counters[childIndex]++;
 			}
@@ -216,10 +291,10 @@ namespace batchwise_multithreaded_2{
 
 		vector<Batch> outputs(8);
 
-		int offset = 0;
+		int offset = batch.first * sizeof(Point);
 		for(int i = 0; i < 8; i++){
 			int numPoints = counters[i];
-			outputs[i].buffer = make_shared<Buffer>(numPoints * sizeof(Point));
+			outputs[i].buffer = make_shared<Buffer>(numPoints * sizeof(Point), bufferPool);
 			outputs[i].cube = childCubeOf(node, i);
 			outputs[i].size = numPoints;
 
@@ -245,26 +320,81 @@ namespace batchwise_multithreaded_2{
 
 		//cout << repeat(" ", 4 * node->level) << "addPoints( " << node->name << ", ..., " << numPoints << ");" << endl;
 
+		uint64_t numPoints = node->numPoints.fetch_add(batch.size) + batch.size;
+
+		if(node->state == INNER){
+			// PASS
+			pass(node, batch);
+
+			return;
+		}
+
 		// ADD
-		if(node->numPoints <= NODE_CAPACITY){
-			node->points.push_back(batch);
+		node->batches.push(batch);
+
+		int state = node->state;
+
+		if(state == INNER){
+			// split() published INNER after our check, and may have taken the list before our push
+			vector<Batch> batches = node->batches.takeAll();
+			handOff(node, batches);
+		}else if(state == LEAF && numPoints > NODE_CAPACITY){
+			// SPLIT, if no other thread claimed it first
+			int expected = LEAF;
+			if(node->state.compare_exchange_strong(expected, SPLITTING)){
+				split(node);
+			}
 		}
 
-		node->numPoints += batch.size;
+	}
+
+	// MERGE sparse siblings into their parent, bottom-up, like the GPU split does with
+	// SplitPolicy::shouldMerge(). Returns whether <node> is a leaf afterwards.
+	bool mergeSparse(Node* node){
+
+		if(node->state == LEAF) return true;
+
+		uint64_t sumPoints = 0;
+		uint32_t numNonempty = 0;
+		bool allLeaves = true;
+		for(Node* child : node->children){
+			if(child == nullptr) continue;
 
-		if(node->name == "r0"){
-			int a = 10;
+			allLeaves = mergeSparse(child) && allLeaves;
+
+			if(child->numPoints > 0){
+				sumPoints += child->numPoints;
+				numNonempty++;
+			}
 		}
 
-		if(node->numPoints > NODE_CAPACITY && node->points.size() > 0){
-			// SPLIT
-			split(node);
-		}else if(node->numPoints > NODE_CAPACITY) {
-			// PASS
-			pass(node, batch);
+		if(!allLeaves || sumPoints > IN_MEMORY_SPLIT_POLICY.maxPoints) return false;
+		if(!IN_MEMORY_SPLIT_POLICY.shouldMerge(uint32_t(sumPoints), numNonempty)) return false;
+
+		for(int i = 0; i < 8; i++){
+			Node* child = node->children[i];
+			if(child == nullptr) continue;
+
+			node->points.insert(node->points.end(), child->points.begin(), child->points.end());
+
+			delete child;
+			node->children[i] = nullptr;
 		}
 
-		
+		node->state = LEAF;
+
+		return true;
+	}
+
+	// moves the batches of the leaves to Node::points and merges sparse siblings, after all threads are done
+	void finalize(Node* node){
+		node->traverse([](Node* node){
+			node->points = node->batches.takeAll();
+		});
+
+		for(Node* child : node->children){
+			if(child != nullptr) mergeSparse(child);
+		}
 	}
 
 
@@ -286,10 +416,71 @@ namespace batchwise_multithreaded_2{
 		cube_i.size = pow(2, MORTON_LEVELS);
 		root->cube_i = cube_i;
 
+		for(int i = 0; i < 8; i++){
+			Node* child = new Node();
+			child->name = root->name + to_string(i);
+			child->boundingBox = childBoundingBoxOf(root->boundingBox.min, root->boundingBox.max, i);
+			child->cube_i = childCubeOf(root, i);
+			child->level = root->level + 1;
+			child->index = i;
+
+			root->children[i] = child;
+		}
+
+		root->state = INNER;
+
 		string file = lasfile.path;
 
 		auto tStart = now();
 
+		// DOMAINS
+		int numNumaNodes = getNumaNodeCount();
+		int numDomains = std::min(numNumaNodes, 8);
+		domains = vector<Domain>(numDomains);
+
+		for(int d = 0; d < numDomains; d++){
+			Domain& domain = domains[d];
+
+			int numOctants = 0;
+			for(int octant = 0; octant < 8; octant++){
+				if(domainOf(octant) == d) numOctants++;
+			}
+
+			int numThreads = std::max(getNumaNodeProcessorCount(d), 1);
+
+			if(numNumaNodes > 1){
+				domain.numaNode = d;
+				domain.bufferPool = BufferPool::get("batchwise_multithreaded_2/node" + to_string(d), true, d);
+			}else{
+				domain.bufferPool = BufferPool::get("batchwise_multithreaded_2", true);
+			}
+
+			cout << "domain " << d << ": " << numOctants << " subtrees, " << numThreads << " threads" << endl;
+
+			domain.inserts = make_shared<TaskPool<InsertTask>>(numThreads, [&domain](shared_ptr<InsertTask> task){
+
+				thread_local int pinnedNode = -1;
+				if(domain.numaNode >= 0 && pinnedNode != domain.numaNode){
+					pinThreadToNumaNode(domain.numaNode);
+					pinnedNode = domain.numaNode;
+				}
+
+				bufferPool = domain.bufferPool;
+
+				if(task->handedOff){
+					pass(task->node, task->batch);
+				}else{
+					auto zone_add = Tracer::zone("addPoints");
+					addPoints(task->node, task->batch);
+					zone_add.end();
+				}
+			});
+		}
+
+		for(int octant = 0; octant < 8; octant++){
+			root->children[octant]->domain = domainOf(octant);
+		}
+
 		pool = make_shared<TaskPool<Task>>(20, [&metadata, &lasfile, root](shared_ptr<Task> task){
 
 			auto points = LasLoader::loadSync(task->file, task->firstPoint, task->numPoints);
@@ -303,53 +494,63 @@ namespace batchwise_multithreaded_2{
 			dvec3 boxSize = box.size();
 			double cubeSize = std::max(std::max(boxSize.x, boxSize.y), boxSize.z);
 
-			Cube_i cube;
-
-			auto toMC = [min, cubeSize, &cube](Point point){
-				int32_t mx = MORTON_GRID_SIZE * (point.x - min.x) / cubeSize;
-				int32_t my = MORTON_GRID_SIZE * (point.y - min.y) / cubeSize;
-				int32_t mz = MORTON_GRID_SIZE * (point.z - min.z) / cubeSize;
-
-				cube.min.x = std::min(cube.min.x, mx);
-				cube.min.y = std::min(cube.min.y, my);
-				cube.min.z = std::min(cube.min.z, mz);
-
-				int sx = std::max(cube.size, (mx - cube.min.x));
-				int sy = std::max(cube.size, (my - cube.min.y));
-				int sz = std::max(cube.size, (mz - cube.min.z));
-				cube.size = std::max(std::max(sx, sy), std::max(sz, cube.size));
+			// points on the max faces of the box are clamped into the last cell, like in distributed::mortonCodeOf()
+			auto toMC = [min, cubeSize](Point point){
+				int32_t mx = std::clamp(MORTON_GRID_SIZE * (point.x - min.x) / cubeSize, 0.0, MORTON_GRID_SIZE - 1.0);
+				int32_t my = std::clamp(MORTON_GRID_SIZE * (point.y - min.y) / cubeSize, 0.0, MORTON_GRID_SIZE - 1.0);
+				int32_t mz = std::clamp(MORTON_GRID_SIZE * (point.z - min.z) / cubeSize, 0.0, MORTON_GRID_SIZE - 1.0);
 
 				int64_t mc = morton::encode(mx, my, mz);
 
 				return mc;
 			};
 
+			auto zone_morton = Tracer::zone("morton codes");
 			for(int i = 0; i < points.numPoints; i++){
 				ppoints[i].mortonCode = toMC(ppoints[i]);
 			}
+			zone_morton.end();
 
-			//stringstream ss;
-			//ss << "=== CUBE ===" << endl;
-			//ss << cube.min.x << ", " << cube.min.y << ", " << cube.min.z << endl;
-			//ss << cube.size << endl;
-			//cout << ss.str();
-
+			auto zone_sort = Tracer::zone("sort");
 			std::sort(ppoints, ppoints + points.numPoints, [](Point& a, Point& b){
 				return a.mortonCode < b.mortonCode;
 			});
+			zone_sort.end();
+
+			// DISTRIBUTE to the subtrees, contiguous ranges of the sorted points.
+			// Without NUMA, the ranges share the loaded buffer. Otherwise, they're copied to their domain.
+			auto zone_distribute = Tracer::zone("distribute");
+			int first = 0;
+			while(first < points.numPoints){
+				int octant = morton::childIndexAt(ppoints[first].mortonCode, 0, MORTON_LEVELS);
+
+				int last = first;
+				while(last < points.numPoints && morton::childIndexAt(ppoints[last].mortonCode, 0, MORTON_LEVELS) == octant){
+					last++;
+				}
 
-			Batch batch;
-			batch.buffer = points.buffer;
-			batch.cube = cube;
-			batch.first = 0;
-			batch.size = points.numPoints;
+				int numPoints = last - first;
+				Domain& domain = domains[domainOf(octant)];
+
+				auto insert = make_shared<InsertTask>();
+				insert->node = root->children[octant];
+				insert->batch.cube = cubeOf(ppoints[first].mortonCode, ppoints[last - 1].mortonCode);
+				insert->batch.size = numPoints;
+
+				if(domain.numaNode >= 0){
+					insert->batch.buffer = make_shared<Buffer>(numPoints * sizeof(Point), domain.bufferPool);
+					insert->batch.first = 0;
+					memcpy(insert->batch.buffer->data, ppoints + first, numPoints * sizeof(Point));
+				}else{
+					insert->batch.buffer = points.buffer;
+					insert->batch.first = first;
+				}
 
-			lock_guard<mutex> lock(mtx_add);
-			//cout << "finished loading node! adding to tree" << endl;
+				domain.inserts->addTask(insert);
 
-			auto tStart = now();
-			addPoints(root, batch);
-			printElapsedTime("addPoints", tStart);
+				first = last;
+			}
+			zone_distribute.end();
 
 		});
 
@@ -367,6 +568,32 @@ namespace batchwise_multithreaded_2{
 		pool->waitTillEmpty();
 		pool->close();
 
+		for(Domain& domain : domains){
+			domain.inserts->waitTillEmpty();
+			domain.inserts->close();
+		}
+
+		finalize(root);
+
+		// MERGE the subtrees into the root
+		for(Node* child : root->children){
+			root->numPoints += child->numPoints;
+		}
+
+		if(root->numPoints <= NODE_CAPACITY){
+			// small enough for the root alone, as if it had never been split
+			for(int i = 0; i < 8; i++){
+				Node* child = root->children[i];
+				root->points.insert(root->points.end(), child->points.begin(), child->points.end());
+
+				delete child;
+				root->children[i] = nullptr;
+			}
+		}
+
+		// the workers are joined and their caches flushed, return the unused batch memory
+		BufferPool::trimAll();
+
 		//root->traverse([](Node* node){
 		//	
 		//	if(node->numPoints == 0){
@@ -4,14 +4,16 @@
 #include <execution>
 
 #include "TaskPool.h"
+#include "ConcurrentList.h"
+#include "Tracer.h"
 
 namespace add_voxelized{
-	constexpr uint64_t NODE_CAPACITY = 1'000'000;
+	constexpr uint64_t NODE_CAPACITY = IN_MEMORY_SPLIT_POLICY.splitThreshold();
 	constexpr uint64_t MAX_BATCH_SIZE = 1'000'000;
 	constexpr int MORTON_LEVELS = 10;
 	double MORTON_GRID_SIZE = pow(2, MORTON_LEVELS); // 10: 1024
 
-	mutex mtx_add;
+	BufferPool* bufferPool = BufferPool::get("add_voxelized", true);
 
 	struct Point {
 		double x;
@@ -20,16 +22,29 @@ namespace add_voxelized{
 		uint64_t mortonCode;
 	};
 
+	// Lock-free insertion, same as in batchwise_multithreaded_2:
+	// a LEAF collects buffers in a lock-free list, the thread whose buffer exceeds NODE_CAPACITY
+	// claims the split (SPLITTING), creates the children, publishes INNER and passes the collected
+	// buffers down, all but the first on the <splits> pool. Buffers arriving at INNER nodes are passed down.
+	enum NodeState : int {
+		LEAF      = 0,
+		SPLITTING = 1,
+		INNER     = 2,
+	};
+
 	struct Node {
 
 		string name = "";
-		uint64_t numPoints = 0;
+		atomic<uint64_t> numPoints = 0;
 		int index = 0;
 		int level = 0;
 		Box boundingBox;
 		Node* children[8] = { nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr };
+		atomic<int> state = LEAF;
+		ConcurrentList<shared_ptr<Buffer>> buffers;
+
+		// buffers of leaves, moved from <buffers> by finalize() once all threads are done
 		vector<shared_ptr<Buffer>> points;
-		mutex mtx;
 
 		Node() {
 
@@ -54,7 +69,13 @@ namespace add_voxelized{
 		int64_t numPoints;
 	};
 
+	struct PassTask{
+		Node* node = nullptr;
+		shared_ptr<Buffer> points = nullptr;
+	};
+
 	shared_ptr<TaskPool<Task>> pool = nullptr;
+	shared_ptr<TaskPool<PassTask>> splits = nullptr;
 
 	inline Box childBoundingBoxOf(dvec3 min, dvec3 max, int index) {
 		Box box;
@@ -91,16 +112,45 @@ namespace add_voxelized{
 	void pass(Node* node, shared_ptr<Buffer> points);
 	void addPoints(Node* node, shared_ptr<Buffer> points, int numPoints);
 
+	// passes buffers that were collected by <node> to its children, all but the first on the <splits> pool
+	void handOff(Node* node, vector<shared_ptr<Buffer>>& buffers){
+
+		for(int i = 1; i < buffers.size(); i++){
+			auto task = make_shared<PassTask>();
+			task->node = node;
+			task->points = buffers[i];
+
+			splits->addTask(task);
+		}
+
+		if(buffers.size() > 0){
+			pass(node, buffers[0]);
+		}
+	}
+
+	// only called by the thread that moved <node> from LEAF to SPLITTING
 	void split(Node* node){
 
+		auto zone = Tracer::zone("split");
+
 		//cout << repeat(" ", 4 * node->level) << "split( " << node->name << ");" << endl;
-		
-		auto pointsList = node->points;
-		node->points = vector<shared_ptr<Buffer>>();
 
-		for(auto points : pointsList){
-			pass(node, points);
-		}		
+		for(int i = 0; i < 8; i++){
+			Node* child = new Node();
+			child->name = node->name + to_string(i);
+			child->boundingBox = childBoundingBoxOf(node->boundingBox.min, node->boundingBox.max, i);
+			child->level = node->level + 1;
+			child->index = i;
+
+			node->children[i] = child;
+		}
+
+		// Buffers pushed before this point are taken here. Threads that push
+		// concurrently see INNER afterwards and take their buffers themselves.
+		node->state = INNER;
+
+		auto buffers = node->buffers.takeAll();
+		handOff(node, buffers);
 
 	}
 
@@ -119,10 +169,7 @@ namespace add_voxelized{
 
 			for(int i = 0; i < size; i++){
 
-				uint64_t shift_levels = (MORTON_LEVELS - node->level - 1);
-				uint64_t shift = 3 * shift_levels;
-				uint64_t shifted = points[i].mortonCode >> shift;
-				uint64_t childIndex = shifted & 0b111;
+				uint64_t childIndex = morton::childIndexAt(points[i].mortonCode, node->level, MORTON_LEVELS);
 
 				counters[childIndex]++;
 			}
@@ -133,7 +180,7 @@ namespace add_voxelized{
 
 		for(int i = 0; i < 8; i++){
 			int numPoints = counters[i];
-			outputs[i] = make_shared<Buffer>(numPoints * sizeof(Point));
+			outputs[i] = make_shared<Buffer>(numPoints * sizeof(Point), bufferPool);
 		}
 
 		//for(auto pointBuffer : points)
@@ -144,10 +191,7 @@ namespace add_voxelized{
 
 			for(int i = 0; i < size; i++){
 
-				uint64_t shift_levels = (MORTON_LEVELS - node->level - 1);
-				uint64_t shift = 3 * shift_levels;
-				uint64_t shifted = points[i].mortonCode >> shift;
-				uint64_t childIndex = shifted & 0b111;
+				uint64_t childIndex = morton::childIndexAt(points[i].mortonCode, node->level, MORTON_LEVELS);
 
 				//outputs[childIndex].push_back(points[i]);
 
@@ -164,16 +208,6 @@ namespace add_voxelized{
 
 			if(numPoints > 0){
 
-				if(node->children[i] == nullptr){
-					Node* child = new Node();
-					child->name = node->name + to_string(i);
-					child->boundingBox = childBoundingBoxOf(node->boundingBox.min, node->boundingBox.max, i);
-					child->level = node->level + 1;
-					child->index = i;
-
-					node->children[i] = child;
-				}
-
 				Node* child = node->children[i];
 
 				auto points = outputs[i];
@@ -187,26 +221,39 @@ namespace add_voxelized{
 
 		//cout << repeat(" ", 4 * node->level) << "addPoints( " << node->name << ", ..., " << numPoints << ");" << endl;
 
-		// ADD
-		if(node->numPoints <= NODE_CAPACITY){
-			node->points.push_back(points);
-		}
+		uint64_t total = node->numPoints.fetch_add(numPoints) + numPoints;
 
-		node->numPoints += numPoints;
+		if(node->state == INNER){
+			// PASS
+			pass(node, points);
 
-		if(node->name == "r0"){
-			int a = 10;
+			return;
 		}
 
-		if(node->numPoints > NODE_CAPACITY && node->points.size() > 0){
-			// SPLIT
-			split(node);
-		}else if(node->numPoints > NODE_CAPACITY) {
-			// PASS
-			pass(node, points);
+		// ADD
+		node->buffers.push(points);
+
+		int state = node->state;
+
+		if(state == INNER){
+			// split() published INNER after our check, and may have taken the list before our push
+			auto buffers = node->buffers.takeAll();
+			handOff(node, buffers);
+		}else if(state == LEAF && total > NODE_CAPACITY){
+			// SPLIT, if no other thread claimed it first
+			int expected = LEAF;
+			if(node->state.compare_exchange_strong(expected, SPLITTING)){
+				split(node);
+			}
 		}
 
-		
+	}
+
+	// moves the buffers of the leaves to Node::points, after all threads are done
+	void finalize(Node* node){
+		node->traverse([](Node* node){
+			node->points = node->buffers.takeAll();
+		});
 	}
 
 
@@ -224,6 +271,10 @@ namespace add_voxelized{
 
 		auto tStart = now();
 
+		splits = make_shared<TaskPool<PassTask>>(std::thread::hardware_concurrency(), [](shared_ptr<PassTask> task){
+			pass(task->node, task->points);
+		});
+
 		pool = make_shared<TaskPool<Task>>(20, [&metadata, &lasfile, root](shared_ptr<Task> task){
 
 			auto points = LasLoader::loadSync(task->file, task->firstPoint, task->numPoints);
@@ -266,11 +317,13 @@ namespace add_voxelized{
 				mcs[i].index = i;
 			}
 
+			auto zone_sort = Tracer::zone("sort");
 			std::sort(mcs.begin(), mcs.end(), [](MC& a, MC& b){
 				return a.mc < b.mc;
 			});
+			zone_sort.end();
 
-			auto targetBuffer = make_shared<Buffer>(points.buffer->size);
+			auto targetBuffer = make_shared<Buffer>(points.buffer->size, bufferPool);
 			Point* targetPoints = reinterpret_cast<Point*>(targetBuffer->data);
 
 			for(int i = 0; i < points.numPoints; i++){
@@ -278,6 +331,8 @@ namespace add_voxelized{
 			}
 
 
+			auto zone_voxelize = Tracer::zone("voxelize");
+
 			int currentVoxelIndex = -1;
 			int currentVoxelStart = 0;
 			int currentVoxelSize = 0;
@@ -285,7 +340,7 @@ namespace add_voxelized{
 			for(int i = 0; i < points.numPoints; i++){
 			
 				Point point = targetPoints[i];
-				int voxelIndex = point.mortonCode >> 6;
+				int voxelIndex = morton::ancestor(point.mortonCode, 2);
 
 				if(voxelIndex == currentVoxelIndex){
 					currentVoxelSize++;
@@ -305,9 +360,8 @@ namespace add_voxelized{
 
 
 
-			//lock_guard<mutex> lock(mtx_add);
 			//cout << "finished loading node! adding to tree" << endl;
-			//addPoints(root, targetBuffer, points.numPoints);
+			addPoints(root, targetBuffer, points.numPoints);
 
 
 
@@ -329,12 +383,20 @@ namespace add_voxelized{
 		pool->waitTillEmpty();
 		pool->close();
 
+		splits->waitTillEmpty();
+		splits->close();
+
+		finalize(root);
+
 		root->traverse([](Node* node){
 			
-			cout << repeat(" ", 4 * node->level) << node->name << " - points: " << formatNumber(node->numPoints) << endl;
+			cout << repeat(" ", 4 * node->level) << node->name << " - points: " << formatNumber(node->numPoints.load()) << endl;
 
 		});
 
+		// the workers are joined and their caches flushed, return the unused batch memory
+		BufferPool::trimAll();
+
 
 		using namespace std::chrono_literals;
 
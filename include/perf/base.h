@@ -1,6 +1,15 @@
 
 #pragma once
 
+#include "simlod/sampling_cuda_nonprogressive/split_policy.h"
+
+// in-memory builders keep points with 32 bytes each and request about 32MB per node.
+// Leaves are limited to 2^21 points, the most that sample_hash keys can index per child,
+// which is well above the model's threshold of about 1.3M points.
+constexpr SplitPolicy IN_MEMORY_SPLIT_POLICY = SplitPolicy::create(32'000'000.0f, 32.0f, 2'097'152, 0.25f);
+
+static_assert(IN_MEMORY_SPLIT_POLICY.splitThreshold() < IN_MEMORY_SPLIT_POLICY.maxPoints, "leaf size is clamped, not derived from the cost model");
+
 struct LasFile{
 	string path = "";
 	int format = 0;
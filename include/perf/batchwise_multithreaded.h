@@ -4,14 +4,16 @@
 #include <execution>
 
 #include "TaskPool.h"
+#include "Tracer.h"
 
 namespace batchwise_multithreaded{
-	constexpr uint64_t NODE_CAPACITY = 1'000'000;
+	constexpr uint64_t NODE_CAPACITY = IN_MEMORY_SPLIT_POLICY.splitThreshold();
 	constexpr uint64_t MAX_BATCH_SIZE = 1'000'000;
 	constexpr int MORTON_LEVELS = 10;
 	double MORTON_GRID_SIZE = pow(2, MORTON_LEVELS); // 10: 1024
 
 	mutex mtx_add;
+	BufferPool* bufferPool = BufferPool::get("batchwise_multithreaded");
 
 	struct Point {
 		double x;
@@ -93,6 +95,8 @@ namespace batchwise_multithreaded{
 
 	void split(Node* node){
 
+		auto zone = Tracer::zone("split");
+
 		//cout << repeat(" ", 4 * node->level) << "split( " << node->name << ");" << endl;
 		
 		auto pointsList = node->points;
@@ -119,10 +123,7 @@ namespace batchwise_multithreaded{
 
 			for(int i = 0; i < size; i++){
 
-				uint64_t shift_levels = (MORTON_LEVELS - node->level - 1);
-				uint64_t shift = 3 * shift_levels;
-				uint64_t shifted = points[i].mortonCode >> shift;
-				uint64_t childIndex = shifted & 0b111;
+				uint64_t childIndex = morton::childIndexAt(points[i].mortonCode, node->level, MORTON_LEVELS);
 
 				counters[childIndex]++;
 			}
@@ -133,7 +134,7 @@ namespace batchwise_multithreaded{
 
 		for(int i = 0; i < 8; i++){
 			int numPoints = counters[i];
-			outputs[i] = make_shared<Buffer>(numPoints * sizeof(Point));
+			outputs[i] = make_shared<Buffer>(numPoints * sizeof(Point), bufferPool);
 		}
 
 		//for(auto pointBuffer : points)
@@ -144,10 +145,7 @@ namespace batchwise_multithreaded{
 
 			for(int i = 0; i < size; i++){
 
-				uint64_t shift_levels = (MORTON_LEVELS - node->level - 1);
-				uint64_t shift = 3 * shift_levels;
-				uint64_t shifted = points[i].mortonCode >> shift;
-				uint64_t childIndex = shifted & 0b111;
+				uint64_t childIndex = morton::childIndexAt(points[i].mortonCode, node->level, MORTON_LEVELS);
 
 				//outputs[childIndex].push_back(points[i]);
 
@@ -266,19 +264,24 @@ namespace batchwise_multithreaded{
 				mcs[i].index = i;
 			}
 
+			auto zone_sort = Tracer::zone("sort");
 			std::sort(mcs.begin(), mcs.end(), [](MC& a, MC& b){
 				return a.mc < b.mc;
 			});
+			zone_sort.end();
 
-			auto targetBuffer = make_shared<Buffer>(points.buffer->size);
+			auto targetBuffer = make_shared<Buffer>(points.buffer->size, bufferPool);
 			Point* targetPoints = reinterpret_cast<Point*>(targetBuffer->data);
 
 			for(int i = 0; i < points.numPoints; i++){
 				targetPoints[i] = ppoints[mcs[i].index];
 			}
 
+			auto zone_wait = Tracer::zone("wait mtx_add");
 			lock_guard<mutex> lock(mtx_add);
+			zone_wait.end();
 			//cout << "finished loading node! adding to tree" << endl;
+			auto zone_add = Tracer::zone("addPoints");
 			addPoints(root, targetBuffer, points.numPoints);
 
 		});
@@ -0,0 +1,1223 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <fstream>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+
+#include "glm/common.hpp"
+#include "glm/vec3.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include "unsuck.hpp"
+#include "Box.h"
+#include "LasHeader.h"
+#include "LasLoader.h"
+#include "LasAttributes.h"
+#include "TaskPool.h"
+#include "HashSampling.h"
+#include "PoissonSampling.h"
+#include "morton.h"
+#include "Tracer.h"
+#include "Metrics.h"
+#include "Checkpoint.h"
+#include "simlod/sampling_cuda_nonprogressive/split_policy.h"
+
+using nlohmann::json;
+using glm::vec3;
+using glm::dvec3;
+using glm::ivec3;
+
+namespace fs = std::filesystem;
+
+// LOD construction with multiple processes, each holding only a part of the points in memory.
+//
+// The COORDINATOR
+// - counts all points into the 2^COUNTING_LEVEL³ counting grid, over the morton codes of the builders.
+// - partitions the octree into cells, nodes with at most <cellBudget> points or at COUNTING_LEVEL.
+//   A cell is a morton prefix, e.g. 0b101'011 at level 2 is node r53.
+// - assigns contiguous morton ranges of cells with about equal numbers of points to the workers,
+//   writes a job file for each worker and launches the worker processes.
+// - reads the roots of the cells' subtrees, attaches them below the upper levels
+//   and voxelizes the upper levels from the voxels of the cells. The rest of each subtree stays
+//   in its checkpoint, see Hierarchy::subtrees and loadSubtree().
+//
+// A WORKER loads all input but only keeps the points within its cells. It builds the subtree of
+// each cell, voxelizes it with HashSampling or PoissonSampling and writes it to the cell's subtree checkpoint.
+//
+// With Options::attributes, points and voxels carry LAS attributes, one AttributeChannels per node,
+// through the split, the sampling and both kinds of checkpoints.
+//
+// Phase outputs are checkpointed in <workdir>, see CHECKPOINTS. A build that is restarted
+// after it was interrupted continues with the cells that weren't completed.
+//
+// Workers only exchange files with the coordinator: job files in, subtrees and exit codes out.
+// Locally, they are child processes, see Options::launch. On a cluster, launch() would submit the same
+// command to a scheduler, with <workdir> and the input on a shared file system.
+//
+// Nodes split and merge like in batchwise_multithreaded_2, with IN_MEMORY_SPLIT_POLICY. <cellBudget> is at
+// least the policy's maxPoints, so nodes above cells would be split and never merged by a single process
+// as well. The hierarchy, voxels included, is therefore the same for any number of workers, and its
+// nodes have the same size as in a local build.
+namespace distributed{
+
+	constexpr int MORTON_LEVELS = 20;
+	constexpr int COUNTING_LEVEL = 5; // 32³ cells
+	constexpr int CELLS_PER_WORKER = 4;
+	constexpr int64_t MAX_BATCH_SIZE = 1'000'000;
+
+	// same leaf sizes as the local in-memory build, although points are stored with 16 bytes here
+	constexpr SplitPolicy SPLIT_POLICY = IN_MEMORY_SPLIT_POLICY;
+
+	// of the subtree format and the split, part of the checkpoint keys
+	constexpr uint32_t VERSION = 3;
+
+	// layout of LasLoader::loadSync()
+	struct LoadedPoint {
+		double x;
+		double y;
+		double z;
+		uint32_t color;
+		uint32_t padding;
+	};
+
+	using Point = HashSampling::Point;
+
+	// fields of OctreeWriter::CuNode, for HashSampling, SpatialQuery and LasExporter.
+	// Coordinates are relative to Hierarchy::origin.
+	struct Node {
+
+		string name = "";
+		int level = 0;
+		ivec3 coordinate = {0, 0, 0}; // within the 2^level grid of its level
+		vec3 min;
+		vec3 max;
+
+		Node* children[8] = { nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr };
+
+		int numPoints = 0;
+		Point* points = nullptr;
+		int numVoxels = 0;
+		Point* voxels = nullptr;
+
+		// with Options::attributes, indexed like <points> and <voxels>
+		shared_ptr<AttributeChannels> pointAttributes = nullptr;
+		shared_ptr<AttributeChannels> voxelAttributes = nullptr;
+
+		void traverse(function<void(Node*)> callback) {
+
+			callback(this);
+
+			for (auto child : children) {
+				if (child != nullptr) {
+					child->traverse(callback);
+				}
+			}
+
+		}
+	};
+
+	inline void deleteSubtree(Node* node){
+		vector<Node*> nodes;
+		node->traverse([&nodes](Node* node){
+			nodes.push_back(node);
+		});
+
+		for(Node* node : nodes){
+			delete node;
+		}
+	}
+
+	// The nodes below a cell root, in the cell's subtree checkpoint at <path>.
+	// Their records start at <offset>, in pre-order, for the children in <childMask>.
+	struct Subtree {
+		string path = "";
+		int64_t offset = 0;
+		uint32_t childMask = 0;
+		uint32_t attributes = 0;
+		Node* cellRoot = nullptr;
+	};
+
+	// the merged hierarchy, and the buffers that its points and voxels are stored in.
+	// Only the upper levels and the cell roots are in memory, the subtrees below stay on disk until loaded.
+	struct Hierarchy {
+		Node* root = nullptr;
+		dvec3 origin = {0.0, 0.0, 0.0};
+		double cubeSize = 0.0;
+		vector<shared_ptr<Buffer>> buffers;
+		vector<Subtree> subtrees;
+
+		~Hierarchy(){
+			if(root != nullptr){
+				deleteSubtree(root);
+			}
+		}
+	};
+
+	struct Cell {
+		uint64_t prefix = 0; // morton code of the node at <level>
+		int level = 0;
+		uint64_t numPoints = 0;
+		int worker = 0;
+
+		uint64_t firstCode() const {
+			return prefix << (3 * (MORTON_LEVELS - level));
+		}
+
+		uint64_t lastCode() const {
+			return ((prefix + 1) << (3 * (MORTON_LEVELS - level))) - 1;
+		}
+	};
+
+	// a point of a cell, sorted by morton code after the split
+	struct Entry {
+		uint64_t mortonCode;
+		Point point;
+	};
+
+	struct Options {
+		int numWorkers = 4;
+		int threadsPerWorker = 0; // 0: hardware threads divided among the workers
+		uint32_t seed = 0;
+		string workdir = "./distributed";
+
+		// Poisson-disk instead of random samples in inner nodes, see PoissonSampling
+		bool poissonDisk = false;
+		PoissonPolicy poissonPolicy;
+
+		// LasAttribute mask of the attributes that points and voxels carry, e.g. LAS_ALL_ATTRIBUTES
+		uint32_t attributes = 0;
+
+		// continue from the checkpoints in <workdir> that match the input
+		bool resume = true;
+
+		// started as <executable> --distributed-worker <job file>, see main_buildup_perf.cpp
+		string executable = "";
+
+		// runs a worker command and returns its exit code
+		function<int(string)> launch = [](string command){
+			return std::system(command.c_str());
+		};
+	};
+
+	inline uint64_t mortonCodeOf(dvec3 position, dvec3 min, double cubeSize){
+		double gridSize = double(1 << MORTON_LEVELS);
+
+		auto toCell = [&](double value, double min){
+			return uint32_t(std::clamp(gridSize * (value - min) / cubeSize, 0.0, gridSize - 1.0));
+		};
+
+		return morton::encode(toCell(position.x, min.x), toCell(position.y, min.y), toCell(position.z, min.z));
+	}
+
+	// bounds from the coordinate, so that nodes get the same bounds in the workers and the coordinator
+	inline void setBounds(Node* node, double cubeSize){
+		double nodeSize = cubeSize / double(1 << node->level);
+
+		node->min = vec3(dvec3(node->coordinate) * nodeSize);
+		node->max = vec3(dvec3(node->coordinate + 1) * nodeSize);
+	}
+
+	inline Node* createChild(Node* node, int childIndex, double cubeSize){
+		Node* child = new Node();
+		child->name = node->name + to_string(childIndex);
+		child->level = node->level + 1;
+		child->coordinate = 2 * node->coordinate + ivec3((childIndex >> 2) & 1, (childIndex >> 1) & 1, childIndex & 1);
+		setBounds(child, cubeSize);
+
+		node->children[childIndex] = child;
+
+		return child;
+	}
+
+	// e.g. r53 for prefix 0b101'011 at level 2
+	inline string nameOf(uint64_t prefix, int level){
+		string name = "r";
+
+		for(int i = 0; i < level; i++){
+			name += to_string(morton::childIndexAt(prefix, i, level));
+		}
+
+		return name;
+	}
+
+	inline Node* createCellRoot(uint64_t prefix, int level, double cubeSize){
+		Node* node = new Node();
+		node->name = nameOf(prefix, level);
+		node->level = level;
+
+		uint32_t x, y, z;
+		morton::decode(prefix, x, y, z);
+		node->coordinate = {int(x), int(y), int(z)};
+		setBounds(node, cubeSize);
+
+		return node;
+	}
+
+	// calls back with each loaded batch of each file, on <numThreads> threads
+	inline void forEachBatch(const vector<string>& paths, int numThreads, function<void(LasPoints&)> callback, bool keepRecords = false){
+
+		struct Task{
+			string path;
+			int64_t firstPoint;
+		};
+
+		auto pool = make_shared<TaskPool<Task>>(std::max(numThreads, 1), [&callback, keepRecords](shared_ptr<Task> task){
+			auto points = LasLoader::loadSync(task->path, task->firstPoint, MAX_BATCH_SIZE, keepRecords);
+
+			callback(points);
+		});
+
+		pool->queueDepth = &Metrics::gauge("cudalod_queue_depth", "Tasks waiting in a task pool", "pool=\"load\"");
+
+		for(string path : paths){
+			auto header = LasHeader::read(path);
+
+			for(int64_t firstPoint = 0; firstPoint < header.numPoints; firstPoint += MAX_BATCH_SIZE){
+				auto task = make_shared<Task>();
+				task->path = path;
+				task->firstPoint = firstPoint;
+
+				pool->addTask(task);
+			}
+		}
+
+		pool->waitTillEmpty();
+		pool->close();
+	}
+
+	// number of points in each cell of the counting grid, indexed by morton code
+	inline vector<uint64_t> count(const vector<string>& paths, dvec3 min, double cubeSize, int numThreads){
+
+		auto zone = Tracer::zone("count");
+		Metrics::Phase phase("count");
+
+		vector<uint64_t> counts(1ull << (3 * COUNTING_LEVEL), 0);
+		mutex mtx;
+
+		forEachBatch(paths, numThreads, [&](LasPoints& points){
+			vector<uint64_t> local(counts.size(), 0);
+			LoadedPoint* loaded = reinterpret_cast<LoadedPoint*>(points.buffer->data);
+
+			for(int64_t i = 0; i < points.numPoints; i++){
+				uint64_t mortonCode = mortonCodeOf({loaded[i].x, loaded[i].y, loaded[i].z}, min, cubeSize);
+
+				local[morton::ancestor(mortonCode, MORTON_LEVELS - COUNTING_LEVEL)]++;
+			}
+
+			phase.addPoints(double(points.numPoints));
+
+			lock_guard<mutex> lock(mtx);
+			for(int64_t cell = 0; cell < counts.size(); cell++){
+				counts[cell] += local[cell];
+			}
+		});
+
+		return counts;
+	}
+
+	// Cells in morton order. Nodes are split into cells while they have more than <cellBudget> points,
+	// down to the counting grid.
+	inline vector<Cell> partition(const vector<uint64_t>& counts, uint64_t cellBudget){
+
+		// counts of the coarser levels, summed up from the counting grid
+		vector<vector<uint64_t>> levels(COUNTING_LEVEL + 1);
+		levels[COUNTING_LEVEL] = counts;
+
+		for(int level = COUNTING_LEVEL - 1; level >= 0; level--){
+			levels[level].resize(1ull << (3 * level), 0);
+
+			for(uint64_t code = 0; code < levels[level + 1].size(); code++){
+				levels[level][code >> 3] += levels[level + 1][code];
+			}
+		}
+
+		vector<Cell> cells;
+
+		function<void(uint64_t, int)> visit = [&](uint64_t prefix, int level){
+			uint64_t numPoints = levels[level][prefix];
+
+			if(numPoints == 0) return;
+
+			if(numPoints > cellBudget && level < COUNTING_LEVEL){
+				for(int i = 0; i < 8; i++){
+					visit((prefix << 3) | i, level + 1);
+				}
+			}else{
+				Cell cell;
+				cell.prefix = prefix;
+				cell.level = level;
+				cell.numPoints = numPoints;
+
+				cells.push_back(cell);
+			}
+		};
+
+		visit(0, 0);
+
+		return cells;
+	}
+
+	// contiguous runs of cells with about the same number of points per worker
+	inline void assign(vector<Cell>& cells, int numWorkers){
+
+		uint64_t numPoints = 0;
+		for(Cell& cell : cells){
+			numPoints += cell.numPoints;
+		}
+
+		uint64_t before = 0;
+		for(Cell& cell : cells){
+			uint64_t center = before + cell.numPoints / 2;
+
+			cell.worker = std::min(int(center * numWorkers / numPoints), numWorkers - 1);
+			before += cell.numPoints;
+		}
+	}
+
+	// <attributes> of the entries, if any, start at <firstAttribute>
+	inline void setPoints(Node* node, Entry* entries, int64_t numEntries, const AttributeChannels* attributes, int64_t firstAttribute, vector<shared_ptr<Buffer>>& buffers){
+		auto buffer = make_shared<Buffer>(numEntries * sizeof(Point));
+		Point* points = reinterpret_cast<Point*>(buffer->data);
+
+		for(int64_t i = 0; i < numEntries; i++){
+			points[i] = entries[i].point;
+		}
+
+		node->points = points;
+		node->numPoints = numEntries;
+		buffers.push_back(buffer);
+
+		if(attributes != nullptr){
+			node->pointAttributes = make_shared<AttributeChannels>(attributes->slice(firstAttribute, numEntries));
+		}
+	}
+
+	// Builds the subtree of <node> from <numEntries> points, sorted by morton code, with their
+	// <attributes> from <firstAttribute> on, or nullptr. Returns whether <node> is a leaf.
+	//
+	// Workers have the points of a cell sorted by morton code, so a split is a scan over contiguous
+	// ranges instead of the concurrent inserts of batchwise_multithreaded_2. Both split above
+	// SPLIT_POLICY.splitThreshold() and merge sparse siblings bottom-up, so the nodes are the same.
+	inline bool build(Node* node, Entry* entries, int64_t numEntries, const AttributeChannels* attributes, int64_t firstAttribute, double cubeSize, vector<shared_ptr<Buffer>>& buffers){
+
+		if(numEntries <= SPLIT_POLICY.splitThreshold() || node->level == MORTON_LEVELS){
+			setPoints(node, entries, numEntries, attributes, firstAttribute, buffers);
+
+			return true;
+		}
+
+		int64_t numBuffers = buffers.size();
+		bool allLeaves = true;
+		uint32_t numChildren = 0;
+
+		// children are contiguous ranges of the sorted points
+		int64_t first = 0;
+		while(first < numEntries){
+			int childIndex = morton::childIndexAt(entries[first].mortonCode, node->level, MORTON_LEVELS);
+
+			int64_t last = first;
+			while(last < numEntries && morton::childIndexAt(entries[last].mortonCode, node->level, MORTON_LEVELS) == childIndex){
+				last++;
+			}
+
+			Node* child = createChild(node, childIndex, cubeSize);
+			allLeaves = build(child, entries + first, last - first, attributes, firstAttribute + first, cubeSize, buffers) && allLeaves;
+			numChildren++;
+
+			first = last;
+		}
+
+		// MERGE sparse siblings, see batchwise_multithreaded_2::mergeSparse()
+		if(!allLeaves || numEntries > SPLIT_POLICY.maxPoints) return false;
+		if(!SPLIT_POLICY.shouldMerge(uint32_t(numEntries), numChildren)) return false;
+
+		for(Node*& child : node->children){
+			delete child;
+			child = nullptr;
+		}
+
+		buffers.resize(numBuffers);
+		setPoints(node, entries, numEntries, attributes, firstAttribute, buffers);
+
+		return true;
+	}
+
+	// CHECKPOINTS
+	// A build continues from what an earlier run with the same input completed:
+	// - counts.ckpt                the counting grid
+	// - cell_<name>.sorted.ckpt    the sorted points of a cell after the split, until its subtree is done
+	// - cell_<name>.subtree.ckpt   the voxelized subtree of a cell, which Hierarchy::subtrees refer to
+
+	// the input files, as far as their size and modification time tell, and the octree cube
+	inline uint64_t inputKeyOf(const vector<string>& paths, dvec3 min, double cubeSize){
+		Checksum checksum;
+		checksum.add(VERSION);
+		checksum.add(MORTON_LEVELS);
+
+		for(string path : paths){
+			checksum.add(path);
+			checksum.add(uint64_t(fs::file_size(path)));
+			checksum.add(int64_t(fs::last_write_time(path).time_since_epoch().count()));
+		}
+
+		checksum.add(min);
+		checksum.add(cubeSize);
+
+		return checksum.value();
+	}
+
+	// sorted points only depend on the input and the attributes they carry, subtrees also on how their voxels are sampled
+	inline uint64_t sortedKeyOf(uint64_t inputKey, uint32_t attributes, const Cell& cell){
+		Checksum checksum;
+		checksum.add(inputKey);
+		checksum.add(attributes);
+		checksum.add(cell.prefix);
+		checksum.add(int64_t(cell.level));
+
+		return checksum.value();
+	}
+
+	inline uint64_t subtreeKeyOf(uint64_t inputKey, const Options& options, const Cell& cell){
+		Checksum checksum;
+		checksum.add(sortedKeyOf(inputKey, options.attributes, cell));
+		checksum.add(options.seed);
+		checksum.add(options.poissonDisk);
+
+		if(options.poissonDisk){
+			checksum.add(options.poissonPolicy.radiusScale);
+		}
+
+		return checksum.value();
+	}
+
+	// samples of the inner nodes below <root>, with the strategy of <options>
+	inline vector<shared_ptr<Buffer>> voxelize(Node* root, const Options& options, int numThreads){
+		if(options.poissonDisk){
+			return PoissonSampling::voxelize(root, options.poissonPolicy, options.seed, numThreads);
+		}else{
+			return HashSampling::voxelize(root, options.seed, numThreads);
+		}
+	}
+
+	inline string cellPathOf(string workdir, const Cell& cell, string kind){
+		return workdir + "/cell_" + nameOf(cell.prefix, cell.level) + "." + kind + ".ckpt";
+	}
+
+	// size of the channels in <mask> of <count> samples in a checkpoint, each padded to 4 bytes
+	inline int64_t attributeBytesOf(uint32_t mask, int64_t count){
+		int64_t bytes = 0;
+
+		AttributeChannels(mask, 0).forEachChannel([&](uint32_t, auto& channel){
+			bytes += (count * sizeof(channel[0]) + 3) / 4 * 4;
+		});
+
+		return bytes;
+	}
+
+	// the channels in <mask> of <count> samples, zeros for those that <attributes> lacks
+	inline void writeAttributes(Checkpoint::Writer& writer, const AttributeChannels* attributes, uint32_t mask, int64_t count){
+
+		if(mask == 0 || count == 0) return;
+
+		AttributeChannels written(mask, count);
+
+		if(attributes != nullptr){
+			for(int64_t i = 0; i < count; i++){
+				written.copy(i, *attributes, i);
+			}
+		}
+
+		written.forEachChannel([&](uint32_t, auto& channel){
+			int64_t size = count * sizeof(channel[0]);
+			uint8_t padding[4] = {0, 0, 0, 0};
+
+			writer.write(channel.data(), size);
+			writer.write(padding, (4 - size % 4) % 4);
+		});
+	}
+
+	// reads what writeAttributes() wrote, attributeBytesOf(mask, count) bytes at <data>
+	inline shared_ptr<AttributeChannels> readAttributes(const uint8_t* data, uint32_t mask, int64_t count){
+
+		if(mask == 0 || count == 0) return nullptr;
+
+		auto attributes = make_shared<AttributeChannels>(mask, count);
+		int64_t cursor = 0;
+
+		attributes->forEachChannel([&](uint32_t, auto& channel){
+			int64_t size = count * sizeof(channel[0]);
+
+			memcpy(channel.data(), data + cursor, size);
+			cursor += (size + 3) / 4 * 4;
+		});
+
+		return attributes;
+	}
+
+	// Subtree checkpoint of a cell: its prefix and level, then the nodes in pre-order with their
+	// child mask, bounds, points, voxels, and the attributes of points and voxels in <attributes>.
+	// All fields are 4 byte aligned.
+	inline bool writeSubtree(string path, uint64_t key, const Cell& cell, Node* cellRoot, uint32_t attributes){
+
+		auto zone = Tracer::zone("writeSubtree");
+
+		Checkpoint::Writer writer(path, key);
+		writer.write(cell.prefix);
+		writer.write(int64_t(cell.level));
+
+		cellRoot->traverse([&](Node* node){
+			uint32_t childMask = 0;
+			for(int childIndex = 0; childIndex < 8; childIndex++){
+				if(node->children[childIndex] != nullptr){
+					childMask |= 1 << childIndex;
+				}
+			}
+
+			writer.write(childMask);
+			writer.write(node->min);
+			writer.write(node->max);
+			writer.write(int32_t(node->numPoints));
+			writer.write(int32_t(node->numVoxels));
+			writer.write(node->points, node->numPoints * sizeof(Point));
+			writer.write(node->voxels, node->numVoxels * sizeof(Point));
+			writeAttributes(writer, node->pointAttributes.get(), attributes, node->numPoints);
+			writeAttributes(writer, node->voxelAttributes.get(), attributes, node->numVoxels);
+		});
+
+		return writer.close();
+	}
+
+	// cell prefix and level, then the fields of the cell root up to its points
+	constexpr int64_t CELL_ROOT_RECORD_SIZE = 8 + 8 + 4 + 12 + 12 + 4 + 4;
+
+	// The root of the cell's subtree with its points and voxels, or nullptr without a valid checkpoint.
+	// Only reads the cell root, <subtree> tells where the nodes below it are, see loadSubtree().
+	inline Node* readCellRoot(string path, uint64_t key, uint32_t attributes, double cubeSize, vector<shared_ptr<Buffer>>& buffers, Subtree& subtree){
+
+		auto zone = Tracer::zone("readCellRoot");
+
+		if(!Checkpoint::verify(path, key)) return nullptr;
+
+		int64_t fileSize = fs::file_size(path);
+		int64_t cursor = Checkpoint::HEADER_SIZE;
+
+		if(cursor + CELL_ROOT_RECORD_SIZE > fileSize) return nullptr;
+
+		uint8_t record[CELL_ROOT_RECORD_SIZE];
+		readBinaryFile(path, cursor, CELL_ROOT_RECORD_SIZE, record);
+		cursor += CELL_ROOT_RECORD_SIZE;
+
+		int64_t recordCursor = 0;
+		auto read = [&]<typename T>(T& value){
+			memcpy(&value, record + recordCursor, sizeof(T));
+			recordCursor += sizeof(T);
+		};
+
+		uint64_t prefix;
+		int64_t level;
+		uint32_t childMask;
+		read(prefix);
+		read(level);
+		read(childMask);
+
+		Node* cellRoot = createCellRoot(prefix, level, cubeSize);
+		read(cellRoot->min);
+		read(cellRoot->max);
+		read(cellRoot->numPoints);
+		read(cellRoot->numVoxels);
+
+		int64_t numBytes = (int64_t(cellRoot->numPoints) + int64_t(cellRoot->numVoxels)) * sizeof(Point);
+		int64_t numPointAttributeBytes = attributeBytesOf(attributes, cellRoot->numPoints);
+		int64_t numVoxelAttributeBytes = attributeBytesOf(attributes, cellRoot->numVoxels);
+		int64_t numAttributeBytes = numPointAttributeBytes + numVoxelAttributeBytes;
+
+		if(cellRoot->numPoints < 0 || cellRoot->numVoxels < 0 || cursor + numBytes + numAttributeBytes > fileSize){
+			cout << "WARNING: invalid cell root in checkpoint " << path << endl;
+			delete cellRoot;
+
+			return nullptr;
+		}
+
+		if(numBytes > 0){
+			auto buffer = make_shared<Buffer>(numBytes);
+			readBinaryFile(path, cursor, numBytes, buffer->data);
+
+			Point* points = reinterpret_cast<Point*>(buffer->data);
+			cellRoot->points = cellRoot->numPoints > 0 ? points : nullptr;
+			cellRoot->voxels = cellRoot->numVoxels > 0 ? points + cellRoot->numPoints : nullptr;
+
+			buffers.push_back(buffer);
+		}
+
+		if(numAttributeBytes > 0){
+			auto buffer = readBinaryFile(path, cursor + numBytes, numAttributeBytes);
+
+			cellRoot->pointAttributes = readAttributes(buffer->data_u8, attributes, cellRoot->numPoints);
+			cellRoot->voxelAttributes = readAttributes(buffer->data_u8 + numPointAttributeBytes, attributes, cellRoot->numVoxels);
+		}
+
+		subtree.path = path;
+		subtree.offset = cursor + numBytes + numAttributeBytes;
+		subtree.childMask = childMask;
+		subtree.attributes = attributes;
+		subtree.cellRoot = cellRoot;
+
+		return cellRoot;
+	}
+
+	// Reads the nodes below a cell root from its checkpoint and attaches them.
+	// Points and voxels stay in the loaded part of the checkpoint, which is added to <hierarchy.buffers>.
+	inline void loadSubtree(Hierarchy& hierarchy, const Subtree& subtree){
+
+		auto zone = Tracer::zone("loadSubtree");
+
+		if(subtree.childMask == 0) return;
+
+		int64_t size = fs::file_size(subtree.path) - subtree.offset;
+		auto buffer = readBinaryFile(subtree.path, subtree.offset, size);
+
+		int64_t cursor = 0;
+
+		auto read = [&]<typename T>(T& value){
+			memcpy(&value, buffer->data_u8 + cursor, sizeof(T));
+			cursor += sizeof(T);
+		};
+
+		auto readPoints = [&](int32_t count){
+			Point* points = count > 0 ? reinterpret_cast<Point*>(buffer->data_u8 + cursor) : nullptr;
+			cursor += count * sizeof(Point);
+
+			return points;
+		};
+
+		auto readChannels = [&](int32_t count){
+			auto attributes = readAttributes(buffer->data_u8 + cursor, subtree.attributes, count);
+			cursor += attributeBytesOf(subtree.attributes, count);
+
+			return attributes;
+		};
+
+		function<void(Node*, uint32_t)> readChildren = [&](Node* node, uint32_t childMask){
+			for(int childIndex = 0; childIndex < 8; childIndex++){
+				if((childMask & (1 << childIndex)) == 0) continue;
+
+				Node* child = createChild(node, childIndex, hierarchy.cubeSize);
+
+				uint32_t grandchildMask;
+				read(grandchildMask);
+				read(child->min);
+				read(child->max);
+				read(child->numPoints);
+				read(child->numVoxels);
+				child->points = readPoints(child->numPoints);
+				child->voxels = readPoints(child->numVoxels);
+				child->pointAttributes = readChannels(child->numPoints);
+				child->voxelAttributes = readChannels(child->numVoxels);
+
+				readChildren(child, grandchildMask);
+			}
+		};
+
+		readChildren(subtree.cellRoot, subtree.childMask);
+
+		hierarchy.buffers.push_back(buffer);
+	}
+
+	// cmd.exe strips the outer quotes of commands that start with one
+	inline string commandOf(string executable, string jobPath){
+		string command = "\"" + executable + "\" --distributed-worker \"" + jobPath + "\"";
+
+		#if defined(_WIN32)
+		command = "\"" + command + "\"";
+		#endif
+
+		return command;
+	}
+
+	// Builds and voxelizes the subtrees of the cells in <jobPath> that aren't checkpointed, yet.
+	// Returns the exit code of the worker process.
+	inline int runWorker(string jobPath){
+
+		auto tStart = now();
+
+		if(!fs::exists(jobPath)){
+			cout << "ERROR: job file not found: " << jobPath << endl;
+			return 1;
+		}
+
+		auto js = json::parse(readTextFile(jobPath));
+
+		int worker = js["worker"];
+		uint64_t inputKey = js["key"];
+		string workdir = js["workdir"];
+		vector<string> paths = js["files"];
+		dvec3 min = {js["min"][0], js["min"][1], js["min"][2]};
+		double cubeSize = js["cubeSize"];
+		int numThreads = js["threads"];
+
+		Options options;
+		options.seed = js["seed"];
+		options.poissonDisk = js["poissonDisk"];
+		options.poissonPolicy.radiusScale = js["poissonRadius"];
+		options.attributes = js["attributes"];
+
+		vector<Cell> cells;
+		for(auto& jsCell : js["cells"]){
+			Cell cell;
+			cell.prefix = jsCell[0];
+			cell.level = jsCell[1];
+			cell.worker = worker;
+
+			cells.push_back(cell);
+		}
+
+		Tracer::setThreadName("worker " + to_string(worker));
+
+		// progress of this worker, for orchestration that watches for stalled workers
+		Metrics::startWriter(workdir + "/metrics_worker_" + to_string(worker) + ".prom");
+		auto& cellsBuilt = Metrics::counter("cudalod_cells_built_total", "Cells whose subtree was built and written");
+		Metrics::gauge("cudalod_cells", "Cells assigned to this process").set(double(cells.size()));
+
+		// cells that an earlier run didn't complete. Only checks the headers,
+		// the coordinator verifies the subtrees and removes those that are corrupted.
+		vector<int64_t> pending;
+		for(int64_t cellIndex = 0; cellIndex < cells.size(); cellIndex++){
+			Cell& cell = cells[cellIndex];
+
+			if(!Checkpoint::exists(cellPathOf(workdir, cell, "subtree"), subtreeKeyOf(inputKey, options, cell))){
+				pending.push_back(cellIndex);
+			}
+		}
+
+		// SPLIT - the points of cells, sorted by morton code and checkpointed, with their attributes.
+		// Loads all input but only keeps the points within the cells, which are disjoint morton ranges in morton order.
+		// Sorted checkpoint: number of entries, entries, attributes.
+		vector<vector<Entry>> cellEntries(cells.size());
+		vector<AttributeChannels> cellAttributes(cells.size(), AttributeChannels(options.attributes, 0));
+		vector<char> isSorted(cells.size(), false);
+		mutex mtx;
+
+		auto split = [&](vector<int64_t> indices){
+
+			vector<uint64_t> firstCodes;
+			for(int64_t cellIndex : indices){
+				firstCodes.push_back(cells[cellIndex].firstCode());
+			}
+
+			Metrics::Phase filterPhase("filter");
+
+			forEachBatch(paths, numThreads, [&](LasPoints& points){
+				auto zone = Tracer::zone("filter");
+				filterPhase.addPoints(double(points.numPoints));
+
+				vector<vector<Entry>> local(indices.size());
+				vector<AttributeChannels> localAttributes(indices.size(), AttributeChannels(options.attributes, 0));
+				LoadedPoint* loaded = reinterpret_cast<LoadedPoint*>(points.buffer->data);
+
+				shared_ptr<LasAttributes> attributes = nullptr;
+				if(points.records != nullptr){
+					attributes = make_shared<LasAttributes>(points.records, nullptr, 0, points.numPoints);
+					attributes->decode(options.attributes);
+				}
+
+				for(int64_t i = 0; i < points.numPoints; i++){
+					dvec3 position = {loaded[i].x, loaded[i].y, loaded[i].z};
+					uint64_t mortonCode = mortonCodeOf(position, min, cubeSize);
+
+					auto it = std::upper_bound(firstCodes.begin(), firstCodes.end(), mortonCode);
+					if(it == firstCodes.begin()) continue;
+
+					int64_t slot = (it - firstCodes.begin()) - 1;
+					if(mortonCode > cells[indices[slot]].lastCode()) continue;
+
+					Entry entry;
+					entry.mortonCode = mortonCode;
+					entry.point.x = float(position.x - min.x);
+					entry.point.y = float(position.y - min.y);
+					entry.point.z = float(position.z - min.z);
+					entry.point.color = loaded[i].color;
+
+					local[slot].push_back(entry);
+
+					if(attributes != nullptr){
+						localAttributes[slot].push(attributes->decoded, i);
+					}
+				}
+
+				lock_guard<mutex> lock(mtx);
+				for(int64_t slot = 0; slot < indices.size(); slot++){
+					vector<Entry>& entries = cellEntries[indices[slot]];
+					entries.insert(entries.end(), local[slot].begin(), local[slot].end());
+					cellAttributes[indices[slot]].append(localAttributes[slot]);
+				}
+			}, options.attributes != 0);
+
+			filterPhase.end();
+			Metrics::Phase sortPhase("sort");
+
+			HashSampling::parallelRange(indices.size(), numThreads, [&](int64_t first, int64_t last, int threadIndex){
+				for(int64_t slot = first; slot < last; slot++){
+					auto zone = Tracer::zone("sort");
+
+					Cell& cell = cells[indices[slot]];
+					vector<Entry>& entries = cellEntries[indices[slot]];
+					AttributeChannels& attributes = cellAttributes[indices[slot]];
+
+					if(options.attributes != 0){
+						// sort an order instead, then permute entries and attributes with it
+						vector<uint32_t> order(entries.size());
+						for(int64_t i = 0; i < int64_t(order.size()); i++){
+							order[i] = i;
+						}
+
+						std::sort(order.begin(), order.end(), [&entries](uint32_t a, uint32_t b){
+							return entries[a].mortonCode < entries[b].mortonCode;
+						});
+
+						vector<Entry> sorted(entries.size());
+						for(int64_t i = 0; i < int64_t(order.size()); i++){
+							sorted[i] = entries[order[i]];
+						}
+
+						entries = std::move(sorted);
+						attributes = attributes.permute(order);
+					}else{
+						std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){
+							return a.mortonCode < b.mortonCode;
+						});
+					}
+
+					sortPhase.addPoints(double(entries.size()));
+
+					Checkpoint::Writer writer(cellPathOf(workdir, cell, "sorted"), sortedKeyOf(inputKey, options.attributes, cell));
+					writer.write(int64_t(entries.size()));
+					writer.write(entries.data(), entries.size() * sizeof(Entry));
+					writeAttributes(writer, &attributes, options.attributes, entries.size());
+					writer.close();
+
+					isSorted[indices[slot]] = true;
+				}
+			});
+		};
+
+		vector<int64_t> unsorted;
+		for(int64_t cellIndex : pending){
+			if(!Checkpoint::exists(cellPathOf(workdir, cells[cellIndex], "sorted"), sortedKeyOf(inputKey, options.attributes, cells[cellIndex]))){
+				unsorted.push_back(cellIndex);
+			}
+		}
+
+		if(unsorted.size() > 0){
+			split(unsorted);
+		}
+
+		// BUILD and VOXELIZE the pending cells, one at a time
+		uint64_t numPoints = 0;
+
+		for(int64_t cellIndex : pending){
+			Cell& cell = cells[cellIndex];
+			string sortedPath = cellPathOf(workdir, cell, "sorted");
+			vector<Entry>& entries = cellEntries[cellIndex];
+			AttributeChannels& attributes = cellAttributes[cellIndex];
+
+			if(!isSorted[cellIndex]){
+				auto buffer = Checkpoint::read(sortedPath, sortedKeyOf(inputKey, options.attributes, cell));
+
+				if(buffer != nullptr){
+					int64_t numEntries = buffer->get<int64_t>(Checkpoint::HEADER_SIZE);
+					int64_t entriesStart = Checkpoint::HEADER_SIZE + 8;
+					int64_t attributesStart = entriesStart + numEntries * sizeof(Entry);
+
+					entries.resize(numEntries);
+					memcpy(entries.data(), buffer->data_u8 + entriesStart, numEntries * sizeof(Entry));
+
+					auto read = readAttributes(buffer->data_u8 + attributesStart, options.attributes, numEntries);
+					attributes = read != nullptr ? std::move(*read) : AttributeChannels(options.attributes, 0);
+				}else{
+					split({cellIndex});
+				}
+			}
+
+			vector<shared_ptr<Buffer>> buffers;
+			Node* cellRoot = createCellRoot(cell.prefix, cell.level, cubeSize);
+
+			{
+				auto zone = Tracer::zone("build");
+				Metrics::Phase phase("build");
+				build(cellRoot, entries.data(), entries.size(), options.attributes != 0 ? &attributes : nullptr, 0, cubeSize, buffers);
+				phase.addPoints(double(entries.size()));
+			}
+
+			int64_t numCellPoints = entries.size();
+			numPoints += numCellPoints;
+			entries = vector<Entry>();
+			attributes = AttributeChannels();
+
+			Metrics::Phase voxelizePhase("voxelize");
+			auto voxelBuffers = voxelize(cellRoot, options, numThreads);
+			voxelizePhase.addPoints(double(numCellPoints));
+			voxelizePhase.end();
+
+			bool written = writeSubtree(cellPathOf(workdir, cell, "subtree"), subtreeKeyOf(inputKey, options, cell), cell, cellRoot, options.attributes);
+
+			deleteSubtree(cellRoot);
+
+			if(!written){
+				Metrics::stopWriter();
+				return 1;
+			}
+
+			Checkpoint::remove(sortedPath);
+			cellsBuilt.add();
+		}
+
+		Metrics::stopWriter();
+
+		cout << "worker " << worker << ": " << pending.size() << " of " << cells.size() << " cells built, " << formatNumber(numPoints) << " points" << endl;
+		printElapsedTime("worker " + to_string(worker), tStart);
+
+		return 0;
+	}
+
+	// Builds the hierarchy of all files in <metadata> with <options.numWorkers> worker processes.
+	// Returns nullptr if a worker failed.
+	inline shared_ptr<Hierarchy> run(Metadata metadata, Options options){
+
+		auto tStart = now();
+
+		if(options.executable == ""){
+			cout << "ERROR: distributed::run() needs the executable that runs the workers" << endl;
+			return nullptr;
+		}
+
+		int numThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+		int numWorkers = std::max(options.numWorkers, 1);
+		int threadsPerWorker = options.threadsPerWorker > 0 ? options.threadsPerWorker : std::max(numThreads / numWorkers, 1);
+
+		vector<string> paths;
+		for(auto& file : metadata.files){
+			paths.push_back(file.path);
+		}
+
+		Box cube = metadata.boundingBox.cube();
+		double cubeSize = cube.size().x;
+
+		fs::create_directories(options.workdir);
+
+		if(!options.resume){
+			for(const auto& entry : fs::directory_iterator(options.workdir)){
+				if(iEndsWith(entry.path().string(), ".ckpt")){
+					fs::remove(entry.path());
+				}
+			}
+		}
+
+		uint64_t inputKey = inputKeyOf(paths, cube.min, cubeSize);
+
+		// COUNT, unless an earlier run did
+		vector<uint64_t> counts(1ull << (3 * COUNTING_LEVEL), 0);
+		{
+			string countsPath = options.workdir + "/counts.ckpt";
+			auto checkpoint = Checkpoint::read(countsPath, inputKey);
+
+			if(checkpoint != nullptr && checkpoint->size == Checkpoint::HEADER_SIZE + counts.size() * sizeof(uint64_t)){
+				memcpy(counts.data(), checkpoint->data_u8 + Checkpoint::HEADER_SIZE, counts.size() * sizeof(uint64_t));
+			}else{
+				counts = count(paths, cube.min, cubeSize, numThreads);
+				Checkpoint::write(countsPath, inputKey, counts.data(), counts.size() * sizeof(uint64_t));
+			}
+		}
+
+		uint64_t numPoints = 0;
+		for(uint64_t count : counts){
+			numPoints += count;
+		}
+
+		// PARTITION
+		uint64_t cellBudget = std::max(uint64_t(SPLIT_POLICY.maxPoints), numPoints / (CELLS_PER_WORKER * numWorkers));
+
+		auto cells = partition(counts, cellBudget);
+		assign(cells, numWorkers);
+
+		auto& cellsDone = Metrics::gauge("cudalod_cells_done", "Cells whose subtree was read by the coordinator");
+		auto& workersRunning = Metrics::gauge("cudalod_workers_running", "Worker processes that are running");
+		Metrics::gauge("cudalod_cells", "Cells assigned to this process").set(double(cells.size()));
+
+		cout << "distributed: " << formatNumber(numPoints) << " points, " << cells.size() << " cells, " << numWorkers << " workers" << endl;
+
+		auto hierarchy = make_shared<Hierarchy>();
+		hierarchy->origin = cube.min;
+		hierarchy->cubeSize = cubeSize;
+		hierarchy->root = createCellRoot(0, 0, cubeSize);
+
+		// WORKERS build the cells that aren't checkpointed. A checkpoint that fails verification
+		// once it's read is rebuilt in a second round.
+		vector<Node*> cellRoots(cells.size(), nullptr);
+		vector<Subtree> subtrees(cells.size());
+		vector<int> exitCodes(numWorkers, 0);
+
+		for(int round = 0; round < 2; round++){
+
+			vector<bool> launch(numWorkers, false);
+			for(Cell& cell : cells){
+				int64_t cellIndex = &cell - cells.data();
+
+				if(cellRoots[cellIndex] != nullptr) continue;
+
+				bool checkpointed = Checkpoint::exists(cellPathOf(options.workdir, cell, "subtree"), subtreeKeyOf(inputKey, options, cell));
+
+				if(round > 0 || !checkpointed){
+					launch[cell.worker] = true;
+				}
+			}
+
+			vector<string> commands(numWorkers, "");
+			for(int worker = 0; worker < numWorkers; worker++){
+				if(!launch[worker]) continue;
+
+				json jsCells = json::array();
+				uint64_t numWorkerPoints = 0;
+				for(Cell& cell : cells){
+					if(cell.worker != worker) continue;
+
+					jsCells.push_back({cell.prefix, cell.level});
+					numWorkerPoints += cell.numPoints;
+				}
+
+				string jobPath = options.workdir + "/job_" + to_string(worker) + ".json";
+
+				json js;
+				js["worker"] = worker;
+				js["key"] = inputKey;
+				js["workdir"] = options.workdir;
+				js["files"] = paths;
+				js["min"] = {cube.min.x, cube.min.y, cube.min.z};
+				js["cubeSize"] = cubeSize;
+				js["cells"] = jsCells;
+				js["seed"] = options.seed;
+				js["poissonDisk"] = options.poissonDisk;
+				js["poissonRadius"] = options.poissonPolicy.radiusScale;
+				js["attributes"] = options.attributes;
+				js["threads"] = threadsPerWorker;
+
+				writeFile(jobPath, js.dump(4));
+
+				commands[worker] = commandOf(options.executable, jobPath);
+
+				cout << "worker " << worker << ": " << jsCells.size() << " cells, " << formatNumber(numWorkerPoints) << " points" << endl;
+			}
+
+			// LAUNCH
+			{
+				auto zone = Tracer::zone("workers");
+
+				vector<thread> threads;
+				for(int worker = 0; worker < numWorkers; worker++){
+					if(commands[worker] == "") continue;
+
+					threads.emplace_back([&, worker](){
+						workersRunning.add(1.0);
+						exitCodes[worker] = options.launch(commands[worker]);
+						workersRunning.add(-1.0);
+					});
+				}
+
+				for(auto& t : threads){
+					t.join();
+				}
+			}
+
+			// READ the roots of the cells
+			bool complete = true;
+			for(Cell& cell : cells){
+				int64_t cellIndex = &cell - cells.data();
+
+				if(cellRoots[cellIndex] != nullptr) continue;
+
+				string path = cellPathOf(options.workdir, cell, "subtree");
+				cellRoots[cellIndex] = readCellRoot(path, subtreeKeyOf(inputKey, options, cell), options.attributes, cubeSize, hierarchy->buffers, subtrees[cellIndex]);
+
+				// so that the worker of the next round rebuilds it
+				if(cellRoots[cellIndex] == nullptr){
+					Checkpoint::remove(path);
+				}
+
+				complete = complete && cellRoots[cellIndex] != nullptr;
+				cellsDone.add(cellRoots[cellIndex] != nullptr ? 1.0 : 0.0);
+			}
+
+			if(complete) break;
+		}
+
+		for(Cell& cell : cells){
+			int64_t cellIndex = &cell - cells.data();
+
+			if(cellRoots[cellIndex] != nullptr) continue;
+
+			cout << "ERROR: worker " << cell.worker << " failed with exit code " << exitCodes[cell.worker] << ", no subtree of cell " << nameOf(cell.prefix, cell.level) << endl;
+
+			for(Node* cellRoot : cellRoots){
+				if(cellRoot != nullptr){
+					deleteSubtree(cellRoot);
+				}
+			}
+
+			return nullptr;
+		}
+
+		// MERGE the cells below the upper levels
+		for(Node* cellRoot : cellRoots){
+
+			if(cellRoot->level == 0){
+				// the whole data set fit into a single cell
+				delete hierarchy->root;
+				hierarchy->root = cellRoot;
+
+				break;
+			}
+
+			uint64_t prefix = morton::encode(cellRoot->coordinate.x, cellRoot->coordinate.y, cellRoot->coordinate.z);
+
+			Node* node = hierarchy->root;
+			for(int level = 0; level < cellRoot->level - 1; level++){
+				int childIndex = morton::childIndexAt(prefix, level, cellRoot->level);
+
+				if(node->children[childIndex] == nullptr){
+					createChild(node, childIndex, cubeSize);
+				}
+
+				node = node->children[childIndex];
+			}
+
+			node->children[morton::childIndexAt(prefix, cellRoot->level - 1, cellRoot->level)] = cellRoot;
+		}
+
+		hierarchy->subtrees = subtrees;
+
+		// VOXELIZE the upper levels. Cells are already voxelized by the workers, and without
+		// their subtrees loaded, the scheduler takes them for leaves.
+		{
+			auto zone = Tracer::zone("voxelize upper levels");
+
+			auto buffers = voxelize(hierarchy->root, options, numThreads);
+			hierarchy->buffers.insert(hierarchy->buffers.end(), buffers.begin(), buffers.end());
+		}
+
+		cout << "====================================" << endl;
+		cout << "# DISTRIBUTED" << endl;
+		printElapsedTime("# duration", tStart);
+		cout << "====================================" << endl;
+
+		return hierarchy;
+	}
+
+}
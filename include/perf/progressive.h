@@ -0,0 +1,573 @@
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+
+#include "ConcurrentSparseGrid.h"
+#include "Tracer.h"
+
+// Progressive, coarse-first LOD construction on the CPU.
+// Counterpart of main_topDownSampling() in modules/simlod/sampling_cuda/kernel_moduled.cu.
+//
+// Points are ingested in batches. Each batch is
+// - COUNTed into the current leaves, leaves that would exceed SPLIT_POLICY.splitThreshold() are SPLIT
+//   and their points are pushed back into the workload, until no more splits are needed.
+// - inserted into the leaves, which keep all points at full resolution.
+// - sampled into voxel grids of the upper NUM_SAMPLED_LEVELS levels (128³ voxels per node).
+//   The batch is first reduced with a ConcurrentSparseGrid, then merged into the persistent per-node grids.
+//
+// After each batch, an immutable Snapshot of the upper levels is published. Snapshots only
+// share unchanged voxel lists with their predecessors, so a viewer or server can hold on to
+// one while ingestion continues and always sees a consistent state of a whole batch.
+namespace progressive{
+
+	// leaves are streamed to viewers, so they are sized for I/O like the GPU octree, but with 32 byte points
+	constexpr SplitPolicy SPLIT_POLICY = SplitPolicy::create(SplitPolicy().targetBytes(), 32.0f, 50'000);
+	constexpr uint64_t MAX_BATCH_SIZE = 1'000'000;
+	constexpr int MAX_OCTREE_DEPTH = 20;
+	constexpr int NUM_SAMPLED_LEVELS = 3;
+	constexpr int SAMPLE_GRID_BITS = 7; // 128³ voxels per node
+	constexpr int SAMPLE_GRID_SIZE = 1 << SAMPLE_GRID_BITS;
+
+	// layout of LasLoader::loadSync()
+	struct Point {
+		double x;
+		double y;
+		double z;
+		uint32_t color;
+		uint32_t padding;
+	};
+
+	struct Voxel {
+		dvec3 position;
+		uint32_t color;
+		uint32_t numPoints;
+	};
+
+	struct Node {
+
+		string name = "";
+		int level = 0;
+		int index = 0;
+		ivec3 coordinate = {0, 0, 0}; // within the 2^level grid of this level
+		Box boundingBox;
+
+		// points of leaves. Inner nodes are summarized by the voxels of their level.
+		uint64_t numPoints = 0;
+		vector<Point> points;
+
+		Node* children[8] = { nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr , nullptr };
+
+		// per batch
+		atomic<uint64_t> numNewPoints = 0;
+		atomic<uint64_t> insertCursor = 0;
+
+		bool isLeaf(){
+			return children[0] == nullptr;
+		}
+
+		void traverse(function<void(Node*)> callback) {
+
+			callback(this);
+
+			for (auto child : children) {
+				if (child != nullptr) {
+					child->traverse(callback);
+				}
+			}
+
+		}
+	};
+
+	// accumulated color of all points that fell into a voxel so far
+	struct VoxelSum {
+		uint64_t R = 0;
+		uint64_t G = 0;
+		uint64_t B = 0;
+		uint64_t count = 0;
+	};
+
+	// persistent voxel grid of one node in the upper levels
+	struct SampledNode {
+		unordered_map<uint32_t, VoxelSum> cells; // key: ix | iy << 7 | iz << 14
+		bool dirty = false;
+		shared_ptr<const vector<Voxel>> published = make_shared<vector<Voxel>>();
+	};
+
+	struct SnapshotNode {
+		string name = "";
+		int level = 0;
+		Box boundingBox;
+		uint64_t numPoints = 0; // all points ingested into this subtree so far
+		bool isLeaf = true;
+		uint8_t childMask = 0;
+		shared_ptr<const vector<Voxel>> voxels;
+	};
+
+	struct Snapshot {
+		int64_t batchIndex = -1;
+		uint64_t numPointsIngested = 0;
+		uint64_t numVoxels = 0;
+		double timestamp = 0.0;
+		vector<SnapshotNode> nodes; // depth-first pre-order
+	};
+
+	inline Box childBoundingBoxOf(dvec3 min, dvec3 max, int index) {
+		Box box;
+		auto size = max - min;
+		dvec3 center = min + (size * 0.5);
+
+		if ((index & 0b100) == 0) {
+			box.min.x = min.x;
+			box.max.x = center.x;
+		} else {
+			box.min.x = center.x;
+			box.max.x = max.x;
+		}
+
+		if ((index & 0b010) == 0) {
+			box.min.y = min.y;
+			box.max.y = center.y;
+		} else {
+			box.min.y = center.y;
+			box.max.y = max.y;
+		}
+
+		if ((index & 0b001) == 0) {
+			box.min.z = min.z;
+			box.max.z = center.z;
+		} else {
+			box.min.z = center.z;
+			box.max.z = max.z;
+		}
+
+		return box;
+	}
+
+	struct Builder {
+
+		Box cube;
+		int numThreads = 1;
+		Node* root = nullptr;
+
+		int64_t numBatches = 0;
+		uint64_t numPointsIngested = 0;
+		double tStart = 0.0;
+
+		// [level][nx | ny << 20 | nz << 40]
+		unordered_map<uint64_t, SampledNode> sampledNodes[NUM_SAMPLED_LEVELS];
+		shared_ptr<ConcurrentSparseGrid> batchGrid = nullptr;
+
+		mutex mtx_snapshot;
+		shared_ptr<const Snapshot> snapshot = make_shared<Snapshot>();
+
+		// invoked on the ingesting thread, after each published snapshot
+		function<void(shared_ptr<const Snapshot>)> onSnapshot = nullptr;
+
+		Builder(Box boundingBox, int numThreads){
+			this->cube = boundingBox.cube();
+			this->numThreads = std::max(numThreads, 1);
+			this->tStart = now();
+
+			root = new Node();
+			root->name = "r";
+			root->level = 0;
+			root->boundingBox = cube;
+		}
+
+		~Builder(){
+			vector<Node*> nodes;
+			root->traverse([&nodes](Node* node){
+				nodes.push_back(node);
+			});
+
+			for(auto node : nodes){
+				delete node;
+			}
+		}
+
+		// latest published snapshot. Safe to call from any thread.
+		shared_ptr<const Snapshot> getSnapshot(){
+			lock_guard<mutex> lock(mtx_snapshot);
+
+			return snapshot;
+		}
+
+		// position in the 2^MAX_OCTREE_DEPTH grid over the root cube
+		ivec3 toGridCoordinate(const Point& point){
+			double factor = double(1 << MAX_OCTREE_DEPTH);
+			double cubeSize = cube.max.x - cube.min.x;
+			int maxCoordinate = (1 << MAX_OCTREE_DEPTH) - 1;
+
+			ivec3 coordinate;
+			coordinate.x = std::clamp(int(factor * (point.x - cube.min.x) / cubeSize), 0, maxCoordinate);
+			coordinate.y = std::clamp(int(factor * (point.y - cube.min.y) / cubeSize), 0, maxCoordinate);
+			coordinate.z = std::clamp(int(factor * (point.z - cube.min.z) / cubeSize), 0, maxCoordinate);
+
+			return coordinate;
+		}
+
+		Node* findLeaf(const Point& point){
+			ivec3 coordinate = toGridCoordinate(point);
+			Node* node = root;
+
+			while(!node->isLeaf()){
+				int shift = MAX_OCTREE_DEPTH - node->level - 1;
+				int cx = (coordinate.x >> shift) & 1;
+				int cy = (coordinate.y >> shift) & 1;
+				int cz = (coordinate.z >> shift) & 1;
+
+				node = node->children[(cx << 2) | (cy << 1) | (cz << 0)];
+			}
+
+			return node;
+		}
+
+		void split(Node* node, vector<Point>& workload){
+
+			for(int childIndex = 0; childIndex < 8; childIndex++){
+				Node* child = new Node();
+				child->name = node->name + to_string(childIndex);
+				child->level = node->level + 1;
+				child->index = childIndex;
+				child->coordinate = 2 * node->coordinate + ivec3((childIndex >> 2) & 1, (childIndex >> 1) & 1, childIndex & 1);
+				child->boundingBox = childBoundingBoxOf(node->boundingBox.min, node->boundingBox.max, childIndex);
+
+				node->children[childIndex] = child;
+			}
+
+			// points of the former leaf are distributed to the new children by the next COUNT
+			workload.insert(workload.end(), node->points.begin(), node->points.end());
+			node->points = vector<Point>();
+			node->numPoints = 0;
+		}
+
+		void insert(Point* batch, int64_t batchSize){
+
+			vector<Point> workload(batch, batch + batchSize);
+			vector<Node*> leaves;
+			vector<Node*> touched;
+
+			// COUNT & SPLIT until all leaves can hold their new points
+			while(true){
+
+				auto zone_count = Tracer::zone("count");
+				leaves.resize(workload.size());
+				ConcurrentSparseGrid::parallelRange(workload.size(), numThreads, [&](uint64_t first, uint64_t last){
+					for(uint64_t i = first; i < last; i++){
+						Node* leaf = findLeaf(workload[i]);
+						leaf->numNewPoints.fetch_add(1, memory_order_relaxed);
+						leaves[i] = leaf;
+					}
+				});
+
+				touched.clear();
+				root->traverse([&touched](Node* node){
+					if(node->numNewPoints > 0) touched.push_back(node);
+				});
+
+				zone_count.end();
+
+				auto zone_split = Tracer::zone("split");
+				bool splitAny = false;
+				for(Node* node : touched){
+					bool exceedsThreshold = node->numPoints + node->numNewPoints > SPLIT_POLICY.splitThreshold();
+					bool canSplit = node->level < MAX_OCTREE_DEPTH;
+
+					if(exceedsThreshold && canSplit){
+						split(node, workload);
+						splitAny = true;
+					}
+				}
+
+				if(!splitAny) break;
+
+				for(Node* node : touched){
+					node->numNewPoints = 0;
+				}
+			}
+
+			// INSERT
+			auto zone_insert = Tracer::zone("insert");
+			for(Node* node : touched){
+				node->insertCursor = node->points.size();
+				node->points.resize(node->points.size() + node->numNewPoints);
+			}
+
+			ConcurrentSparseGrid::parallelRange(workload.size(), numThreads, [&](uint64_t first, uint64_t last){
+				for(uint64_t i = first; i < last; i++){
+					Node* leaf = leaves[i];
+					uint64_t target = leaf->insertCursor.fetch_add(1, memory_order_relaxed);
+					leaf->points[target] = workload[i];
+				}
+			});
+
+			for(Node* node : touched){
+				node->numPoints += node->numNewPoints;
+				node->numNewPoints = 0;
+			}
+		}
+
+		// accumulates the batch into the voxel grids of the upper levels.
+		// Only the new points are sampled. Points redistributed by a split already were, in an earlier batch.
+		void sample(Point* batch, int64_t batchSize){
+
+			auto zone = Tracer::zone("voxelize");
+
+			for(int level = 0; level < NUM_SAMPLED_LEVELS; level++){
+
+				uint64_t gridSize = uint64_t(SAMPLE_GRID_SIZE) << level;
+				uint64_t numCells = gridSize * gridSize * gridSize;
+				uint64_t capacity = ConcurrentSparseGrid::estimateCapacity(batchSize, numCells);
+
+				if(batchGrid == nullptr || batchGrid->capacity < capacity){
+					batchGrid = make_shared<ConcurrentSparseGrid>(capacity, numThreads);
+				}else{
+					batchGrid->clear(numThreads);
+				}
+
+				int shift = MAX_OCTREE_DEPTH - SAMPLE_GRID_BITS - level;
+
+				ConcurrentSparseGrid::parallelRange(batchSize, numThreads, [&](uint64_t first, uint64_t last){
+					for(uint64_t i = first; i < last; i++){
+						ivec3 coordinate = toGridCoordinate(batch[i]) >> shift;
+
+						batchGrid->add(coordinate.x, coordinate.y, coordinate.z, batch[i].color);
+					}
+				});
+
+				auto cells = batchGrid->extract(numThreads);
+				auto& nodes = sampledNodes[level];
+
+				for(auto& cell : cells){
+					uint32_t ix, iy, iz, unused;
+					ConcurrentSparseGrid::fromKey(cell.key, ix, iy, iz, unused);
+
+					uint64_t nx = ix >> SAMPLE_GRID_BITS;
+					uint64_t ny = iy >> SAMPLE_GRID_BITS;
+					uint64_t nz = iz >> SAMPLE_GRID_BITS;
+					uint64_t nodeKey = nx | (ny << 20) | (nz << 40);
+
+					uint32_t mask = SAMPLE_GRID_SIZE - 1;
+					uint32_t cellKey = (ix & mask) | ((iy & mask) << SAMPLE_GRID_BITS) | ((iz & mask) << (2 * SAMPLE_GRID_BITS));
+
+					SampledNode& node = nodes[nodeKey];
+					VoxelSum& sum = node.cells[cellKey];
+					sum.R += cell.R;
+					sum.G += cell.G;
+					sum.B += cell.B;
+					sum.count += cell.weight;
+
+					node.dirty = true;
+				}
+			}
+		}
+
+		// rebuilds the voxel lists of nodes that changed in the last batch
+		void publishVoxels(int level, uint64_t nodeKey, SampledNode& node){
+
+			uint64_t nx = (nodeKey >>  0) & 0xfffff;
+			uint64_t ny = (nodeKey >> 20) & 0xfffff;
+			uint64_t nz = (nodeKey >> 40) & 0xfffff;
+
+			double nodeSize = (cube.max.x - cube.min.x) / double(1 << level);
+			double voxelSize = nodeSize / double(SAMPLE_GRID_SIZE);
+			dvec3 nodeMin = cube.min + dvec3(nx, ny, nz) * nodeSize;
+
+			auto voxels = make_shared<vector<Voxel>>();
+			voxels->reserve(node.cells.size());
+
+			uint32_t mask = SAMPLE_GRID_SIZE - 1;
+			for(auto& [cellKey, sum] : node.cells){
+				uint32_t ix = (cellKey >> 0) & mask;
+				uint32_t iy = (cellKey >> SAMPLE_GRID_BITS) & mask;
+				uint32_t iz = (cellKey >> (2 * SAMPLE_GRID_BITS)) & mask;
+
+				uint32_t R = (sum.R / sum.count) & 0xff;
+				uint32_t G = (sum.G / sum.count) & 0xff;
+				uint32_t B = (sum.B / sum.count) & 0xff;
+
+				Voxel voxel;
+				voxel.position = nodeMin + (dvec3(ix, iy, iz) + 0.5) * voxelSize;
+				voxel.color = R | (G << 8) | (B << 16);
+				voxel.numPoints = sum.count;
+
+				voxels->push_back(voxel);
+			}
+
+			node.published = voxels;
+			node.dirty = false;
+		}
+
+		void publishSnapshot(){
+
+			auto zone = Tracer::zone("publish snapshot");
+
+			vector<uint64_t> dirtyKeys[NUM_SAMPLED_LEVELS];
+			for(int level = 0; level < NUM_SAMPLED_LEVELS; level++){
+				for(auto& [nodeKey, node] : sampledNodes[level]){
+					if(node.dirty) dirtyKeys[level].push_back(nodeKey);
+				}
+			}
+
+			for(int level = 0; level < NUM_SAMPLED_LEVELS; level++){
+				auto& keys = dirtyKeys[level];
+
+				ConcurrentSparseGrid::parallelRange(keys.size(), numThreads, [&](uint64_t first, uint64_t last){
+					for(uint64_t i = first; i < last; i++){
+						publishVoxels(level, keys[i], sampledNodes[level].find(keys[i])->second);
+					}
+				});
+			}
+
+			auto next = make_shared<Snapshot>();
+			next->batchIndex = numBatches - 1;
+			next->numPointsIngested = numPointsIngested;
+			next->timestamp = now() - tStart;
+
+			function<uint64_t(Node*)> addNode = [&](Node* node) -> uint64_t {
+
+				int64_t index = next->nodes.size();
+				next->nodes.push_back(SnapshotNode());
+
+				uint64_t numPoints = node->numPoints;
+				uint8_t childMask = 0;
+
+				for(int childIndex = 0; childIndex < 8; childIndex++){
+					Node* child = node->children[childIndex];
+
+					if(child == nullptr) continue;
+
+					if(child->level < NUM_SAMPLED_LEVELS){
+						uint64_t numChildPoints = addNode(child);
+
+						if(numChildPoints > 0){
+							childMask |= 1 << childIndex;
+						}
+
+						numPoints += numChildPoints;
+					}else{
+						uint64_t numChildPoints = 0;
+						child->traverse([&numChildPoints](Node* descendant){
+							numChildPoints += descendant->numPoints;
+						});
+
+						numPoints += numChildPoints;
+					}
+				}
+
+				uint64_t nodeKey = uint64_t(node->coordinate.x) | (uint64_t(node->coordinate.y) << 20) | (uint64_t(node->coordinate.z) << 40);
+				auto& nodes = sampledNodes[node->level];
+				auto it = nodes.find(nodeKey);
+
+				SnapshotNode& snode = next->nodes[index];
+				snode.name = node->name;
+				snode.level = node->level;
+				snode.boundingBox = node->boundingBox;
+				snode.numPoints = numPoints;
+				snode.isLeaf = node->isLeaf();
+				snode.childMask = childMask;
+				snode.voxels = it != nodes.end() ? it->second.published : make_shared<vector<Voxel>>();
+
+				next->numVoxels += snode.voxels->size();
+
+				return numPoints;
+			};
+
+			addNode(root);
+
+			// drop empty nodes, keep pre-order
+			std::erase_if(next->nodes, [](SnapshotNode& node){
+				return node.numPoints == 0 && node.name != "r";
+			});
+
+			{
+				lock_guard<mutex> lock(mtx_snapshot);
+				snapshot = next;
+			}
+
+			if(onSnapshot != nullptr){
+				onSnapshot(next);
+			}
+		}
+
+		void ingest(Point* batch, int64_t batchSize){
+
+			auto zone = Tracer::zone("ingest");
+
+			insert(batch, batchSize);
+			sample(batch, batchSize);
+
+			numBatches++;
+			numPointsIngested += batchSize;
+
+			Tracer::counter("points ingested", double(numPointsIngested));
+
+			publishSnapshot();
+		}
+
+	};
+
+	void run(Metadata metadata, LasFile lasfile){
+
+		cout << "loading " << lasfile.path << endl;
+		cout << "#points: " << lasfile.numPoints << endl;
+
+		int numThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+		Builder builder(metadata.boundingBox, numThreads);
+
+		builder.onSnapshot = [](shared_ptr<const Snapshot> snapshot){
+			cout << "snapshot " << snapshot->batchIndex
+				<< " after " << snapshot->timestamp << "s"
+				<< ", points: " << formatNumber(snapshot->numPointsIngested)
+				<< ", nodes: " << snapshot->nodes.size()
+				<< ", voxels: " << formatNumber(snapshot->numVoxels) << endl;
+		};
+
+		auto tStart = now();
+
+		// load the next batch while the current one is ingested
+		LasPoints next = LasLoader::loadSync(lasfile.path, 0, MAX_BATCH_SIZE);
+
+		for(int64_t firstPoint = 0; firstPoint < lasfile.numPoints; firstPoint += MAX_BATCH_SIZE){
+
+			LasPoints current = next;
+			int64_t nextFirstPoint = firstPoint + MAX_BATCH_SIZE;
+
+			thread loader([&](){
+				Tracer::setThreadName("loader");
+
+				if(nextFirstPoint < lasfile.numPoints){
+					next = LasLoader::loadSync(lasfile.path, nextFirstPoint, MAX_BATCH_SIZE);
+				}
+			});
+
+			Point* points = reinterpret_cast<Point*>(current.buffer->data);
+			builder.ingest(points, current.numPoints);
+
+			loader.join();
+		}
+
+		uint64_t numNodes = 0;
+		uint64_t numLeaves = 0;
+		builder.root->traverse([&](Node* node){
+			numNodes++;
+			if(node->isLeaf()) numLeaves++;
+		});
+
+		cout << "#nodes: " << formatNumber(numNodes) << ", #leaves: " << formatNumber(numLeaves) << endl;
+
+		cout << "done" << endl;
+
+		cout << "====================================" << endl;
+		cout << "# PROGRESSIVE" << endl;
+		printElapsedTime("# duration", tStart);
+		cout << "====================================" << endl;
+
+	}
+
+}
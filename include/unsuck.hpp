@@ -20,6 +20,8 @@
 #include <functional>
 #include <mutex>
 
+#include "BufferPool.h"
+
 using std::cout;
 using std::endl;
 using std::to_string;
@@ -73,6 +75,14 @@ MemoryData getMemoryData();
 
 CpuData getCpuData();
 
+// NUMA topology. Systems without NUMA support report a single node 0 with all processors.
+int getNumaNodeCount();
+
+int getNumaNodeProcessorCount(int node);
+
+// restricts the calling thread to the processors of <node>, returns false if that's not possible
+bool pinThreadToNumaNode(int node);
+
 void printMemoryReport();
 
 void launchMemoryChecker(int64_t maxMB, double checkInterval);
@@ -114,12 +124,15 @@ struct Buffer {
 	int64_t size = 0;
 	int64_t pos = 0;
 
+	// owner of data, nullptr if data was not allocated by the buffer
+	BufferPool* pool = nullptr;
+
 	Buffer() {
 		this->id = Buffer::createID();
 	}
 
-	Buffer(int64_t size) {
-		data = malloc(size);
+	Buffer(int64_t size, BufferPool* pool = BufferPool::global()) {
+		data = pool->allocate(size);
 
 		if (data == nullptr) {
 			auto memory = getMemoryData();
@@ -160,22 +173,45 @@ struct Buffer {
 		data_char = reinterpret_cast<char*>(data);
 
 		this->size = size;
+		this->pool = pool;
 
 		this->id = Buffer::createID();
 	}
 
-	static int createID(){
-		static int64_t counter = 0;
+	// view of memory that the buffer doesn't own, e.g. a slot of a SharedRing
+	Buffer(void* data, int64_t size) {
+		this->data = data;
+		data_u8 = reinterpret_cast<uint8_t*>(data);
+		data_u16 = reinterpret_cast<uint16_t*>(data);
+		data_u32 = reinterpret_cast<uint32_t*>(data);
+		data_u64 = reinterpret_cast<uint64_t*>(data);
+		data_i8 = reinterpret_cast<int8_t*>(data);
+		data_i16 = reinterpret_cast<int16_t*>(data);
+		data_i32 = reinterpret_cast<int32_t*>(data);
+		data_i64 = reinterpret_cast<int64_t*>(data);
+		data_f32 = reinterpret_cast<float*>(data);
+		data_f64 = reinterpret_cast<double*>(data);
+		data_char = reinterpret_cast<char*>(data);
+
+		this->size = size;
+		this->pool = nullptr;
+
+		this->id = Buffer::createID();
+	}
 
-		int id = int(counter);
+	// buffers are created by many threads at once
+	static int createID(){
+		static std::atomic<int64_t> counter = 0;
 
-		counter++;
+		int id = int(counter.fetch_add(1));
 
 		return id;
 	}
 
 	~Buffer() {
-		free(data);
+		if(pool != nullptr){
+			pool->release(data, size);
+		}
 	}
 
 	template<class T>
@@ -159,12 +159,138 @@ CpuData getCpuData() {
 	return data;
 }
 
+int getNumaNodeCount(){
+	ULONG highestNode = 0;
+
+	if(!GetNumaHighestNodeNumber(&highestNode)){
+		return 1;
+	}
+
+	return highestNode + 1;
+}
+
+int getNumaNodeProcessorCount(int node){
+	GROUP_AFFINITY affinity;
+
+	if(!GetNumaNodeProcessorMaskEx(USHORT(node), &affinity)){
+		return node == 0 ? std::thread::hardware_concurrency() : 0;
+	}
+
+	return std::popcount(uint64_t(affinity.Mask));
+}
+
+bool pinThreadToNumaNode(int node){
+	GROUP_AFFINITY affinity;
+
+	if(!GetNumaNodeProcessorMaskEx(USHORT(node), &affinity) || affinity.Mask == 0){
+		return false;
+	}
+
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+// large pages need the SeLockMemoryPrivilege ("Lock pages in memory"), fall back to regular pages otherwise
+void* allocatePages(int64_t size, bool hugePages, int numaNode){
+
+	HANDLE process = GetCurrentProcess();
+	DWORD preferred = numaNode >= 0 ? DWORD(numaNode) : NUMA_NO_PREFERRED_NODE;
+
+	if(hugePages){
+		SIZE_T largePageSize = GetLargePageMinimum();
+
+		if(largePageSize > 0){
+			SIZE_T roundedSize = ((size + largePageSize - 1) / largePageSize) * largePageSize;
+			void* data = VirtualAllocExNuma(process, nullptr, roundedSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, preferred);
+
+			if(data != nullptr) return data;
+		}
+	}
+
+	return VirtualAllocExNuma(process, nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, preferred);
+}
+
+void freePages(void* data, int64_t size){
+	VirtualFree(data, 0, MEM_RELEASE);
+}
+
+// page file backed section in the session namespace, removed once the last handle is closed
+void* mapSharedMemory(string name, int64_t& size, bool create, void*& handle){
+
+	string sectionName = "Local\\" + name;
+	HANDLE section = nullptr;
+
+	if(create){
+		section = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 
+			DWORD(uint64_t(size) >> 32), DWORD(uint64_t(size) & 0xffffffff), sectionName.c_str());
+
+		if(section != nullptr && GetLastError() == ERROR_ALREADY_EXISTS){
+			CloseHandle(section);
+			section = nullptr;
+		}
+	}else{
+		section = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, sectionName.c_str());
+	}
+
+	if(section == nullptr) return nullptr;
+
+	void* data = MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, create ? size : 0);
+
+	if(data == nullptr){
+		CloseHandle(section);
+		return nullptr;
+	}
+
+	if(!create){
+		MEMORY_BASIC_INFORMATION info;
+		VirtualQuery(data, &info, sizeof(info));
+		size = info.RegionSize;
+	}
+
+	handle = section;
+
+	return data;
+}
+
+void unmapSharedMemory(void* data, int64_t size, void* handle){
+	UnmapViewOfFile(data);
+	CloseHandle(handle);
+}
+
+void removeSharedMemory(string name){
+	// sections don't have a name outside of the processes that hold them
+}
+
+int64_t getProcessId(){
+	return GetCurrentProcessId();
+}
+
+bool isProcessRunning(int64_t pid){
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, DWORD(pid));
+
+	// exists, but belongs to someone else
+	if(process == nullptr) return GetLastError() == ERROR_ACCESS_DENIED;
+
+	bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+
+	return running;
+}
+
 #elif defined(__linux__)
 
 // see https://stackoverflow.com/questions/63166/how-to-determine-cpu-and-memory-consumption-from-inside-a-process
 
 #include "sys/types.h"
 #include "sys/sysinfo.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "sys/syscall.h"
+#include "fcntl.h"
+#include "sched.h"
+#include "pthread.h"
+#include "unistd.h"
+#include "signal.h"
+#include "errno.h"
 
 #include "stdlib.h"
 #include "stdio.h"
@@ -370,5 +496,192 @@ CpuData getCpuData() {
 	return data;
 }
 
+// sysfs lists like "0-15,32-47"
+static vector<int> parseSysfsList(string list){
+	vector<int> values;
+
+	std::stringstream ss(list);
+	string range;
+	while(std::getline(ss, range, ',')){
+		if(range.empty()) continue;
+
+		size_t dash = range.find('-');
+		int first = stoi(range.substr(0, dash));
+		int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+
+		for(int i = first; i <= last; i++){
+			values.push_back(i);
+		}
+	}
+
+	return values;
+}
+
+// NUMA topology from sysfs, so that we don't depend on libnuma.
+// Like on Windows, this is the highest node number + 1. Node numbers may have gaps, e.g. "0,2",
+// nodes in the gaps have no processors.
+int getNumaNodeCount(){
+	std::ifstream file("/sys/devices/system/node/online");
+	string online;
+
+	if(!std::getline(file, online)){
+		return 1;
+	}
+
+	vector<int> nodes = parseSysfsList(online);
+
+	if(nodes.empty()){
+		return 1;
+	}
+
+	return *std::max_element(nodes.begin(), nodes.end()) + 1;
+}
+
+static vector<int> getNumaNodeProcessors(int node){
+	vector<int> processors;
+
+	std::ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+	string cpulist;
+
+	if(!std::getline(file, cpulist)){
+		if(node == 0){
+			for(int i = 0; i < int(std::thread::hardware_concurrency()); i++){
+				processors.push_back(i);
+			}
+		}
+
+		return processors;
+	}
+
+	return parseSysfsList(cpulist);
+}
+
+int getNumaNodeProcessorCount(int node){
+	return getNumaNodeProcessors(node).size();
+}
+
+bool pinThreadToNumaNode(int node){
+	vector<int> processors = getNumaNodeProcessors(node);
+
+	if(processors.empty()) return false;
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+
+	for(int processor : processors){
+		if(processor < CPU_SETSIZE){
+			CPU_SET(processor, &cpuset);
+		}
+	}
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) == 0;
+}
+
+// transparent huge pages, if enabled for madvise in /sys/kernel/mm/transparent_hugepage/enabled
+void* allocatePages(int64_t size, bool hugePages, int numaNode){
+
+	void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(data == MAP_FAILED) return nullptr;
+
+	if(hugePages){
+		madvise(data, size, MADV_HUGEPAGE);
+	}
+
+	// prefer, rather than bind, so that a full node spills over instead of failing
+	if(numaNode >= 0 && numaNode < 64){
+		constexpr int MPOL_PREFERRED = 1; // see <numaif.h>
+		unsigned long nodemask = 1ul << numaNode;
+
+		// the kernel reads maxnode - 1 bits
+		syscall(SYS_mbind, data, size, MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask) + 1, 0);
+	}
+
+	return data;
+}
+
+void freePages(void* data, int64_t size){
+	munmap(data, size);
+}
+
+// POSIX shared memory object, /dev/shm/<name> on Linux
+void* mapSharedMemory(string name, int64_t& size, bool create, void*& handle){
+
+	string objectName = "/" + name;
+	int fd = -1;
+
+	if(create){
+		fd = shm_open(objectName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+		if(fd >= 0 && ftruncate(fd, size) != 0){
+			close(fd);
+			shm_unlink(objectName.c_str());
+			return nullptr;
+		}
+	}else{
+		fd = shm_open(objectName.c_str(), O_RDWR, 0600);
+
+		struct stat info;
+		if(fd >= 0 && fstat(fd, &info) == 0){
+			size = info.st_size;
+		}
+	}
+
+	if(fd < 0) return nullptr;
+
+	void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	// the mapping keeps the object alive
+	close(fd);
+	handle = nullptr;
+
+	if(data == MAP_FAILED){
+		if(create) shm_unlink(objectName.c_str());
+
+		return nullptr;
+	}
+
+	return data;
+}
+
+void unmapSharedMemory(void* data, int64_t size, void*){
+	munmap(data, size);
+}
+
+void removeSharedMemory(string name){
+	string objectName = "/" + name;
+	shm_unlink(objectName.c_str());
+}
+
+int64_t getProcessId(){
+	return getpid();
+}
+
+// zombies count as exited, they only wait for their parent to reap them
+bool isProcessRunning(int64_t pid){
+
+	if(kill(pid_t(pid), 0) != 0 && errno != EPERM) return false;
+
+	string path = "/proc/" + to_string(pid) + "/stat";
+	FILE* file = fopen(path.c_str(), "r");
+
+	if(file == nullptr) return true;
+
+	// <pid> (<name>) <state> ..., where the name may contain parentheses
+	char line[512] = {};
+	bool read = fgets(line, sizeof(line), file) != nullptr;
+	fclose(file);
+
+	if(!read) return true;
+
+	char* nameEnd = strrchr(line, ')');
+
+	if(nameEnd == nullptr || nameEnd[1] == 0) return true;
+
+	char state = nameEnd[2];
+
+	return state != 'Z' && state != 'X';
+}
+
 
 #endif
\ No newline at end of file
@@ -1,6 +1,10 @@
 
 #include "LasLoaderSparse.h"
 #include "unsuck.hpp"
+#include "Tracer.h"
+#include "Debug.h"
+
+#include <unordered_map>
 
 
 #define STEPS_30BIT 1073741824
@@ -36,10 +40,17 @@ struct Batch{
 
 shared_ptr<LoadResult> loadLas(shared_ptr<LasFile> lasfile, int64_t firstPoint, int64_t numPoints){
 
+	auto zone = Tracer::zone("loadLas");
+
 	string path = lasfile->path;
 	int64_t file_byteOffset = lasfile->offsetToPointData + firstPoint * lasfile->bytesPerPoint;
 	int64_t file_byteSize = numPoints * lasfile->bytesPerPoint;
+
+	auto zone_read = Tracer::zone("read");
 	auto source = readBinaryFile(path, file_byteOffset, file_byteSize);
+	zone_read.end();
+
+	Tracer::increment("bytes read", double(file_byteSize));
 	int64_t sparse_pointOffset = lasfile->sparse_point_offset + firstPoint;
 
 	// compute batch metadata
@@ -213,6 +224,8 @@ shared_ptr<LoadResult> loadLas(shared_ptr<LasFile> lasfile, int64_t firstPoint,
 
 shared_ptr<LoadResult> loadLaz(shared_ptr<LasFile> lasfile, int64_t firstPoint, int64_t numPoints){
 
+	auto zone = Tracer::zone("loadLaz");
+
 	string path = lasfile->path;
 	int64_t sparse_pointOffset = lasfile->sparse_point_offset + firstPoint;
 
@@ -449,6 +462,10 @@ LasLoaderSparse::LasLoaderSparse(shared_ptr<Renderer> renderer){
 		glClearNamedBufferData(this->ssBatches.handle, GL_R32UI, GL_RED, GL_UNSIGNED_INT, &zero);
 	}
 
+	residency.onEvict = [this](int64_t chunkIndex){
+		evict(chunkIndex);
+	};
+
 	int numThreads = 1;
 	auto cpuData = getCpuData();
 
@@ -490,41 +507,17 @@ void LasLoaderSparse::add(vector<string> files, std::function<void(vector<shared
 		lasfile->fileIndex = task->fileIndex;
 		lasfile->path = task->file;
 
-		auto buffer_header = readBinaryFile(lasfile->path, 0, 375);
-
-		int versionMajor = buffer_header->get<uint8_t>(24);
-		int versionMinor = buffer_header->get<uint8_t>(25);
-
-		if(versionMajor == 1 && versionMinor < 4){
-			lasfile->numPoints = buffer_header->get<uint32_t>(107);
-		}else{
-			lasfile->numPoints = buffer_header->get<uint64_t>(247);
-		}
+		auto header = LasHeader::read(lasfile->path);
 
-		lasfile->numPoints = min(lasfile->numPoints, 1'000'000'000ll);
+		lasfile->numPoints = min(header.numPoints, 1'000'000'000ll);
+		lasfile->offsetToPointData = header.offsetToPointData;
+		lasfile->pointFormat = header.format;
+		lasfile->bytesPerPoint = header.recordLength;
+		lasfile->scale = header.scale;
+		lasfile->offset = header.offset;
+		lasfile->boxMin = header.min;
+		lasfile->boxMax = header.max;
 
-		lasfile->offsetToPointData = buffer_header->get<uint32_t>(96);
-		lasfile->pointFormat = buffer_header->get<uint8_t>(104) % 128;
-		lasfile->bytesPerPoint = buffer_header->get<uint16_t>(105);
-		
-		lasfile->scale.x = buffer_header->get<double>(131);
-		lasfile->scale.y = buffer_header->get<double>(139);
-		lasfile->scale.z = buffer_header->get<double>(147);
-		
-		lasfile->offset.x = buffer_header->get<double>(155);
-		lasfile->offset.y = buffer_header->get<double>(163);
-		lasfile->offset.z = buffer_header->get<double>(171);
-		
-		lasfile->boxMin.x = buffer_header->get<double>(187);
-		lasfile->boxMin.y = buffer_header->get<double>(203);
-		lasfile->boxMin.z = buffer_header->get<double>(219);
-		
-		lasfile->boxMax.x = buffer_header->get<double>(179);
-		lasfile->boxMax.y = buffer_header->get<double>(195);
-		lasfile->boxMax.z = buffer_header->get<double>(211);
-
-		
-		
 		{
 			unique_lock<mutex> lock1(mtx_lasfiles);
 			
@@ -547,7 +540,7 @@ void LasLoaderSparse::add(vector<string> files, std::function<void(vector<shared
 			cout << ss.str() << endl;
 		}
 
-		{ // create load tasks
+		{ // create chunks, loaded once they are visible
 
 			unique_lock<mutex> lock2(ref->mtx_load);
 			
@@ -558,12 +551,18 @@ void LasLoaderSparse::add(vector<string> files, std::function<void(vector<shared
 				int64_t remaining = lasfile->numPoints - pointOffset;
 				int64_t pointsInBatch = min(int64_t(MAX_POINTS_PER_BATCH), remaining);
 
-				LoadTask task;
-				task.lasfile = lasfile;
-				task.firstPoint = pointOffset;
-				task.numPoints = pointsInBatch;
+				auto chunk = make_shared<Chunk>();
+				chunk->index = ref->chunks.size();
+				chunk->lasfile = lasfile;
+				chunk->firstPoint = pointOffset;
+				chunk->numPoints = pointsInBatch;
+				chunk->batchOffset = ref->numBatchSlots;
+				chunk->numBatches = (pointsInBatch + POINTS_PER_WORKGROUP - 1) / POINTS_PER_WORKGROUP;
+				chunk->min = lasfile->boxMin;
+				chunk->max = lasfile->boxMax;
 
-				ref->loadTasks.push_back(task);
+				ref->chunks.push_back(chunk);
+				ref->numBatchSlots += chunk->numBatches;
 
 				pointOffset += pointsInBatch;
 			}
@@ -598,6 +597,8 @@ void LasLoaderSparse::spawnLoader(){
 
 	thread t([ref](){
 
+		Tracer::setThreadName("LasLoaderSparse loader");
+
 		while(true){
 
 			std::this_thread::sleep_for(10ms);
@@ -620,16 +621,21 @@ void LasLoaderSparse::spawnLoader(){
 			
 			//unique_lock<mutex> lock_dbg(mtx_debug);
 
-			if(iEndsWith(task.lasfile->path, "las")){
-				result = loadLas(task.lasfile, task.firstPoint, task.numPoints);
-			}else if(iEndsWith(task.lasfile->path, "laz")){
-				result = loadLaz(task.lasfile, task.firstPoint, task.numPoints);
+			auto chunk = task.chunk;
+
+			if(iEndsWith(chunk->lasfile->path, "las")){
+				result = loadLas(chunk->lasfile, chunk->firstPoint, chunk->numPoints);
+			}else if(iEndsWith(chunk->lasfile->path, "laz")){
+				result = loadLaz(chunk->lasfile, chunk->firstPoint, chunk->numPoints);
 			}
 
+			Tracer::increment("points loaded", double(chunk->numPoints));
+
 			UploadTask uploadTask;
-			uploadTask.lasfile = task.lasfile;
+			uploadTask.lasfile = chunk->lasfile;
+			uploadTask.chunk = chunk;
 			uploadTask.sparse_pointOffset = result->sparse_pointOffset;
-			uploadTask.numPoints = task.numPoints;
+			uploadTask.numPoints = chunk->numPoints;
 			uploadTask.numBatches = result->numBatches;
 			uploadTask.bXyzLow = result->bXyzLow;
 			uploadTask.bXyzMed = result->bXyzMed;
@@ -671,9 +677,9 @@ void LasLoaderSparse::process(){
 		int64_t offset = 4 * task.sparse_pointOffset;
 		int64_t pageAlignedOffset = offset - (offset % PAGE_SIZE);
 
-		int64_t size = 4 * task.numPoints;
-		int64_t pageAlignedSize = size - (size % PAGE_SIZE) + PAGE_SIZE;
-		pageAlignedSize = std::min(pageAlignedSize, 4 * MAX_POINTS);
+		int64_t end = offset + 4 * task.numPoints;
+		int64_t pageAlignedEnd = ((end + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+		int64_t pageAlignedSize = std::min(pageAlignedEnd, 4 * MAX_POINTS) - pageAlignedOffset;
 
 		//cout << "commiting, offset: " << formatNumber(pageAlignedOffset) << ", size: " << formatNumber(pageAlignedSize) << endl;
 
@@ -688,7 +694,7 @@ void LasLoaderSparse::process(){
 
 	// upload batch metadata
 	glNamedBufferSubData(ssBatches.handle, 
-		64 * this->numBatchesLoaded, 
+		64 * task.chunk->batchOffset, 
 		task.bBatches->size, 
 		task.bBatches->data);
 
@@ -706,6 +712,143 @@ void LasLoaderSparse::process(){
 	this->numPointsLoaded += task.numPoints;
 	task.lasfile->numPointsLoaded += task.numPoints;
 
+	{ // the batches are relative to the file's bounding box, and tighter than the file's box used for culling so far
+		auto chunk = task.chunk;
+		dvec3 min = {Infinity, Infinity, Infinity};
+		dvec3 max = {-Infinity, -Infinity, -Infinity};
+
+		for(int64_t i = 0; i < task.numBatches; i++){
+			min.x = std::min(min.x, double(task.bBatches->get<float>(64 * i +  4)));
+			min.y = std::min(min.y, double(task.bBatches->get<float>(64 * i +  8)));
+			min.z = std::min(min.z, double(task.bBatches->get<float>(64 * i + 12)));
+			max.x = std::max(max.x, double(task.bBatches->get<float>(64 * i + 16)));
+			max.y = std::max(max.y, double(task.bBatches->get<float>(64 * i + 20)));
+			max.z = std::max(max.z, double(task.bBatches->get<float>(64 * i + 24)));
+		}
+
+		chunk->min = task.lasfile->boxMin + min;
+		chunk->max = task.lasfile->boxMin + max;
+	}
+
+	// may evict chunks that went out of view
+	residency.insert(task.chunk->index, 16 * task.numPoints);
+
 	//cout << "numBatchesLoaded: " << numBatchesLoaded << endl;
 
-}
\ No newline at end of file
+}
+
+void LasLoaderSparse::updateResidency(dmat4 viewProj, dvec3 cameraPosition){
+
+	Frustum frustum;
+	frustum.set(viewProj);
+
+	struct Request{
+		shared_ptr<Chunk> chunk;
+		double priority;
+	};
+
+	vector<Request> requests;
+
+	unique_lock<mutex> lock_load(mtx_load);
+
+	for(auto chunk : chunks){
+
+		Box box;
+		box.min = chunk->min;
+		box.max = chunk->max;
+
+		if(!frustum.intersectsBox(box)) continue;
+
+		// roughly the projected size, 1 if the camera is inside the chunk
+		double radius = glm::length(box.size()) / 2.0;
+		double distance = std::max(glm::length(box.center() - cameraPosition) - radius, 0.0);
+		double priority = radius / (radius + distance);
+
+		requests.push_back({chunk, priority});
+	}
+
+	std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b){
+		return a.priority > b.priority;
+	});
+
+	residency.unpinAll();
+
+	unordered_map<int64_t, double> wanted;
+	vector<LoadTask> newTasks;
+
+	for(auto& request : requests){
+		auto status = residency.request(request.chunk->index, request.priority, 16 * request.chunk->numPoints);
+
+		if(status == ResidencyCache::Status::MISS){
+			newTasks.push_back({request.chunk, request.priority});
+		}else if(status == ResidencyCache::Status::PENDING){
+			wanted[request.chunk->index] = request.priority;
+		}
+	}
+
+	// drop queued chunks that went out of view, reprioritize the others
+	vector<LoadTask> tasks;
+	for(auto& task : loadTasks){
+		auto it = wanted.find(task.chunk->index);
+
+		if(it == wanted.end()){
+			residency.cancel(task.chunk->index);
+		}else{
+			task.priority = it->second;
+			tasks.push_back(task);
+		}
+	}
+
+	tasks.insert(tasks.end(), newTasks.begin(), newTasks.end());
+
+	std::sort(tasks.begin(), tasks.end(), [](const LoadTask& a, const LoadTask& b){
+		return a.priority < b.priority;
+	});
+
+	loadTasks = tasks;
+
+	lock_load.unlock();
+
+	auto stats = residency.getStats();
+	double MB = 1024.0 * 1024.0;
+
+	Debug::set("resident chunks", formatNumber(stats.numResident));
+	Debug::set("resident MB", formatNumber(double(stats.bytesResident) / MB, 1) + " / " + formatNumber(double(residency.budget) / MB, 1));
+	Debug::set("residency hits / misses", formatNumber(stats.hits) + " / " + formatNumber(stats.misses));
+	Debug::set("residency evictions", formatNumber(stats.evictions));
+}
+
+void LasLoaderSparse::evict(int64_t chunkIndex){
+
+	unique_lock<mutex> lock_load(mtx_load);
+	auto chunk = chunks[chunkIndex];
+	lock_load.unlock();
+
+	auto lasfile = chunk->lasfile;
+
+	{ // decommit pages that lie entirely within the chunk, the others may hold points of neighboring chunks
+		int64_t begin = 4 * (lasfile->sparse_point_offset + chunk->firstPoint);
+		int64_t end = begin + 4 * chunk->numPoints;
+		int64_t pageBegin = ((begin + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+		int64_t pageEnd = (end / PAGE_SIZE) * PAGE_SIZE;
+
+		if(pageEnd > pageBegin){
+			for(auto glBuffer : {ssXyzLow, ssXyzMed, ssXyzHig, ssColors}){
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, glBuffer.handle);
+				glBufferPageCommitmentARB(GL_SHADER_STORAGE_BUFFER, pageBegin, pageEnd - pageBegin, GL_FALSE);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			}
+		}
+	}
+
+	// zeroed batches have no points
+	GLuint zero = 0;
+	glClearNamedBufferSubData(ssBatches.handle, GL_R32UI, 
+		64 * chunk->batchOffset, 
+		64 * chunk->numBatches, 
+		GL_RED, GL_UNSIGNED_INT, &zero);
+
+	this->numBatchesLoaded -= chunk->numBatches;
+	this->numPointsLoaded -= chunk->numPoints;
+	lasfile->numPointsLoaded -= chunk->numPoints;
+}
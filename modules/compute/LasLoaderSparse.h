@@ -12,7 +12,10 @@
 #include "Shader.h"
 #include "Resources.h"
 #include "TaskPool.h"
+#include "ResidencyCache.h"
+#include "Frustum.h"
 #include "laszip_api.h"
+#include "LasHeader.h"
 
 using namespace std;
 using glm::vec3;
@@ -51,14 +54,29 @@ struct LasLoaderSparse {
 	mutex mtx_upload;
 	mutex mtx_load;
 
-	struct LoadTask{
+	// range of points of a file that is loaded, uploaded and evicted as a whole.
+	// Its batches always go to the same slots of ssBatches, and its points to the same range of the sparse buffers.
+	struct Chunk{
+		int64_t index = 0;
 		shared_ptr<LasFile> lasfile;
-		int64_t firstPoint;
-		int64_t numPoints;
+		int64_t firstPoint = 0;
+		int64_t numPoints = 0;
+		int64_t batchOffset = 0;
+		int64_t numBatches = 0;
+
+		// bounding box of the file until the chunk was loaded once
+		dvec3 min;
+		dvec3 max;
+	};
+
+	struct LoadTask{
+		shared_ptr<Chunk> chunk;
+		double priority = 0.0;
 	};
 
 	struct UploadTask{
 		shared_ptr<LasFile> lasfile;
+		shared_ptr<Chunk> chunk;
 		int64_t sparse_pointOffset;
 		int64_t sparse_batchOffset;
 		int64_t numPoints;
@@ -71,15 +89,22 @@ struct LasLoaderSparse {
 	};
 
 	vector<shared_ptr<LasFile>> files;
-	vector<LoadTask> loadTasks;
+	vector<shared_ptr<Chunk>> chunks;
+	vector<LoadTask> loadTasks;   // ascending priority, loaders take from the back
 	vector<UploadTask> uploadTasks;
 
+	// Points of the visible chunks are loaded on demand and stay on the GPU while visible.
+	// Once the budget is exceeded, chunks that are out of view are evicted and their pages decommitted.
+	// The budget counts the 16 bytes per point of the xyz and color buffers.
+	ResidencyCache residency = ResidencyCache(int64_t(4) * 1024 * 1024 * 1024);
+
 	int64_t numPoints = 0;
 	int64_t numPointsLoaded = 0;
 	int64_t numBatches = 0;
 	int64_t numBatchesLoaded = 0;
 	int64_t bytesReserved = 0;
 	int64_t numFiles = 0;
+	int64_t numBatchSlots = 0;
 
 	shared_ptr<Renderer> renderer = nullptr;
 
@@ -98,4 +123,10 @@ struct LasLoaderSparse {
 
 	void process();
 
+	// requests the chunks within the view frustum, nearby ones first. Call once per frame.
+	void updateResidency(dmat4 viewProj, dvec3 cameraPosition);
+
+	// frees the GPU memory of a chunk, called by the residency cache
+	void evict(int64_t chunkIndex);
+
 };
\ No newline at end of file
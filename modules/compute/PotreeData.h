@@ -15,6 +15,7 @@
 #include "unsuck.hpp"
 #include "Shader.h"
 #include "Resources.h"
+#include "PotreeHierarchy.h"
 
 using namespace std;
 using glm::vec3;
@@ -39,26 +40,7 @@ struct PotreeData : public Resource {
 		int64_t numPoints = 0;
 	};
 
-	struct Node{
-		string name = "";
-		Box boundingBox;
-		int nodeType = 0;
-		int64_t numPoints = 0;
-		int64_t byteOffset = 0;
-		int64_t byteSize = 0;
-		int64_t hierarchyByteOffset = 0;
-		int64_t hierarchyByteSize = 0;
-		float spacing = 1.0;
-		int level = 0;
-		int loadIndex = 0;
-
-		shared_ptr<Node> parent = nullptr;
-
-		shared_ptr<Node> children[8] = {
-			nullptr, nullptr, nullptr, nullptr, 
-			nullptr, nullptr, nullptr, nullptr};
-
-	};
+	using Node = PotreeHierarchy::Node;
 
 	struct Bin{
 		vector<Node> nodes;
@@ -67,18 +49,6 @@ struct PotreeData : public Resource {
 		int64_t numPoints = 0;
 	};
 
-	void traverse(Node* node, std::function<void(Node*)> callback) {
-
-		callback(node);
-
-		for (auto child : node->children) {
-			if (child) {
-				traverse(child.get(), callback);
-			}
-		}
-
-	}
-
 	string path = "";
 	shared_ptr<LoaderTask> task = nullptr;
 	mutex mtx_state;
@@ -110,174 +80,45 @@ struct PotreeData : public Resource {
 
 	}
 
-	Box createChildAABB(Box aabb, int index){
-		vec3 min = aabb.min;
-		vec3 max = aabb.max;
-		vec3 size = max - min;
-
-		if ((index & 0b0001) > 0) {
-			min.z += size.z / 2;
-		} else {
-			max.z -= size.z / 2;
-		}
-
-		if ((index & 0b0010) > 0) {
-			min.y += size.y / 2;
-		} else {
-			max.y -= size.y / 2;
-		}
-		
-		if ((index & 0b0100) > 0) {
-			min.x += size.x / 2;
-		} else {
-			max.x -= size.x / 2;
-		}
-
-		Box box;
-		box.min = min;
-		box.max = max;
-
-		return box;
-	}
-
-
 	void loadMetadata(){
-		auto strMetadata = readTextFile(path + "/metadata.json");
-		auto jsMetadata = json::parse(strMetadata);
-
-		boxMin.x = jsMetadata["boundingBox"]["min"][0];
-		boxMin.y = jsMetadata["boundingBox"]["min"][1];
-		boxMin.z = jsMetadata["boundingBox"]["min"][2];
-		boxMax.x = jsMetadata["boundingBox"]["max"][0];
-		boxMax.y = jsMetadata["boundingBox"]["max"][1];
-		boxMax.z = jsMetadata["boundingBox"]["max"][2];
-
-		scale.x = jsMetadata["scale"][0];
-		scale.y = jsMetadata["scale"][1];
-		scale.z = jsMetadata["scale"][2];
-
-		offset.x = jsMetadata["offset"][0];
-		offset.y = jsMetadata["offset"][1];
-		offset.z = jsMetadata["offset"][2];
-
-		// numPoints = jsMetadata["points"];
-		numPoints = jsMetadata["points"];
+		PotreeHierarchy hierarchy;
+		hierarchy.path = path;
+		hierarchy.loadMetadata();
+
+		boxMin = hierarchy.boxMin;
+		boxMax = hierarchy.boxMax;
+		scale = hierarchy.scale;
+		offset = hierarchy.offset;
+		numPoints = hierarchy.numPoints;
 		//numPoints = std::min(numPoints, 1'000'000'000ll);
 		numPointsLoaded = numPoints;
-		spacing = jsMetadata["spacing"];
-
-		firstHierarchyChunkSize = jsMetadata["hierarchy"]["firstChunkSize"];
-
-		bytesPerPoint = 0;
-		auto jsAttributes = jsMetadata["attributes"];
-		for(int i = 0; i < jsAttributes.size(); i++){
-			auto jsAttribute = jsAttributes[i];
-
-			string name = jsAttribute["name"];
-
-			if(name == "rgb"){
-				rgbOffset = bytesPerPoint;
-			}
-
-			bytesPerPoint += jsAttribute["size"];
-		}
+		spacing = hierarchy.spacing;
+		firstHierarchyChunkSize = hierarchy.firstHierarchyChunkSize;
+		bytesPerPoint = hierarchy.bytesPerPoint;
+		rgbOffset = hierarchy.rgbOffset;
 
 		metadataLoaded = true;
 	}
 
-	void parseHierarchy(shared_ptr<Node> node, shared_ptr<Buffer> buffer){
-
-		int bytesPerNode = 22;
-
-		int numNodes = node->hierarchyByteSize / bytesPerNode;
-
-		static int loadIndex = 0;
-
-		vector<shared_ptr<Node>> nodes(numNodes);
-		nodes[0] = node;
-		int nodePos = 1;
-
-		for(int i = 0; i < numNodes; i++){
-			auto current = nodes[i];
-
-			int type           = buffer->get< uint8_t>(node->hierarchyByteOffset + i * bytesPerNode + 0);
-			int childMask      = buffer->get< uint8_t>(node->hierarchyByteOffset + i * bytesPerNode + 1);
-			int numPoints      = buffer->get<uint32_t>(node->hierarchyByteOffset + i * bytesPerNode + 2);
-			int64_t byteOffset = buffer->get< int64_t>(node->hierarchyByteOffset + i * bytesPerNode + 6);
-			int64_t byteSize   = buffer->get< int64_t>(node->hierarchyByteOffset + i * bytesPerNode + 14);
-
-			if(current->nodeType == 2){
-				current->byteOffset = byteOffset;
-				current->byteSize = byteSize;
-				current->numPoints = numPoints;
-			}else if(type == 2){
-				current->hierarchyByteOffset = byteOffset;
-				current->hierarchyByteSize = byteSize;
-				current->numPoints = numPoints;
-			}else{
-				current->byteOffset = byteOffset;
-				current->byteSize = byteSize;
-				current->numPoints = numPoints;
-			}
-
-			current->nodeType = type;
-
-			if(current->nodeType == 2){
-				continue;
-			}
-
-			for(int childIndex = 0; childIndex < 8; childIndex++){
-				bool childExists = ((1 << childIndex) & childMask) != 0;
-
-				if(!childExists){
-					continue;
-				};
-
-				auto childAABB = createChildAABB(current->boundingBox, childIndex);
-				auto child = make_shared<Node>();
-				child->name = current->name + to_string(childIndex);
-				child->spacing = current->spacing / 2;
-				child->level = current->level + 1;
-				child->boundingBox = childAABB;
-				child->loadIndex = loadIndex;
-				loadIndex++;
-
-				current->children[childIndex] = child;
-				child->parent = current;
-
-				nodes[nodePos] = child;
-				nodePos++;
-			}
-		}
-
-		for(auto node : nodes){
-			if(node->nodeType == 2){
-				parseHierarchy(node, buffer);
-			}
-		}
-
-	}
-
 	void loadHierarchy(){
 
-		auto buffer = readBinaryFile(path + "/hierarchy.bin");
+		PotreeHierarchy hierarchy;
+		hierarchy.path = path;
+		hierarchy.spacing = spacing;
+		hierarchy.firstHierarchyChunkSize = firstHierarchyChunkSize;
 
-		auto root = make_shared<Node>();
-		root->name = "r";
-		root->nodeType = 2;
-		root->hierarchyByteOffset = 0;
-		root->hierarchyByteSize = firstHierarchyChunkSize;
-		root->spacing = spacing;
-		// root->boundingBox = Box(boxMin, boxMax);
-		root->boundingBox.min = {0.0, 0.0, 0.0};
-		root->boundingBox.max = boxMax - boxMin;
+		// Box rootBox = Box(boxMin, boxMax);
+		Box rootBox;
+		rootBox.min = {0.0, 0.0, 0.0};
+		rootBox.max = boxMax - boxMin;
 
+		hierarchy.loadHierarchy(rootBox);
 
-		parseHierarchy(root, buffer);
+		auto root = hierarchy.root;
 
 		vector<Node> nodes;
 
-		traverse(root.get(), [&nodes](Node* node) {
+		PotreeHierarchy::traverse(root.get(), [&nodes](Node* node) {
 			nodes.push_back(*node);
 		});
 
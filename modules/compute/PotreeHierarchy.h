@@ -0,0 +1,262 @@
+
+#pragma once
+
+#include <string>
+#include <functional>
+
+#include "nlohmann/json.hpp"
+
+#include "glm/common.hpp"
+#include "glm/matrix.hpp"
+#include "glm/vec3.hpp"
+#include <glm/gtx/transform.hpp>
+#include "unsuck.hpp"
+#include "Box.h"
+
+using namespace std;
+using glm::dvec3;
+using nlohmann::json;
+
+// Potree 2 metadata.json and hierarchy.bin parsing, without any GL dependencies.
+// Shared by PotreeData (rendering) and the tools that convert Potree 2 data sets.
+struct PotreeHierarchy{
+
+	enum NodeType{
+		NORMAL = 0,
+		LEAF   = 1,
+		PROXY  = 2,
+	};
+
+	struct Node{
+		string name = "";
+		Box boundingBox;
+		int nodeType = 0;
+		int64_t numPoints = 0;
+		int64_t byteOffset = 0;
+		int64_t byteSize = 0;
+		int64_t hierarchyByteOffset = 0;
+		int64_t hierarchyByteSize = 0;
+		float spacing = 1.0;
+		int level = 0;
+		int loadIndex = 0;
+
+		shared_ptr<Node> parent = nullptr;
+
+		shared_ptr<Node> children[8] = {
+			nullptr, nullptr, nullptr, nullptr,
+			nullptr, nullptr, nullptr, nullptr};
+
+	};
+
+	string path = "";
+
+	int64_t numPoints = 0;
+	dvec3 scale = {1.0, 1.0, 1.0};
+	dvec3 offset = {0.0, 0.0, 0.0};
+	dvec3 boxMin;
+	dvec3 boxMax;
+	float spacing = 1.0;
+	int64_t firstHierarchyChunkSize = 0;
+	int64_t bytesPerPoint = 0;
+	int64_t rgbOffset = 0;
+
+	shared_ptr<Node> root = nullptr;
+
+	static void traverse(Node* node, std::function<void(Node*)> callback) {
+
+		callback(node);
+
+		for (auto child : node->children) {
+			if (child) {
+				traverse(child.get(), callback);
+			}
+		}
+
+	}
+
+	// same arithmetic as createChildAABB() in tools/potree2_to_wg.js, in double precision
+	static Box createChildAABB(Box aabb, int index){
+		dvec3 min = aabb.min;
+		dvec3 max = aabb.max;
+		dvec3 size = max - min;
+
+		if ((index & 0b0001) > 0) {
+			min.z += size.z / 2;
+		} else {
+			max.z -= size.z / 2;
+		}
+
+		if ((index & 0b0010) > 0) {
+			min.y += size.y / 2;
+		} else {
+			max.y -= size.y / 2;
+		}
+
+		if ((index & 0b0100) > 0) {
+			min.x += size.x / 2;
+		} else {
+			max.x -= size.x / 2;
+		}
+
+		Box box;
+		box.min = min;
+		box.max = max;
+
+		return box;
+	}
+
+	void loadMetadata(){
+		auto strMetadata = readTextFile(path + "/metadata.json");
+		auto jsMetadata = json::parse(strMetadata);
+
+		boxMin.x = jsMetadata["boundingBox"]["min"][0];
+		boxMin.y = jsMetadata["boundingBox"]["min"][1];
+		boxMin.z = jsMetadata["boundingBox"]["min"][2];
+		boxMax.x = jsMetadata["boundingBox"]["max"][0];
+		boxMax.y = jsMetadata["boundingBox"]["max"][1];
+		boxMax.z = jsMetadata["boundingBox"]["max"][2];
+
+		scale.x = jsMetadata["scale"][0];
+		scale.y = jsMetadata["scale"][1];
+		scale.z = jsMetadata["scale"][2];
+
+		offset.x = jsMetadata["offset"][0];
+		offset.y = jsMetadata["offset"][1];
+		offset.z = jsMetadata["offset"][2];
+
+		numPoints = jsMetadata["points"];
+		spacing = jsMetadata["spacing"];
+
+		firstHierarchyChunkSize = jsMetadata["hierarchy"]["firstChunkSize"];
+
+		bytesPerPoint = 0;
+		auto jsAttributes = jsMetadata["attributes"];
+		for(int i = 0; i < jsAttributes.size(); i++){
+			auto jsAttribute = jsAttributes[i];
+
+			string name = jsAttribute["name"];
+
+			if(name == "rgb"){
+				rgbOffset = bytesPerPoint;
+			}
+
+			bytesPerPoint += int64_t(jsAttribute["size"]);
+		}
+	}
+
+	static void parseHierarchy(shared_ptr<Node> node, shared_ptr<Buffer> buffer){
+
+		int bytesPerNode = 22;
+
+		int numNodes = node->hierarchyByteSize / bytesPerNode;
+
+		static int loadIndex = 0;
+
+		vector<shared_ptr<Node>> nodes(numNodes);
+		nodes[0] = node;
+		int nodePos = 1;
+
+		for(int i = 0; i < numNodes; i++){
+			auto current = nodes[i];
+
+			int type           = buffer->get< uint8_t>(node->hierarchyByteOffset + i * bytesPerNode + 0);
+			int childMask      = buffer->get< uint8_t>(node->hierarchyByteOffset + i * bytesPerNode + 1);
+			int numPoints      = buffer->get<uint32_t>(node->hierarchyByteOffset + i * bytesPerNode + 2);
+			int64_t byteOffset = buffer->get< int64_t>(node->hierarchyByteOffset + i * bytesPerNode + 6);
+			int64_t byteSize   = buffer->get< int64_t>(node->hierarchyByteOffset + i * bytesPerNode + 14);
+
+			if(current->nodeType == PROXY){
+				current->byteOffset = byteOffset;
+				current->byteSize = byteSize;
+				current->numPoints = numPoints;
+			}else if(type == PROXY){
+				current->hierarchyByteOffset = byteOffset;
+				current->hierarchyByteSize = byteSize;
+				current->numPoints = numPoints;
+			}else{
+				current->byteOffset = byteOffset;
+				current->byteSize = byteSize;
+				current->numPoints = numPoints;
+			}
+
+			current->nodeType = type;
+
+			if(current->nodeType == PROXY){
+				continue;
+			}
+
+			for(int childIndex = 0; childIndex < 8; childIndex++){
+				bool childExists = ((1 << childIndex) & childMask) != 0;
+
+				if(!childExists){
+					continue;
+				};
+
+				auto childAABB = createChildAABB(current->boundingBox, childIndex);
+				auto child = make_shared<Node>();
+				child->name = current->name + to_string(childIndex);
+				child->spacing = current->spacing / 2;
+				child->level = current->level + 1;
+				child->boundingBox = childAABB;
+				child->loadIndex = loadIndex;
+				loadIndex++;
+
+				current->children[childIndex] = child;
+				child->parent = current;
+
+				nodes[nodePos] = child;
+				nodePos++;
+			}
+		}
+
+		for(auto node : nodes){
+			if(node->nodeType == PROXY){
+				parseHierarchy(node, buffer);
+			}
+		}
+
+	}
+
+	// parses hierarchy.bin, including all proxy chunks, into a tree below <this->root>
+	void loadHierarchy(Box rootBoundingBox){
+
+		auto buffer = readBinaryFile(path + "/hierarchy.bin");
+
+		auto root = make_shared<Node>();
+		root->name = "r";
+		root->nodeType = PROXY;
+		root->hierarchyByteOffset = 0;
+		root->hierarchyByteSize = firstHierarchyChunkSize;
+		root->spacing = spacing;
+		root->boundingBox = rootBoundingBox;
+
+		parseHierarchy(root, buffer);
+
+		this->root = root;
+	}
+
+	// nodes in depth-first pre-order, children in index order
+	vector<Node*> flatten(){
+		vector<Node*> nodes;
+
+		traverse(root.get(), [&nodes](Node* node) {
+			nodes.push_back(node);
+		});
+
+		return nodes;
+	}
+
+	static shared_ptr<PotreeHierarchy> load(string path){
+		auto hierarchy = make_shared<PotreeHierarchy>();
+		hierarchy->path = path;
+		hierarchy->loadMetadata();
+
+		Box box;
+		box.min = hierarchy->boxMin;
+		box.max = hierarchy->boxMax;
+		hierarchy->loadHierarchy(box);
+
+		return hierarchy;
+	}
+
+};
@@ -18,6 +18,7 @@
 #include "Debug.h"
 #include "Camera.h"
 #include "LasLoader.h"
+#include "Metrics.h"
 #include "Frustum.h"
 #include "Renderer.h"
 
@@ -99,7 +100,11 @@ shared_ptr<LasFile> loadLas(string path){
 		int64_t start = header.offsetToPointData;
 		int64_t size = header.numPoints * header.bytesPerPoint;
 		
+		static auto& pointsRead = Metrics::counter("cudalod_points_read_total", "Points read from input files");
+		static auto& bytesRead  = Metrics::counter("cudalod_bytes_read_total", "Bytes read from input files");
+
 		auto buffer = readBinaryFile(path, start, size);
+		bytesRead.add(double(size));
 
 		int64_t stride = header.bytesPerPoint;
 
@@ -130,7 +135,9 @@ shared_ptr<LasFile> loadLas(string path){
 
 			lasfile->points.push_back(point);
 
-			
+			if(((i + 1) % 1'000'000) == 0){
+				pointsRead.add(1'000'000.0);
+			}
 			
 			if((i % 10'000'000) == 0){
 				
@@ -139,6 +146,8 @@ shared_ptr<LasFile> loadLas(string path){
 			}
 		}
 
+		pointsRead.add(double(header.numPoints % 1'000'000));
+
 		auto locale = std::locale("en_GB.UTF-8");
 		cout << std::format(locale, "finished loading {:L} points", lasfile->points.size()) << endl;
 
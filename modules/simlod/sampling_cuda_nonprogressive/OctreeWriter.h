@@ -11,8 +11,9 @@
 #include "toojpeg.h"
 
 #include "unsuck.hpp"
-#include "utils.h"
+#include "morton.h"
 #include "Box.h"
+#include "Tracer.h"
 
 using namespace std;
 using glm::vec3;
@@ -60,6 +61,7 @@ struct OctreeWriter{
 	uint64_t offset_buffer = 0;
 	uint64_t offset_nodes = 0;
 	Box box;
+	bool hostPointers = false;
 
 	struct HNode{
 		CuNode* cunode = nullptr;
@@ -176,16 +178,8 @@ struct OctreeWriter{
 			vector<uint8_t> childmasks_list;
 			for(int i = 0; i < childmasks.size(); i++){
 
-				int mortonCode = i;
-				int x = 0;
-				int y = 0;
-				int z = 0;
-
-				for(int mi = 0; mi < 6; mi++){
-					x = x | (((mortonCode >> (3 * mi + 2)) & 1) << mi);
-					y = y | (((mortonCode >> (3 * mi + 1)) & 1) << mi);
-					z = z | (((mortonCode >> (3 * mi + 0)) & 1) << mi);
-				}
+				uint32_t x, y, z;
+				morton::decode(i, x, y, z);
 
 				int voxelIndex = x + y * gridSize + z * gridSize * gridSize;
 
@@ -238,17 +232,8 @@ struct OctreeWriter{
 
 		for(int pointIndex = 0; pointIndex < points.size(); pointIndex++){
 
-			uint32_t mortoncode = pointIndex;
-			
-			uint32_t x = 0;
-			uint32_t y = 0;
-			for(uint32_t bitindex = 0; bitindex < 10; bitindex++){
-				uint32_t bx = (mortoncode >> (2 * bitindex + 0)) & 1;
-				uint32_t by = (mortoncode >> (2 * bitindex + 1)) & 1;
-
-				x = x | (bx << bitindex);
-				y = y | (by << bitindex);
-			}
+			uint32_t x, y;
+			morton::decode2D(pointIndex, x, y);
 
 			Point point = points[pointIndex];
 			uint8_t r = (point.color >>  0) & 0xff;
@@ -291,16 +276,18 @@ struct OctreeWriter{
 		return buffer;
 	}
 
-	void write(){
-
-		cout << "writer()" << endl;
+	// root of the downloaded hierarchy, with pointers to host instead of cuda memory.
+	// Usable without writing, e.g. with SpatialQuery<OctreeWriter::CuNode>.
+	CuNode* hostRoot(){
 
 		uint64_t offsetToNodeArray = offset_nodes - offset_buffer;
 		CuNode* nodeArray = reinterpret_cast<CuNode*>(buffer->data_u8 + offsetToNodeArray);
-		CuNode* curoot = &nodeArray[0];
+
+		if(hostPointers){
+			return &nodeArray[0];
+		}
 
 		cout << "convert pointers" << endl;
-		// make pointers point to host instead of cuda memory
 		for(int i = 0; i < numNodes; i++){
 			CuNode* node = &nodeArray[i];
 
@@ -316,7 +303,22 @@ struct OctreeWriter{
 			}
 		}
 
+		hostPointers = true;
+
+		return &nodeArray[0];
+	}
+
+	void write(){
+
+		cout << "writer()" << endl;
+
+		auto zone = Tracer::zone("OctreeWriter::write");
+
+		CuNode* curoot = hostRoot();
+		CuNode* nodeArray = curoot;
+
 		cout << "sort by morton code" << endl;
+		auto zone_sort = Tracer::zone("sort by morton code");
 		// sort points and voxels by morton code
 		for(int i = 0; i < numNodes; i++){
 			CuNode* node = &nodeArray[i];
@@ -348,6 +350,8 @@ struct OctreeWriter{
 
 		
 
+		zone_sort.end();
+
 		cout << "create hnodes" << endl;
 		unordered_map<string, HNode> hnodes;
 		curoot->traverse("r", [&](CuNode* cunode, string name){
@@ -388,6 +392,7 @@ struct OctreeWriter{
 
 		stringstream ssBatches;
 		{
+			auto zone_batches = Tracer::zone("write batches");
 			std::locale::global(std::locale("en_US.UTF-8"));
 
 			int batchDepth = 3;
@@ -467,6 +472,7 @@ struct OctreeWriter{
 
 
 				{ // save blob
+					auto zone = Tracer::zone("write batch file");
 					string filepath = path + "/" + batchName + ".batch";
 					ofstream fout;
 					fout.open(filepath, ios::binary | ios::out);
@@ -511,6 +517,7 @@ struct OctreeWriter{
 		stringstream ssNodes;
 
 		cout << "start writing nodes" << endl;
+		auto zone_nodes = Tracer::zone("write nodes");
 		for(auto& [name, hnode] : hnodes){
 
 			CuNode* cunode = hnode.cunode;
@@ -574,6 +581,8 @@ struct OctreeWriter{
 			ssNodes.str(), ssBatches.str()
 		);
 
+		zone_nodes.end();
+
 		writeFile(path + "/metadata.json", metadata);
 
 		cout << "#voxels: " << numVoxels << endl;
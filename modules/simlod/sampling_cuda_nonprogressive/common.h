@@ -1,6 +1,11 @@
 
 #pragma once
 
+#include "split_policy.h"
+#include "dedup_policy.h"
+#include "compact_input.h"
+#include "poisson_policy.h"
+
 struct Mat4 {
 	float4 rows[4];
 };
@@ -19,7 +24,8 @@ enum SamplingStrategy{
 	FIRST_COME            = 0,
 	RANDOM                = 1,
 	AVERAGE_SINGLECELL    = 2,
-	WEIGHTED_NEIGHBORHOOD = 3
+	WEIGHTED_NEIGHBORHOOD = 3,
+	POISSON_DISK          = 4
 };
 
 struct State{
@@ -28,6 +34,11 @@ struct State{
 	int2 imageSize;
 	SamplingStrategy strategy;
 	float LOD;
+	uint32_t seed; // RANDOM strategy, see sample_hash.h
+	SplitPolicy splitPolicy;
+	DedupPolicy dedupPolicy;
+	CompactInput compactInput;
+	PoissonPolicy poissonPolicy; // POISSON_DISK strategy
 };
 
 constexpr int HISTOGRAM_NUM_BINS = 100;
@@ -56,4 +67,6 @@ struct Results{
 
 	uint64_t allocatedMemory_splitting;
 	uint64_t allocatedMemory_voxelization;
+
+	uint64_t duplicates; // points removed by DedupPolicy while splitting
 };
\ No newline at end of file
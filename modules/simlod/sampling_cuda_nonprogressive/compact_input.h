@@ -0,0 +1,79 @@
+
+#pragma once
+
+// Compact input of the split, shared by the CUDA kernels (NVRTC) and the host.
+//
+// Instead of 16 byte Points, the input holds two streams:
+//   uint64_t positions[numPoints]  x, y and z quantized to <bitsPerAxis> bits each within the root node's cube
+//   uint32_t colors[numPoints]
+// The counting passes of the split only read the 8 byte positions, and the input takes 12 instead of 16 bytes per point.
+//
+// Quantized positions decode to the centers of their cells, i.e., they're off by half a cell, cubeSize / 2^(bitsPerAxis + 1),
+// plus float rounding. With 21 bits, that's about 0.3mm for a 1km cube. Fewer bits merge nearby points into the same cell,
+// but positions still take one 64 bit word.
+
+#if !defined(__CUDACC_RTC__)
+	#include <cstdint>
+#endif
+
+#if defined(__CUDACC__) || defined(__CUDACC_RTC__)
+	#define COMPACT_INPUT_FUNC __host__ __device__ constexpr
+#else
+	#define COMPACT_INPUT_FUNC constexpr
+#endif
+
+enum InputFormat{
+	INPUT_FORMAT_POINTS  = 0,
+	INPUT_FORMAT_COMPACT = 1,
+};
+
+struct CompactInput{
+
+	static constexpr uint32_t MAX_BITS = 21;
+
+	InputFormat format   = INPUT_FORMAT_POINTS;
+	uint32_t bitsPerAxis = MAX_BITS;
+
+	// the root node's cube
+	float min_x    = 0.0f;
+	float min_y    = 0.0f;
+	float min_z    = 0.0f;
+	float cubeSize = 1.0f;
+
+	COMPACT_INPUT_FUNC uint32_t numCells() const {
+		return 1u << bitsPerAxis;
+	}
+
+	COMPACT_INPUT_FUNC float cellSize() const {
+		return cubeSize / float(numCells());
+	}
+
+	COMPACT_INPUT_FUNC int64_t bytesPerPoint() const {
+		return format == INPUT_FORMAT_COMPACT ? 12 : 16;
+	}
+
+	COMPACT_INPUT_FUNC uint32_t quantize(float value, float min) const {
+		float f = (value - min) / cellSize();
+
+		if(!(f > 0.0f)) return 0;
+		if(f >= float(numCells() - 1)) return numCells() - 1;
+
+		return uint32_t(f);
+	}
+
+	COMPACT_INPUT_FUNC uint64_t encode(float x, float y, float z) const {
+		uint64_t qx = quantize(x, min_x);
+		uint64_t qy = quantize(y, min_y);
+		uint64_t qz = quantize(z, min_z);
+
+		return qx | (qy << MAX_BITS) | (qz << (2 * MAX_BITS));
+	}
+
+	// coordinate of <axis> (0, 1 or 2) of an encoded position
+	COMPACT_INPUT_FUNC float decode(uint64_t position, uint32_t axis, float min) const {
+		uint32_t q = (position >> (axis * MAX_BITS)) & ((1u << MAX_BITS) - 1u);
+
+		return (float(q) + 0.5f) * cellSize() + min;
+	}
+
+};
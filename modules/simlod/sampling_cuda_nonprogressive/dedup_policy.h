@@ -0,0 +1,78 @@
+
+#pragma once
+
+// Duplicate-point elimination while splitting, shared by the CUDA kernels (NVRTC) and the host.
+//
+// Positions are quantized to cells within the root node's cube. Points that fall into the same cell
+// are duplicates, only the one with the lowest input index is kept.
+// The cell size is the largest cubeSize / 2^k that doesn't exceed <tolerance>, so that quantization cells
+// nest inside octree nodes and all duplicates of a point belong to the same leaf.
+// Depending on <colorMerge>, the kept point retains its own color or gets the average of all its duplicates.
+//
+// Keys use 21 bits per axis, so cells can't be smaller than cubeSize / 2^21.
+
+#if !defined(__CUDACC_RTC__)
+	#include <cstdint>
+#endif
+
+#if defined(__CUDACC__) || defined(__CUDACC_RTC__)
+	#define DEDUP_POLICY_FUNC __host__ __device__ constexpr
+#else
+	#define DEDUP_POLICY_FUNC constexpr
+#endif
+
+enum ColorMerge{
+	COLOR_MERGE_FIRST   = 0,
+	COLOR_MERGE_AVERAGE = 1,
+};
+
+struct DedupPolicy{
+
+	static constexpr uint32_t KEY_BITS = 21;
+	static constexpr uint32_t KEY_CELLS = 1u << KEY_BITS;
+	static constexpr uint64_t EMPTY_KEY = 0xffffffffffffffffull;
+
+	bool enabled          = false;
+	float tolerance       = 0.001f;
+	ColorMerge colorMerge = COLOR_MERGE_FIRST;
+
+	DEDUP_POLICY_FUNC float cellSize(float cubeSize) const {
+		float size = cubeSize;
+
+		for(uint32_t level = 0; level < KEY_BITS && size > tolerance; level++){
+			size = size * 0.5f;
+		}
+
+		return size;
+	}
+
+	DEDUP_POLICY_FUNC uint32_t quantize(float value, float min, float cellSize) const {
+		float f = (value - min) / cellSize;
+
+		if(!(f > 0.0f)) return 0;
+		if(f >= float(KEY_CELLS - 1)) return KEY_CELLS - 1;
+
+		return uint32_t(f);
+	}
+
+	DEDUP_POLICY_FUNC uint64_t keyOf(float x, float y, float z, float min_x, float min_y, float min_z, float cellSize) const {
+		uint64_t qx = quantize(x, min_x, cellSize);
+		uint64_t qy = quantize(y, min_y, cellSize);
+		uint64_t qz = quantize(z, min_z, cellSize);
+
+		return qx | (qy << KEY_BITS) | (qz << (2 * KEY_BITS));
+	}
+
+	// start of the probe sequence of <key> in a table with <capacity> slots
+	DEDUP_POLICY_FUNC uint64_t slotOf(uint64_t key, uint64_t capacity) const {
+		uint64_t h = key;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+
+		return h % capacity;
+	}
+
+};
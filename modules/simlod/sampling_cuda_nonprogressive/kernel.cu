@@ -7,6 +7,7 @@
 #include <curand_kernel.h>
 
 #include "methods_common.h.cu"
+#include "sample_hash.h" // at global scope, it's shared by several voxelize_* namespaces
 
 #include "voxelize_singlecell.cu"
 #include "voxelize_neighborhood.cu"
@@ -19,6 +20,7 @@
 #include "voxelize_singlecell_blockwise.cu"
 #include "voxelize_neighborhood_blockwise.cu"
 #include "voxelize_sampleselect_central_blockwise.cu"
+#include "voxelize_poisson_blockwise.cu"
    
 namespace cg = cooperative_groups;
  
@@ -181,6 +183,12 @@ void kernel2(
 		box.max = box.min + cubeSize;
 	} 
 
+	// methods_common.h.cu is included into each split namespace, so each has its own copy of the policies
+	split_countsort::splitPolicy = state.splitPolicy;
+	split_countsort_blockwise::splitPolicy = state.splitPolicy;
+	split_countsort_blockwise::dedupPolicy = state.dedupPolicy;
+	split_countsort_blockwise::compactInput = state.compactInput;
+
 	grid.sync();
 
 	{// PICK SPLIT METHOD
@@ -188,7 +196,7 @@ void kernel2(
 		// split_countsort::main_split(allocator, box, input_points, state.metadata.numPoints, nodes, num_nodes, sorted);
 
 		// One workgroup per node on second split. 
-		split_countsort_blockwise::main_split(allocator, box, input_points, state.metadata.numPoints, nodes, num_nodes, sorted, points, lines);
+		split_countsort_blockwise::main_split(allocator, box, input_points, state.metadata.numPoints, nodes, num_nodes, sorted, points, lines, &results->duplicates);
 	}
 
 	// prototyping, dont use
@@ -253,15 +261,17 @@ void kernel3(
 	if(state.strategy == SamplingStrategy::FIRST_COME){
 		sampleselect_first_blockwise::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted);
 	}else if(state.strategy == SamplingStrategy::RANDOM){
-		sampleselect_random_blockwise_globalmem::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted);
+		sampleselect_random_blockwise_globalmem::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted, state.seed);
 	}else if(state.strategy == SamplingStrategy::AVERAGE_SINGLECELL){
 		voxelize_singlecell_blockwise::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted);
 	}else if(state.strategy == SamplingStrategy::WEIGHTED_NEIGHBORHOOD){
 		voxelize_neighborhood_blockwise::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted);
+	}else if(state.strategy == SamplingStrategy::POISSON_DISK){
+		voxelize_poisson_blockwise::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted, state.seed, state.poissonPolicy);
 	}
 	 
 	{ // PICK VOXELIZATION METHOD
-		// sampleselect_random_blockwise_globalmem::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted);
+		// sampleselect_random_blockwise_globalmem::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted, state.seed);
 		
 		// FIRST-COME
 		// sampleselect_first_blockwise::main_voxelize(allocator, box, state.metadata.numPoints, *nodes, *num_nodes, *sorted);
@@ -385,7 +395,7 @@ void kernel3(
 
 		if(grid.thread_rank() == 0){
 			results->strategy   = state.strategy;
-			results->points     = numPoints;
+			results->points     = numPoints - results->duplicates; // the points in the tree
 			results->voxels     = stat_sum_inner;
 			results->nodes      = numNodes;
 			results->innerNodes = stat_num_inner;
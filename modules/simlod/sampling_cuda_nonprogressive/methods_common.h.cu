@@ -1,13 +1,24 @@
 
 #include "lib.h.cu"
+#include "split_policy.h"
+#include "dedup_policy.h"
+#include "compact_input.h"
 
 constexpr bool PRINT_STATS = false;
 
 static constexpr int MAX_NODES           = 200'000;
-static constexpr int MAX_POINTS_PER_NODE = 50'000;
 static constexpr int VOXEL_GRID_SIZE     = 128;
 static constexpr int MAX_DEPTH           = 20;
 
+// leaf sizes, copied from State::splitPolicy before splitting
+SplitPolicy splitPolicy;
+
+// duplicate removal, copied from State::dedupPolicy before splitting
+DedupPolicy dedupPolicy;
+
+// format of the split input, copied from State::compactInput before splitting
+CompactInput compactInput;
+
 struct Node{
 	int pointOffset;
 	int numPoints;
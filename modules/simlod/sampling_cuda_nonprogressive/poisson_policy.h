@@ -0,0 +1,83 @@
+#pragma once
+
+// Poisson-disk sample selection, shared by the CUDA kernels (NVRTC) and the host.
+//
+// A node keeps a subset of its children's points and voxels in which no two samples are closer than
+//     radius = radiusScale * nodeSize / 128
+// i.e. <radiusScale> cells of the 128³ grid of the other strategies. Samples keep their positions.
+//
+// Candidates are bucketed into a spatial hash with cell size radius / sqrt(3), so a cell holds
+// at most one sample and a candidate can only conflict with samples up to 2 cells away.
+// Cells are processed in 27 phases by (x % 3, y % 3, z % 3). Cells of the same phase are at least
+// 3 cells apart along an axis, so a phase can be processed in parallel without conflicts.
+// Within a cell, candidates are tried in the order of their sample_hash key, so that the result
+// only depends on the seed and the candidates, not on their order or on the number of threads.
+//
+// Cell coordinates are computed in double precision, which is rounded the same on host and device.
+// Keys use 21 bits per axis.
+//
+// CPU: include/PoissonSampling.h, GPU: voxelize_poisson_blockwise.cu
+
+#if !defined(__CUDACC_RTC__)
+	#include <cstdint>
+#endif
+
+#if defined(__CUDACC__) || defined(__CUDACC_RTC__)
+	#define POISSON_POLICY_FUNC __host__ __device__ constexpr
+#else
+	#define POISSON_POLICY_FUNC constexpr
+#endif
+
+struct PoissonPolicy{
+
+	static constexpr uint32_t KEY_BITS = 21;
+	static constexpr int MAX_CELL = (1 << KEY_BITS) - 1;
+	static constexpr uint64_t EMPTY_KEY = 0xffffffffffffffffull;
+	static constexpr int NUM_PHASES = 27;
+
+	float radiusScale = 1.0f;
+
+	POISSON_POLICY_FUNC double radius(double nodeSize, double gridSize) const {
+		return double(radiusScale) * nodeSize / gridSize;
+	}
+
+	POISSON_POLICY_FUNC double cellSize(double radius) const {
+		return radius / 1.7320508075688772;
+	}
+
+	POISSON_POLICY_FUNC int maxCell(double nodeSize, double cellSize) const {
+		double cells = nodeSize / cellSize;
+
+		return cells < double(MAX_CELL) ? int(cells) : MAX_CELL;
+	}
+
+	POISSON_POLICY_FUNC int toCell(float value, float min, double cellSize, int maxCell) const {
+		double f = (double(value) - double(min)) / cellSize;
+
+		if(!(f > 0.0)) return 0;
+		if(f >= double(maxCell)) return maxCell;
+
+		return int(f);
+	}
+
+	POISSON_POLICY_FUNC uint64_t keyOf(int ix, int iy, int iz) const {
+		return uint64_t(ix) | (uint64_t(iy) << KEY_BITS) | (uint64_t(iz) << (2 * KEY_BITS));
+	}
+
+	POISSON_POLICY_FUNC int phaseOf(int ix, int iy, int iz) const {
+		return (ix % 3) + 3 * (iy % 3) + 9 * (iz % 3);
+	}
+
+	// start of the probe sequence of <key> in a table with <capacity> slots
+	POISSON_POLICY_FUNC uint64_t slotOf(uint64_t key, uint64_t capacity) const {
+		uint64_t h = key;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+
+		return h % capacity;
+	}
+
+};
@@ -0,0 +1,104 @@
+
+#pragma once
+
+// Deterministic sample selection, shared by the CUDA kernels (NVRTC) and the host.
+//
+// Each cell keeps the candidate with the smallest 64 bit key
+//     [ 40 bit hash of the point | 3 bit child index | 21 bit index within the child ]
+// The hash only depends on the seed and on the point's position and color bits, so the selected
+// representative does not depend on point order, thread count or scheduling, and a cell can be
+// reduced in a single pass with atomic min.
+//
+// Cell coordinates and cell centers use explicitly rounded float ops, so that
+// --use_fast_math on the device doesn't make them diverge from the host.
+
+#if !defined(__CUDACC_RTC__)
+	#include <cstdint>
+	#include <cstring>
+#endif
+
+#if defined(__CUDACC__) || defined(__CUDACC_RTC__)
+	#define SAMPLE_HASH_FUNC __host__ __device__ inline
+#else
+	#define SAMPLE_HASH_FUNC inline
+#endif
+
+namespace sample_hash{
+
+	constexpr uint64_t EMPTY_KEY        = 0xffffffff'ffffffffull;
+	constexpr int      INDEX_BITS       = 21;
+	constexpr uint64_t INDEX_MASK       = (1ull << INDEX_BITS) - 1ull;
+	constexpr int      CHILD_SHIFT      = INDEX_BITS;
+	constexpr int      HASH_SHIFT       = INDEX_BITS + 3;
+
+	SAMPLE_HASH_FUNC uint32_t floatBits(float value){
+		#if defined(__CUDA_ARCH__)
+			return __float_as_uint(value);
+		#else
+			uint32_t bits;
+			memcpy(&bits, &value, 4);
+			return bits;
+		#endif
+	}
+
+	// splitmix64 finalizer
+	SAMPLE_HASH_FUNC uint64_t mix(uint64_t h){
+		h ^= h >> 30;
+		h *= 0xbf58476d1ce4e5b9ull;
+		h ^= h >> 27;
+		h *= 0x94d049bb133111ebull;
+		h ^= h >> 31;
+
+		return h;
+	}
+
+	SAMPLE_HASH_FUNC uint64_t hashPoint(float x, float y, float z, uint32_t color, uint32_t seed){
+		uint64_t h = mix(uint64_t(seed) + 0x9e3779b97f4a7c15ull);
+		h = mix(h ^ ((uint64_t(floatBits(x)) << 32) | floatBits(y)));
+		h = mix(h ^ ((uint64_t(floatBits(z)) << 32) | color));
+
+		return h;
+	}
+
+	SAMPLE_HASH_FUNC uint64_t toKey(uint64_t hash, uint32_t childIndex, uint32_t index){
+		return ((hash >> HASH_SHIFT) << HASH_SHIFT)
+			| (uint64_t(childIndex & 0b111) << CHILD_SHIFT)
+			| (uint64_t(index) & INDEX_MASK);
+	}
+
+	SAMPLE_HASH_FUNC uint32_t childIndexOf(uint64_t key){
+		return (key >> CHILD_SHIFT) & 0b111;
+	}
+
+	SAMPLE_HASH_FUNC uint32_t indexOf(uint64_t key){
+		return key & INDEX_MASK;
+	}
+
+	// clamp(gridSize * (value - min) / size, 0, gridSize - 1), as computed by the kernels
+	SAMPLE_HASH_FUNC int toCell(float value, float min, float size, float fGridSize){
+		#if defined(__CUDA_ARCH__)
+			float u = __fdiv_rn(__fmul_rn(fGridSize, __fsub_rn(value, min)), size);
+		#else
+			volatile float diff = value - min;
+			volatile float scaled = fGridSize * diff;
+			float u = scaled / size;
+		#endif
+
+		u = u < 0.0f ? 0.0f : u;
+		u = u > fGridSize - 1.0f ? fGridSize - 1.0f : u;
+
+		return int(u);
+	}
+
+	// (cell + 0.5) * size / gridSize + min
+	SAMPLE_HASH_FUNC float cellCenter(int cell, float min, float size, float fGridSize){
+		#if defined(__CUDA_ARCH__)
+			return __fadd_rn(__fdiv_rn(__fmul_rn(float(cell) + 0.5f, size), fGridSize), min);
+		#else
+			volatile float scaled = (float(cell) + 0.5f) * size;
+			volatile float divided = scaled / fGridSize;
+			return divided + min;
+		#endif
+	}
+
+};
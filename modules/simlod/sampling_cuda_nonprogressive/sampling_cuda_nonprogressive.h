@@ -30,7 +30,7 @@
 #include "CudaModularProgram.h"
 #include "common.h"
 
-#include "utils.h"
+#include "morton.h"
 #include "OctreeWriter.h"
 
 #include <thrust/sort.h>
@@ -49,6 +49,9 @@ namespace simlod_gentree_cuda_nonprogressive{
 	// For Bernhard and the CA21 Bunds datas set with 975M points
 	#define MAX_BUFFER_SIZE 15'000'000'000
 
+// Not resumable, unlike distributed::run() with its checkpoints. The octree only exists in device
+// memory, linked by device pointers, and a restart repeats loadLas() and both kernels. The kernels take
+// seconds, so a checkpoint would mostly save the load, at the cost of writing the octree's nodes relocatably.
 struct VoxelTreeGen{
 
 	Renderer* renderer = nullptr;
@@ -66,6 +69,10 @@ struct VoxelTreeGen{
 	CudaModularProgram*  prog_build_lod = nullptr;
 	CudaModularProgram*  prog_render = nullptr;
 
+	// format of the points in ptr_input_points
+	CompactInput uploadedInput;
+	bool inputUploaded = false;
+
 	GLuint vao = -1;
 
 	bool registered = false;
@@ -79,8 +86,8 @@ struct VoxelTreeGen{
 		cuMemAlloc(&ptr_buffer, MAX_BUFFER_SIZE);
 		cuMemAlloc(&ptr_results, sizeof(Results));
 		cuMemAlloc(&ptr_render_buffer, 100'000'000);
-		cuMemAlloc(&ptr_input_points, 16 * lasfile->points.size());
-		cuMemcpyHtoD(ptr_input_points, &lasfile->points[0], 16 * lasfile->points.size());
+
+		uploadInput();
 
 		prog_build_lod = new CudaModularProgram({
 			.modules = {
@@ -134,6 +141,58 @@ struct VoxelTreeGen{
 
 	}
 
+	// uploads the points in the format selected in Runtime::compactInput, unless they already are.
+	// Compact positions are quantized to the root node's cube, which starts at 0 like the points.
+	void uploadInput(){
+
+		CompactInput input = Runtime::compactInput;
+		input.bitsPerAxis = std::clamp(input.bitsPerAxis, 1u, CompactInput::MAX_BITS);
+		input.min_x = 0.0f;
+		input.min_y = 0.0f;
+		input.min_z = 0.0f;
+		input.cubeSize = std::max({
+			float(lasfile->header.boxMax.x) - float(lasfile->header.boxMin.x),
+			float(lasfile->header.boxMax.y) - float(lasfile->header.boxMin.y),
+			float(lasfile->header.boxMax.z) - float(lasfile->header.boxMin.z),
+		});
+
+		bool unchanged = inputUploaded
+			&& input.format == uploadedInput.format
+			&& (input.format == INPUT_FORMAT_POINTS || input.bitsPerAxis == uploadedInput.bitsPerAxis);
+
+		if(unchanged) return;
+
+		int64_t numPoints = lasfile->points.size();
+
+		if(inputUploaded){
+			cuMemFree(ptr_input_points);
+		}
+
+		cuMemAlloc(&ptr_input_points, input.bytesPerPoint() * numPoints);
+
+		if(input.format == INPUT_FORMAT_COMPACT){
+			Buffer buffer(input.bytesPerPoint() * numPoints);
+			uint64_t* positions = reinterpret_cast<uint64_t*>(buffer.data);
+			uint32_t* colors = reinterpret_cast<uint32_t*>(positions + numPoints);
+
+			for(int64_t i = 0; i < numPoints; i++){
+				auto& point = lasfile->points[i];
+
+				positions[i] = input.encode(point.x, point.y, point.z);
+				memcpy(&colors[i], &point.r, 4);
+			}
+
+			cuMemcpyHtoD(ptr_input_points, buffer.data, buffer.size);
+		}else{
+			cuMemcpyHtoD(ptr_input_points, &lasfile->points[0], 16 * numPoints);
+		}
+
+		uploadedInput = input;
+		inputUploaded = true;
+
+		cout << "uploaded " << formatNumber(numPoints) << " points, " << input.bytesPerPoint() << " bytes per point" << endl;
+	}
+
 	void voxelize(bool wasJustCompiled = false){
 		if (prog_build_lod == nullptr){
 			return;
@@ -146,6 +205,8 @@ struct VoxelTreeGen{
 		cout << endl;
 		cout << "==== run cuda ===" << endl;
 
+		uploadInput();
+
 		State state;
 		{
 			state.metadata.numPoints = this->numPoints;
@@ -170,6 +231,11 @@ struct VoxelTreeGen{
 
 			state.strategy = static_cast<SamplingStrategy>(Runtime::samplingStrategy);
 			state.LOD = Runtime::LOD;
+			state.seed = Runtime::samplingSeed;
+			state.splitPolicy = Runtime::splitPolicy;
+			state.dedupPolicy = Runtime::dedupPolicy;
+			state.compactInput = uploadedInput;
+			state.poissonPolicy = Runtime::poissonPolicy;
 		}
 
 		void* args[] = {
@@ -343,16 +409,19 @@ struct VoxelTreeGen{
 
 			ss << "==== RESULTS ====" << endl;
 
-			double pointsPerMS = double(results.points) / double(total_ms);
+			// throughput of the input, including the duplicates that were removed
+			double pointsPerMS = double(results.points + results.duplicates) / double(total_ms);
 			uint64_t mpointsPerS = (pointsPerMS * 1000.0) / 1'000'000.0;
 			
 			auto locale = std::locale("en_GB.UTF-8");
 			ss << std::format(locale, "#points:                     {:15L}", results.points) << endl;
 			ss << std::format(locale, "#voxels:                     {:15L}", results.voxels) << endl;
+			ss << std::format(locale, "#duplicates removed:         {:15L}", results.duplicates) << endl;
 			ss << std::format(locale, "#nodes:                      {:15L}", results.nodes) << endl;
 			ss << std::format(locale, "million points / sec:        {:15L}", mpointsPerS) << endl;
 			ss << std::format(locale, "#allocated (splitting):      {:15L}", results.allocatedMemory_splitting) << endl;
 			ss << std::format(locale, "#allocated (voxelization):   {:15L}", results.allocatedMemory_voxelization) << endl;
+			ss << std::format(locale, "split threshold (points):    {:15L}", Runtime::splitPolicy.splitThreshold()) << endl;
 			ss << std::format(locale, "min-avg-max points/node      {:7L} - {:7L} - {:7L}", 
 				results.minPoints, results.avgPoints, results.maxPoints) << endl;
 			ss << std::format(locale, "min-avg-max voxels/node      {:7L} - {:7L} - {:7L}", 
@@ -443,6 +512,8 @@ struct VoxelTreeGen{
 				strategy = "AVERAGE_SINGLECELL";
 			}else if(results.strategy == SamplingStrategy::WEIGHTED_NEIGHBORHOOD){
 				strategy = "WEIGHTED_NEIGHBORHOOD";
+			}else if(results.strategy == SamplingStrategy::POISSON_DISK){
+				strategy = "POISSON_DISK";
 			}
 
 			auto timestamp = std::chrono::system_clock::now();
@@ -11,7 +11,7 @@ namespace cg = cooperative_groups;
 
 
 // splits an octree node with many points by <depth> hierachy levels
-// until leaf nodes have at most MAX_POINTS_PER_NODE.
+// until leaf nodes have at most splitPolicy.splitThreshold() points.
 // Leaf nodes can have more points if <depth> is insufficient.
 // In that case, split_node must be called again on all large leaf nodes.
 void split_node(
@@ -204,7 +204,7 @@ void split_node(
 				if(c111 == -1){ numUnmergeable++; } else if(c111 > 0) { numMergeable++; sumPoints += c111; };
 			}
 			
-			if(sumPoints < MAX_POINTS_PER_NODE && sumPoints != 0 && numUnmergeable == 0){
+			if(numUnmergeable == 0 && splitPolicy.shouldMerge(sumPoints, numMergeable)){
 
 				// MERGE
 				// for(int dx : {0, 1})
@@ -543,7 +543,7 @@ void main_split(
 
 		auto oldAllocatorOffset = allocator.offset;
 
-		if(node->numPoints > MAX_POINTS_PER_NODE){
+		if(node->numPoints > splitPolicy.splitThreshold()){
 
 			// 1. COPY POINTS IN NODE INTO A TEMP BUFFER
 			// 2. SPLIT WITH TEMP BUFFER AS INPUT, AND SORTED AS TARGET
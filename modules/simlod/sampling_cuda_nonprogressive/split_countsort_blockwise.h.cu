@@ -48,6 +48,28 @@ Node** subGridsPtrs_l4;
 
 uint32_t* dbg;
 
+// DUPLICATES, see dedup_policy.h
+// Open addressing hash map from quantized positions to the lowest index of a point in that cell.
+// It's only needed until the keep bits are set, so it lives in the sorted buffer, which distribute() overwrites later.
+// 12 byte slots in the 16 bytes per point of the sorted buffer give a load factor of at most 0.75.
+uint64_t dedupCapacity;
+unsigned long long* dedupKeys;
+uint32_t* dedupFirst;
+vec3 dedupMin;
+float dedupCellSize;
+uint32_t* numDuplicates;
+
+// one bit per input point, set for the points that are kept
+uint32_t* dedupKeep;
+
+// COLOR_MERGE_AVERAGE: cells with duplicates get a group with 64 bit sums of r, g, b and the count at dedupGroupSums[4 * group].
+// dedupColors holds the merged color of each kept point.
+constexpr uint32_t NO_GROUP = 0xffffffff;
+uint32_t* dedupGroups;
+uint32_t* numDedupGroups;
+unsigned long long* dedupGroupSums;
+uint32_t* dedupColors;
+
 struct State{
 	Box3 box;
 	vec3 boxSize;
@@ -55,8 +77,189 @@ struct State{
 	uint32_t* numNodes;
 	Point* points_unsorted;
 	Point* points_sorted;
+
+	// INPUT_FORMAT_COMPACT, see compact_input.h
+	bool isCompact;
+	uint64_t* positions_unsorted;
+	uint32_t* colors_unsorted;
 };
 
+// input point without its color, enough for counting
+Point loadPosition(const State& state, uint32_t pointIndex){
+
+	if(!state.isCompact) return state.points_unsorted[pointIndex];
+
+	uint64_t position = state.positions_unsorted[pointIndex];
+
+	Point point;
+	point.x = compactInput.decode(position, 0, compactInput.min_x);
+	point.y = compactInput.decode(position, 1, compactInput.min_y);
+	point.z = compactInput.decode(position, 2, compactInput.min_z);
+	point.color = 0;
+
+	return point;
+}
+
+Point loadPoint(const State& state, uint32_t pointIndex){
+
+	if(!state.isCompact) return state.points_unsorted[pointIndex];
+
+	Point point = loadPosition(state, pointIndex);
+	point.color = state.colors_unsorted[pointIndex];
+
+	return point;
+}
+
+
+uint64_t dedupSlotOf(Point point){
+	uint64_t key = dedupPolicy.keyOf(point.x, point.y, point.z, dedupMin.x, dedupMin.y, dedupMin.z, dedupCellSize);
+	uint64_t slot = dedupPolicy.slotOf(key, dedupCapacity);
+
+	while(dedupKeys[slot] != key){
+		slot = (slot + 1) % dedupCapacity;
+	}
+
+	return slot;
+}
+
+bool isKept(uint32_t pointIndex){
+	return (dedupKeep[pointIndex / 32] & (1u << (pointIndex % 32))) != 0;
+}
+
+// Sets the keep bits of the points of local_root, and with COLOR_MERGE_AVERAGE their merged colors.
+// Besides the sorted buffer, this needs 1 bit per point, or with averaged colors about 10 bytes per point
+// plus 32 bytes per cell with duplicates. All of it is released together with the other temporary split buffers.
+void doDeduplication(Node* local_root, State state){
+	auto grid = cg::this_grid();
+
+	uint32_t numPoints = local_root->numPoints;
+	bool averageColors = dedupPolicy.colorMerge == COLOR_MERGE_AVERAGE;
+
+	if(numPoints == 0) return;
+
+	dedupCapacity = (uint64_t(numPoints) * sizeof(Point)) / (sizeof(unsigned long long) + sizeof(uint32_t));
+	dedupMin      = state.box.min;
+	dedupCellSize = dedupPolicy.cellSize(state.boxSize.longestAxis());
+	dedupKeys     = reinterpret_cast<unsigned long long*>(state.points_sorted);
+	dedupFirst    = reinterpret_cast<uint32_t*>(dedupKeys + dedupCapacity);
+	dedupKeep     = allocator->alloc<uint32_t*>((numPoints / 32 + 1) * sizeof(uint32_t));
+
+	clearBuffer(dedupKeys, 0, dedupCapacity * sizeof(unsigned long long), 0xff);
+	clearBuffer(dedupFirst, 0, dedupCapacity * sizeof(uint32_t), 0xff);
+	clearBuffer(dedupKeep, 0, (numPoints / 32 + 1) * sizeof(uint32_t), 0);
+
+	if(averageColors){
+		dedupGroups    = allocator->alloc<uint32_t*>(dedupCapacity * sizeof(uint32_t));
+		numDedupGroups = allocator->alloc<uint32_t*>(4);
+		dedupColors    = allocator->alloc<uint32_t*>(uint64_t(numPoints) * sizeof(uint32_t));
+
+		clearBuffer(dedupGroups, 0, dedupCapacity * sizeof(uint32_t), 0);
+
+		if(isFirstThread()){
+			*numDedupGroups = 0;
+		}
+	}
+
+	grid.sync();
+
+	// INSERT
+	processRange(0, numPoints, [&](int pointIndex){
+		Point point = loadPosition(state, pointIndex);
+
+		uint64_t key = dedupPolicy.keyOf(point.x, point.y, point.z, dedupMin.x, dedupMin.y, dedupMin.z, dedupCellSize);
+		uint64_t slot = dedupPolicy.slotOf(key, dedupCapacity);
+
+		// linear probing until we either claim an empty slot or find the key
+		while(true){
+			unsigned long long old = atomicCAS(&dedupKeys[slot], DedupPolicy::EMPTY_KEY, key);
+
+			if(old == DedupPolicy::EMPTY_KEY || old == key) break;
+
+			slot = (slot + 1) % dedupCapacity;
+		}
+
+		// lowest index wins, so results don't depend on thread scheduling
+		atomicMin(&dedupFirst[slot], uint32_t(pointIndex));
+
+		if(averageColors){
+			// counts the points of the cell, until groups are assigned
+			atomicAdd(&dedupGroups[slot], 1);
+		}
+	});
+
+	grid.sync();
+
+	if(averageColors){
+		processRange(0, dedupCapacity, [&](int slot){
+			dedupGroups[slot] = dedupGroups[slot] > 1 ? atomicAdd(numDedupGroups, 1) : NO_GROUP;
+		});
+
+		grid.sync();
+
+		dedupGroupSums = allocator->alloc<unsigned long long*>(4 * uint64_t(*numDedupGroups) * sizeof(unsigned long long));
+		clearBuffer(dedupGroupSums, 0, 4 * uint64_t(*numDedupGroups) * sizeof(unsigned long long), 0);
+
+		grid.sync();
+	}
+
+	// KEEP the first point of each cell
+	processRange(0, numPoints, [&](int pointIndex){
+		Point point = averageColors ? loadPoint(state, pointIndex) : loadPosition(state, pointIndex);
+		uint64_t slot = dedupSlotOf(point);
+
+		if(dedupFirst[slot] == pointIndex){
+			atomicOr(&dedupKeep[pointIndex / 32], 1u << (pointIndex % 32));
+		}
+
+		if(averageColors && dedupGroups[slot] != NO_GROUP){
+			unsigned long long* sums = &dedupGroupSums[4 * dedupGroups[slot]];
+
+			atomicAdd(&sums[0], (unsigned long long)((point.color >>  0) & 0xff));
+			atomicAdd(&sums[1], (unsigned long long)((point.color >>  8) & 0xff));
+			atomicAdd(&sums[2], (unsigned long long)((point.color >> 16) & 0xff));
+			atomicAdd(&sums[3], 1ull);
+		}
+	});
+
+	grid.sync();
+
+	// MERGE the colors of the kept points
+	if(averageColors){
+		processRange(0, numPoints, [&](int pointIndex){
+			if(!isKept(pointIndex)) return;
+
+			Point point = loadPoint(state, pointIndex);
+			uint32_t group = dedupGroups[dedupSlotOf(point)];
+
+			if(group != NO_GROUP){
+				unsigned long long* sums = &dedupGroupSums[4 * group];
+				uint32_t r = sums[0] / sums[3];
+				uint32_t g = sums[1] / sums[3];
+				uint32_t b = sums[2] / sums[3];
+				point.color = r | (g << 8) | (b << 16) | (point.color & 0xff000000);
+			}
+
+			dedupColors[pointIndex] = point.color;
+		});
+	}
+
+	grid.sync();
+}
+
+// Whether the point is a duplicate that is dropped.
+// If it is kept and colors are averaged, <point> receives the merged color.
+bool resolveDuplicate(Point& point, uint32_t pointIndex){
+
+	if(!dedupPolicy.enabled) return false;
+
+	if(!isKept(pointIndex)) return true;
+
+	if(dedupPolicy.colorMerge == COLOR_MERGE_AVERAGE){
+		point.color = dedupColors[pointIndex];
+	}
+
+	return false;
+}
 
 // count how many points fall into each cell
 // - we first count on the main grid (256³ if depth == 8)
@@ -64,6 +267,7 @@ struct State{
 //   we create subgrids of depth 4 (16³ cells) and count on subgrids
 // end result is a counting grid of depth 12, made up of a main grid of depth 8
 // and optional sparse grids with depth 4
+// - with dedupPolicy enabled, only the first point of each quantization cell is counted
 void doCounting(
 	uint32_t* countingGrid,
 	Node* local_root,
@@ -77,12 +281,12 @@ void doCounting(
 	uint32_t pointsPerThread = local_root->numPoints / grid.num_threads() + 1;
 	uint32_t pointsPerBlock  = pointsPerThread * block.num_threads();
 	uint32_t blockFirst      = grid.block_rank() * pointsPerBlock;
+	uint32_t splitThreshold  = splitPolicy.splitThreshold();
 
 	int gridSize             = state.gridSize;
 	float fGridSize          = state.gridSize;
 	Box3 box                 = state.box;
 	vec3 boxSize             = state.boxSize;
-	Point* points_unsorted   = state.points_unsorted;
 	
 	// count points on main counting grid (if 8 levels -> 256³)
 	for(int i = 0; i < pointsPerThread; i++){
@@ -91,7 +295,12 @@ void doCounting(
 
 		if(pointIndex >= local_root->numPoints) break;
 		
-		Point point = state.points_unsorted[pointIndex];
+		Point point = loadPosition(state, pointIndex);
+
+		if(resolveDuplicate(point, pointIndex)){
+			atomicAdd(numDuplicates, 1);
+			continue;
+		}
 
 		float fx = fGridSize * (point.x - box.min.x) / boxSize.x;
 		float fy = fGridSize * (point.y - box.min.y) / boxSize.y;
@@ -119,7 +328,7 @@ void doCounting(
 		uint32_t old = atomicAdd(&countingGrid[voxelIndex], 1);
 
 		// cells with too many points are noted and added to a list
-		if(old == MAX_POINTS_PER_NODE){
+		if(old == splitThreshold){
 			uint32_t largeCellIndex = atomicAdd(numSubGrids, 1);
 			largeCells[largeCellIndex] = voxelIndex;
 		}
@@ -183,7 +392,9 @@ void doCounting(
 
 		if(pointIndex >= local_root->numPoints) break;
 		
-		Point point = points_unsorted[pointIndex];
+		Point point = loadPosition(state, pointIndex);
+
+		if(resolveDuplicate(point, pointIndex)) continue;
 
 		float fx = fGridSize * (point.x - box.min.x) / boxSize.x;
 		float fy = fGridSize * (point.y - box.min.y) / boxSize.y;
@@ -220,8 +431,8 @@ void doCounting(
 }
 
 // each cell represents an octree node, but we want to avoid nodes with too litle points
-// this function merges cells with few points, provided the merged cell has less than 
-// the threshold
+// this function merges cells with few points, if the split policy's cost model
+// considers one merged leaf cheaper than the separate siblings
 void mergeSubGrids(){
 	auto grid = cg::this_grid();
 
@@ -287,7 +498,7 @@ void mergeSubGrids(){
 			if(c110 == 0xffffffff){ numUnmergeable++; } else if(c110 > 0) { numMergeable++; sumPoints += c110; };
 			if(c111 == 0xffffffff){ numUnmergeable++; } else if(c111 > 0) { numMergeable++; sumPoints += c111; };
 
-			if(sumPoints < MAX_POINTS_PER_NODE && sumPoints != 0 && numUnmergeable == 0){
+			if(numUnmergeable == 0 && splitPolicy.shouldMerge(sumPoints, numMergeable)){
 				// MERGE
 
 				counters_next[((2 * ix + 0) + gridSize2 * (2 * iy + 0) + gridSize2 * gridSize2 * (2 * iz + 0))] = 0;
@@ -362,7 +573,7 @@ void mergeMainGrid(
 			if(isUnmergable(c110)){ numUnmergeable++; } else if(c110 > 0) { numMergeable++; sumPoints += c110; };
 			if(isUnmergable(c111)){ numUnmergeable++; } else if(c111 > 0) { numMergeable++; sumPoints += c111; };
 
-			if(sumPoints < MAX_POINTS_PER_NODE && sumPoints != 0 && numUnmergeable == 0){
+			if(numUnmergeable == 0 && splitPolicy.shouldMerge(sumPoints, numMergeable)){
 				// MERGE
 
 				grids[level + 1][((2 * ix + 0) + gridSize2 * (2 * iy + 0) + gridSize2 * gridSize2 * (2 * iz + 0))] = 0;
@@ -740,7 +951,7 @@ void distributeSubGrid(
 // distribute points to octree nodes.
 void distribute(
 	Node* local_root, 
-	Point* points_unsorted, 
+	const State& state, 
 	Point* points_sorted, 
 	Box3 box, 
 	vec3 boxSize, 
@@ -765,7 +976,9 @@ void distribute(
 
 		if(pointIndex >= local_root->numPoints) continue;
 
-		Point point = points_unsorted[pointIndex];
+		Point point = loadPoint(state, pointIndex);
+
+		if(resolveDuplicate(point, pointIndex)) continue;
 
 		float fx = fGridSize * (point.x - box.min.x) / boxSize.x;
 		float fy = fGridSize * (point.y - box.min.y) / boxSize.y;
@@ -943,7 +1156,7 @@ void dbg_verifyCounters(
 
 
 // splits an octree node with many points by <depth> hierachy levels
-// until leaf nodes have at most MAX_POINTS_PER_NODE.
+// until leaf nodes have at most splitPolicy.splitThreshold() points.
 // Leaf nodes can have more points if <depth> is insufficient.
 // In that case, split_node must be called again on all large leaf nodes.
 void split_node(
@@ -953,7 +1166,8 @@ void split_node(
 	int depth,              // 7: 34MB, 8: 268MB, 9: 2GB! 10: 17GB!!!
 	Node* nodes,
 	uint32_t& numNodes,
-	Lines* lines
+	Lines* lines,
+	InputFormat inputFormat = INPUT_FORMAT_POINTS // with INPUT_FORMAT_COMPACT, points_unsorted holds the streams of compact_input.h
 ){
 	auto grid = cg::this_grid();
 	auto block = cg::this_thread_block();
@@ -1006,9 +1220,16 @@ void split_node(
 	state.numNodes = &numNodes;
 	state.points_unsorted = points_unsorted;
 	state.points_sorted = points_sorted;
+	state.isCompact = inputFormat == INPUT_FORMAT_COMPACT;
+	state.positions_unsorted = (uint64_t*)points_unsorted;
+	state.colors_unsorted = (uint32_t*)(state.positions_unsorted + local_root->numPoints);
 	
 	grid.sync();
 
+	if(dedupPolicy.enabled){
+		doDeduplication(local_root, state); grid.sync();
+	}
+
 	doCounting(countingGrid, local_root, largeCells, state, lines); grid.sync();
 
 	// dbg_verifyCounters(depth, countgrids, nodegrids); grid.sync();
@@ -1039,7 +1260,7 @@ void split_node(
 	// 	}
 	// });
 
-	distribute(local_root, points_unsorted, points_sorted, box, boxSize, gridSize, depth, countgrids, nodegrids);
+	distribute(local_root, state, points_sorted, box, boxSize, gridSize, depth, countgrids, nodegrids);
 
 	// if(grid.thread_rank() == 0){
 	// 	printf("allocator->offset: %llu \n ", allocator->offset);
@@ -1065,7 +1286,8 @@ void main_split(
 	uint32_t* nnum_nodes,
 	void** ssorted,
 	Points* _points,
-	Lines* _lines
+	Lines* _lines,
+	uint64_t* nnum_duplicates
 ){
 	auto grid  = cg::this_grid();
 	auto block = cg::this_thread_block();
@@ -1077,6 +1299,9 @@ void main_split(
 	dbg = allocator->alloc<uint32_t*>(4);
 	*dbg = 0;
 
+	numDuplicates = allocator->alloc<uint32_t*>(4, "duplicate counter");
+	*numDuplicates = 0;
+
 	uint32_t& numNodes = *allocator->alloc<uint32_t*>(4, "node counter");
 	Node* nodes        = allocator->alloc<Node*>(sizeof(Node) * MAX_NODES, "nodes");
 	Point* sorted      = allocator->alloc<Point*>(sizeof(Point) * numPoints, "sorted");
@@ -1102,13 +1327,14 @@ void main_split(
 	// split root j
 	int depth = 8;
 	Node* root = &nodes[0];
-	split_node(root, input_points, sorted, depth, nodes, numNodes, lines);
+	split_node(root, input_points, sorted, depth, nodes, numNodes, lines, compactInput.format);
 	
 	grid.sync();
 
 	*nnodes = (void*)nodes;
 	*ssorted = (void*)sorted;
 	*nnum_nodes = numNodes;
+	*nnum_duplicates = *numDuplicates;
 
 	grid.sync();
 
@@ -1119,6 +1345,7 @@ void main_split(
 		printf("allocated memory: %i MB \n", int(allocator->offset / (1024 * 1024)));
 		printf("#nodes:           %i \n", numNodes);
 		printf("#subGrids:      %i \n", *numSubGrids);
+		printf("#duplicates:      %i \n", *numDuplicates);
 	}
 }
 
@@ -0,0 +1,85 @@
+
+#pragma once
+
+// Cost model that decides octree leaf sizes, shared by the CUDA kernels (NVRTC) and the host.
+//
+// Loading a node costs one request plus the transfer of its points:
+//     cost(n) = latency + n * bytesPerPoint / bandwidth
+// Once a node is refined, each of its children is needed with probability <childCoverage>,
+// i.e. the expected fraction of a refined node's children that ends up on screen.
+// A group of k sibling leaves with N points in total is then either
+//   - merged into their parent, which becomes a leaf:        cost(N)
+//   - kept, below a parent that holds <lodPoints> samples:   cost(min(N, lodPoints)) + childCoverage * (k * latency + N * transfer)
+// whichever is cheaper. Sparse siblings merge because each saved request saves a latency,
+// dense siblings stay apart because a merged leaf transfers points that are not on screen.
+// More siblings need more requests, so they are allowed to merge into larger leaves.
+//
+// Leaves never exceed <maxPoints>, the hard limit of the buffers that hold them.
+
+#if !defined(__CUDACC_RTC__)
+	#include <cstdint>
+#endif
+
+#if defined(__CUDACC__) || defined(__CUDACC_RTC__)
+	#define SPLIT_POLICY_FUNC __host__ __device__ constexpr
+#else
+	#define SPLIT_POLICY_FUNC constexpr
+#endif
+
+struct SplitPolicy{
+
+	float latency        = 0.1f;         // milliseconds per node request
+	float bandwidth      = 4'194'304.0f; // bytes per millisecond
+	float bytesPerPoint  = 16.0f;
+	float childCoverage  = 0.25f;
+	float lodPoints      = 8'192.0f;     // expected number of LOD samples in an inner node
+	float expectedFanout = 4.0f;         // non-empty children per split, before counts are known
+	uint32_t maxPoints   = 50'000;
+
+	// <targetBytes> is the request size at which transfer takes as long as the latency
+	static SPLIT_POLICY_FUNC SplitPolicy create(float targetBytes, float bytesPerPoint, uint32_t maxPoints, float childCoverage = 0.25f){
+		SplitPolicy policy;
+		policy.latency = targetBytes / policy.bandwidth;
+		policy.bytesPerPoint = bytesPerPoint;
+		policy.maxPoints = maxPoints;
+		policy.childCoverage = childCoverage;
+
+		return policy;
+	}
+
+	SPLIT_POLICY_FUNC float targetBytes() const {
+		return latency * bandwidth;
+	}
+
+	SPLIT_POLICY_FUNC float cost(float numPoints) const {
+		return latency + numPoints * bytesPerPoint / bandwidth;
+	}
+
+	// expected cost of keeping <numChildren> sibling leaves with <numPoints> in total
+	SPLIT_POLICY_FUNC float splitCost(float numPoints, float numChildren) const {
+		float numLodPoints = numPoints < lodPoints ? numPoints : lodPoints;
+
+		return cost(numLodPoints) + childCoverage * (numChildren * latency + numPoints * bytesPerPoint / bandwidth);
+	}
+
+	SPLIT_POLICY_FUNC bool shouldMerge(uint32_t numPoints, uint32_t numChildren) const {
+		if(numPoints == 0 || numPoints > maxPoints) return false;
+
+		return cost(float(numPoints)) <= splitCost(float(numPoints), float(numChildren));
+	}
+
+	// leaves with more points are split while counting, before the actual child counts are known.
+	// Solves cost(N) = splitCost(N, expectedFanout) for N.
+	SPLIT_POLICY_FUNC uint32_t splitThreshold() const {
+		if(childCoverage >= 1.0f) return maxPoints;
+
+		float pointCost = bytesPerPoint / bandwidth;
+		float threshold = (lodPoints * pointCost + childCoverage * expectedFanout * latency) / ((1.0f - childCoverage) * pointCost);
+
+		if(threshold < 1.0f) return 1;
+		if(threshold > float(maxPoints)) return maxPoints;
+
+		return uint32_t(threshold);
+	}
+
+};
@@ -0,0 +1,415 @@
+// Poisson-disk sample selection, see poisson_policy.h. One workgroup per node.
+//
+// - COUNT: candidates are registered in the cells of a spatial hash in global memory, one per workgroup.
+// - SCATTER: their sample_hash keys are counting-sorted into the cells, then sorted within each cell.
+// - PHASES: the 27 phases are processed one after the other, the cells of a phase in parallel.
+//   A cell accepts its first candidate that keeps the minimum distance to the samples accepted so far.
+//
+// Given the same candidates, the selected samples are the same as on the CPU, in a different order.
+// CPU counterpart: include/PoissonSampling.h
+namespace voxelize_poisson_blockwise{
+
+#include <cooperative_groups.h>
+#include "lib.h.cu"
+#include "methods_common.h.cu"
+#include "sample_hash.h"
+#include "poisson_policy.h"
+
+namespace cg = cooperative_groups;
+
+// Per workgroup. Candidates beyond the capacity are ignored, in child and index order,
+// which keeps the minimum distance but may leave gaps. Leaves and voxelized children
+// typically hold well below 128k samples each.
+// Memory per workgroup: 44 bytes per candidate of capacity, about 44MB.
+constexpr uint32_t CANDIDATE_CAPACITY = 1'048'576;
+constexpr uint32_t TABLE_CAPACITY     = 2 * CANDIDATE_CAPACITY;
+constexpr uint32_t NO_SAMPLE          = 0xffffffff;
+
+void computeWorkload(Node* nodes, uint32_t numNodes, NodePtr* workload, uint32_t& workloadSize){
+
+	auto grid = cg::this_grid();
+
+	if(isFirstThread()){
+		workloadSize = 0;
+	}
+	grid.sync();
+
+	processRange(0, numNodes, [&](int nodeIndex){
+		Node* node = &nodes[nodeIndex];
+
+		int numSamplesInChildren = 0;
+		bool allChildrenNonempty = true;
+		for(int childIndex = 0; childIndex < 8; childIndex++){
+			Node* child = node->children[childIndex];
+
+			if(child){
+				numSamplesInChildren += child->numPoints + child->numVoxels;
+				if((child->numPoints + child->numVoxels) == 0){
+					allChildrenNonempty = false;
+				}
+			}
+		}
+
+		bool isEmpty = node->numPoints == 0 && node->numVoxels == 0;
+
+		if(isEmpty && allChildrenNonempty){
+			uint32_t targetIndex = atomicAdd(&workloadSize, 1);
+			workload[targetIndex] = node;
+		}
+	});
+
+	grid.sync();
+}
+
+void main_voxelize(
+	Allocator& allocator,
+	Box3 box,
+	int numPoints,
+	void* nnnodes,
+	uint32_t numNodes,
+	void* sssorted,
+	uint32_t seed,
+	PoissonPolicy policy
+){
+	Node* nodes = (Node*)nnnodes;
+
+	auto grid = cg::this_grid();
+	auto block = cg::this_thread_block();
+
+	NodePtr* workload              =  allocator.alloc<NodePtr*>(sizeof(Node) * numNodes, "workload");
+	uint32_t& workloadSize         = *allocator.alloc<uint32_t*>(sizeof(uint32_t), "workload counter");
+	uint32_t& workIndexCounter     = *allocator.alloc<uint32_t*>(4, "work index counter");
+	uint32_t& numTruncated         = *allocator.alloc<uint32_t*>(4, "truncated nodes counter");
+
+	// SPATIAL HASH of each workgroup
+	// - tableKeys:   cell keys, EMPTY_KEY if the slot is free
+	// - tableValues: number of candidates while counting, then the index of the cell
+	// - cellSlots:   slot of each cell, in order of registration
+	// - cellOffsets: first candidate of each cell, and the total at [numCells]
+	// - accepted:    write cursor while scattering, then the accepted candidate relative to the cell's first
+	uint64_t* tableKeys_all   = allocator.alloc<uint64_t*>(uint64_t(grid.num_blocks()) * TABLE_CAPACITY * 8, "poisson table keys");
+	uint32_t* tableValues_all = allocator.alloc<uint32_t*>(uint64_t(grid.num_blocks()) * TABLE_CAPACITY * 4, "poisson table values");
+	uint32_t* cellSlots_all   = allocator.alloc<uint32_t*>(uint64_t(grid.num_blocks()) * CANDIDATE_CAPACITY * 4, "poisson cell slots");
+	uint32_t* cellOffsets_all = allocator.alloc<uint32_t*>(uint64_t(grid.num_blocks()) * (CANDIDATE_CAPACITY + 4) * 4, "poisson cell offsets");
+	uint32_t* accepted_all    = allocator.alloc<uint32_t*>(uint64_t(grid.num_blocks()) * CANDIDATE_CAPACITY * 4, "poisson accepted");
+	uint64_t* candidates_all  = allocator.alloc<uint64_t*>(uint64_t(grid.num_blocks()) * CANDIDATE_CAPACITY * 8, "poisson candidates");
+
+	uint64_t* tableKeys   = tableKeys_all + uint64_t(grid.block_rank()) * TABLE_CAPACITY;
+	uint32_t* tableValues = tableValues_all + uint64_t(grid.block_rank()) * TABLE_CAPACITY;
+	uint32_t* cellSlots   = cellSlots_all + uint64_t(grid.block_rank()) * CANDIDATE_CAPACITY;
+	uint32_t* cellOffsets = cellOffsets_all + uint64_t(grid.block_rank()) * (CANDIDATE_CAPACITY + 4);
+	uint32_t* accepted    = accepted_all + uint64_t(grid.block_rank()) * CANDIDATE_CAPACITY;
+	uint64_t* candidates  = candidates_all + uint64_t(grid.block_rank()) * CANDIDATE_CAPACITY;
+
+	uint64_t& globalAllocatorOffset = *allocator.alloc<uint64_t*>(8);
+
+	__shared__ uint32_t sh_workIndex;
+	__shared__ uint32_t sh_numCells;
+	__shared__ uint32_t sh_numAccepted;
+	__shared__ uint32_t sh_numWritten;
+	__shared__ uint32_t sh_sums[1024];
+
+	clearBuffer(tableKeys_all, 0, uint64_t(grid.num_blocks()) * TABLE_CAPACITY * 8, 0xff);
+	clearBuffer(tableValues_all, 0, uint64_t(grid.num_blocks()) * TABLE_CAPACITY * 4, 0);
+
+	if(isFirstThread()){
+		numTruncated = 0;
+		globalAllocatorOffset = allocator.offset;
+
+		printf("allocator.offset:        ");
+		printNumber(allocator.offset, 13);
+		printf("\n");
+	}
+
+	grid.sync();
+
+	// slot of <key>, or of the free slot where it would be inserted
+	auto find = [&](uint64_t key){
+		uint32_t slot = policy.slotOf(key, TABLE_CAPACITY);
+
+		while(tableKeys[slot] != key && tableKeys[slot] != PoissonPolicy::EMPTY_KEY){
+			slot = (slot + 1) % TABLE_CAPACITY;
+		}
+
+		return slot;
+	};
+
+	auto pointOf = [&](Node* node, uint64_t key){
+		Node* child = node->children[sample_hash::childIndexOf(key)];
+		uint32_t index = sample_hash::indexOf(key);
+
+		return child->numPoints > 0 ? child->points[index] : child->voxels[index];
+	};
+
+	// loop until all work done, but limit loop range to be safe
+	for(int abc = 0; abc < 20; abc++){
+
+		grid.sync();
+
+		computeWorkload(nodes, numNodes, workload, workloadSize);
+		if(grid.thread_rank() == 0){
+			workIndexCounter = 0;
+		}
+		grid.sync();
+
+		if(workloadSize == 0) break;
+
+		while(workIndexCounter < workloadSize){
+
+			block.sync();
+			if(block.thread_rank() == 0){
+				sh_workIndex = atomicAdd(&workIndexCounter, 1);
+				sh_numCells = 0;
+				sh_numAccepted = 0;
+				sh_numWritten = 0;
+			}
+			block.sync();
+
+			if(sh_workIndex >= workloadSize) break;
+
+			Node* node = workload[sh_workIndex];
+			vec3 boxSize = node->max - node->min;
+			double nodeSize = fmax(fmax(boxSize.x, boxSize.y), boxSize.z);
+			double radius = policy.radius(nodeSize, VOXEL_GRID_SIZE);
+			double radiusSquared = radius * radius;
+			double cellSize = policy.cellSize(radius);
+			int maxCell = policy.maxCell(nodeSize, cellSize);
+
+			auto cellKeyOf = [&](Point point){
+				int ix = policy.toCell(point.x, node->min.x, cellSize, maxCell);
+				int iy = policy.toCell(point.y, node->min.y, cellSize, maxCell);
+				int iz = policy.toCell(point.z, node->min.z, cellSize, maxCell);
+
+				return policy.keyOf(ix, iy, iz);
+			};
+
+			// calls back with the first CANDIDATE_CAPACITY points and voxels of the children,
+			// f(point, sample_hash key)
+			auto forEachCandidate = [&](auto f){
+				uint32_t numCandidates = 0;
+
+				for(int childIndex = 0; childIndex < 8; childIndex++){
+					Node* child = node->children[childIndex];
+
+					if(child == nullptr) continue;
+
+					for(int kind = 0; kind < 2; kind++){
+						Point* points = kind == 0 ? child->points : child->voxels;
+						uint32_t count = kind == 0 ? child->numPoints : child->numVoxels;
+						count = min(count, CANDIDATE_CAPACITY - numCandidates);
+
+						for(uint32_t index = block.thread_rank(); index < count; index += block.num_threads()){
+							Point point = points[index];
+							uint64_t hash = sample_hash::hashPoint(point.x, point.y, point.z, point.color, seed);
+
+							f(point, sample_hash::toKey(hash, childIndex, index));
+						}
+
+						numCandidates += count;
+					}
+				}
+
+				return numCandidates;
+			};
+
+			// COUNT candidates per cell, the thread that inserts a key registers the cell
+			uint32_t numCandidates = forEachCandidate([&](Point point, uint64_t key){
+				uint64_t cellKey = cellKeyOf(point);
+				uint32_t slot = policy.slotOf(cellKey, TABLE_CAPACITY);
+
+				while(true){
+					uint64_t old = atomicCAS(&tableKeys[slot], PoissonPolicy::EMPTY_KEY, cellKey);
+
+					if(old == PoissonPolicy::EMPTY_KEY){
+						uint32_t cellIndex = atomicAdd(&sh_numCells, 1);
+						cellSlots[cellIndex] = slot;
+					}
+
+					if(old == PoissonPolicy::EMPTY_KEY || old == cellKey){
+						atomicAdd(&tableValues[slot], 1);
+						break;
+					}
+
+					slot = (slot + 1) % TABLE_CAPACITY;
+				}
+			});
+
+			if(block.thread_rank() == 0){
+				uint32_t numSamplesInChildren = 0;
+				for(int childIndex = 0; childIndex < 8; childIndex++){
+					Node* child = node->children[childIndex];
+
+					if(child) numSamplesInChildren += child->numPoints + child->numVoxels;
+				}
+
+				if(numSamplesInChildren > numCandidates && atomicAdd(&numTruncated, 1) == 0){
+					printf("WARNING: poisson-disk sampling of a node only considered %u of %u candidates\n", numCandidates, numSamplesInChildren);
+				}
+			}
+
+			block.sync();
+
+			uint32_t numCells = sh_numCells;
+
+			// OFFSETS - exclusive prefix sum over the counts, in contiguous ranges of cells per thread
+			uint32_t cellsPerThread = (numCells + block.num_threads() - 1) / block.num_threads();
+			uint32_t firstCell = min(block.thread_rank() * cellsPerThread, numCells);
+			uint32_t lastCell = min(firstCell + cellsPerThread, numCells);
+
+			uint32_t sum = 0;
+			for(uint32_t cellIndex = firstCell; cellIndex < lastCell; cellIndex++){
+				sum += tableValues[cellSlots[cellIndex]];
+			}
+			sh_sums[block.thread_rank()] = sum;
+
+			block.sync();
+
+			if(block.thread_rank() == 0){
+				uint32_t offset = 0;
+				for(int i = 0; i < block.num_threads(); i++){
+					uint32_t count = sh_sums[i];
+					sh_sums[i] = offset;
+					offset += count;
+				}
+
+				cellOffsets[numCells] = offset;
+			}
+
+			block.sync();
+
+			uint32_t offset = sh_sums[block.thread_rank()];
+			for(uint32_t cellIndex = firstCell; cellIndex < lastCell; cellIndex++){
+				uint32_t slot = cellSlots[cellIndex];
+
+				cellOffsets[cellIndex] = offset;
+				offset += tableValues[slot];
+
+				tableValues[slot] = cellIndex;
+				accepted[cellIndex] = 0;
+			}
+
+			block.sync();
+
+			// SCATTER the keys of the candidates into their cells
+			forEachCandidate([&](Point point, uint64_t key){
+				uint32_t cellIndex = tableValues[find(cellKeyOf(point))];
+				uint32_t targetIndex = cellOffsets[cellIndex] + atomicAdd(&accepted[cellIndex], 1);
+
+				candidates[targetIndex] = key;
+			});
+
+			block.sync();
+
+			// SORT the candidates of each cell by key, insertion sort since cells hold few candidates
+			for(uint32_t cellIndex = block.thread_rank(); cellIndex < numCells; cellIndex += block.num_threads()){
+				uint64_t* cellCandidates = candidates + cellOffsets[cellIndex];
+				uint32_t count = cellOffsets[cellIndex + 1] - cellOffsets[cellIndex];
+
+				for(uint32_t i = 1; i < count; i++){
+					uint64_t key = cellCandidates[i];
+					uint32_t j = i;
+
+					while(j > 0 && cellCandidates[j - 1] > key){
+						cellCandidates[j] = cellCandidates[j - 1];
+						j--;
+					}
+
+					cellCandidates[j] = key;
+				}
+
+				accepted[cellIndex] = NO_SAMPLE;
+			}
+
+			block.sync();
+
+			// PHASES
+			uint64_t cellMask = (1ull << PoissonPolicy::KEY_BITS) - 1ull;
+
+			for(int phase = 0; phase < PoissonPolicy::NUM_PHASES; phase++){
+
+				for(uint32_t cellIndex = block.thread_rank(); cellIndex < numCells; cellIndex += block.num_threads()){
+					uint64_t cellKey = tableKeys[cellSlots[cellIndex]];
+					int ix = (cellKey >> 0) & cellMask;
+					int iy = (cellKey >> PoissonPolicy::KEY_BITS) & cellMask;
+					int iz = (cellKey >> (2 * PoissonPolicy::KEY_BITS)) & cellMask;
+
+					if(policy.phaseOf(ix, iy, iz) != phase) continue;
+
+					uint32_t first = cellOffsets[cellIndex];
+					uint32_t count = cellOffsets[cellIndex + 1] - first;
+
+					for(uint32_t i = 0; i < count; i++){
+						Point point = pointOf(node, candidates[first + i]);
+						bool conflicts = false;
+
+						for(int dz = -2; dz <= 2 && !conflicts; dz++)
+						for(int dy = -2; dy <= 2 && !conflicts; dy++)
+						for(int dx = -2; dx <= 2 && !conflicts; dx++){
+							int nx = ix + dx;
+							int ny = iy + dy;
+							int nz = iz + dz;
+
+							if(nx < 0 || ny < 0 || nz < 0) continue;
+							if(nx > maxCell || ny > maxCell || nz > maxCell) continue;
+							if(dx == 0 && dy == 0 && dz == 0) continue;
+
+							uint32_t slot = find(policy.keyOf(nx, ny, nz));
+							if(tableKeys[slot] == PoissonPolicy::EMPTY_KEY) continue;
+
+							uint32_t neighbor = tableValues[slot];
+							if(accepted[neighbor] == NO_SAMPLE) continue;
+
+							Point sample = pointOf(node, candidates[cellOffsets[neighbor] + accepted[neighbor]]);
+							double ddx = double(point.x) - double(sample.x);
+							double ddy = double(point.y) - double(sample.y);
+							double ddz = double(point.z) - double(sample.z);
+
+							conflicts = ddx * ddx + ddy * ddy + ddz * ddz < radiusSquared;
+						}
+
+						if(!conflicts){
+							accepted[cellIndex] = i;
+							atomicAdd(&sh_numAccepted, 1);
+
+							break;
+						}
+					}
+				}
+
+				block.sync();
+			}
+
+			// allocate memory for voxels
+			if(block.thread_rank() == 0){
+				uint64_t bufferOffset = atomicAdd(&globalAllocatorOffset, 16ull * sh_numAccepted);
+
+				node->voxels = reinterpret_cast<Point*>(allocator.buffer + bufferOffset);
+				node->numVoxels = sh_numAccepted;
+			}
+
+			block.sync();
+
+			// write accepted samples to node's voxel buffer and reset the spatial hash
+			for(uint32_t cellIndex = block.thread_rank(); cellIndex < numCells; cellIndex += block.num_threads()){
+				uint32_t slot = cellSlots[cellIndex];
+
+				if(accepted[cellIndex] != NO_SAMPLE){
+					uint32_t targetIndex = atomicAdd(&sh_numWritten, 1);
+
+					node->voxels[targetIndex] = pointOf(node, candidates[cellOffsets[cellIndex] + accepted[cellIndex]]);
+				}
+
+				tableKeys[slot] = PoissonPolicy::EMPTY_KEY;
+				tableValues[slot] = 0;
+			}
+
+			block.sync();
+		}
+	}
+
+	grid.sync();
+
+	allocator.offset = globalAllocatorOffset;
+}
+
+};
@@ -1,11 +1,14 @@
 
 
+// Random sample selection that is reproducible across runs, thread counts and CPU/GPU.
+// Each cell keeps the candidate with the smallest seeded hash, see sample_hash.h.
+// CPU counterpart: include/HashSampling.h
 namespace sampleselect_random_blockwise_globalmem{
 
 #include <cooperative_groups.h>
 #include "lib.h.cu"
 #include "methods_common.h.cu"
-#include <curand_kernel.h>
+#include "sample_hash.h"
 
 // constexpr bool COMPARE_WITH_NONHEURISTIC = true;
 
@@ -53,7 +56,8 @@ void main_voxelize(
 	int numPoints,
 	void* nnnodes,
 	uint32_t numNodes,
-	void* sssorted
+	void* sssorted,
+	uint32_t seed
 ){
 	// Point* sorted = (Point*)sssorted;
 	Node* nodes = (Node*)nnnodes;
@@ -84,22 +88,20 @@ void main_voxelize(
 	uint32_t* accepteds        = allocator.alloc<uint32_t*>(grid.num_blocks() * acceptedByteSize, "list of accepted indices");
 	uint32_t* accepted         = accepteds + grid.block_rank() * acceptedCapacity;
 
-	// Create one voxelgrid per workgroup, and a <voxelGrid> pointer that points to the active workgroup's memory
-	uint64_t voxelGridByteSize = sizeof(uint32_t) * numCells;
-	uint32_t* voxelGrids       = allocator.alloc<uint32_t*>(grid.num_blocks() * voxelGridByteSize, "voxel sampling grids");
-	uint32_t* voxelGrid        = voxelGrids + grid.block_rank() * numCells;
+	// Create one voxelgrid per workgroup, and a <voxelGrid> pointer that points to the active workgroup's memory.
+	// Cells hold the smallest sample_hash key of their candidates, EMPTY_KEY if there are none.
+	uint64_t voxelGridByteSize = sizeof(uint64_t) * numCells;
+	uint64_t* voxelGrids       = allocator.alloc<uint64_t*>(grid.num_blocks() * voxelGridByteSize, "voxel sampling grids");
+	uint64_t* voxelGrid        = voxelGrids + grid.block_rank() * numCells;
 
 	uint64_t& globalAllocatorOffset = *allocator.alloc<uint64_t*>(8);
 
-	curandStateXORWOW_t thread_random_state;
-	curand_init(grid.thread_rank(), 0, 0, &thread_random_state);
-
 	__shared__ uint32_t sh_numAccepted;
 	__shared__ uint32_t sh_workIndex;
 	__shared__ uint32_t sh_iteration_block;
 
-	// initially clear all voxel grids
-	clearBuffer(voxelGrids, 0, grid.num_blocks() * voxelGridByteSize, 0);
+	// initially clear all voxel grids to EMPTY_KEY
+	clearBuffer(voxelGrids, 0, grid.num_blocks() * voxelGridByteSize, 0xff);
 
 	PRINT("gridSize: %i \n", gridSize);
 	PRINT("voxelGridByteSize: %i \n", voxelGridByteSize);
@@ -166,26 +168,24 @@ void main_voxelize(
 					Point point = child->points[pointIndex];
 
 					// project to node's 128³ sample grid
-					int ix = clamp(fGridSize * (point.x - node->min.x) / boxSize.x, 0.0f, fGridSize - 1.0f);
-					int iy = clamp(fGridSize * (point.y - node->min.y) / boxSize.y, 0.0f, fGridSize - 1.0f);
-					int iz = clamp(fGridSize * (point.z - node->min.z) / boxSize.z, 0.0f, fGridSize - 1.0f);
+					int ix = sample_hash::toCell(point.x, node->min.x, boxSize.x, fGridSize);
+					int iy = sample_hash::toCell(point.y, node->min.y, boxSize.y, fGridSize);
+					int iz = sample_hash::toCell(point.z, node->min.z, boxSize.z, fGridSize);
 
 					int voxelIndex = ix + gridSize * iy + gridSize * gridSize * iz;
 					assert(voxelIndex >= 0);
 					assert(voxelIndex < numCells);
 
-					uint32_t randomNumber = curand(&thread_random_state);
-					uint32_t encoded = 
-						(randomNumber & 0b11111111'11110000'00000000'00000000) | 
-						(pointIndex   & 0b00000000'00001111'11111111'11111111);
+					uint64_t hash = sample_hash::hashPoint(point.x, point.y, point.z, point.color, seed);
+					uint64_t key = sample_hash::toKey(hash, childIndex, pointIndex);
 
-					uint32_t old = atomicMax(&voxelGrid[voxelIndex], encoded);
-					bool isAccepted = (old == 0);
+					uint64_t old = atomicMin(&voxelGrid[voxelIndex], key);
+					bool isAccepted = (old == sample_hash::EMPTY_KEY);
 
 					if(isAccepted){
 						auto targetIndex = atomicAdd(&sh_numAccepted, 1);
 
-						accepted[targetIndex] = voxelIndex | (childIndex << 24);
+						accepted[targetIndex] = voxelIndex;
 					}
 				}
 
@@ -201,26 +201,24 @@ void main_voxelize(
 					Point point = child->voxels[pointIndex];
 
 					// project to node's 128³ sample grid
-					int ix = clamp(fGridSize * (point.x - node->min.x) / boxSize.x, 0.0f, fGridSize - 1.0f);
-					int iy = clamp(fGridSize * (point.y - node->min.y) / boxSize.y, 0.0f, fGridSize - 1.0f);
-					int iz = clamp(fGridSize * (point.z - node->min.z) / boxSize.z, 0.0f, fGridSize - 1.0f);
+					int ix = sample_hash::toCell(point.x, node->min.x, boxSize.x, fGridSize);
+					int iy = sample_hash::toCell(point.y, node->min.y, boxSize.y, fGridSize);
+					int iz = sample_hash::toCell(point.z, node->min.z, boxSize.z, fGridSize);
 
 					int voxelIndex = ix + gridSize * iy + gridSize * gridSize * iz;
 					assert(voxelIndex >= 0);
 					assert(voxelIndex < numCells);
 
-					uint32_t randomNumber = curand(&thread_random_state);
-					uint32_t encoded = 
-						(randomNumber & 0b11111111'11110000'00000000'00000000) | 
-						(pointIndex   & 0b00000000'00001111'11111111'11111111);
+					uint64_t hash = sample_hash::hashPoint(point.x, point.y, point.z, point.color, seed);
+					uint64_t key = sample_hash::toKey(hash, childIndex, pointIndex);
 
-					uint32_t old = atomicMax(&voxelGrid[voxelIndex], encoded);
-					bool isAccepted = (old == 0);
+					uint64_t old = atomicMin(&voxelGrid[voxelIndex], key);
+					bool isAccepted = (old == sample_hash::EMPTY_KEY);
 
 					if(isAccepted){
 						auto targetIndex = atomicAdd(&sh_numAccepted, 1);
 
-						accepted[targetIndex] = voxelIndex | (childIndex << 24);
+						accepted[targetIndex] = voxelIndex;
 					}
 				}
 
@@ -252,11 +250,12 @@ void main_voxelize(
 
 				if(index >= sh_numAccepted) continue;
 
-				uint32_t val = accepted[index];
-				uint32_t voxelIndex = (val & 0x00ffffff);
-				uint32_t childIndex = (val >> 24);
-				uint32_t sampleIndex = voxelGrid[voxelIndex] & 0b00000000'00001111'11111111'11111111;
+				uint32_t voxelIndex = accepted[index];
+				uint64_t key = voxelGrid[voxelIndex];
+				uint32_t childIndex = sample_hash::childIndexOf(key);
+				uint32_t sampleIndex = sample_hash::indexOf(key);
 
+				// the winner may come from a different child than the candidate that registered the cell
 				Node* child = node->children[childIndex];
 
 				// Point voxel = child->points[sampleIndex];
@@ -270,13 +269,13 @@ void main_voxelize(
 					assert(false);
 				}
 
-				int ix = clamp(fGridSize * (voxel.x - node->min.x) / boxSize.x, 0.0f, fGridSize - 1.0f);
-				int iy = clamp(fGridSize * (voxel.y - node->min.y) / boxSize.y, 0.0f, fGridSize - 1.0f);
-				int iz = clamp(fGridSize * (voxel.z - node->min.z) / boxSize.z, 0.0f, fGridSize - 1.0f);
+				int ix = sample_hash::toCell(voxel.x, node->min.x, boxSize.x, fGridSize);
+				int iy = sample_hash::toCell(voxel.y, node->min.y, boxSize.y, fGridSize);
+				int iz = sample_hash::toCell(voxel.z, node->min.z, boxSize.z, fGridSize);
 
-				voxel.x = float(ix + 0.5f) * boxSize.x / fGridSize + node->min.x;
-				voxel.y = float(iy + 0.5f) * boxSize.y / fGridSize + node->min.y;
-				voxel.z = float(iz + 0.5f) * boxSize.z / fGridSize + node->min.z;
+				voxel.x = sample_hash::cellCenter(ix, node->min.x, boxSize.x, fGridSize);
+				voxel.y = sample_hash::cellCenter(iy, node->min.y, boxSize.y, fGridSize);
+				voxel.z = sample_hash::cellCenter(iz, node->min.z, boxSize.z, fGridSize);
 
 				node->voxels[index] = voxel;
 
@@ -288,7 +287,7 @@ void main_voxelize(
 				// 	assert(false);
 				// }
 
-				voxelGrid[voxelIndex] = 0;
+				voxelGrid[voxelIndex] = sample_hash::EMPTY_KEY;
 			}
 
 			block.sync();
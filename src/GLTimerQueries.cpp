@@ -2,6 +2,7 @@
 #include "GLTimerQueries.h"
 
 #include "unsuck.hpp"
+#include "Tracer.h"
 
 void GLTimerQueries::timestamp(string label) {
 	GLTimerQueries* glt = GLTimerQueries::instance();
@@ -124,6 +125,11 @@ void GLTimerQueries::frameEnd() {
 				stat.sum += millies;
 				stat.count++;
 
+				// GPU timestamps are not on the CPU clock, so they show up as counters in CPU traces
+				if(Tracer::isEnabled()){
+					Tracer::counter(Tracer::intern("gpu " + baseLabel + " (ms)"), millies);
+				}
+
 				Duration item;
 				item.label = baseLabel;
 				item.nanos = duration;
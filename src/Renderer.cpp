@@ -564,7 +564,57 @@ void Renderer::loop(function<void(void)> update, function<void(void)> render){
 				Runtime::samplingStrategy = 3;
 				Runtime::requestLodGeneration = true;
 			}
+
+			if (ImGui::Button("Benchmark: Poisson-Disk")) {
+				Runtime::samplingStrategy = 4;
+				Runtime::requestLodGeneration = true;
+			}
+
+			// minimum distance between samples, in cells of the 128 x 128 x 128 grid of a node
+			ImGui::SliderFloat("Poisson-disk radius", &Runtime::poissonPolicy.radiusScale, 0.5f, 4.0f, "%.2f");
+			if(ImGui::IsItemDeactivatedAfterEdit() && Runtime::samplingStrategy == 4){
+				Runtime::requestLodGeneration = true;
+			}
 			
+			// expected fraction of a refined node's children that is on screen, see SplitPolicy
+			ImGui::SliderFloat("Child coverage", &Runtime::splitPolicy.childCoverage, 0.05f, 1.0f, "%.2f");
+			if(ImGui::IsItemDeactivatedAfterEdit()){
+				Runtime::requestLodGeneration = true;
+			}
+
+			auto& dedup = Runtime::dedupPolicy;
+			bool averageColors = dedup.colorMerge == COLOR_MERGE_AVERAGE;
+			bool dedupChanged = false;
+
+			// The map of duplicates reuses the sorted buffer of the split. On top of that, removing them needs
+			// 1 bit per point, averaging their colors about 10 bytes per point plus 32 bytes per cell with duplicates.
+			dedupChanged |= ImGui::Checkbox("Remove duplicate points", &dedup.enabled);
+			ImGui::SliderFloat("Duplicate tolerance", &dedup.tolerance, 0.0f, 0.1f, "%.4f");
+			dedupChanged |= dedup.enabled && ImGui::IsItemDeactivatedAfterEdit();
+			dedupChanged |= ImGui::Checkbox("Average colors of duplicates", &averageColors) && dedup.enabled;
+
+			dedup.colorMerge = averageColors ? COLOR_MERGE_AVERAGE : COLOR_MERGE_FIRST;
+
+			if(dedupChanged){
+				Runtime::requestLodGeneration = true;
+			}
+
+			auto& input = Runtime::compactInput;
+			bool compact = input.format == INPUT_FORMAT_COMPACT;
+			int bitsPerAxis = input.bitsPerAxis;
+			bool inputChanged = false;
+
+			inputChanged |= ImGui::Checkbox("Compact split input (12 bytes per point)", &compact);
+			ImGui::SliderInt("Bits per axis", &bitsPerAxis, 16, CompactInput::MAX_BITS);
+			inputChanged |= compact && ImGui::IsItemDeactivatedAfterEdit();
+
+			input.format = compact ? INPUT_FORMAT_COMPACT : INPUT_FORMAT_POINTS;
+			input.bitsPerAxis = bitsPerAxis;
+
+			if(inputChanged){
+				Runtime::requestLodGeneration = true;
+			}
+
 			static float LOD = 0.9f;
 			ImGui::SliderFloat("Level of Detail", &LOD, 0.0f, 1.0f, "ratio = %.3f");
 
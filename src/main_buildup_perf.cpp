@@ -4,9 +4,13 @@
 #include <mutex>
 
 #include "LasLoader.h"
+#include "DatasetManifest.h"
+#include "Tracer.h"
+#include "Metrics.h"
 #include "unsuck.hpp"
 #include "Box.h"
-#include "utils.h"
+#include "morton.h"
+#include "LasExporter.h"
 
 #include "perf/base.h"
 #include "perf/add_batched.h"
@@ -15,6 +19,8 @@
 #include "perf/add_voxelized.h"
 #include "perf/add_multithreaded_2.h"
 #include "perf/add_morton_multithreaded.h"
+#include "perf/progressive.h"
+#include "perf/distributed.h"
 
 using namespace std;
 
@@ -22,61 +28,42 @@ using namespace std;
 
 Metadata loadMetadata(string lasdir){
 
-	vector<string> files;
-	for (const auto & entry : fs::directory_iterator(lasdir)){
-		string filepath = entry.path().string();
+	auto manifest = DatasetManifest::load(lasdir);
 
-		if(iEndsWith(filepath, ".las")){
-			files.push_back(filepath);
-		}
-	}
+	cout << "manifest: " << manifest->numReused << " files cached, " << manifest->numScanned << " scanned" << endl;
 
 	Box fullBoundingBox;
 	vector<LasFile> lasfiles;
-	for(string file : files){
-
-		auto buffer = new Buffer(2 * 1024);
-		readBinaryFile(file, 0, buffer->size, buffer->data);
-
-		uint64_t offsetToPointData = buffer->get<uint32_t>(96);
-		int format = buffer->get<uint8_t>(104);
+	int64_t numSkipped = 0;
+	for(auto& file : manifest->files){
 
-		int versionMajor = buffer->get<uint8_t>(24);
-		int versionMinor = buffer->get<uint8_t>(25);
+		// the builders read raw LAS records
+		if(file.header.isCompressed){
+			cout << "WARNING: skipping compressed file " << file.path << endl;
+			numSkipped++;
 
-		glm::dvec3 min = {
-			buffer->get<double>(187),
-			buffer->get<double>(203),
-			buffer->get<double>(219)};
-
-		glm::dvec3 max = {
-			buffer->get<double>(179),
-			buffer->get<double>(195),
-			buffer->get<double>(211)};
-
-		int64_t numPoints = 0;
-
-		if(versionMajor == 1 && versionMinor <= 3){
-			numPoints = buffer->get<uint32_t>(107);
-		}else{
-			numPoints = buffer->get<int64_t>(247);
+			continue;
 		}
 
 		Box boundingBox;
-		boundingBox.expand(min);
-		boundingBox.expand(max);
+		boundingBox.expand(file.header.min);
+		boundingBox.expand(file.header.max);
 		
 		fullBoundingBox.expand(boundingBox);
 
 		LasFile lasfile;
-		lasfile.path = file;
-		lasfile.format = format;
-		lasfile.numPoints = numPoints;
-		lasfile.offsetToPointData = offsetToPointData;
+		lasfile.path = file.path;
+		lasfile.format = file.header.format;
+		lasfile.numPoints = file.header.numPoints;
+		lasfile.offsetToPointData = file.header.offsetToPointData;
 
 		lasfiles.push_back(lasfile);
 	}
 
+	if(numSkipped > 0){
+		cout << "skipped " << numSkipped << " LAZ files, decompress them to LAS to include them" << endl;
+	}
+
 	Metadata metadata;
 	metadata.files = lasfiles;
 	metadata.boundingBox = fullBoundingBox;
@@ -84,7 +71,12 @@ Metadata loadMetadata(string lasdir){
 	return metadata;
 }
 
-int main(){
+int main(int argc, char** argv){
+
+	// worker process of a distributed build, see distributed::run()
+	if(argc >= 3 && string(argv[1]) == "--distributed-worker"){
+		return distributed::runWorker(argv[2]);
+	}
 
 	//string file = "D:/dev/pointclouds/eclepens.las";
 	//string file = "D:/dev/pointclouds/heidentor.las";
@@ -94,6 +86,54 @@ int main(){
 	//string lasdir = "F:/pointclouds/CA13_selection";
 	//string lasdir = "F:/pointclouds/ca13_single";
 
+	// both off unless requested:
+	// --trace <path>    Chrome trace of all zones, written at exit
+	// --metrics <path>  Prometheus text, rewritten every 5 seconds
+	//
+	// --distributed <workers>  build all files with distributed::run() instead of a single one in memory
+	// --poisson <radius>       Poisson-disk instead of random samples in distributed builds,
+	//                          with a minimum distance of <radius> cells of a node's 128^3 grid
+	// --attributes             carry intensity, returns, classification and GPS time in distributed builds
+	// --export <path>          writes the distributed build to a LAS or LAZ file, down to --export-level <level>
+	string path_trace = "";
+	string path_metrics = "";
+	int numWorkers = 0;
+	bool poissonDisk = false;
+	float poissonRadius = 1.0f;
+	bool attributes = false;
+	string path_export = "";
+	int exportLevel = 1'000;
+	for(int i = 1; i < argc; i++){
+		if(string(argv[i]) == "--attributes"){
+			attributes = true;
+		}
+	}
+	for(int i = 1; i + 1 < argc; i++){
+		if(string(argv[i]) == "--trace"){
+			path_trace = argv[i + 1];
+		}else if(string(argv[i]) == "--metrics"){
+			path_metrics = argv[i + 1];
+		}else if(string(argv[i]) == "--distributed"){
+			numWorkers = std::stoi(argv[i + 1]);
+		}else if(string(argv[i]) == "--poisson"){
+			poissonDisk = true;
+			poissonRadius = std::stof(argv[i + 1]);
+		}else if(string(argv[i]) == "--export"){
+			path_export = argv[i + 1];
+		}else if(string(argv[i]) == "--export-level"){
+			exportLevel = std::stoi(argv[i + 1]);
+		}
+	}
+
+	if(path_trace != ""){
+		Tracer::enable();
+		Tracer::setThreadName("main");
+	}
+
+	if(path_metrics != ""){
+		Metrics::startWriter(path_metrics);
+	}
+
 	auto metadata = loadMetadata(lasdir);
 
 	//LasFile lasfile = metadata.files[0];
@@ -106,10 +146,11 @@ int main(){
 	LasFile selected;
 	for(auto lasfile : metadata.files){
 		auto path = fs::path(lasfile.path);
-		if(path.filename().string() == "ot_35120A4202A_1_1.las"){
+		if(numWorkers == 0 && path.filename().string() == "ot_35120A4202A_1_1.las"){
 
 			batchwise_multithreaded_2::run(metadata, lasfile);
 			//add_voxelized::run(metadata, lasfile);
+			//progressive::run(metadata, lasfile);
 
 		}
 	}
@@ -119,5 +160,40 @@ int main(){
 	//add_batched(metadata, lasfile);
 	//batchwise_multithreaded::run(metadata, lasfile);
 
+	if(numWorkers > 0){
+		distributed::Options options;
+		options.executable = argv[0];
+		options.numWorkers = numWorkers;
+		options.poissonDisk = poissonDisk;
+		options.poissonPolicy.radiusScale = poissonRadius;
+		options.attributes = attributes ? uint32_t(LAS_ALL_ATTRIBUTES) : 0;
+
+		auto hierarchy = distributed::run(metadata, options);
+
+		if(hierarchy != nullptr && path_export != ""){
+			for(auto& subtree : hierarchy->subtrees){
+				distributed::loadSubtree(*hierarchy, subtree);
+			}
+
+			LasExporter<distributed::Node>::Options exportOptions;
+			exportOptions.maxLevel = exportLevel;
+			exportOptions.compress = iEndsWith(path_export, ".laz");
+			exportOptions.origin = hierarchy->origin;
+
+			LasExporter<distributed::Node>::write(path_export, hierarchy->root, exportOptions);
+		}
+	}
+
+	if(path_metrics != ""){
+		Metrics::stopWriter();
+	}
+
+	if(path_trace != ""){
+		Tracer::writeChromeTrace(path_trace);
+		Tracer::printSummary();
+	}
+
+	BufferPool::printReport();
+
 	return 0;
 }
\ No newline at end of file
@@ -108,6 +108,7 @@ int main(){
 
 	auto update = [&](){
 
+		lasLoaderSparse->updateResidency(renderer->camera->proj * renderer->camera->view, renderer->camera->position);
 		lasLoaderSparse->process();
 
 		auto selected = Runtime::getSelectedMethod();
@@ -15,6 +15,7 @@
 //#include "VrRuntime.h"
 #include "Runtime.h"
 #include "Method.h"
+#include "Metrics.h"
 #include "compute/ComputeLasLoader.h"
 #include "compute/LasLoaderStandard.h"
 #include "compute/PotreeData.h"
@@ -34,7 +35,7 @@ using namespace std;
 
 int numPoints = 1'000'000;
 
-int main(){
+int main(int argc, char** argv){
 
 	cout << std::setprecision(2) << std::fixed;
 
@@ -59,6 +60,8 @@ int main(){
 	struct Setting{
 		string path_potree = "";
 		string path_las = "";
+		// Prometheus text, rewritten every 5 seconds. Empty to disable, overridden by --metrics <path>
+		string path_metrics = "./metrics.prom";
 		float yaw = 0.0;
 		float pitch = 0.0;
 		float radius = 0.0;
@@ -257,6 +260,16 @@ int main(){
 	// Setting setting = settings["SaintRoman_2"];
 	Setting setting = settings["whatever"];
 
+	for(int i = 1; i + 1 < argc; i++){
+		if(string(argv[i]) == "--metrics"){
+			setting.path_metrics = argv[i + 1];
+		}
+	}
+
+	if(setting.path_metrics != ""){
+		Metrics::startWriter(setting.path_metrics);
+	}
+
 	if(setting.radius == 0.0)
 	{ // override camera pos with sensible default
 		auto box = readBox(setting.path_las);
@@ -322,6 +335,7 @@ int main(){
 
 	auto update = [&](){
 
+		lasLoaderSparse->updateResidency(renderer->camera->proj * renderer->camera->view, renderer->camera->position);
 		lasLoaderSparse->process();
 
 		simlod->update();
@@ -454,6 +468,8 @@ int main(){
 
 	renderer->loop(update, render);
 
+	Metrics::stopWriter();
+
 	return 0;
 }
 
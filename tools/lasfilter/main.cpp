@@ -0,0 +1,760 @@
+
+// Streams a LAS or LAZ file of any size through a set of filters and writes the
+// remaining points to a LAS file. Replaces tools/crop_las.mjs.
+//
+// usage: lasfilter <input.las|laz> <output.las> [options]
+//
+//   --box minX minY minZ maxX maxY maxZ   keep points inside the box (inclusive)
+//   --polygon x,y x,y x,y [...]           keep points inside the xy-polygon (infinite prism along z)
+//   --classes 2,6,9                       keep only these classifications
+//   --drop-classes 7,18                   remove these classifications
+//   --every n                             keep every n-th point of the input
+//   --fraction f [--seed s]               keep a deterministic random fraction of the points
+//   --max-points n                        stop after n points were written
+//   --threads n                           number of decode/filter threads
+//   --trace file.json                     write a Chrome trace of decode, filter and write zones
+//
+// - the input is split into units of POINTS_PER_UNIT points that are decoded and filtered in parallel.
+//   Each LAZ thread owns its own laszip reader and seeks to the unit it is working on.
+// - results are written in input order, one large write per unit. Output is identical for any thread count.
+// - bounding box, point counts and counts by return are computed from the written points.
+// - VLRs are copied, the laszip VLR is dropped. EVLRs and waveform data are not copied.
+//
+// Built by the lasfilter project in build/CudaLOD.sln, which links laszip.dll.
+
+#include <iostream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <limits>
+#include <algorithm>
+
+#include "glm/vec2.hpp"
+
+#include "unsuck.hpp"
+#include "LasHeader.h"
+#include "Tracer.h"
+#include "laszip_api.h"
+
+using namespace std;
+using glm::dvec2;
+
+constexpr int64_t POINTS_PER_UNIT = 1'000'000;
+
+// bounds how far decoding may run ahead of the writer
+constexpr int64_t MAX_UNITS_IN_FLIGHT_PER_THREAD = 2;
+
+struct Filter{
+
+	bool hasBox = false;
+	dvec3 boxMin;
+	dvec3 boxMax;
+
+	vector<dvec2> polygon;
+	dvec2 polygonMin;
+	dvec2 polygonMax;
+
+	bool hasClasses = false;
+	bool keepClass[256];
+
+	int64_t every = 1;
+	double fraction = 1.0;
+	uint64_t seed = 0;
+
+	int64_t maxPoints = -1;
+
+	Filter(){
+		for(int i = 0; i < 256; i++){
+			keepClass[i] = true;
+		}
+	}
+
+	// crossing number test
+	bool insidePolygon(double x, double y){
+
+		if(x < polygonMin.x || x > polygonMax.x) return false;
+		if(y < polygonMin.y || y > polygonMax.y) return false;
+
+		bool inside = false;
+		int64_t n = polygon.size();
+
+		for(int64_t i = 0, j = n - 1; i < n; j = i++){
+			dvec2 a = polygon[i];
+			dvec2 b = polygon[j];
+
+			if((a.y > y) != (b.y > y)){
+				double xCross = (b.x - a.x) * (y - a.y) / (b.y - a.y) + a.x;
+
+				if(x < xCross){
+					inside = !inside;
+				}
+			}
+		}
+
+		return inside;
+	}
+
+};
+
+// accumulated over the points that are written
+struct Stats{
+	int64_t numPoints = 0;
+	int64_t numPointsByReturn[15] = {0};
+	int32_t min[3] = {
+		std::numeric_limits<int32_t>::max(),
+		std::numeric_limits<int32_t>::max(),
+		std::numeric_limits<int32_t>::max()};
+	int32_t max[3] = {
+		std::numeric_limits<int32_t>::min(),
+		std::numeric_limits<int32_t>::min(),
+		std::numeric_limits<int32_t>::min()};
+
+	void add(uint8_t* record, int format){
+		int32_t XYZ[3];
+		memcpy(XYZ, record, 12);
+
+		for(int i = 0; i < 3; i++){
+			min[i] = std::min(min[i], XYZ[i]);
+			max[i] = std::max(max[i], XYZ[i]);
+		}
+
+		int returnNumber = format < 6 ? (record[14] & 0b111) : (record[14] & 0b1111);
+
+		if(returnNumber >= 1 && returnNumber <= 15){
+			numPointsByReturn[returnNumber - 1]++;
+		}
+
+		numPoints++;
+	}
+
+	void add(Stats& other){
+		for(int i = 0; i < 3; i++){
+			min[i] = std::min(min[i], other.min[i]);
+			max[i] = std::max(max[i], other.max[i]);
+		}
+
+		for(int i = 0; i < 15; i++){
+			numPointsByReturn[i] += other.numPointsByReturn[i];
+		}
+
+		numPoints += other.numPoints;
+	}
+};
+
+struct Unit{
+	vector<uint8_t> records;
+	int64_t numPoints = 0;
+	Stats stats;
+};
+
+// splitmix64
+inline uint64_t hashIndex(uint64_t index, uint64_t seed){
+	uint64_t z = index + seed * 0x9e3779b97f4a7c15ull + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+	return z ^ (z >> 31);
+}
+
+// serializes a decoded laszip point back into a LAS record of the given format
+void packRecord(laszip_point* point, int format, int recordLength, uint8_t* target){
+
+	memset(target, 0, recordLength);
+
+	memcpy(target + 0, &point->X, 4);
+	memcpy(target + 4, &point->Y, 4);
+	memcpy(target + 8, &point->Z, 4);
+	memcpy(target + 12, &point->intensity, 2);
+
+	int gpsOffset = -1;
+	int rgbOffset = LasHeader::rgbOffset(format);
+	int nirOffset = -1;
+	int wavePacketOffset = -1;
+
+	if(format < 6){
+		target[14] = (point->return_number << 0)
+			| (point->number_of_returns << 3)
+			| (point->scan_direction_flag << 6)
+			| (point->edge_of_flight_line << 7);
+		target[15] = (point->classification << 0)
+			| (point->synthetic_flag << 5)
+			| (point->keypoint_flag << 6)
+			| (point->withheld_flag << 7);
+		target[16] = uint8_t(point->scan_angle_rank);
+		target[17] = point->user_data;
+		memcpy(target + 18, &point->point_source_ID, 2);
+
+		if(format == 1 || format == 3 || format == 4 || format == 5) gpsOffset = 20;
+		if(format == 4) wavePacketOffset = 28;
+		if(format == 5) wavePacketOffset = 34;
+	}else{
+		target[14] = (point->extended_return_number << 0)
+			| (point->extended_number_of_returns << 4);
+		target[15] = (point->extended_classification_flags << 0)
+			| (point->extended_scanner_channel << 4)
+			| (point->scan_direction_flag << 6)
+			| (point->edge_of_flight_line << 7);
+		target[16] = point->extended_classification;
+		target[17] = point->user_data;
+		memcpy(target + 18, &point->extended_scan_angle, 2);
+		memcpy(target + 20, &point->point_source_ID, 2);
+
+		gpsOffset = 22;
+		if(format == 8 || format == 10) nirOffset = 36;
+		if(format == 9) wavePacketOffset = 30;
+		if(format == 10) wavePacketOffset = 38;
+	}
+
+	if(gpsOffset >= 0) memcpy(target + gpsOffset, &point->gps_time, 8);
+	if(rgbOffset >= 0) memcpy(target + rgbOffset, &point->rgb[0], 6);
+	if(nirOffset >= 0) memcpy(target + nirOffset, &point->rgb[3], 2);
+	if(wavePacketOffset >= 0) memcpy(target + wavePacketOffset, &point->wave_packet[0], 29);
+
+	int standardLength = LasHeader::standardRecordLength(format);
+	int numExtraBytes = std::min(recordLength - standardLength, int(point->num_extra_bytes));
+	if(numExtraBytes > 0){
+		memcpy(target + standardLength, point->extra_bytes, numExtraBytes);
+	}
+}
+
+// header and VLRs of the output file. For LAZ input, the laszip VLR is removed.
+vector<uint8_t> createOutputHeader(string path, LasHeader& header){
+
+	vector<uint8_t> output;
+
+	if(!header.isCompressed){
+		auto buffer = readBinaryFile(path, 0, header.offsetToPointData);
+		output.resize(buffer->size);
+		memcpy(output.data(), buffer->data, buffer->size);
+	}else{
+		auto buffer = readBinaryFile(path, 0, header.offsetToPointData);
+
+		output.insert(output.end(), buffer->data_u8, buffer->data_u8 + header.headerSize);
+
+		uint32_t numVLRs = 0;
+		int64_t vlrOffset = header.headerSize;
+		for(uint32_t i = 0; i < header.numVLRs; i++){
+			uint16_t recordID = buffer->get<uint16_t>(vlrOffset + 18);
+			uint16_t recordLengthAfterHeader = buffer->get<uint16_t>(vlrOffset + 20);
+			string userID = string((const char*)(buffer->data_u8 + vlrOffset + 2), 16);
+			int64_t vlrSize = 54 + recordLengthAfterHeader;
+
+			bool isLaszipVLR = userID.starts_with("laszip encoded") && recordID == 22204;
+
+			if(!isLaszipVLR){
+				output.insert(output.end(), buffer->data_u8 + vlrOffset, buffer->data_u8 + vlrOffset + vlrSize);
+				numVLRs++;
+			}
+
+			vlrOffset += vlrSize;
+		}
+
+		uint32_t offsetToPointData = output.size();
+		uint8_t format = header.format;
+		memcpy(output.data() + 96, &offsetToPointData, 4);
+		memcpy(output.data() + 100, &numVLRs, 4);
+		memcpy(output.data() + 104, &format, 1);
+	}
+
+	int64_t zero = 0;
+	if(header.headerSize >= 235){
+		// start of waveform data packet record
+		memcpy(output.data() + 227, &zero, 8);
+	}
+	if(header.headerSize >= 375){
+		// start and number of EVLRs
+		memcpy(output.data() + 235, &zero, 8);
+		memcpy(output.data() + 243, &zero, 4);
+	}
+
+	return output;
+}
+
+void patchOutputHeader(vector<uint8_t>& output, LasHeader& header, Stats& stats){
+
+	auto set = [&output](auto value, int64_t offset){
+		memcpy(output.data() + offset, &value, sizeof(value));
+	};
+
+	bool hasLegacyCounts = header.format < 6 && stats.numPoints <= std::numeric_limits<uint32_t>::max();
+
+	set(uint32_t(hasLegacyCounts ? stats.numPoints : 0), 107);
+	for(int i = 0; i < 5; i++){
+		set(uint32_t(hasLegacyCounts ? stats.numPointsByReturn[i] : 0), 111 + 4 * i);
+	}
+
+	if(stats.numPoints > 0){
+		dvec3 min = {
+			double(stats.min[0]) * header.scale.x + header.offset.x,
+			double(stats.min[1]) * header.scale.y + header.offset.y,
+			double(stats.min[2]) * header.scale.z + header.offset.z,
+		};
+		dvec3 max = {
+			double(stats.max[0]) * header.scale.x + header.offset.x,
+			double(stats.max[1]) * header.scale.y + header.offset.y,
+			double(stats.max[2]) * header.scale.z + header.offset.z,
+		};
+
+		set(max.x, 179);
+		set(min.x, 187);
+		set(max.y, 195);
+		set(min.y, 203);
+		set(max.z, 211);
+		set(min.z, 219);
+	}else{
+		for(int i = 0; i < 6; i++){
+			set(0.0, 179 + 8 * i);
+		}
+	}
+
+	if(header.headerSize >= 375){
+		set(uint64_t(stats.numPoints), 247);
+		for(int i = 0; i < 15; i++){
+			set(uint64_t(stats.numPointsByReturn[i]), 255 + 8 * i);
+		}
+	}
+}
+
+// reads the records of [firstPoint, firstPoint + numPoints) in their uncompressed form
+struct UnitDecoder{
+
+	string path;
+	LasHeader header;
+
+	FILE* file = nullptr;
+
+	laszip_POINTER laszip_reader = nullptr;
+	laszip_point* laz_point = nullptr;
+	int64_t lazPosition = -1;
+
+	UnitDecoder(string path, LasHeader header){
+		this->path = path;
+		this->header = header;
+	}
+
+	~UnitDecoder(){
+		if(file){
+			fclose(file);
+		}
+
+		if(laszip_reader){
+			laszip_close_reader(laszip_reader);
+			laszip_destroy(laszip_reader);
+		}
+	}
+
+	void exitWithLaszipError(string function, int64_t pointIndex){
+		laszip_CHAR* error = nullptr;
+		laszip_get_error(laszip_reader, &error);
+
+		cout << "ERROR: " << function << " failed at point " << pointIndex << " of " << path << ": " << (error ? error : "") << endl;
+		exit(1);
+	}
+
+	void decode(int64_t firstPoint, int64_t numPoints, vector<uint8_t>& target){
+
+		auto zone = Tracer::zone("decode");
+
+		int64_t recordLength = header.recordLength;
+		target.resize(numPoints * recordLength);
+
+		if(!header.isCompressed){
+
+			if(!file){
+				file = fopen(path.c_str(), "rb");
+
+				if(file == nullptr){
+					cout << "ERROR: could not open " << path << endl;
+					exit(1);
+				}
+			}
+
+			fseek_64_all_platforms(file, header.offsetToPointData + firstPoint * recordLength, SEEK_SET);
+			int64_t bytesRead = fread(target.data(), 1, numPoints * recordLength, file);
+
+			if(bytesRead != numPoints * recordLength){
+				cout << "ERROR: could not read points " << firstPoint << " to " << (firstPoint + numPoints) << " of " << path
+					<< ", the file is shorter than its header says" << endl;
+				exit(1);
+			}
+
+		}else{
+
+			if(!laszip_reader){
+				laszip_BOOL is_compressed = true;
+
+				laszip_create(&laszip_reader);
+
+				if(laszip_open_reader(laszip_reader, path.c_str(), &is_compressed)){
+					cout << "ERROR: laszip could not open " << path << endl;
+					exit(1);
+				}
+
+				laszip_get_point_pointer(laszip_reader, &laz_point);
+				lazPosition = 0;
+			}
+
+			if(lazPosition != firstPoint){
+				if(laszip_seek_point(laszip_reader, firstPoint)){
+					exitWithLaszipError("laszip_seek_point", firstPoint);
+				}
+			}
+
+			for(int64_t i = 0; i < numPoints; i++){
+				if(laszip_read_point(laszip_reader)){
+					exitWithLaszipError("laszip_read_point", firstPoint + i);
+				}
+
+				packRecord(laz_point, header.format, recordLength, target.data() + i * recordLength);
+			}
+
+			lazPosition = firstPoint + numPoints;
+		}
+	}
+};
+
+void filterUnit(Filter& filter, LasHeader& header, int64_t firstPoint, int64_t numPoints, vector<uint8_t>& source, Unit& unit){
+
+	auto zone = Tracer::zone("filter");
+
+	int64_t recordLength = header.recordLength;
+	int classOffset = header.format < 6 ? 15 : 16;
+	uint8_t classMask = header.format < 6 ? 0b0001'1111 : 0b1111'1111;
+	uint64_t fractionThreshold = uint64_t(std::clamp(filter.fraction, 0.0, 1.0) * 9007199254740992.0);
+
+	unit.records.resize(numPoints * recordLength);
+	unit.numPoints = 0;
+	unit.stats = Stats();
+
+	for(int64_t i = 0; i < numPoints; i++){
+		int64_t index = firstPoint + i;
+		uint8_t* record = source.data() + i * recordLength;
+
+		if(filter.every > 1 && (index % filter.every) != 0) continue;
+		if(filter.fraction < 1.0 && (hashIndex(index, filter.seed) >> 11) >= fractionThreshold) continue;
+		if(filter.hasClasses && !filter.keepClass[record[classOffset] & classMask]) continue;
+
+		if(filter.hasBox || filter.polygon.size() > 0){
+			int32_t XYZ[3];
+			memcpy(XYZ, record, 12);
+
+			double x = double(XYZ[0]) * header.scale.x + header.offset.x;
+			double y = double(XYZ[1]) * header.scale.y + header.offset.y;
+			double z = double(XYZ[2]) * header.scale.z + header.offset.z;
+
+			if(filter.hasBox){
+				if(x < filter.boxMin.x || x > filter.boxMax.x) continue;
+				if(y < filter.boxMin.y || y > filter.boxMax.y) continue;
+				if(z < filter.boxMin.z || z > filter.boxMax.z) continue;
+			}
+
+			if(filter.polygon.size() > 0 && !filter.insidePolygon(x, y)) continue;
+		}
+
+		memcpy(unit.records.data() + unit.numPoints * recordLength, record, recordLength);
+		unit.stats.add(record, header.format);
+		unit.numPoints++;
+	}
+
+	unit.records.resize(unit.numPoints * recordLength);
+}
+
+vector<string> splitString(string str, char delimiter){
+	vector<string> tokens;
+
+	size_t start = 0;
+	while(true){
+		size_t end = str.find(delimiter, start);
+
+		if(end == string::npos){
+			tokens.push_back(str.substr(start));
+			break;
+		}
+
+		tokens.push_back(str.substr(start, end - start));
+		start = end + 1;
+	}
+
+	return tokens;
+}
+
+vector<int64_t> parseIntegerList(string str){
+	vector<int64_t> values;
+
+	for(auto token : splitString(str, ',')){
+		if(token.size() > 0){
+			values.push_back(std::stoll(token));
+		}
+	}
+
+	return values;
+}
+
+void printUsage(){
+	cout << "usage: lasfilter <input.las|laz> <output.las> [options]" << endl;
+	cout << "  --box minX minY minZ maxX maxY maxZ" << endl;
+	cout << "  --polygon x,y x,y x,y [...]" << endl;
+	cout << "  --classes 2,6,9" << endl;
+	cout << "  --drop-classes 7,18" << endl;
+	cout << "  --every n" << endl;
+	cout << "  --fraction f [--seed s]" << endl;
+	cout << "  --max-points n" << endl;
+	cout << "  --threads n" << endl;
+	cout << "  --trace file.json" << endl;
+}
+
+int main(int argc, char** argv){
+
+	if(argc < 3){
+		printUsage();
+
+		return 1;
+	}
+
+	string path = argv[1];
+	string targetPath = argv[2];
+
+	Filter filter;
+	int numThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+	string tracePath = "";
+
+	for(int i = 3; i < argc; i++){
+		string arg = argv[i];
+
+		auto hasValues = [&](int count){
+			if(i + count >= argc){
+				cout << "ERROR: missing value for " << arg << endl;
+				exit(1);
+			}
+
+			return true;
+		};
+
+		if(arg == "--box" && hasValues(6)){
+			filter.hasBox = true;
+			filter.boxMin = {stod(argv[i + 1]), stod(argv[i + 2]), stod(argv[i + 3])};
+			filter.boxMax = {stod(argv[i + 4]), stod(argv[i + 5]), stod(argv[i + 6])};
+			i += 6;
+		}else if(arg == "--polygon"){
+			while(i + 1 < argc && !string(argv[i + 1]).starts_with("--")){
+				auto tokens = splitString(string(argv[i + 1]), ',');
+
+				if(tokens.size() != 2){
+					cout << "ERROR: expected polygon vertex as x,y but got " << argv[i + 1] << endl;
+					exit(1);
+				}
+
+				filter.polygon.push_back({stod(tokens[0]), stod(tokens[1])});
+				i++;
+			}
+
+			if(filter.polygon.size() < 3){
+				cout << "ERROR: polygon needs at least 3 vertices" << endl;
+				exit(1);
+			}
+		}else if(arg == "--classes" && hasValues(1)){
+			filter.hasClasses = true;
+			for(int j = 0; j < 256; j++){
+				filter.keepClass[j] = false;
+			}
+			for(auto classification : parseIntegerList(argv[i + 1])){
+				filter.keepClass[classification & 0xff] = true;
+			}
+			i++;
+		}else if(arg == "--drop-classes" && hasValues(1)){
+			filter.hasClasses = true;
+			for(auto classification : parseIntegerList(argv[i + 1])){
+				filter.keepClass[classification & 0xff] = false;
+			}
+			i++;
+		}else if(arg == "--every" && hasValues(1)){
+			filter.every = std::max(std::stoll(argv[i + 1]), 1ll);
+			i++;
+		}else if(arg == "--fraction" && hasValues(1)){
+			filter.fraction = stod(argv[i + 1]);
+			i++;
+		}else if(arg == "--seed" && hasValues(1)){
+			filter.seed = std::stoull(argv[i + 1]);
+			i++;
+		}else if(arg == "--max-points" && hasValues(1)){
+			filter.maxPoints = std::stoll(argv[i + 1]);
+			i++;
+		}else if(arg == "--threads" && hasValues(1)){
+			numThreads = std::max(std::stoi(argv[i + 1]), 1);
+			i++;
+		}else if(arg == "--trace" && hasValues(1)){
+			tracePath = argv[i + 1];
+			i++;
+		}else{
+			cout << "ERROR: unknown argument " << arg << endl;
+			printUsage();
+
+			return 1;
+		}
+	}
+
+	if(filter.polygon.size() > 0){
+		filter.polygonMin = filter.polygon[0];
+		filter.polygonMax = filter.polygon[0];
+
+		for(auto vertex : filter.polygon){
+			filter.polygonMin = glm::min(filter.polygonMin, vertex);
+			filter.polygonMax = glm::max(filter.polygonMax, vertex);
+		}
+	}
+
+	if(tracePath != ""){
+		Tracer::enable();
+		Tracer::setThreadName("writer");
+	}
+
+	auto tStart = now();
+
+	LasHeader header = LasHeader::read(path);
+
+	if(header.format > 10 || header.recordLength < LasHeader::standardRecordLength(header.format)){
+		cout << "ERROR: unsupported point format " << header.format << " with record length " << header.recordLength << endl;
+
+		return 1;
+	}
+
+	int64_t numUnits = (header.numPoints + POINTS_PER_UNIT - 1) / POINTS_PER_UNIT;
+
+	cout << "input:    " << path << endl;
+	cout << "#points:  " << formatNumber(header.numPoints) << endl;
+	cout << "format:   " << header.format << (header.isCompressed ? " (laz)" : "") << endl;
+	cout << "#threads: " << numThreads << endl;
+
+	vector<uint8_t> outputHeader = createOutputHeader(path, header);
+
+	FILE* target = fopen(targetPath.c_str(), "wb");
+
+	if(target == nullptr){
+		cout << "ERROR: could not open " << targetPath << endl;
+
+		return 1;
+	}
+
+	fwrite(outputHeader.data(), 1, outputHeader.size(), target);
+
+	// decoded and filtered units, waiting to be written in order
+	map<int64_t, shared_ptr<Unit>> finishedUnits;
+	mutex mtx_units;
+	condition_variable cv_units;
+	atomic<int64_t> nextUnit = 0;
+	int64_t unitsWritten = 0;
+	bool done = false;
+	int64_t maxUnitsInFlight = MAX_UNITS_IN_FLIGHT_PER_THREAD * numThreads;
+
+	vector<thread> threads;
+	for(int threadIndex = 0; threadIndex < numThreads; threadIndex++){
+		threads.emplace_back([&, threadIndex](){
+
+			Tracer::setThreadName("decoder " + to_string(threadIndex));
+
+			UnitDecoder decoder(path, header);
+			vector<uint8_t> source;
+
+			while(true){
+				int64_t unitIndex = nextUnit.fetch_add(1);
+
+				if(unitIndex >= numUnits) break;
+
+				{
+					unique_lock<mutex> lock(mtx_units);
+					cv_units.wait(lock, [&](){
+						return done || unitIndex < unitsWritten + maxUnitsInFlight;
+					});
+
+					if(done) break;
+				}
+
+				int64_t firstPoint = unitIndex * POINTS_PER_UNIT;
+				int64_t numPoints = std::min(POINTS_PER_UNIT, header.numPoints - firstPoint);
+
+				auto unit = make_shared<Unit>();
+
+				decoder.decode(firstPoint, numPoints, source);
+				filterUnit(filter, header, firstPoint, numPoints, source, *unit);
+
+				{
+					lock_guard<mutex> lock(mtx_units);
+					finishedUnits[unitIndex] = unit;
+				}
+				cv_units.notify_all();
+			}
+		});
+	}
+
+	Stats stats;
+	for(int64_t unitIndex = 0; unitIndex < numUnits; unitIndex++){
+
+		shared_ptr<Unit> unit = nullptr;
+		{
+			auto zone = Tracer::zone("wait for unit");
+			unique_lock<mutex> lock(mtx_units);
+			cv_units.wait(lock, [&](){
+				return finishedUnits.find(unitIndex) != finishedUnits.end();
+			});
+
+			unit = finishedUnits[unitIndex];
+			finishedUnits.erase(unitIndex);
+		}
+
+		int64_t numPoints = unit->numPoints;
+		bool reachedMaxPoints = false;
+
+		if(filter.maxPoints >= 0 && stats.numPoints + numPoints >= filter.maxPoints){
+			numPoints = filter.maxPoints - stats.numPoints;
+			reachedMaxPoints = true;
+
+			unit->stats = Stats();
+			for(int64_t i = 0; i < numPoints; i++){
+				unit->stats.add(unit->records.data() + i * header.recordLength, header.format);
+			}
+		}
+
+		{
+			auto zone = Tracer::zone("write");
+			fwrite(unit->records.data(), 1, numPoints * header.recordLength, target);
+		}
+		stats.add(unit->stats);
+		Tracer::increment("bytes written", double(numPoints * header.recordLength));
+
+		{
+			lock_guard<mutex> lock(mtx_units);
+			unitsWritten++;
+			done = reachedMaxPoints;
+		}
+		cv_units.notify_all();
+
+		if((unitIndex % 100) == 0 || reachedMaxPoints || unitIndex == numUnits - 1){
+			cout << "progress: " << formatNumber((unitIndex + 1) * POINTS_PER_UNIT < header.numPoints ? (unitIndex + 1) * POINTS_PER_UNIT : header.numPoints)
+				<< " / " << formatNumber(header.numPoints) << " points read, "
+				<< formatNumber(stats.numPoints) << " written" << endl;
+		}
+
+		if(reachedMaxPoints) break;
+	}
+
+	for(auto& t : threads){
+		t.join();
+	}
+
+	patchOutputHeader(outputHeader, header, stats);
+	fseek_64_all_platforms(target, 0, SEEK_SET);
+	fwrite(outputHeader.data(), 1, outputHeader.size(), target);
+	fclose(target);
+
+	printElapsedTime("duration", tStart);
+
+	cout << "#points written: " << formatNumber(stats.numPoints) << endl;
+
+	if(tracePath != ""){
+		Tracer::writeChromeTrace(tracePath);
+		Tracer::printSummary();
+	}
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+
+// Microbenchmarks for include/morton.h
+//
+// usage: morton_bench [count] [iterations]
+//
+// Encodes and decodes <count> random 21 bit coordinates with each available path and reports
+// million codes per second, the best of <iterations> runs. Build once with and once without
+// /arch:AVX2 (-mavx2 -mbmi2) to compare the BMI2/AVX2 paths against the lookup tables. The morton_bench project in
+// build/CudaLOD.sln builds without it, set "Enable Enhanced Instruction Set" to AVX2 for the second build.
+// All paths are checked against each other, a mismatch is reported as an error.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include "morton.h"
+
+using namespace std;
+
+struct Benchmark{
+	int64_t count = 0;
+	int iterations = 0;
+
+	// best of <iterations>, in million items per second
+	double run(function<void()> fn){
+		double best = 1e30;
+
+		for(int i = 0; i < iterations; i++){
+			auto start = chrono::steady_clock::now();
+			fn();
+			auto end = chrono::steady_clock::now();
+
+			best = std::min(best, chrono::duration<double>(end - start).count());
+		}
+
+		return double(count) / best / 1'000'000.0;
+	}
+
+	void report(string label, double mps){
+		printf("%-40s %10.1f M/s\n", label.c_str(), mps);
+	}
+};
+
+// the per-bit loop that OctreeWriter used before morton.h
+static void decodeLoop(uint64_t code, uint32_t& x, uint32_t& y, uint32_t& z){
+	x = 0;
+	y = 0;
+	z = 0;
+
+	for(int bit = 0; bit < 21; bit++){
+		x |= ((code >> (3 * bit + 2)) & 1) << bit;
+		y |= ((code >> (3 * bit + 1)) & 1) << bit;
+		z |= ((code >> (3 * bit + 0)) & 1) << bit;
+	}
+}
+
+int main(int argc, char** argv){
+
+	int64_t count = argc > 1 ? stoll(argv[1]) : 10'000'000;
+	int iterations = argc > 2 ? stoi(argv[2]) : 5;
+
+	printf("count: %lld, iterations: %d, BMI2: %s, AVX2: %s\n",
+		(long long)count, iterations, MORTON_BMI2 ? "yes" : "no", MORTON_AVX2 ? "yes" : "no");
+
+	vector<uint32_t> X(count), Y(count), Z(count);
+	vector<uint32_t> dx(count), dy(count), dz(count);
+	vector<uint64_t> codes(count), reference(count);
+
+	mt19937 rng(123);
+	for(int64_t i = 0; i < count; i++){
+		X[i] = rng() & 0x1fffff;
+		Y[i] = rng() & 0x1fffff;
+		Z[i] = rng() & 0x1fffff;
+	}
+
+	for(int64_t i = 0; i < count; i++){
+		reference[i] = (morton::splitBy3(X[i]) << 2) | (morton::splitBy3(Y[i]) << 1) | morton::splitBy3(Z[i]);
+	}
+
+	Benchmark bench;
+	bench.count = count;
+	bench.iterations = iterations;
+
+	int numErrors = 0;
+	auto verifyCodes = [&](string label){
+		if(codes != reference){
+			printf("ERROR: %s produced wrong codes\n", label.c_str());
+			numErrors++;
+		}
+		std::fill(codes.begin(), codes.end(), 0);
+	};
+	auto verifyCoordinates = [&](string label){
+		if(dx != X || dy != Y || dz != Z){
+			printf("ERROR: %s produced wrong coordinates\n", label.c_str());
+			numErrors++;
+		}
+		std::fill(dx.begin(), dx.end(), 0);
+		std::fill(dy.begin(), dy.end(), 0);
+		std::fill(dz.begin(), dz.end(), 0);
+	};
+
+	// ENCODE
+	bench.report("encode: magic bits", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			codes[i] = (morton::splitBy3(X[i]) << 2) | (morton::splitBy3(Y[i]) << 1) | morton::splitBy3(Z[i]);
+		}
+	}));
+	verifyCodes("magic bits");
+
+	bench.report("encode: lookup table", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			codes[i] = morton::lut::encode(X[i], Y[i], Z[i]);
+		}
+	}));
+	verifyCodes("lookup table");
+
+	bench.report(MORTON_BMI2 ? "encode: scalar (PDEP)" : "encode: scalar (lookup table)", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			codes[i] = morton::encode(X[i], Y[i], Z[i]);
+		}
+	}));
+	verifyCodes("scalar");
+
+	bench.report(MORTON_AVX2 ? "encode: array (AVX2)" : "encode: array (scalar)", bench.run([&](){
+		morton::encode(X.data(), Y.data(), Z.data(), codes.data(), count);
+	}));
+	verifyCodes("array");
+
+	// DECODE
+	bench.report("decode: bit loop", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			decodeLoop(reference[i], dx[i], dy[i], dz[i]);
+		}
+	}));
+	verifyCoordinates("bit loop");
+
+	bench.report("decode: magic bits", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			uint64_t code = reference[i];
+			dx[i] = morton::compactBy3(code >> 2);
+			dy[i] = morton::compactBy3(code >> 1);
+			dz[i] = morton::compactBy3(code >> 0);
+		}
+	}));
+	verifyCoordinates("magic bits");
+
+	bench.report("decode: lookup table", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			morton::lut::decode(reference[i], dx[i], dy[i], dz[i]);
+		}
+	}));
+	verifyCoordinates("lookup table");
+
+	bench.report(MORTON_BMI2 ? "decode: scalar (PEXT)" : "decode: scalar (magic bits)", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			morton::decode(reference[i], dx[i], dy[i], dz[i]);
+		}
+	}));
+	verifyCoordinates("scalar");
+
+	bench.report(MORTON_AVX2 ? "decode: array (AVX2)" : "decode: array (scalar)", bench.run([&](){
+		morton::decode(reference.data(), dx.data(), dy.data(), dz.data(), count);
+	}));
+	verifyCoordinates("array");
+
+	// 2D
+	bench.report("encode 2D", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			codes[i] = morton::encode2D(X[i], Y[i]);
+		}
+	}));
+
+	bench.report("decode 2D", bench.run([&](){
+		for(int64_t i = 0; i < count; i++){
+			morton::decode2D(codes[i], dx[i], dy[i]);
+		}
+	}));
+
+	if(dx != X || dy != Y){
+		printf("ERROR: 2D round trip produced wrong coordinates\n");
+		numErrors++;
+	}
+
+	return numErrors == 0 ? 0 : 1;
+}
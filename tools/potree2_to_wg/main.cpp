@@ -0,0 +1,311 @@
+
+// Converts a Potree 2 point cloud (metadata.json, hierarchy.bin, octree.bin) into the
+// workgroup-render format (batches.bin, points.bin, colors.bin).
+// Native, multithreaded replacement for tools/potree2_to_wg.js with byte-identical output.
+//
+// usage: potree2_to_wg <potree2 directory> <target directory> [numThreads] [trace.json]
+//
+// Built by the potree2_to_wg project in build/CudaLOD.sln.
+//
+// - nodes are converted in depth-first pre-order, just like the js tool
+// - output offsets are known upfront (prefix sum over node point counts), so nodes
+//   of a segment are converted in parallel, directly into their final location
+// - each segment is then appended to points.bin/colors.bin with a single large write
+
+#include <iostream>
+#include <atomic>
+#include <cmath>
+
+#include "unsuck.hpp"
+#include "compute/PotreeHierarchy.h"
+#include "Tracer.h"
+
+using namespace std;
+
+// ~16MB per segment in points.bin, ~8MB in colors.bin
+constexpr int64_t MAX_POINTS_PER_SEGMENT = 2'000'000;
+
+// JavaScript's ToInt32(), which the js tool implicitly applies through bitwise operators
+inline int32_t toInt32(double value){
+
+	if(!std::isfinite(value)){
+		return 0;
+	}
+
+	double truncated = std::trunc(value);
+	double wrapped = std::fmod(truncated, 4294967296.0);
+
+	if(wrapped < 0.0){
+		wrapped += 4294967296.0;
+	}
+
+	return int32_t(uint32_t(wrapped));
+}
+
+struct Segment{
+	int64_t firstNode = 0;
+	int64_t numNodes = 0;
+	int64_t firstPoint = 0;
+	int64_t numPoints = 0;
+};
+
+// returns false if octree.bin ended before the node's last byte
+bool convertNode(
+	PotreeHierarchy* hierarchy,
+	PotreeHierarchy::Node* node,
+	FILE* octreeFile,
+	Box rootBox,
+	uint8_t* target_points,
+	uint8_t* target_colors,
+	vector<uint8_t>& source
+){
+	auto zone = Tracer::zone("convertNode");
+
+	int64_t numPoints = node->numPoints;
+	int64_t stride = hierarchy->bytesPerPoint;
+	int64_t rgbOffset = hierarchy->rgbOffset;
+	dvec3 scale = hierarchy->scale;
+	dvec3 offset = hierarchy->offset;
+	dvec3 bbSize = rootBox.size();
+
+	if(numPoints == 0){
+		return true;
+	}
+
+	source.resize(std::max(int64_t(node->byteSize), stride * numPoints));
+	memset(source.data(), 0, source.size());
+
+	{
+		auto zone = Tracer::zone("read");
+		fseek_64_all_platforms(octreeFile, node->byteOffset, SEEK_SET);
+		int64_t bytesRead = int64_t(fread(source.data(), 1, node->byteSize, octreeFile));
+
+		if(bytesRead != node->byteSize){
+			cout << "ERROR: octree.bin is truncated, node " << node->name
+				<< " expects " << node->byteSize << " bytes at offset " << node->byteOffset
+				<< " but only " << bytesRead << " could be read" << endl;
+
+			return false;
+		}
+	}
+
+	for(int64_t i = 0; i < numPoints; i++){
+
+		int32_t X, Y, Z;
+		uint16_t R, G, B;
+
+		memcpy(&X, source.data() + i * stride + 0, 4);
+		memcpy(&Y, source.data() + i * stride + 4, 4);
+		memcpy(&Z, source.data() + i * stride + 8, 4);
+		memcpy(&R, source.data() + i * stride + rgbOffset + 0, 2);
+		memcpy(&G, source.data() + i * stride + rgbOffset + 2, 2);
+		memcpy(&B, source.data() + i * stride + rgbOffset + 4, 2);
+
+		double x = double(X) * scale.x + offset.x;
+		double y = double(Y) * scale.y + offset.y;
+		double z = double(Z) * scale.z + offset.z;
+
+		uint8_t* color = target_colors + 4 * i;
+		color[0] = R > 255 ? R / 256 : R;
+		color[1] = G > 255 ? G / 256 : G;
+		color[2] = B > 255 ? B / 256 : B;
+		color[3] = 255;
+
+		{// 20 bit
+			double factor = 1048576.0;
+			int32_t ix = toInt32(factor * ((x - rootBox.min.x) / bbSize.x));
+			int32_t iy = toInt32(factor * ((y - rootBox.min.y) / bbSize.y));
+			int32_t iz = toInt32(factor * ((z - rootBox.min.z) / bbSize.z));
+
+			uint32_t a = uint32_t(ix) | ((uint32_t(iy) & 4095u) << 20);
+			uint32_t b = uint32_t(iz) | ((uint32_t(iy) >> 12) << 20);
+
+			memcpy(target_points + 8 * i + 0, &a, 4);
+			memcpy(target_points + 8 * i + 4, &b, 4);
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv){
+
+	if(argc < 3){
+		cout << "usage: potree2_to_wg <potree2 directory> <target directory> [numThreads] [trace.json]" << endl;
+
+		return 1;
+	}
+
+	string path = argv[1];
+	string outpath = argv[2];
+	int numThreads = argc > 3 ? std::stoi(argv[3]) : int(std::thread::hardware_concurrency());
+	numThreads = std::max(numThreads, 1);
+	string tracePath = argc > 4 ? argv[4] : "";
+
+	if(tracePath != ""){
+		Tracer::enable();
+		Tracer::setThreadName("main");
+	}
+
+	auto tStart = now();
+
+	auto hierarchy = PotreeHierarchy::load(path);
+	auto nodes = hierarchy->flatten();
+
+	Box rootBox = hierarchy->root->boundingBox;
+
+	cout << "#nodes:   " << formatNumber(nodes.size()) << endl;
+	cout << "#points:  " << formatNumber(hierarchy->numPoints) << endl;
+	cout << "#threads: " << numThreads << endl;
+
+	fs::create_directories(outpath);
+
+	// BATCHES - offsets of each node within points.bin/colors.bin
+	vector<int64_t> pointOffsets(nodes.size());
+	Buffer batches(64 * nodes.size());
+	memset(batches.data, 0, batches.size);
+
+	int64_t pointsWritten = 0;
+	for(int64_t nodeIndex = 0; nodeIndex < int64_t(nodes.size()); nodeIndex++){
+		auto node = nodes[nodeIndex];
+		int64_t offset = 64 * nodeIndex;
+
+		batches.set<float>(node->boundingBox.min.x, offset +  0);
+		batches.set<float>(node->boundingBox.min.y, offset +  4);
+		batches.set<float>(node->boundingBox.min.z, offset +  8);
+		batches.set<float>(node->boundingBox.max.x, offset + 12);
+		batches.set<float>(node->boundingBox.max.y, offset + 16);
+		batches.set<float>(node->boundingBox.max.z, offset + 20);
+
+		batches.set<uint8_t>(255, offset + 24 + 0);
+		batches.set<uint8_t>( 50, offset + 24 + 1);
+		batches.set<uint8_t>( 50, offset + 24 + 2);
+		batches.set<uint8_t>(255, offset + 24 + 3);
+
+		batches.set<int32_t>(int32_t(node->numPoints), offset + 28);
+		batches.set<int32_t>(int32_t(pointsWritten), offset + 32);
+
+		pointOffsets[nodeIndex] = pointsWritten;
+		pointsWritten += node->numPoints;
+	}
+
+	writeBinaryFile(outpath + "/batches.bin", batches);
+
+	// SEGMENTS - consecutive runs of nodes that are converted in parallel, then written at once
+	vector<Segment> segments;
+	{
+		Segment segment;
+		for(int64_t nodeIndex = 0; nodeIndex < int64_t(nodes.size()); nodeIndex++){
+			auto node = nodes[nodeIndex];
+
+			if(segment.numNodes > 0 && segment.numPoints + node->numPoints > MAX_POINTS_PER_SEGMENT){
+				segments.push_back(segment);
+
+				segment = Segment();
+				segment.firstNode = nodeIndex;
+				segment.firstPoint = pointOffsets[nodeIndex];
+			}
+
+			segment.numNodes++;
+			segment.numPoints += node->numPoints;
+		}
+
+		if(segment.numNodes > 0){
+			segments.push_back(segment);
+		}
+	}
+
+	// POINTS & COLORS
+	FILE* fPoints = fopen((outpath + "/points.bin").c_str(), "wb");
+	FILE* fColors = fopen((outpath + "/colors.bin").c_str(), "wb");
+
+	vector<FILE*> octreeFiles;
+	vector<vector<uint8_t>> sourceBuffers(numThreads);
+	for(int i = 0; i < numThreads; i++){
+		octreeFiles.push_back(fopen((path + "/octree.bin").c_str(), "rb"));
+	}
+
+	int64_t largestSegment = 0;
+	for(auto& segment : segments){
+		largestSegment = std::max(largestSegment, segment.numPoints);
+	}
+
+	Buffer targetPoints(std::max(int64_t(8) * largestSegment, int64_t(1)));
+	Buffer targetColors(std::max(int64_t(4) * largestSegment, int64_t(1)));
+
+	std::atomic<bool> failed = false;
+
+	for(int segmentIndex = 0; segmentIndex < int(segments.size()); segmentIndex++){
+		Segment segment = segments[segmentIndex];
+
+		std::atomic<int64_t> nextNode = segment.firstNode;
+		int64_t endNode = segment.firstNode + segment.numNodes;
+
+		vector<thread> threads;
+		for(int threadIndex = 0; threadIndex < numThreads; threadIndex++){
+			threads.emplace_back([&, threadIndex](){
+				Tracer::setThreadName("converter " + to_string(threadIndex));
+
+				while(true){
+					int64_t nodeIndex = nextNode.fetch_add(1);
+
+					if(nodeIndex >= endNode || failed) break;
+
+					int64_t localOffset = pointOffsets[nodeIndex] - segment.firstPoint;
+
+					bool converted = convertNode(hierarchy.get(), nodes[nodeIndex], octreeFiles[threadIndex], rootBox,
+						targetPoints.data_u8 + 8 * localOffset,
+						targetColors.data_u8 + 4 * localOffset,
+						sourceBuffers[threadIndex]);
+
+					if(!converted){
+						failed = true;
+					}
+				}
+			});
+		}
+
+		for(auto& t : threads){
+			t.join();
+		}
+
+		if(failed){
+			break;
+		}
+
+		{
+			auto zone = Tracer::zone("write segment");
+			fwrite(targetPoints.data, 1, 8 * segment.numPoints, fPoints);
+			fwrite(targetColors.data, 1, 4 * segment.numPoints, fColors);
+		}
+		Tracer::increment("bytes written", double(12 * segment.numPoints));
+
+		if((segmentIndex % 100) == 0){
+			cout << "progress: " << (segmentIndex + 1) << " / " << segments.size() << endl;
+		}
+	}
+
+	for(auto file : octreeFiles){
+		fclose(file);
+	}
+
+	fclose(fPoints);
+	fclose(fColors);
+
+	if(failed){
+		cout << "ERROR: conversion aborted, " << outpath << " is incomplete" << endl;
+
+		return 1;
+	}
+
+	printElapsedTime("duration", tStart);
+
+	if(tracePath != ""){
+		Tracer::writeChromeTrace(tracePath);
+		Tracer::printSummary();
+	}
+
+	cout << "done" << endl;
+
+	return 0;
+}
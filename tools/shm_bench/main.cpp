@@ -0,0 +1,252 @@
+
+// Throughput of handing point batches from a loader process to a builder process,
+// through a SharedRing (include/SharedRing.h) versus a pipe.
+//
+// usage: shm_bench [file.las] [batches] [pointsPerBatch] [slots]
+//
+// Launches itself as the producer process. The producer writes <batches> batches of 32 byte points,
+// either decoded from <file.las> with LasLoader, repeated as needed, or synthetic if no file is given.
+// - pipe: the producer decodes into a Buffer and writes it to stdout, the consumer reads it into its own Buffer.
+// - shm:  the producer decodes into a slot of the ring, the consumer reads the slot in place.
+// The consumer touches all bytes of each batch, and both transfers are checked against each other.
+//
+// Built by the shm_bench project in build/CudaLOD.sln. Elsewhere, build with include/unsuck_platform_specific.cpp, e.g.
+//   g++ -std=c++20 -O2 -I../../include -I../../libs/glm main.cpp ../../include/unsuck_platform_specific.cpp -o shm_bench
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <functional>
+
+#if defined(_WIN32)
+	#include <io.h>
+	#include <fcntl.h>
+	#define popen _popen
+	#define pclose _pclose
+	#define PIPE_READ_MODE "rb"
+#else
+	#define PIPE_READ_MODE "r"
+#endif
+
+#include "unsuck.hpp"
+#include "LasLoader.h"
+#include "SharedRing.h"
+
+using namespace std;
+
+struct Options{
+	string file = "";
+	int64_t numBatches = 200;
+	int64_t pointsPerBatch = 1'000'000;
+	int64_t numSlots = 4;
+};
+
+struct Result{
+	double seconds = 0.0;
+	uint64_t checksum = 0;
+	int64_t numBytes = 0;
+};
+
+// fills <target> with batch <batchIndex>
+function<int64_t(int64_t, uint8_t*)> producerOf(Options options){
+
+	if(options.file != ""){
+		auto header = LasHeader::read(options.file);
+		int64_t batchesPerFile = (header.numPoints + options.pointsPerBatch - 1) / options.pointsPerBatch;
+
+		return [=](int64_t batchIndex, uint8_t* target){
+			int64_t firstPoint = (batchIndex % batchesPerFile) * options.pointsPerBatch;
+
+			return LasLoader::loadInto(options.file, firstPoint, options.pointsPerBatch, target);
+		};
+	}
+
+	return [=](int64_t batchIndex, uint8_t* target){
+		uint64_t* words = reinterpret_cast<uint64_t*>(target);
+
+		for(int64_t i = 0; i < 4 * options.pointsPerBatch; i++){
+			words[i] = uint64_t(batchIndex) * 0x9E3779B97F4A7C15ull + uint64_t(i);
+		}
+
+		return options.pointsPerBatch;
+	};
+}
+
+uint64_t checksumOf(const uint8_t* data, int64_t size){
+	const uint64_t* words = reinterpret_cast<const uint64_t*>(data);
+	uint64_t sum = 0;
+
+	for(int64_t i = 0; i < size / 8; i++){
+		sum += words[i] * uint64_t(2 * i + 1);
+	}
+
+	return sum;
+}
+
+string commandOf(string executable, Options options, string mode, string ringName){
+	string command = "\"" + executable + "\" --produce " + mode
+		+ " \"" + options.file + "\" "
+		+ to_string(options.numBatches) + " "
+		+ to_string(options.pointsPerBatch) + " "
+		+ ringName;
+
+	#if defined(_WIN32)
+	command = "\"" + command + "\"";
+	#endif
+
+	return command;
+}
+
+int produce(string mode, Options options, string ringName){
+
+	auto produceBatch = producerOf(options);
+
+	if(mode == "pipe"){
+		#if defined(_WIN32)
+		_setmode(_fileno(stdout), _O_BINARY);
+		#endif
+
+		Buffer buffer(32 * options.pointsPerBatch);
+
+		for(int64_t batchIndex = 0; batchIndex < options.numBatches; batchIndex++){
+			int64_t numPoints = produceBatch(batchIndex, buffer.data_u8);
+			int64_t size = 32 * numPoints;
+
+			fwrite(&size, sizeof(size), 1, stdout);
+			fwrite(buffer.data, 1, size, stdout);
+		}
+
+		fflush(stdout);
+	}else{
+		auto ring = SharedRing::open(ringName);
+
+		if(ring == nullptr) return 1;
+
+		for(int64_t batchIndex = 0; batchIndex < options.numBatches; batchIndex++){
+			uint8_t* target = ring->acquire();
+
+			if(target == nullptr) return 1;
+
+			int64_t numPoints = produceBatch(batchIndex, target);
+
+			ring->publish(32 * numPoints, numPoints);
+		}
+
+		ring->close();
+	}
+
+	return 0;
+}
+
+Result consumePipe(string executable, Options options){
+
+	Result result;
+	Buffer buffer(32 * options.pointsPerBatch);
+
+	double tStart = now();
+
+	FILE* pipe = popen(commandOf(executable, options, "pipe", "-").c_str(), PIPE_READ_MODE);
+
+	if(pipe == nullptr){
+		cout << "ERROR: failed to launch the producer" << endl;
+		return result;
+	}
+
+	int64_t size = 0;
+	while(fread(&size, sizeof(size), 1, pipe) == 1){
+		if(int64_t(fread(buffer.data, 1, size, pipe)) != size){
+			cout << "ERROR: truncated batch" << endl;
+			break;
+		}
+
+		result.checksum += checksumOf(buffer.data_u8, size);
+		result.numBytes += size;
+	}
+
+	pclose(pipe);
+
+	result.seconds = now() - tStart;
+
+	return result;
+}
+
+Result consumeShm(string executable, Options options){
+
+	Result result;
+	string ringName = "shm_bench_" + to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+
+	double tStart = now();
+
+	auto ring = SharedRing::create(ringName, options.numSlots, 32 * options.pointsPerBatch);
+
+	if(ring == nullptr) return result;
+
+	FILE* process = popen(commandOf(executable, options, "shm", ringName).c_str(), PIPE_READ_MODE);
+
+	if(process == nullptr){
+		cout << "ERROR: failed to launch the producer" << endl;
+		return result;
+	}
+
+	SharedRing::Slot slot;
+	while(ring->next(slot)){
+		result.checksum += checksumOf(slot.data, slot.size);
+		result.numBytes += slot.size;
+
+		ring->release();
+	}
+
+	pclose(process);
+
+	if(ring->peerLost){
+		cout << "ERROR: the producer exited before closing the ring" << endl;
+	}
+
+	result.seconds = now() - tStart;
+
+	return result;
+}
+
+void report(string label, Result result, Options options){
+	double GB = double(result.numBytes) / (1024.0 * 1024.0 * 1024.0);
+
+	printf("%-8s %8.2f GB/s %10.1f batches/s %8.3f s\n",
+		label.c_str(), GB / result.seconds, double(options.numBatches) / result.seconds, result.seconds);
+}
+
+int main(int argc, char** argv){
+
+	if(argc >= 7 && string(argv[1]) == "--produce"){
+		Options options;
+		options.file = argv[3];
+		options.numBatches = stoll(argv[4]);
+		options.pointsPerBatch = stoll(argv[5]);
+
+		return produce(argv[2], options, argv[6]);
+	}
+
+	Options options;
+	if(argc > 1) options.file = argv[1];
+	if(argc > 2) options.numBatches = stoll(argv[2]);
+	if(argc > 3) options.pointsPerBatch = stoll(argv[3]);
+	if(argc > 4) options.numSlots = stoll(argv[4]);
+
+	cout << options.numBatches << " batches of " << formatNumber(options.pointsPerBatch) << " points, "
+		<< (options.file != "" ? options.file : "synthetic") << ", " << options.numSlots << " slots" << endl;
+
+	auto pipe = consumePipe(argv[0], options);
+	auto shm = consumeShm(argv[0], options);
+
+	report("pipe", pipe, options);
+	report("shm", shm, options);
+
+	if(pipe.checksum != shm.checksum || pipe.numBytes != shm.numBytes){
+		cout << "ERROR: transfers differ" << endl;
+		return 1;
+	}
+
+	printf("speedup  %8.2f x\n", pipe.seconds / shm.seconds);
+
+	return 0;
+}
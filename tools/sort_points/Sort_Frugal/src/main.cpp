@@ -1,7 +1,10 @@
 
 #include <iostream>
+#include <array>
+#include <functional>
 
 #include "unsuck.hpp"
+#include "../../../../include/morton.h"
 
 using namespace std;
 
@@ -31,7 +34,7 @@ struct Header {
 	uint64_t offsetToPointData = 0;
 	int formatID = 0;
 	int recordLength = 0;
-	int numPoints = 0;
+	int64_t numPoints = 0;
 
 	Vector3 min;
 	Vector3 max;
@@ -55,26 +58,6 @@ T read(shared_ptr<Buffer> buffer, uint64_t offset) {
 //
 //}
 
-// from https://www.forceflow.be/2013/10/07/morton-encodingdecoding-through-bit-interleaving-implementations/
-// method to seperate bits from a given integer 3 positions apart
-inline uint64_t splitBy3(uint32_t a) {
-	uint64_t x = a & 0x1fffff; // we only look at the first 21 bits
-	x = (x | x << 32) & 0x1f00000000ffff; // shift left 32 bits, OR with self, and 00011111000000000000000000000000000000001111111111111111
-	x = (x | x << 16) & 0x1f0000ff0000ff; // shift left 32 bits, OR with self, and 00011111000000000000000011111111000000000000000011111111
-	x = (x | x << 8) & 0x100f00f00f00f00f; // shift left 32 bits, OR with self, and 0001000000001111000000001111000000001111000000001111000000000000
-	x = (x | x << 4) & 0x10c30c30c30c30c3; // shift left 32 bits, OR with self, and 0001000011000011000011000011000011000011000011000011000100000000
-	x = (x | x << 2) & 0x1249249249249249;
-
-	return x;
-}
-
-// from https://www.forceflow.be/2013/10/07/morton-encodingdecoding-through-bit-interleaving-implementations/
-inline uint64_t mortonEncode_magicbits(uint32_t x, uint32_t y, uint32_t z) {
-	uint64_t answer = 0;
-	answer |= splitBy3(x) | splitBy3(y) << 1 | splitBy3(z) << 2;
-
-	return answer;
-}
 
 shared_ptr<Buffer> sort_morton(string targetDir, shared_ptr<Buffer> source, Header header, vector<Point>& points) {
 	cout << "sort: morton" << endl;
@@ -88,11 +71,6 @@ shared_ptr<Buffer> sort_morton(string targetDir, shared_ptr<Buffer> source, Head
 		header.max.z - header.min.z
 	};
 	double cubeSize = std::max(std::max(size.x, size.y), size.z);
-	Vector3 max = {
-		min.x + cubeSize,
-		min.y + cubeSize,
-		min.z + cubeSize,
-	};
 
 	double factor = pow(2.0, 21.0);
 
@@ -107,7 +85,8 @@ shared_ptr<Buffer> sort_morton(string targetDir, shared_ptr<Buffer> source, Head
 		uint32_t Y = uint32_t(ny * factor);
 		uint32_t Z = uint32_t(nz * factor);
 
-		uint64_t mortonCode = mortonEncode_magicbits(X, Y, Z);
+		// x in the lowest bit of each triplet, reversed from morton.h
+		uint64_t mortonCode = morton::encode(Z, Y, X);
 
 		point.value_u64 = mortonCode;
 	}
@@ -172,7 +151,7 @@ shared_ptr<Buffer> sort_shuffle(string targetDir, shared_ptr<Buffer> source, Hea
 
 	cout << "sort: shuffle" << endl;
 
-	vector<double> randomValues = random(0.0, 100'000'000.0, header.numPoints);
+	vector<double> randomValues = random(0.0, 100'000'000.0, int(header.numPoints));
 	for (int64_t i = 0; i < header.numPoints; i++) {
 		points[i].value = randomValues[i];
 	}
@@ -260,7 +239,272 @@ vector<Point> parsePoints(shared_ptr<Buffer> source, Header header) {
 	return points;
 }
 
-int main() {
+// KEY-INDEX MODE
+//
+// Reads the file once, computes one compact (key, index) pair per point for each requested ordering,
+// sorts the pairs with a parallel LSD radix sort and writes the records in that order with a
+// parallel gather into large blocks. Records are never parsed into Points or copied for sorting,
+// so the memory besides the source file is 24 bytes per point - 12 byte pairs plus the radix sort's
+// scatter buffer of the same size - and one output block.
+
+// packed to 12 bytes, padding would make it 16
+#pragma pack(push, 1)
+struct KeyIndex {
+	uint64_t key = 0;
+	uint32_t index = 0;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(KeyIndex) == 12);
+
+constexpr int64_t GATHER_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// the shuffle seeds a generator per chunk of points, not per thread, so that its order doesn't depend on the number of threads
+constexpr int64_t SHUFFLE_CHUNK_SIZE = 64 * 1024;
+
+// splits [0, count) into one contiguous range per thread, callback(first, last, threadIndex)
+void parallelRange(int64_t count, int numThreads, function<void(int64_t, int64_t, int)> callback) {
+
+	int64_t rangeSize = (count + numThreads - 1) / numThreads;
+
+	vector<thread> threads;
+	for (int threadIndex = 0; threadIndex < numThreads; threadIndex++) {
+		int64_t first = std::min(count, threadIndex * rangeSize);
+		int64_t last = std::min(count, first + rangeSize);
+
+		threads.emplace_back(callback, first, last, threadIndex);
+	}
+
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+// stable, 8 bits per pass. Passes over bytes that are equal in all keys are skipped.
+void radixSort(vector<KeyIndex>& pairs, int numThreads) {
+
+	int64_t n = pairs.size();
+
+	vector<uint64_t> ors(numThreads, 0);
+	vector<uint64_t> ands(numThreads, ~0ull);
+	parallelRange(n, numThreads, [&](int64_t first, int64_t last, int threadIndex) {
+		for (int64_t i = first; i < last; i++) {
+			ors[threadIndex] |= pairs[i].key;
+			ands[threadIndex] &= pairs[i].key;
+		}
+	});
+
+	uint64_t orBits = 0;
+	uint64_t andBits = ~0ull;
+	for (int i = 0; i < numThreads; i++) {
+		orBits |= ors[i];
+		andBits &= ands[i];
+	}
+	uint64_t varyingBits = orBits ^ andBits;
+
+	// scatter buffer, as large as <pairs>
+	vector<KeyIndex> temp(n);
+	vector<std::array<int64_t, 256>> histograms(numThreads);
+
+	for (int shift = 0; shift < 64; shift += 8) {
+
+		if (((varyingBits >> shift) & 0xff) == 0) continue;
+
+		// HISTOGRAM per thread
+		parallelRange(n, numThreads, [&](int64_t first, int64_t last, int threadIndex) {
+			auto& histogram = histograms[threadIndex];
+			histogram.fill(0);
+
+			for (int64_t i = first; i < last; i++) {
+				histogram[(pairs[i].key >> shift) & 0xff]++;
+			}
+		});
+
+		// OFFSETS - by digit, then by thread, so that the scatter is stable
+		int64_t offset = 0;
+		for (int digit = 0; digit < 256; digit++) {
+			for (int threadIndex = 0; threadIndex < numThreads; threadIndex++) {
+				int64_t count = histograms[threadIndex][digit];
+				histograms[threadIndex][digit] = offset;
+				offset += count;
+			}
+		}
+
+		// SCATTER
+		parallelRange(n, numThreads, [&](int64_t first, int64_t last, int threadIndex) {
+			auto& offsets = histograms[threadIndex];
+
+			for (int64_t i = first; i < last; i++) {
+				int digit = (pairs[i].key >> shift) & 0xff;
+				temp[offsets[digit]++] = pairs[i];
+			}
+		});
+
+		std::swap(pairs, temp);
+	}
+}
+
+// sort key of each point for <ordering>: shuffle, morton or x
+vector<KeyIndex> computeKeys(string ordering, shared_ptr<Buffer> source, Header header, int numThreads) {
+
+	vector<KeyIndex> pairs(header.numPoints);
+
+	Vector3 min = header.min;
+	Vector3 size = {
+		header.max.x - header.min.x,
+		header.max.y - header.min.y,
+		header.max.z - header.min.z
+	};
+	double cubeSize = std::max(std::max(size.x, size.y), size.z);
+	double factor = pow(2.0, 21.0);
+
+	bool shuffle = ordering == "shuffle";
+	bool sortX = ordering == "x";
+
+	parallelRange(header.numPoints, numThreads, [&](int64_t first, int64_t last, int) {
+
+		std::mt19937_64 rng;
+
+		for (int64_t i = first; i < last; i++) {
+			if (shuffle && (i == first || i % SHUFFLE_CHUNK_SIZE == 0)) {
+				rng.seed(1234 + i / SHUFFLE_CHUNK_SIZE);
+				rng.discard(i % SHUFFLE_CHUNK_SIZE);
+			}
+
+			const uint8_t* record = source->data_u8 + header.offsetToPointData + i * header.recordLength;
+
+			int32_t X, Y, Z;
+			memcpy(&X, record + 0, 4);
+			memcpy(&Y, record + 4, 4);
+			memcpy(&Z, record + 8, 4);
+
+			uint64_t key = 0;
+			if (shuffle) {
+				key = rng();
+			} else if (sortX) {
+				// flip the sign bit so that negative coordinates come first
+				key = uint32_t(X) ^ 0x8000'0000u;
+			} else {
+
+				double x = double(X) * header.scale.x + header.offset.x;
+				double y = double(Y) * header.scale.y + header.offset.y;
+				double z = double(Z) * header.scale.z + header.offset.z;
+
+				uint32_t mX = uint32_t((x - min.x) / cubeSize * factor);
+				uint32_t mY = uint32_t((y - min.y) / cubeSize * factor);
+				uint32_t mZ = uint32_t((z - min.z) / cubeSize * factor);
+
+				// x in the lowest bit of each triplet, reversed from morton.h
+				key = morton::encode(mZ, mY, mX);
+			}
+
+			pairs[i] = {key, uint32_t(i)};
+		}
+	});
+
+	return pairs;
+}
+
+// writes the header, the records in the order of <pairs>, and whatever follows the records, e.g. EVLRs
+void writeOrdered(string targetPath, shared_ptr<Buffer> source, Header header, vector<KeyIndex>& pairs, int numThreads) {
+
+	auto of = fstream(targetPath, ios::out | ios::binary);
+
+	of.write(source->data_char, header.offsetToPointData);
+
+	int64_t recordLength = header.recordLength;
+	int64_t pointsPerBlock = std::max(GATHER_BLOCK_SIZE / recordLength, int64_t(1));
+	Buffer block(pointsPerBlock * recordLength);
+
+	for (int64_t blockStart = 0; blockStart < header.numPoints; blockStart += pointsPerBlock) {
+		int64_t numPoints = std::min(pointsPerBlock, header.numPoints - blockStart);
+
+		parallelRange(numPoints, numThreads, [&](int64_t first, int64_t last, int) {
+			for (int64_t i = first; i < last; i++) {
+				int64_t sourceOffset = header.offsetToPointData + pairs[blockStart + i].index * recordLength;
+
+				memcpy(block.data_u8 + i * recordLength, source->data_u8 + sourceOffset, recordLength);
+			}
+		});
+
+		of.write(block.data_char, numPoints * recordLength);
+	}
+
+	int64_t end = header.offsetToPointData + header.numPoints * recordLength;
+	if (source->size > end) {
+		of.write(source->data_char + end, source->size - end);
+	}
+
+	of.close();
+}
+
+// usage: SortLas <file> <targetDir> [shuffle] [morton] [x]
+int main_keyindex(int argc, char** argv) {
+
+	string file = argv[1];
+	string targetDir = argv[2];
+
+	vector<string> orderings;
+	for (int i = 3; i < argc; i++) {
+		orderings.push_back(argv[i]);
+	}
+	if (orderings.empty()) {
+		orderings = { "shuffle", "morton", "x" };
+	}
+
+	int numThreads = std::max(int(thread::hardware_concurrency()), 1);
+
+	double tStart = now();
+
+	cout << "reading file" << endl;
+	auto source = readBinaryFile(file);
+	auto header = parseHeader(source);
+
+	if (header.numPoints > std::numeric_limits<uint32_t>::max()) {
+		cout << "ERROR: key-index mode supports up to 2^32 points" << endl;
+
+		return 1;
+	}
+
+	fs::create_directories(targetDir);
+	printElapsedTime("read", tStart);
+
+	for (string ordering : orderings) {
+
+		if (ordering != "shuffle" && ordering != "morton" && ordering != "x") {
+			cout << "ERROR: unknown ordering " << ordering << endl;
+			continue;
+		}
+
+		cout << "sort: " << ordering << endl;
+
+		double t = now();
+		auto pairs = computeKeys(ordering, source, header, numThreads);
+		printElapsedTime("keys", t);
+
+		t = now();
+		radixSort(pairs, numThreads);
+		printElapsedTime("sort", t);
+
+		string targetPath = targetDir + "/sort_" + ordering + ".las";
+		cout << "writing file " << targetPath << endl;
+
+		t = now();
+		writeOrdered(targetPath, source, header, pairs, numThreads);
+		printElapsedTime("write", t);
+	}
+
+	printElapsedTime("duration", tStart);
+	printMemoryReport();
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+
+	if (argc >= 3) {
+		return main_keyindex(argc, argv);
+	}
 
 	cout << "start" << endl;
 
@@ -5,6 +5,7 @@
 #include <functional>
 
 #include "unsuck.hpp"
+#include "../../../../include/morton.h"
 
 
 using namespace std;
@@ -54,26 +55,6 @@ T read(shared_ptr<Buffer> buffer, uint64_t offset) {
 	return value;
 }
 
-// from https://www.forceflow.be/2013/10/07/morton-encodingdecoding-through-bit-interleaving-implementations/
-// method to seperate bits from a given integer 3 positions apart
-inline uint64_t splitBy3(uint32_t a) {
-	uint64_t x = a & 0x1fffff; // we only look at the first 21 bits
-	x = (x | x << 32) & 0x1f00000000ffff; // shift left 32 bits, OR with self, and 00011111000000000000000000000000000000001111111111111111
-	x = (x | x << 16) & 0x1f0000ff0000ff; // shift left 32 bits, OR with self, and 00011111000000000000000011111111000000000000000011111111
-	x = (x | x << 8) & 0x100f00f00f00f00f; // shift left 32 bits, OR with self, and 0001000000001111000000001111000000001111000000001111000000000000
-	x = (x | x << 4) & 0x10c30c30c30c30c3; // shift left 32 bits, OR with self, and 0001000011000011000011000011000011000011000011000011000100000000
-	x = (x | x << 2) & 0x1249249249249249;
-
-	return x;
-}
-
-// from https://www.forceflow.be/2013/10/07/morton-encodingdecoding-through-bit-interleaving-implementations/
-inline uint64_t mortonEncode_magicbits(uint32_t x, uint32_t y, uint32_t z) {
-	uint64_t answer = 0;
-	answer |= splitBy3(x) | splitBy3(y) << 1 | splitBy3(z) << 2;
-
-	return answer;
-}
 
 Header parseHeader(string file) {
 
@@ -277,7 +258,8 @@ vector<SortPair<uint64_t>> sort_morton(string file) {
 			uint32_t mY = uint32_t(ny * factor);
 			uint32_t mZ = uint32_t(nz * factor);
 
-			uint64_t mortonCode = mortonEncode_magicbits(mX, mY, mZ);
+			// x in the lowest bit of each triplet, reversed from morton.h
+			uint64_t mortonCode = morton::encode(mZ, mY, mX);
 
 			SortPair<uint64_t> pair;
 			pair.index = processed;